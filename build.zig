@@ -30,6 +30,7 @@ pub fn build(b: *std.Build) !void {
             "source/m3_api_uvwasi.c",
             "source/m3_api_wasi.c",
             "source/m3_bind.c",
+            "source/m3_cache.c",
             "source/m3_code.c",
             "source/m3_compile.c",
             "source/m3_core.c",
@@ -37,8 +38,11 @@ pub fn build(b: *std.Build) !void {
             "source/m3_exec.c",
             "source/m3_function.c",
             "source/m3_info.c",
+            "source/m3_jit.c",
             "source/m3_module.c",
             "source/m3_parse.c",
+            "source/m3_pool.c",
+            "source/m3_sched.c",
         },
         .flags = if (libwasm3.rootModuleTarget().isWasm())
             &cflags ++ [_][]const u8{
@@ -29,6 +29,7 @@
  * NOTE: Gas metering/limit only applies to pre-instrumented modules.
  * You can generate a metered version from any wasm file automatically, using
  *   https://github.com/ewasm/wasm-metering
+ * --fuel meters any module, in the interpreter itself (see m3_SetFuel).
  */
 #define GAS_LIMIT       500000000
 #define GAS_FACTOR      10000LL
@@ -44,6 +45,13 @@ static IM3Runtime runtime;
 static u8* wasm_bins[MAX_MODULES];
 static int wasm_bins_qty = 0;
 
+static bool is_jit_enabled = false;
+static long jit_hotness = -1;
+static long compile_threads = -1;
+static bool is_background_compile = false;
+static const char* cache_file = NULL;
+static long long fuel_limit = -1;
+
 #if defined(GAS_LIMIT)
 
 static int64_t initial_gas = GAS_FACTOR * GAS_LIMIT;
@@ -158,6 +166,14 @@ M3Result repl_load  (const char* fn)
     result = link_all (module);
     if (result) goto on_error_after_load;
 
+    // a cache that is missing or stale is written afresh
+    if (cache_file and m3_LoadCompiledModule (module, cache_file)) {
+        M3Result cacheResult = m3_SaveCompiledModule (module, cache_file);
+        if (cacheResult) {
+            fprintf (stderr, "Warning: cannot save %s: %s\n", cache_file, cacheResult);
+        }
+    }
+
     result = m3_RunStart (module);
     if (result) goto on_error_after_load;
 
@@ -262,6 +278,9 @@ void print_gas_used()
         fprintf(stderr, "Gas used: %0.4f\n", (double)(initial_gas - current_gas) / GAS_FACTOR);
     }
 #endif
+    if (fuel_limit >= 0) {
+        fprintf(stderr, "Fuel used: %llu\n", (unsigned long long)(fuel_limit - m3_GetFuel(runtime)));
+    }
 }
 
 void print_backtrace()
@@ -516,6 +535,9 @@ M3Result repl_global_set  (const char* name, const char* value)
 
 M3Result repl_compile  ()
 {
+    if (compile_threads >= 0) {
+        return m3_CompileModuleParallel(runtime->modules, compile_threads);
+    }
     return m3_CompileModule(runtime->modules);
 }
 
@@ -559,6 +581,21 @@ M3Result repl_init  (unsigned stack)
     if (runtime == NULL) {
         return "m3_NewRuntime failed";
     }
+    if (is_background_compile) {
+        M3Result result = m3_EnableBackgroundCompile (runtime, 1);
+        if (result) return result;
+    }
+    if (fuel_limit >= 0) {
+        M3Result result = m3_SetFuel (runtime, fuel_limit);
+        if (result) return result;
+    }
+    if (is_jit_enabled) {
+        M3Result result = m3_EnableJit (runtime, 1);
+        if (!result && jit_hotness >= 0) {
+            result = m3_SetJitHotness (runtime, jit_hotness);
+        }
+        return result;
+    }
     return m3Err_none;
 }
 
@@ -641,9 +678,15 @@ void print_usage() {
     puts("  --func <function>     function to run       default: _start");
     puts("  --stack-size <size>   stack size in bytes   default: 64KB");
     puts("  --compile             disable lazy compilation");
+    puts("  --compile-threads <n> compile up front on n threads (0: one per core)");
+    puts("  --background-compile  compile callees ahead of their first call on a thread");
+    puts("  --cache <file>        load compiled code from file, or save it there");
+    puts("  --jit                 generate native code where supported");
+    puts("  --jit-hotness <n>     calls + loop iterations before a function goes native");
     puts("  --spec-repl           repl for the spec tests");
     puts("  --dump-on-trap        dump wasm memory");
     puts("  --gas-limit           set gas limit");
+    puts("  --fuel <n>            trap once about n wasm operations have run");
 }
 
 #define ARGV_SHIFT()  { i_argc--; i_argv++; }
@@ -688,6 +731,22 @@ int  main  (int i_argc, const char* i_argv[])
             argDumpOnTrap = true;
         } else if (!strcmp("--compile", arg)) {
             argCompile = true;
+        } else if (!strcmp("--compile-threads", arg)) {
+            const char* tmp = "0";
+            ARGV_SET(tmp);
+            compile_threads = atol(tmp);
+            argCompile = true;
+        } else if (!strcmp("--background-compile", arg)) {
+            is_background_compile = true;
+        } else if (!strcmp("--cache", arg)) {
+            ARGV_SET(cache_file);
+        } else if (!strcmp("--jit", arg)) {
+            is_jit_enabled = true;
+        } else if (!strcmp("--jit-hotness", arg)) {
+            const char* tmp = "0";
+            ARGV_SET(tmp);
+            jit_hotness = atol(tmp);
+            is_jit_enabled = true;
         } else if (!strcmp("--stack-size", arg)) {
             const char* tmp = "65536";
             ARGV_SET(tmp);
@@ -696,6 +755,10 @@ int  main  (int i_argc, const char* i_argv[])
             const char* tmp = "0";
             ARGV_SET(tmp);
             initial_gas = current_gas = GAS_FACTOR * atol(tmp);
+        } else if (!strcmp("--fuel", arg)) {
+            const char* tmp = "0";
+            ARGV_SET(tmp);
+            fuel_limit = atoll(tmp);
         } else if (!strcmp("--dir", arg)) {
             const char* argDir;
             ARGV_SET(argDir);
@@ -99,7 +99,6 @@ _   (AllocFuncType (& funcType, (u32) maxNumTypes));
 }
 
 
-static
 M3Result  ValidateSignature  (IM3Function i_function, ccstr_t i_linkingSignature)
 {
     M3Result result = m3Err_none;
@@ -112,7 +111,7 @@ _   (SignatureToFuncType (& ftype, i_linkingSignature));
         m3log (module, "expected: %s", SPrintFuncTypeSignature (ftype));
         m3log (module, "   found: %s", SPrintFuncTypeSignature (i_function->funcType));
 
-        _throw ("function signature mismatch");
+        _throw (m3Err_signatureMismatch);
     }
 
     _catch:
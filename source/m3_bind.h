@@ -14,6 +14,7 @@ d_m3BeginExternC
 
 u8          ConvertTypeCharToTypeId     (char i_code);
 M3Result    SignatureToFuncType         (IM3FuncType * o_functionType, ccstr_t i_signature);
+M3Result    ValidateSignature           (IM3Function i_function, ccstr_t i_signature);
 
 d_m3EndExternC
 
@@ -0,0 +1,834 @@
+//
+//  m3_cache.c
+//
+//  Saves a module's compiled code to a file, and loads it back in a later process
+//  in place of validating and compiling the functions again.
+//
+//  For saving, the module is compiled afresh into code pages of its own, with the
+//  location of every word holding a pointer recorded as it is emitted. Each of those
+//  is written as a relocation: an operation as its index in ListOperations, a pointer
+//  into the code as a page and line, and a function, type, global, table or segment
+//  as its index in the module. Everything else in the pages is position independent.
+//  A file is only any good to the build and the wasm bytes it was made from; its key
+//  covers both.
+//
+
+#include "m3_env.h"
+#include "m3_compile.h"
+#include "m3_exception.h"
+
+#if d_m3HasCodeCache
+
+#define d_m3CacheMagic              0x4333334d      // "M33C"
+#define d_m3CacheVersion            2
+
+enum
+{
+    c_m3RelocOperation,             // index: in ListOperations
+    c_m3RelocCode,                  // index: page; offset: line
+    c_m3RelocFunction,              // the rest: index in the module's own array;
+    c_m3RelocFuncType,              // offset: bytes into the element
+    c_m3RelocGlobal,
+    c_m3RelocTable,
+    c_m3RelocDataSegment,
+    c_m3RelocElementSegment
+};
+
+typedef struct M3CacheHeader
+{
+    u32                     magic;
+    u32                     version;
+    u64                     buildKey;
+    u64                     wasmHash;
+
+    u32                     numFunctions;
+    u32                     numPages;
+    u32                     numRelocations;
+    u32                     numCalls;
+}
+M3CacheHeader;
+
+typedef struct M3CacheSite
+{
+    u32                     page;
+    u32                     line;
+}
+M3CacheSite;
+
+typedef struct M3CacheRelocation
+{
+    M3CacheSite             site;
+    u32                     kind;
+    u32                     index;
+    u32                     offset;
+}
+M3CacheRelocation;
+
+typedef struct M3CacheFunction
+{
+    M3CacheSite             entry;                  // page is ~0 for a function left to compile on first call
+
+    u16                     maxStackSlots;
+    u16                     numRetSlots;
+    u16                     numRetAndArgSlots;
+    u16                     numLocals;
+    u32                     numLocalBytes;
+    u32                     fuelCost;
+    u32                     numConstantBytes;       // followed by the constants themselves
+}
+M3CacheFunction;
+
+// the pages of a cache, by address, for resolving pointers into them
+typedef struct M3CachePage
+{
+    IM3CodePage             page;
+    u32                     index;
+}
+M3CachePage;
+
+typedef struct M3Operations
+{
+    IM3Operation *          operations;             // by index
+    u32                     numOperations;
+
+    IM3Operation *          map;                    // open addressing, for the index of an operation
+    u32 *                   mapIndices;
+    u32                     mapMask;
+}
+M3Operations;
+
+
+//---------------------------------------------------------------------------------------------------------------------------------
+
+static
+u64  HashBytes  (u64 io_hash, const void * i_bytes, size_t i_size)
+{
+    const u8 * bytes = (const u8 *) i_bytes;
+
+    // FNV-1a
+    for (size_t i = 0; i < i_size; ++i)
+        io_hash = (io_hash ^ bytes [i]) * 0x100000001b3ull;
+
+    return io_hash;
+}
+
+static const u64 c_m3HashSeed = 0xcbf29ce484222325ull;
+
+
+static inline
+u32  HashOperation  (IM3Operation i_operation, u32 i_mask)
+{
+    u64 key = (u64) (uintptr_t) i_operation;
+    return (u32) ((key * 0x9E3779B97F4A7C15ull) >> 32) & i_mask;
+}
+
+
+static
+void  FreeOperations  (M3Operations * io_ops)
+{
+    m3_Free (io_ops->operations);
+    m3_Free (io_ops->map);
+    m3_Free (io_ops->mapIndices);
+}
+
+
+static
+M3Result  ListAllOperations  (M3Operations * o_ops)
+{
+    M3Result result = m3Err_none;
+
+    M3_INIT (* o_ops);
+    u32 mapSize = 1;
+
+    u32 numOperations = ListOperations (NULL, 0);
+
+    o_ops->operations = m3_AllocArray (IM3Operation, numOperations);
+    _throwifnull (o_ops->operations);
+
+    o_ops->numOperations = ListOperations (o_ops->operations, numOperations);
+
+    while (mapSize < numOperations * 2)
+        mapSize <<= 1;
+
+    o_ops->map = m3_AllocArray (IM3Operation, mapSize);
+    o_ops->mapIndices = m3_AllocArray (u32, mapSize);
+    o_ops->mapMask = mapSize - 1;
+    _throwifnull (o_ops->map);
+    _throwifnull (o_ops->mapIndices);
+
+    // an operation listed twice keeps its first index
+    for (u32 i = 0; i < numOperations; ++i)
+    {
+        IM3Operation operation = o_ops->operations [i];
+        u32 h = HashOperation (operation, o_ops->mapMask);
+
+        while (o_ops->map [h] and o_ops->map [h] != operation)
+            h = (h + 1) & o_ops->mapMask;
+
+        if (not o_ops->map [h])
+        {
+            o_ops->map [h] = operation;
+            o_ops->mapIndices [h] = i;
+        }
+    }
+
+    _catch:
+    if (result)
+        FreeOperations (o_ops);
+
+    return result;
+}
+
+
+static
+bool  FindOperationIndex  (const M3Operations * i_ops, const void * i_word, u32 * o_index)
+{
+    IM3Operation operation = (IM3Operation) i_word;
+    u32 h = HashOperation (operation, i_ops->mapMask);
+
+    while (i_ops->map [h])
+    {
+        if (i_ops->map [h] == operation)
+        {
+            * o_index = i_ops->mapIndices [h];
+            return true;
+        }
+
+        h = (h + 1) & i_ops->mapMask;
+    }
+
+    return false;
+}
+
+
+// Whatever changes the code the compiler emits, or the operations' places in the binary,
+// should change this. Operations are hashed by their distance from the first one.
+static
+u64  GetBuildKey  (const M3Operations * i_ops)
+{
+    const u32 config [] =
+    {
+        sizeof (void *),    sizeof (m3slot_t),      sizeof (M3CodePageHeader),
+        d_m3HasFloat,       d_m3HasJit,             d_m3HasSecondRegister,      d_m3FuseCompareBranch,
+        d_m3EnableOpTracing,                        d_m3RecordBacktraces,       d_m3MaxConstantTableSize,
+        d_m3HasFuel,        d_m3Stackless,          d_m3UseGuardPages,          d_m3HasEpochs,
+        d_m3HasSuspend,
+        i_ops->numOperations
+    };
+
+    u64 hash = HashBytes (c_m3HashSeed, M3_VERSION, sizeof (M3_VERSION));
+    hash = HashBytes (hash, config, sizeof (config));
+
+    for (u32 i = 0; i < i_ops->numOperations; ++i)
+    {
+        i64 offset = (i64) ((uintptr_t) i_ops->operations [i] - (uintptr_t) i_ops->operations [0]);
+        hash = HashBytes (hash, & offset, sizeof (offset));
+    }
+
+    return hash;
+}
+
+
+static
+u64  GetWasmHash  (IM3Module i_module)
+{
+    return HashBytes (c_m3HashSeed, i_module->wasmStart, i_module->wasmEnd - i_module->wasmStart);
+}
+
+
+static
+int  CompareCachePages  (const void * i_a, const void * i_b)
+{
+    uintptr_t a = (uintptr_t) ((const M3CachePage *) i_a)->page;
+    uintptr_t b = (uintptr_t) ((const M3CachePage *) i_b)->page;
+
+    return (a > b) - (a < b);
+}
+
+
+// a pointer into the pages, including one just past the end of a page's code
+static
+bool  FindCodeSite  (const M3CachePage * i_pages, u32 i_numPages, const void * i_pointer, M3CacheSite * o_site)
+{
+    uintptr_t pointer = (uintptr_t) i_pointer;
+    u32 low = 0, high = i_numPages;
+
+    // the last page starting at or below the pointer
+    while (low < high)
+    {
+        u32 mid = (low + high) / 2;
+
+        if ((uintptr_t) i_pages [mid].page <= pointer)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low == 0)
+        return false;
+
+    IM3CodePage page = i_pages [low - 1].page;
+    uintptr_t start = (uintptr_t) GetPageStartPC (page);
+
+    if (pointer < start or pointer > start + page->info.lineIndex * sizeof (code_t) or (pointer - start) % sizeof (code_t))
+        return false;
+
+    o_site->page = i_pages [low - 1].index;
+    o_site->line = (u32) ((pointer - start) / sizeof (code_t));
+
+    return true;
+}
+
+
+// the index of the element of i_array, i_count long, that i_pointer points into
+static
+bool  FindElement  (const void * i_array, u32 i_count, size_t i_size, const void * i_pointer, u32 * o_index, u32 * o_offset)
+{
+    uintptr_t start = (uintptr_t) i_array, pointer = (uintptr_t) i_pointer;
+
+    if (not i_array or pointer < start or pointer >= start + i_count * i_size)
+        return false;
+
+    * o_index = (u32) ((pointer - start) / i_size);
+    * o_offset = (u32) ((pointer - start) % i_size);
+
+    return true;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------------------
+
+typedef struct M3CacheWriter
+{
+    IM3Module               module;
+    FILE *                  file;
+
+    M3Runtime               scratch;                // the module is compiled again into its own pages
+    M3Environment           environment;            // empty, so pages never come from the shared released list
+    M3Function *            functions;              // the copies compiled; the module's own are left alone
+
+    M3CodeSites             calls;
+    M3CodeSites             pointers;
+
+    M3Operations            ops;
+
+    M3CachePage *           pages;
+    u32                     numPages;
+}
+M3CacheWriter;
+
+
+static
+M3Result  Write  (M3CacheWriter * io, const void * i_data, size_t i_size)
+{
+    return (fwrite (i_data, 1, i_size, io->file) == i_size) ? m3Err_none : m3Err_codeCacheIO;
+}
+
+
+static
+M3Result  ClassifyPointer  (M3CacheWriter * io, const void * i_pointer, M3CacheRelocation * o_reloc)
+{
+    M3Result result = m3Err_none;
+    IM3Module module = io->module;
+
+    u32 index = 0, offset = 0;
+    M3CacheSite site;
+    o_reloc->offset = 0;
+
+    if (FindOperationIndex (& io->ops, i_pointer, & o_reloc->index))
+    {
+        o_reloc->kind = c_m3RelocOperation;
+    }
+    else if (FindCodeSite (io->pages, io->numPages, i_pointer, & site))
+    {
+        o_reloc->kind = c_m3RelocCode;
+        o_reloc->index = site.page;
+        o_reloc->offset = site.line;
+    }
+    else if (FindElement (io->functions, module->numFunctions, sizeof (M3Function), i_pointer, & index, & offset) or
+             FindElement (module->functions, module->numFunctions, sizeof (M3Function), i_pointer, & index, & offset))
+    {
+        _throwif (m3Err_codeCacheUnrelocatable, offset);
+        o_reloc->kind = c_m3RelocFunction;
+        o_reloc->index = index;
+    }
+    else if (FindElement (module->globals, module->numGlobals, sizeof (M3Global), i_pointer, & index, & offset))
+    {
+        o_reloc->kind = c_m3RelocGlobal;
+        o_reloc->index = index;
+        o_reloc->offset = offset;
+    }
+    else if (FindElement (module->tables, module->numTables, sizeof (M3Table), i_pointer, & index, & offset) and not offset)
+    {
+        o_reloc->kind = c_m3RelocTable;
+        o_reloc->index = index;
+    }
+    else if (FindElement (module->dataSegments, module->numDataSegments, sizeof (M3DataSegment), i_pointer, & index, & offset) and not offset)
+    {
+        o_reloc->kind = c_m3RelocDataSegment;
+        o_reloc->index = index;
+    }
+    else if (FindElement (module->elementSegments, module->numElementSegments, sizeof (M3ElementSegment), i_pointer, & index, & offset) and not offset)
+    {
+        o_reloc->kind = c_m3RelocElementSegment;
+        o_reloc->index = index;
+    }
+    else
+    {
+        o_reloc->kind = c_m3RelocFuncType;
+
+        for (index = 0; index < module->numFuncTypes; ++index)
+        {
+            if (module->funcTypes [index] == i_pointer)
+                break;
+        }
+
+        _throwif (m3Err_codeCacheUnrelocatable, index == module->numFuncTypes);
+        o_reloc->index = index;
+    }
+
+    _catch: return result;
+}
+
+
+static
+M3Result  CompileForCache  (M3CacheWriter * io)
+{
+    M3Result result = m3Err_none;
+    IM3Module module = io->module;
+    u32 index = 0;
+
+    io->scratch.environment = & io->environment;
+
+    io->functions = m3_AllocArray (M3Function, module->numFunctions);
+    _throwifnull (io->functions);
+
+    for (u32 i = 0; i < module->numFunctions; ++i)
+    {
+        IM3Function function = & io->functions [i];
+        * function = module->functions [i];
+
+        function->compiled = NULL;
+        function->constants = NULL;
+
+        if (function->wasm)
+        {
+            result = CompileFunctionInto (& io->scratch, function, & io->calls, & io->pointers);
+
+            // left to compile on its first call in the process that loads the cache; what was
+            // emitted before it was abandoned is saved with the rest, but never reached
+            if (result == m3Err_codeCacheUnrelocatable)
+                result = m3Err_none;
+
+            _ (result);
+        }
+    }
+
+    _throwif (m3Err_mallocFailed, io->pointers.isIncomplete);
+
+    io->numPages = CountCodePages (io->scratch.pagesOpen) + CountCodePages (io->scratch.pagesFull);
+    io->pages = m3_AllocArray (M3CachePage, io->numPages);
+    _throwifnull (io->pages);
+
+    for (IM3CodePage page = io->scratch.pagesOpen; page; page = page->info.next)
+        io->pages [index] = (M3CachePage) { page, index }, ++index;
+
+    for (IM3CodePage page = io->scratch.pagesFull; page; page = page->info.next)
+        io->pages [index] = (M3CachePage) { page, index }, ++index;
+
+    qsort (io->pages, io->numPages, sizeof (M3CachePage), CompareCachePages);
+
+    _catch: return result;
+}
+
+
+static
+M3Result  WriteCache  (M3CacheWriter * io)
+{
+    M3Result result = m3Err_none;
+    IM3Module module = io->module;
+
+    M3CacheRelocation * relocs = NULL;
+    M3CacheSite * calls = NULL;
+    IM3CodePage * byIndex = NULL;
+    code_t * buffer = NULL;
+
+    u32 numRelocs = 0, maxLines = 0;
+    M3CacheHeader header;
+
+    relocs = m3_AllocArray (M3CacheRelocation, io->pointers.numSites + 1);
+    calls = m3_AllocArray (M3CacheSite, io->calls.numSites + 1);
+    byIndex = m3_AllocArray (IM3CodePage, io->numPages + 1);
+    _throwifnull (relocs);
+    _throwifnull (calls);
+    _throwifnull (byIndex);
+
+    for (u32 i = 0; i < io->numPages; ++i)
+    {
+        IM3CodePage page = io->pages [i].page;
+        byIndex [io->pages [i].index] = page;
+        maxLines = M3_MAX (maxLines, page->info.lineIndex);
+    }
+
+    for (u32 i = 0; i < io->pointers.numSites; ++i)
+    {
+        pc_t site = io->pointers.sites [i];
+        const void * pointer = * (void * const *) site;
+
+        if (not pointer)
+            continue;
+
+        M3CacheRelocation * reloc = & relocs [numRelocs++];
+
+        _throwif (m3Err_codeCacheUnrelocatable, not FindCodeSite (io->pages, io->numPages, site, & reloc->site));
+_       (ClassifyPointer (io, pointer, reloc));
+    }
+
+    for (u32 i = 0; i < io->calls.numSites; ++i)
+        _throwif (m3Err_codeCacheUnrelocatable, not FindCodeSite (io->pages, io->numPages, io->calls.sites [i], & calls [i]));
+
+    header = (M3CacheHeader) { d_m3CacheMagic, d_m3CacheVersion, GetBuildKey (& io->ops), GetWasmHash (module),
+                               module->numFunctions, io->numPages, numRelocs, io->calls.numSites };
+_   (Write (io, & header, sizeof (header)));
+
+    // the pages, with what the relocations fill in zeroed, so the same module always saves the same file
+    buffer = m3_AllocArray (code_t, maxLines + 1);
+    _throwifnull (buffer);
+
+    for (u32 p = 0; p < io->numPages; ++p)
+    {
+        IM3CodePage page = byIndex [p];
+        u32 numLines = page->info.lineIndex;
+
+        memcpy (buffer, page->code, numLines * sizeof (code_t));
+
+        for (u32 i = 0; i < numRelocs; ++i)
+        {
+            if (relocs [i].site.page == p)
+                buffer [relocs [i].site.line] = NULL;
+        }
+
+_       (Write (io, & numLines, sizeof (numLines)));
+_       (Write (io, buffer, numLines * sizeof (code_t)));
+    }
+
+    for (u32 i = 0; i < module->numFunctions; ++i)
+    {
+        IM3Function function = & io->functions [i];
+
+        M3CacheFunction record;
+        M3_INIT (record);
+        record.entry.page = ~0u;
+
+        if (function->compiled)
+        {
+            _throwif (m3Err_codeCacheUnrelocatable, not FindCodeSite (io->pages, io->numPages, function->compiled, & record.entry));
+
+            record.maxStackSlots        = function->maxStackSlots;
+            record.numRetSlots          = function->numRetSlots;
+            record.numRetAndArgSlots    = function->numRetAndArgSlots;
+            record.numLocals            = function->numLocals;
+            record.numLocalBytes        = function->numLocalBytes;
+# if d_m3HasFuel
+            record.fuelCost             = function->fuelCost;
+# endif
+            record.numConstantBytes     = function->numConstantBytes;
+        }
+
+_       (Write (io, & record, sizeof (record)));
+_       (Write (io, function->constants, record.numConstantBytes));
+    }
+
+_   (Write (io, relocs, numRelocs * sizeof (M3CacheRelocation)));
+_   (Write (io, calls, io->calls.numSites * sizeof (M3CacheSite)));
+
+    _catch:
+    m3_Free (buffer);
+    m3_Free (byIndex);
+    m3_Free (calls);
+    m3_Free (relocs);
+
+    return result;
+}
+
+
+M3Result  m3_SaveCompiledModule  (IM3Module i_module, const char * i_path)
+{
+    M3Result result = m3Err_none;
+
+    M3CacheWriter * io = m3_AllocStruct (M3CacheWriter);
+    _throwifnull (io);
+
+    io->module = i_module;
+    _throwif (m3Err_moduleNotLinked, not i_module->runtime);
+
+_   (ListAllOperations (& io->ops));
+_   (CompileForCache (io));
+
+    io->file = fopen (i_path, "wb");
+    _throwif (m3Err_codeCacheIO, not io->file);
+
+    result = WriteCache (io);
+
+    if (fclose (io->file) and not result)
+        result = m3Err_codeCacheIO;
+
+    // no half-written file for the next process to trip over
+    if (result)
+        remove (i_path);
+
+    _catch:
+    if (io)
+    {
+        if (io->functions)
+        {
+            for (u32 i = 0; i < i_module->numFunctions; ++i)
+                m3_Free (io->functions [i].constants);
+        }
+
+        FreeCodePages (& io->scratch.pagesOpen);
+        FreeCodePages (& io->scratch.pagesFull);
+
+        FreeOperations (& io->ops);
+        m3_Free (io->pages);
+        m3_Free (io->calls.sites);
+        m3_Free (io->pointers.sites);
+        m3_Free (io->functions);
+        m3_Free (io);
+    }
+
+    return result;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------------------
+
+static
+M3Result  Read  (FILE * i_file, void * o_data, size_t i_size)
+{
+    return (fread (o_data, 1, i_size, i_file) == i_size) ? m3Err_none : m3Err_codeCacheMismatch;
+}
+
+
+static
+M3Result  RelocatePointer  (IM3Module i_module, const M3Operations * i_ops, IM3CodePage * i_pages, u32 i_numPages,
+                            const M3CacheRelocation * i_reloc, void ** o_pointer)
+{
+    M3Result result = m3Err_none;
+    u32 index = i_reloc->index;
+
+    switch (i_reloc->kind)
+    {
+        case c_m3RelocOperation:
+            _throwif (m3Err_codeCacheMismatch, index >= i_ops->numOperations);
+            * o_pointer = (void *) i_ops->operations [index];
+            break;
+
+        case c_m3RelocCode:
+            _throwif (m3Err_codeCacheMismatch, index >= i_numPages or i_reloc->offset > i_pages [index]->info.lineIndex);
+            * o_pointer = (void *) (GetPageStartPC (i_pages [index]) + i_reloc->offset);
+            break;
+
+        case c_m3RelocFunction:
+            _throwif (m3Err_codeCacheMismatch, index >= i_module->numFunctions);
+            * o_pointer = & i_module->functions [index];
+            break;
+
+        case c_m3RelocFuncType:
+            _throwif (m3Err_codeCacheMismatch, index >= i_module->numFuncTypes);
+            * o_pointer = i_module->funcTypes [index];
+            break;
+
+        case c_m3RelocGlobal:
+            _throwif (m3Err_codeCacheMismatch, index >= i_module->numGlobals or i_reloc->offset >= sizeof (M3Global));
+            * o_pointer = (u8 *) & i_module->globals [index] + i_reloc->offset;
+            break;
+
+        case c_m3RelocTable:
+            _throwif (m3Err_codeCacheMismatch, index >= i_module->numTables);
+            * o_pointer = & i_module->tables [index];
+            break;
+
+        case c_m3RelocDataSegment:
+            _throwif (m3Err_codeCacheMismatch, index >= i_module->numDataSegments);
+            * o_pointer = & i_module->dataSegments [index];
+            break;
+
+        case c_m3RelocElementSegment:
+            _throwif (m3Err_codeCacheMismatch, index >= i_module->numElementSegments);
+            * o_pointer = & i_module->elementSegments [index];
+            break;
+
+        default:
+            _throw (m3Err_codeCacheMismatch);
+    }
+
+    _catch: return result;
+}
+
+
+M3Result  m3_LoadCompiledModule  (IM3Module io_module, const char * i_path)
+{
+    M3Result result = m3Err_none;
+
+    IM3Runtime runtime = io_module->runtime;
+    M3Operations ops;
+    M3_INIT (ops);
+
+    IM3CodePage * pages = NULL;
+    M3CacheFunction * records = NULL;
+    void ** constants = NULL;
+    M3CodeSites calls;
+    M3_INIT (calls);
+
+    M3CacheHeader header;
+    M3_INIT (header);
+    u32 numPages = 0;
+    FILE * file = NULL;
+
+    _throwif (m3Err_moduleNotLinked, not runtime);
+
+    file = fopen (i_path, "rb");
+    _throwif (m3Err_codeCacheIO, not file);
+
+_   (ListAllOperations (& ops));
+_   (Read (file, & header, sizeof (header)));
+
+    _throwif (m3Err_codeCacheMismatch, header.magic != d_m3CacheMagic or header.version != d_m3CacheVersion or
+                                       header.buildKey != GetBuildKey (& ops) or header.wasmHash != GetWasmHash (io_module) or
+                                       header.numFunctions != io_module->numFunctions);
+
+    pages = m3_AllocArray (IM3CodePage, header.numPages + 1);
+    records = m3_AllocArray (M3CacheFunction, header.numFunctions + 1);
+    constants = m3_AllocArray (void *, header.numFunctions + 1);
+    calls.sites = m3_AllocArray (pc_t, header.numCalls + 1);
+    _throwifnull (pages);
+    _throwifnull (records);
+    _throwifnull (constants);
+    _throwifnull (calls.sites);
+
+    for (; numPages < header.numPages; ++numPages)
+    {
+        u32 numLines;
+_       (Read (file, & numLines, sizeof (numLines)));
+
+        IM3CodePage page = NewCodePage (runtime, numLines);
+        _throwifnull (page);
+
+        pages [numPages] = page;
+        page->info.lineIndex = numLines;
+
+_       (Read (file, page->code, numLines * sizeof (code_t)));
+    }
+
+    for (u32 i = 0; i < header.numFunctions; ++i)
+    {
+        M3CacheFunction * record = & records [i];
+_       (Read (file, record, sizeof (M3CacheFunction)));
+
+        _throwif (m3Err_codeCacheMismatch, record->entry.page != ~0u and (record->entry.page >= numPages or
+                                                                          record->entry.line >= pages [record->entry.page]->info.lineIndex));
+        if (record->numConstantBytes)
+        {
+            constants [i] = m3_Malloc ("M3Function.constants", record->numConstantBytes);
+            _throwifnull (constants [i]);
+_           (Read (file, constants [i], record->numConstantBytes));
+        }
+    }
+
+    for (u32 i = 0; i < header.numRelocations; ++i)
+    {
+        M3CacheRelocation reloc;
+_       (Read (file, & reloc, sizeof (reloc)));
+
+        _throwif (m3Err_codeCacheMismatch, reloc.site.page >= numPages or reloc.site.line >= pages [reloc.site.page]->info.lineIndex);
+_       (RelocatePointer (io_module, & ops, pages, numPages, & reloc, & pages [reloc.site.page]->code [reloc.site.line]));
+    }
+
+    for (u32 i = 0; i < header.numCalls; ++i)
+    {
+        M3CacheSite site;
+_       (Read (file, & site, sizeof (site)));
+
+        _throwif (m3Err_codeCacheMismatch, site.page >= numPages or site.line + 1 >= pages [site.page]->info.lineIndex);
+        calls.sites [calls.numSites++] = GetPageStartPC (pages [site.page]) + site.line;
+    }
+
+    // all read and relocated: nothing can fail from here on
+    for (u32 i = 0; i < numPages; ++i)
+    {
+        PushCodePage (& runtime->pagesFull, pages [i]);
+        runtime->numCodePages++;
+    }
+
+    numPages = 0;
+
+    for (u32 i = 0; i < header.numFunctions; ++i)
+    {
+        IM3Function function = & io_module->functions [i];
+        M3CacheFunction * record = & records [i];
+
+        // one compiled already, by running it, keeps that code
+        if (record->entry.page == ~0u or LoadCompiled (function))
+            continue;
+
+        function->maxStackSlots       = record->maxStackSlots;
+        function->numRetSlots         = record->numRetSlots;
+        function->numRetAndArgSlots   = record->numRetAndArgSlots;
+        function->numLocals           = record->numLocals;
+        function->numLocalBytes       = record->numLocalBytes;
+# if d_m3HasFuel
+        function->fuelCost            = record->fuelCost;
+# endif
+        function->numConstantBytes    = record->numConstantBytes;
+        function->constants           = constants [i];
+        constants [i] = NULL;
+
+# if d_m3HasJit
+        // the cache holds metacode only: a function due to go native straight away is promoted on its first call
+        function->hotness = runtime->jitEnabled ? M3_MAX (runtime->jitHotness, 1) : 0;
+# endif
+
+        StoreCompiled (function, GetPageStartPC (pages [record->entry.page]) + record->entry.line);
+    }
+
+    ResolveDeferredCalls (& calls);
+
+    _catch:
+    if (file)
+        fclose (file);
+
+    for (u32 i = 0; i < numPages; ++i)
+    {
+        pages [i]->info.next = NULL;
+        FreeCodePages (& pages [i]);
+    }
+
+    if (constants)
+    {
+        for (u32 i = 0; i < header.numFunctions; ++i)
+            m3_Free (constants [i]);
+    }
+
+    FreeOperations (& ops);
+    m3_Free (calls.sites);
+    m3_Free (constants);
+    m3_Free (records);
+    m3_Free (pages);
+
+    return result;
+}
+
+#else
+
+M3Result  m3_SaveCompiledModule  (IM3Module i_module, const char * i_path)
+{
+    return m3Err_codeCacheUnsupported;
+}
+
+M3Result  m3_LoadCompiledModule  (IM3Module io_module, const char * i_path)
+{
+    return m3Err_codeCacheUnsupported;
+}
+
+#endif // d_m3HasCodeCache
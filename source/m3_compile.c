@@ -13,6 +13,7 @@
 #include "m3_exec.h"
 #include "m3_exception.h"
 #include "m3_info.h"
+#include "m3_jit.h"
 #include "m3_validate.h"
 
 //----- EMIT --------------------------------------------------------------------------------------------------------------
@@ -23,6 +24,34 @@ pc_t GetPC (IM3Compilation o)
     return GetPagePC (o->page);
 }
 
+static
+M3Result  RecordCodeSite  (M3CodeSites * io_sites, pc_t i_site)
+{
+    M3Result result = m3Err_none;
+
+    if (io_sites->numSites == io_sites->maxSites)
+    {
+        u32 maxSites = io_sites->maxSites ? io_sites->maxSites * 2 : 256;
+        pc_t * sites = m3_ReallocArray (pc_t, io_sites->sites, maxSites, io_sites->maxSites);
+        _throwifnull (sites);
+
+        io_sites->sites = sites;
+        io_sites->maxSites = maxSites;
+    }
+
+    io_sites->sites [io_sites->numSites++] = i_site;
+
+    _catch: return result;
+}
+
+// for the code cache: the word just emitted holds a pointer
+static inline
+void  RecordPointerSite  (IM3Compilation o)
+{
+    if (o->pointerSites and RecordCodeSite (o->pointerSites, GetPagePC (o->page) - 1))
+        o->pointerSites->isIncomplete = true;
+}
+
 static M3_NOINLINE
 M3Result  EnsureCodePageNumLines  (IM3Compilation o, u32 i_numLines)
 {
@@ -40,7 +69,9 @@ M3Result  EnsureCodePageNumLines  (IM3Compilation o, u32 i_numLines)
             d_m3Assert (NumFreeLines (o->page) >= 2);
 
             EmitWord (o->page, op_Branch);
+            RecordPointerSite (o);
             EmitWord (o->page, GetPagePC (page));
+            RecordPointerSite (o);
 
             ReleaseCodePage (o->runtime, o->page);
 
@@ -52,6 +83,31 @@ M3Result  EnsureCodePageNumLines  (IM3Compilation o, u32 i_numLines)
     return result;
 }
 
+#if d_m3HasJit
+// without the complete list the function just isn't handed to the JIT
+static
+void  RecordJitOpStart  (IM3Compilation o)
+{
+    if (o->numJitOpStarts == o->maxJitOpStarts)
+    {
+        u32 maxOpStarts = o->maxJitOpStarts * 2;
+        pc_t * opStarts = m3_ReallocArray (pc_t, o->jitOpStarts, maxOpStarts, o->maxJitOpStarts);
+
+        if (not opStarts)
+        {
+            m3_Free (o->jitOpStarts);
+            o->jitOpStarts = NULL;
+            return;
+        }
+
+        o->jitOpStarts = opStarts;
+        o->maxJitOpStarts = maxOpStarts;
+    }
+
+    o->jitOpStarts [o->numJitOpStarts++] = GetPagePC (o->page);
+}
+#endif
+
 static M3_NOINLINE
 M3Result  EmitOp  (IM3Compilation o, IM3Operation i_operation)
 {
@@ -73,7 +129,12 @@ M3Result  EmitOp  (IM3Compilation o, IM3Operation i_operation)
 # if d_m3RecordBacktraces
             EmitMappingEntry (o->page, o->lastOpcodeStart - o->module->wasmStart);
 # endif // d_m3RecordBacktraces
+# if d_m3HasJit
+            if (o->jitOpStarts)
+                RecordJitOpStart (o);
+# endif
             EmitWord (o->page, i_operation);
+            RecordPointerSite (o);
         }
     }
 
@@ -88,6 +149,22 @@ void  EmitConstant32  (IM3Compilation o, const u32 i_immediate)
         EmitWord32 (o->page, i_immediate);
 }
 
+static M3_NOINLINE
+void  EmitConstant64  (IM3Compilation o, const u64 i_immediate)
+{
+    if (o->page)
+        EmitWord64 (o->page, i_immediate);
+}
+
+static inline
+void  EmitImmediate  (IM3Compilation o, const u64 i_immediate, bool i_is64Bit)
+{
+    if (i_is64Bit)
+        EmitConstant64 (o, i_immediate);
+    else
+        EmitConstant32 (o, (u32) i_immediate);
+}
+
 static M3_NOINLINE
 void  EmitSlotOffset  (IM3Compilation o, const i32 i_offset)
 {
@@ -101,11 +178,60 @@ pc_t  EmitPointer  (IM3Compilation o, const void * const i_pointer)
     pc_t ptr = GetPagePC (o->page);
 
     if (o->page)
+    {
         EmitWord (o->page, i_pointer);
+        RecordPointerSite (o);
+    }
 
     return ptr;
 }
 
+// A shared module's code reaches the globals, tables and segments of whichever instance
+// runs it, by index or offset (see m3_ShareModule). Constant expressions still run where compiled.
+static inline
+bool  IsSharedCode  (IM3Compilation o)
+{
+    return o->module->codeIsShared and o->function;
+}
+
+static
+void  EmitGlobal  (IM3Compilation o, M3Global * i_global)
+{
+    if (IsSharedCode (o))
+        EmitConstant32 (o, (u32) ((u8 *) & i_global->i64Value - (u8 *) o->module->globals));
+    else
+        EmitPointer (o, & i_global->i64Value);
+}
+
+static
+void  EmitTable  (IM3Compilation o, M3Table * i_table)
+{
+    if (IsSharedCode (o))
+        EmitConstant32 (o, (u32) (i_table - o->module->tables));
+    else
+        EmitPointer (o, i_table);
+}
+
+static
+void  EmitDataSegment  (IM3Compilation o, M3DataSegment * i_segment)
+{
+    if (IsSharedCode (o))
+        EmitConstant32 (o, (u32) (i_segment - o->module->dataSegments));
+    else
+        EmitPointer (o, i_segment);
+}
+
+static
+void  EmitElementSegment  (IM3Compilation o, M3ElementSegment * i_segment)
+{
+    if (IsSharedCode (o))
+        EmitConstant32 (o, (u32) (i_segment - o->module->elementSegments));
+    else
+        EmitPointer (o, i_segment);
+}
+
+#define SharedOp(o, NAME, ...)  (IsSharedCode (o) ? op_##NAME##Shared##__VA_ARGS__ : op_##NAME##__VA_ARGS__)
+
 static M3_NOINLINE
 void * ReservePointer (IM3Compilation o)
 {
@@ -150,6 +276,9 @@ static const IM3Operation c_setSetOps [] =       { NULL, op_SetSlot_i32,
 static const IM3Operation c_setGlobalOps [] =    { NULL, op_SetGlobal_i32,             op_SetGlobal_i64,
                                                     FPOP(op_SetGlobal_f32),       FPOP(op_SetGlobal_f64),
                                                     NULL, REFOP(SetGlobal),       REFOP(SetGlobal) };
+static const IM3Operation c_setGlobalSharedOps [] = { NULL, op_SetGlobalShared_i32,    op_SetGlobalShared_i64,
+                                                    FPOP(op_SetGlobalShared_f32), FPOP(op_SetGlobalShared_f64),
+                                                    NULL, REFOP(SetGlobalShared), REFOP(SetGlobalShared) };
 static const IM3Operation c_setRegisterOps [] =  { NULL, op_SetRegister_i32,           op_SetRegister_i64,
                                                     FPOP(op_SetRegister_f32),     FPOP(op_SetRegister_f64),
                                                     NULL, REFOP(SetRegister),     REFOP(SetRegister) };
@@ -282,6 +411,25 @@ m3type_t  GetStackTypeFromBottom  (IM3Compilation o, u16 i_offset)
 static inline bool  IsConstantSlot    (IM3Compilation o, u16 i_slot)  { return (i_slot >= o->slotFirstConstIndex and i_slot < o->slotMaxConstIndex); }
 static inline bool  IsSlotAllocated   (IM3Compilation o, u16 i_slot)  { return o->m3Slots [i_slot]; }
 
+static inline
+u64  GetConstantSlotValue  (IM3Compilation o, u16 i_slot, bool i_is64Bit)
+{                                                                   d_m3Assert (IsConstantSlot (o, i_slot));
+    const void * constant = & o->constants [i_slot - o->slotFirstConstIndex];
+
+    if (i_is64Bit)
+    {
+        u64 value;
+        memcpy (& value, constant, sizeof (value));
+        return value;
+    }
+    else
+    {
+        u32 value;
+        memcpy (& value, constant, sizeof (value));
+        return value;
+    }
+}
+
 static inline
 bool  IsStackIndexInRegister  (IM3Compilation o, i32 i_stackIndex)
 {                                                                           d_m3Assert (i_stackIndex < o->stackIndex or IsStackPolymorphic (o));
@@ -426,17 +574,20 @@ M3Result  AllocateConstantSlots  (IM3Compilation o, u16 * o_slot, m3type_t i_typ
 // TOQUE: this usage count system could be eliminated. real world code doesn't frequently trigger it.  just copy to multiple
 // unique slots.
 static inline
-M3Result  IncrementSlotUsageCount  (IM3Compilation o, u16 i_slot)
+M3Result  IncrementSlotUsageCount  (IM3Compilation o, u16 i_slot, m3type_t i_type)
 {                                                                                       d_m3Assert (i_slot < d_m3MaxFunctionSlots);
-    M3Result result = m3Err_none;                                                       d_m3Assert (o->m3Slots [i_slot] > 0);
+    M3Result result = m3Err_none;
 
     // OPTZ (memory): 'm3Slots' could still be fused with 'typeStack' if 4 bits were used to indicate: [0,1,2,many]. The many-case
     // would scan 'wasmStack' to determine the actual usage count
-    if (o->m3Slots [i_slot] < 0xFF)
-    {
-        o->m3Slots [i_slot]++;
+    for (u16 i = 0; i < GetTypeNumSlots (i_type); ++i, ++i_slot)
+    {                                                                                   d_m3Assert (o->m3Slots [i_slot] > 0);
+        if (o->m3Slots [i_slot] < 0xFF)
+        {
+            o->m3Slots [i_slot]++;
+        }
+        else result = "slot usage count overflow";
     }
-    else result = "slot usage count overflow";
 
     return result;
 }
@@ -530,6 +681,98 @@ _           (EmitOp (o, c_setSetOps [BaseTypeOf(type)]));
 }
 
 
+#if d_m3HasSecondRegister
+
+// binary operators with an _xr form; indexed by opcode
+static const IM3Operation c_extraRegisterOps [] =
+{
+    [0x6a] = op_i32_Add_xr,     [0x6b] = op_i32_Subtract_xr,    [0x6c] = op_i32_Multiply_xr,
+    [0x71] = op_u32_And_xr,     [0x72] = op_u32_Or_xr,          [0x73] = op_u32_Xor_xr,
+
+    [0x7c] = op_i64_Add_xr,     [0x7d] = op_i64_Subtract_xr,    [0x7e] = op_i64_Multiply_xr,
+    [0x83] = op_u64_And_xr,     [0x84] = op_u64_Or_xr,          [0x85] = op_u64_Xor_xr,
+};
+
+static inline bool  IsExtraRegisterAllocated      (IM3Compilation o)  { return (o->extraRegStackIndexPlusOne != c_m3RegisterUnallocated); }
+static inline u16   GetExtraRegisterStackIndex    (IM3Compilation o)  { return o->extraRegStackIndexPlusOne - 1; }
+
+// the _xr operation that consumes the value parked in _r1, if it's the deeper
+// operand of i_opcode and the top operand is in _r0
+static
+IM3Operation  GetExtraRegisterOp  (IM3Compilation o, m3opcode_t i_opcode)
+{
+    IM3Operation op = (i_opcode < M3_COUNT_OF (c_extraRegisterOps)) ? c_extraRegisterOps [i_opcode] : NULL;
+
+    if (op and IsExtraRegisterAllocated (o) and not IsStackPolymorphic (o) and IsStackTopInRegister (o) and
+        GetExtraRegisterStackIndex (o) == GetStackTopIndex (o) - 1)
+    {
+        m3type_t type = GetOpInfo (i_opcode)->type;
+
+        if (GetStackTopType (o) == type and GetStackTypeFromTop (o, 1) == type)
+            return op;
+    }
+
+    return NULL;
+}
+
+// copy the parked value to the slot that backs it
+static
+M3Result  FlushExtraRegister  (IM3Compilation o)
+{
+    M3Result result = m3Err_none;
+
+    if (IsExtraRegisterAllocated (o))
+    {
+        u16 stackIndex = GetExtraRegisterStackIndex (o);
+        o->extraRegStackIndexPlusOne = c_m3RegisterUnallocated;
+
+        m3type_t type = GetStackTypeFromBottom (o, stackIndex);
+
+_       (EmitOp (o, Is64BitType (type) ? op_SetSlotFromExtra_i64 : op_SetSlotFromExtra_i32));
+        EmitSlotOffset (o, o->wasmStack [stackIndex]);
+    }
+
+    _catch: return result;
+}
+
+#endif // d_m3HasSecondRegister
+
+// Like PreserveRegisterIfOccupied, but with d_m3HasSecondRegister an integer
+// value moves to _r1 when it's free. Its slot is allocated all the same and
+// only written if the value has to be flushed.
+static
+M3Result  DisplaceRegisterIfOccupied  (IM3Compilation o, m3type_t i_registerType)
+{
+    M3Result result = m3Err_none;
+
+#if d_m3HasSecondRegister
+    if (not IsFpType (i_registerType) and IsRegisterAllocated (o, 0) and not IsExtraRegisterAllocated (o))
+    {
+        u16 stackIndex = GetRegisterStackIndex (o, 0);
+        m3type_t type = GetStackTypeFromBottom (o, stackIndex);
+
+        if (type == c_m3Type_i32 or type == c_m3Type_i64)
+        {
+            u16 slot = c_slotUnused;
+_           (AllocateSlots (o, & slot, type));
+
+            DeallocateRegister (o, 0);
+            o->wasmStack [stackIndex] = slot;
+
+_           (EmitOp (o, op_MoveToExtraRegister));
+            o->extraRegStackIndexPlusOne = stackIndex + 1;
+
+            goto _catch;
+        }
+    }
+#endif
+
+_   (PreserveRegisterIfOccupied (o, i_registerType));
+
+    _catch: return result;
+}
+
+
 // all values must be in slots before entering loop, if, and else blocks
 // otherwise they'd end up preserve-copied in the block to probably different locations (if/else)
 static inline
@@ -964,9 +1207,10 @@ _           (PushRegister (o, type));
 }
 
 
-// if local is unreferenced, o_preservedSlotNumber will be equal to localIndex on return
+// if local is unreferenced, o_preservedSlotNumber will be equal to localIndex on return.
+// only stack entries below i_endIndex are looked at
 static
-M3Result  FindReferencedLocalWithinCurrentBlock  (IM3Compilation o, u16 * o_preservedSlotNumber, u32 i_localSlot)
+M3Result  FindReferencedLocalBelow  (IM3Compilation o, u16 * o_preservedSlotNumber, u32 i_localSlot, u16 i_endIndex)
 {
     M3Result result = m3Err_none;
 
@@ -984,18 +1228,18 @@ M3Result  FindReferencedLocalWithinCurrentBlock  (IM3Compilation o, u16 * o_pres
 
     * o_preservedSlotNumber = (u16) i_localSlot;
 
-    for (u32 i = startIndex; i < o->stackIndex; ++i)
+    for (u32 i = startIndex; i < i_endIndex; ++i)
     {
         if (o->wasmStack [i] == i_localSlot)
         {
+            m3type_t type = GetStackTypeFromBottom (o, i);                        d_m3Assert (type != c_m3Type_none)
+
             if (* o_preservedSlotNumber == i_localSlot)
             {
-                m3type_t type = GetStackTypeFromBottom (o, i);                    d_m3Assert (type != c_m3Type_none)
-
 _               (AllocateSlots (o, o_preservedSlotNumber, type));
             }
             else
-_               (IncrementSlotUsageCount (o, * o_preservedSlotNumber));
+_               (IncrementSlotUsageCount (o, * o_preservedSlotNumber, type));
 
             o->wasmStack [i] = * o_preservedSlotNumber;
         }
@@ -1004,6 +1248,12 @@ _               (IncrementSlotUsageCount (o, * o_preservedSlotNumber));
     _catch: return result;
 }
 
+static
+M3Result  FindReferencedLocalWithinCurrentBlock  (IM3Compilation o, u16 * o_preservedSlotNumber, u32 i_localSlot)
+{
+    return FindReferencedLocalBelow (o, o_preservedSlotNumber, i_localSlot, o->stackIndex);
+}
+
 static
 M3Result  GetBlockScope  (IM3Compilation o, IM3CompilationScope * o_scope, u32 i_depth)
 {
@@ -1330,7 +1580,8 @@ M3Result  Compile_End  (IM3Compilation o, m3opcode_t i_opcode)
 _               (ReturnValues (o, & o->block, false));
             }
 
-_           (EmitOp (o, op_Return));
+            // nor a return frame to go back through, when calls are stackless
+_           (EmitOp (o, o->function ? op_Return : op_End));
         }
     }
 
@@ -1399,9 +1650,9 @@ M3Result  Compile_GetGlobal  (IM3Compilation o, M3Global * i_global)
 {
     M3Result result;
 
-    IM3Operation op = Is64BitType (i_global->type) ? op_GetGlobal_s64 : op_GetGlobal_s32;
+    IM3Operation op = Is64BitType (i_global->type) ? SharedOp (o, GetGlobal, _s64) : SharedOp (o, GetGlobal, _s32);
 _   (EmitOp (o, op));
-    EmitPointer (o, & i_global->i64Value);
+    EmitGlobal (o, i_global);
 _   (PushAllocatedSlotAndEmit (o, i_global->type));
 
     _catch: return result;
@@ -1427,12 +1678,12 @@ M3Result  Compile_SetGlobal  (IM3Compilation o, M3Global * i_global)
 
         if (IsStackTopInRegister (o))
         {
-            op = c_setGlobalOps [BaseTypeOf(type)];
+            op = IsSharedCode (o) ? c_setGlobalSharedOps [BaseTypeOf(type)] : c_setGlobalOps [BaseTypeOf(type)];
         }
-        else op = Is64BitType (type) ? op_SetGlobal_s64 : op_SetGlobal_s32;
+        else op = Is64BitType (type) ? SharedOp (o, SetGlobal, _s64) : SharedOp (o, SetGlobal, _s32);
 
 _      (EmitOp (o, op));
-        EmitPointer (o, & i_global->i64Value);
+        EmitGlobal (o, i_global);
 
         if (IsStackTopInSlot (o))
             EmitSlotOffset (o, GetStackTopSlotNumber (o));
@@ -1721,6 +1972,18 @@ M3Result  CompileCallArgsAndReturn  (IM3Compilation o, u16 * o_stackOffset, IM3F
 {
 _try {
 
+#if d_m3Stackless
+    // a stackless callee runs on with the caller's registers, so a value below the
+    // arguments can't wait in one across the call
+    i32 firstArgIndex = o->stackIndex - GetFuncTypeNumParams (i_type) - (i_isIndirect ? 1 : 0);
+
+    for (u32 r = 0; r < 2; ++r)
+    {
+        if (IsRegisterAllocated (o, r) and GetRegisterStackIndex (o, r) < firstArgIndex)
+_           (PreserveRegisterIfOccupied (o, r ? c_m3Type_f64 : c_m3Type_i64));
+    }
+#endif
+
     u16 topSlot = GetMaxUsedSlotPlusOne (o);
 
     // force use of at least one stack slot; this is to help ensure
@@ -1814,11 +2077,12 @@ _       (Pop (o));
     } _catch: return result;
 }
 
+
+
 // An import that no host function was bound to may still be satisfied by another
 // module loaded into the same runtime, matched on the module's registered name.
 // Only functions can be linked this way: the runtime owns a single linear memory,
 // so a callee reaching for its own memory would find the caller's.
-static
 M3Result  ResolveImportedFunction  (IM3Function io_function)
 {
     M3Result result = m3Err_none;
@@ -1842,10 +2106,10 @@ M3Result  ResolveImportedFunction  (IM3Function io_function)
             {
                 _throwif (m3Err_functionImportMissing, f->funcType != io_function->funcType);
 
-                if (not f->compiled)
+                if (not LoadCompiled (f))
 _                   (CompileFunction (f));
 
-                io_function->compiled = f->compiled;
+                StoreCompiled (io_function, LoadCompiled (f));
                 return result;
             }
         }
@@ -1954,7 +2218,13 @@ _   (ReadLEB_u32 (& functionIndex, & o->wasm, o->wasmEnd));
 
     IM3Function function = Module_GetFunction (o->module, functionIndex);
 
-    if (function and not function->compiled)
+    // in parallel, another thread may be compiling the callee right now; for the code
+    // cache, imports are left unbound too, to be linked in the process that loads it
+    bool isDeferred = o->deferredCalls and function and (function->wasm or o->pointerSites);
+
+    // imports are only bound on the runtime's own thread; a compile running off it
+    // (parallel or in the background) leaves them for the first call
+    if (function and o->runtime == o->module->runtime and not LoadCompiled (function))
 _       (ResolveImportedFunction (function));
 
     if (function)
@@ -1975,19 +2245,27 @@ _               (CompileCallArgsAndReturn (o, & slotTop, function->funcType, fal
 
             IM3Operation op;
             const void * operand;
+            pc_t compiled = isDeferred ? NULL : LoadCompiled (function);
 
-            if (function->compiled)
+            if (compiled)
             {
                 op = useTailCall ? op_ReturnCall : op_Call;
-                operand = function->compiled;
+                operand = compiled;
             }
             else
             {
                 op = useTailCall ? op_CompileReturnCall : op_Compile;
                 operand = function;
+
+#               if d_m3HasBackgroundCompile
+                if (function->wasm and not isDeferred)
+                    QueueBackgroundCompile (o->module->runtime, function);
+#               endif
             }
 
 _           (EmitOp     (o, op));
+            if (isDeferred and o->page)
+_               (RecordCodeSite (o->deferredCalls, GetPagePC (o->page) - 1));
             EmitPointer (o, operand);
             EmitSlotOffset  (o, slotTop);
 
@@ -2042,9 +2320,9 @@ _       (CompileTailCallArgs (o, & execTop, & numArgSlots, type, true));
 _       (CompileCallArgsAndReturn (o, & execTop, type, true));
     }
 
-_   (EmitOp         (o, useTailCall ? op_ReturnCallIndirect : op_CallIndirect));
+_   (EmitOp         (o, useTailCall ? SharedOp (o, ReturnCallIndirect) : SharedOp (o, CallIndirect)));
     EmitSlotOffset  (o, tableIndexSlot);
-    EmitPointer     (o, & o->module->tables [tableIndex]);
+    EmitTable       (o, & o->module->tables [tableIndex]);
     EmitPointer     (o, type);              // TODO: unify all types in M3Environment
     EmitSlotOffset  (o, execTop);
 
@@ -2163,8 +2441,8 @@ _   (ReadLEB_u32 (& memoryIdx, & o->wasm, o->wasmEnd));
 
 _   (CopyStackTopToRegister (o, false));
 
-_   (EmitOp (o, op_MemInit));
-    EmitPointer (o, segment);
+_   (EmitOp (o, SharedOp (o, MemInit)));
+    EmitDataSegment (o, segment);
 _   (PopType (o, c_m3Type_i32));
 _   (EmitSlotNumOfStackTopAndPop (o));
 _   (EmitSlotNumOfStackTopAndPop (o));
@@ -2293,7 +2571,20 @@ _       (Module_DeclareFunction (o->module, funcIndex));
     refType = RefTypeOfFuncType (o->module->functions [funcIndex].funcType, true);
 #endif
 
-_   (PushConst (o, (u64) (uintptr_t) & o->module->functions [funcIndex], refType));
+    if (IsSharedCode (o))
+    {
+        // each instance has its own copy of the function; look it up by index when run
+_       (EmitOp (o, op_RefFuncShared));
+        EmitConstant32 (o, funcIndex);
+_       (PushAllocatedSlotAndEmit (o, refType));
+    }
+    else
+    {
+        // the reference becomes a constant, not a word of code the cache knows to relocate
+        _throwif (m3Err_codeCacheUnrelocatable, o->function and o->pointerSites);
+
+_       (PushConst (o, (u64) (uintptr_t) & o->module->functions [funcIndex], refType));
+    }
 
     _catch: return result;
 }
@@ -2328,7 +2619,7 @@ M3Result  Compile_Table_Op  (IM3Compilation o, IM3Operation i_op, M3Table * i_ta
 _   (PreserveRegisterIfOccupied (o, c_m3Type_i64));
 
 _   (EmitOp (o, i_op));
-    EmitPointer (o, i_table);
+    EmitTable (o, i_table);
 
     for (u32 i = 0; i < i_numOperands; ++i)
 _       (EmitSlotNumOfStackTopAndPop (o));
@@ -2348,9 +2639,9 @@ M3Result  Compile_Table_GetSet  (IM3Compilation o, m3opcode_t i_opcode)
 _   (ReadTable (o, & table));
 
     if (i_opcode == c_waOp_tableGet)
-_       (Compile_Table_Op (o, op_TableGet, table, 1, table->type))
+_       (Compile_Table_Op (o, SharedOp (o, TableGet), table, 1, table->type))
     else
-_       (Compile_Table_Op (o, op_TableSet, table, 2, c_m3Type_none))
+_       (Compile_Table_Op (o, SharedOp (o, TableSet), table, 2, c_m3Type_none))
 
     _catch: return result;
 }
@@ -2368,9 +2659,9 @@ _   (ReadLEB_u32 (& elemIndex, & o->wasm, o->wasmEnd));
 _   (ReadTable (o, & table));
 
 _   (PreserveRegisterIfOccupied (o, c_m3Type_i64));
-_   (EmitOp (o, op_TableInit));
-    EmitPointer (o, table);
-    EmitPointer (o, & o->module->elementSegments [elemIndex]);
+_   (EmitOp (o, SharedOp (o, TableInit)));
+    EmitTable (o, table);
+    EmitElementSegment (o, & o->module->elementSegments [elemIndex]);
 
     for (u32 i = 0; i < 3; ++i)
 _       (EmitSlotNumOfStackTopAndPop (o));
@@ -2387,8 +2678,8 @@ M3Result  Compile_Elem_Drop  (IM3Compilation o, m3opcode_t i_opcode)
 _   (ReadLEB_u32 (& elemIndex, & o->wasm, o->wasmEnd));
     _throwif ("element segment index out of range", elemIndex >= o->module->numElementSegments);
 
-_   (EmitOp (o, op_ElemDrop));
-    EmitPointer (o, & o->module->elementSegments [elemIndex]);
+_   (EmitOp (o, SharedOp (o, ElemDrop)));
+    EmitElementSegment (o, & o->module->elementSegments [elemIndex]);
 
     _catch: return result;
 }
@@ -2406,9 +2697,9 @@ _   (ReadTable (o, & src));
     _throwif (m3Err_typeMismatch, not IsSubTypeOf (src->type, dst->type));
 
 _   (PreserveRegisterIfOccupied (o, c_m3Type_i64));
-_   (EmitOp (o, op_TableCopy));
-    EmitPointer (o, dst);
-    EmitPointer (o, src);
+_   (EmitOp (o, SharedOp (o, TableCopy)));
+    EmitTable (o, dst);
+    EmitTable (o, src);
 
     for (u32 i = 0; i < 3; ++i)
 _       (EmitSlotNumOfStackTopAndPop (o));
@@ -2423,7 +2714,7 @@ M3Result  Compile_Table_Size  (IM3Compilation o, m3opcode_t i_opcode)
 
     M3Table * table;
 _   (ReadTable (o, & table));
-_   (Compile_Table_Op (o, op_TableSize, table, 0, c_m3Type_i32));
+_   (Compile_Table_Op (o, SharedOp (o, TableSize), table, 0, c_m3Type_i32));
 
     _catch: return result;
 }
@@ -2437,9 +2728,9 @@ M3Result  Compile_Table_GrowFill  (IM3Compilation o, m3opcode_t i_opcode)
 _   (ReadTable (o, & table));
 
     if (i_opcode == c_waOp_tableGrow)
-_       (Compile_Table_Op (o, op_TableGrow, table, 2, c_m3Type_i32))
+_       (Compile_Table_Op (o, SharedOp (o, TableGrow), table, 2, c_m3Type_i32))
     else
-_       (Compile_Table_Op (o, op_TableFill, table, 3, c_m3Type_none))
+_       (Compile_Table_Op (o, SharedOp (o, TableFill), table, 3, c_m3Type_none))
 
     _catch: return result;
 }
@@ -2454,8 +2745,8 @@ M3Result  Compile_Data_Drop  (IM3Compilation o, m3opcode_t i_opcode)
     M3DataSegment * segment = NULL;
 _   (ReadDataSegment (o, & segment));
 
-_   (EmitOp (o, op_DataDrop));
-    EmitPointer (o, segment);
+_   (EmitOp (o, SharedOp (o, DataDrop)));
+    EmitDataSegment (o, segment);
 
     _catch: return result;
 }
@@ -2531,6 +2822,10 @@ static
 M3Result  Compile_LoopOrBlock  (IM3Compilation o, m3opcode_t i_opcode)
 {
     M3Result result;
+#if d_m3HasFuel
+    pc_t fuelCostSite = NULL;
+    u32 outerFuelCost = o->fuelCost;
+#endif
 
     // TODO: these shouldn't be necessary for non-loop blocks?
 _   (PreserveRegisters (o));
@@ -2568,6 +2863,21 @@ _                       (CopyStackIndexToSlot (o, newSlot, i));
         }
 
 _       (EmitOp (o, op_Loop));
+#if d_m3Stackless
+        o->loopHead = o->page ? GetPC (o) - 1 : NULL;
+#endif
+#if d_m3HasJit
+        EmitPointer (o, o->function);
+#endif
+#if d_m3HasFuel
+        // each iteration is charged for the loop's own operations, which are only
+        // known at its end; nested loops charge for theirs. Without d_m3Stackless,
+        // op_Loop charges only on going round again, and the first pass is added to
+        // what encloses it, entering a loop being no reason for a check of its own.
+        fuelCostSite = GetPC (o);
+        EmitConstant32 (o, 0);
+        o->fuelCost = 0;
+#endif
     }
     else
     {
@@ -2575,6 +2885,18 @@ _       (EmitOp (o, op_Loop));
 
 _   (CompileBlock (o, blockType, i_opcode));
 
+#if d_m3HasFuel
+    if (fuelCostSite)
+    {
+        memcpy ((void *) fuelCostSite, & o->fuelCost, sizeof (u32));
+# if d_m3Stackless
+        o->fuelCost = outerFuelCost;
+# else
+        o->fuelCost = outerFuelCost + o->fuelCost;
+# endif
+    }
+#endif
+
     _catch: return result;
 }
 
@@ -2789,80 +3111,506 @@ _   (SetStackPolymorphic (o));
 }
 
 
-// OPTZ: currently all stack slot indices take up a full word, but
-// dual stack source operands could be packed together
+#if d_m3FuseCompareBranch
+
+#define d_fusedCompare(TYPE, NAME, BRANCH)      { op_##TYPE##_##NAME##_##BRANCH##_rs, op_##TYPE##_##NAME##_##BRANCH##_sr, \
+                                                  op_##TYPE##_##NAME##_##BRANCH##_ss, op_##TYPE##_##NAME##_##BRANCH##_ir, \
+                                                  op_##TYPE##_##NAME##_##BRANCH##_is }
+#define d_fusedCommutative(TYPE, NAME, BRANCH)  { op_##TYPE##_##NAME##_##BRANCH##_rs, NULL, \
+                                                  op_##TYPE##_##NAME##_##BRANCH##_ss, op_##TYPE##_##NAME##_##BRANCH##_ir, \
+                                                  op_##TYPE##_##NAME##_##BRANCH##_is }
+#define d_fusedCompareOps(TYPE, NAME)           { d_fusedCompare (TYPE, NAME, BranchIf), d_fusedCompare (TYPE, NAME, ContinueLoopIf) }
+#define d_fusedCommutativeOps(TYPE, NAME)       { d_fusedCommutative (TYPE, NAME, BranchIf), d_fusedCommutative (TYPE, NAME, ContinueLoopIf) }
+
+enum { c_fusedOp_rs, c_fusedOp_sr, c_fusedOp_ss, c_fusedOp_ir, c_fusedOp_is };
+
+typedef struct M3FusedCompare
+{
+    u8                      mirror;                 // compare index with its operands swapped
+    IM3Operation            operations  [2] [5];    // [BranchIf, ContinueLoopIf] [_rs, _sr, _ss, _ir, _is]
+}
+M3FusedCompare;
+
+// indexed by opcode - c_waOp_i32_eq and opcode - c_waOp_i64_eq; the two ranges share the same layout
+static const M3FusedCompare c_fusedCompares [2] [10] =
+{
+    {   { 0, d_fusedCommutativeOps (i32, Equal) },              { 1, d_fusedCommutativeOps (i32, NotEqual) },
+        { 4, d_fusedCompareOps (i32, LessThan) },               { 5, d_fusedCompareOps (u32, LessThan) },
+        { 2, d_fusedCompareOps (i32, GreaterThan) },            { 3, d_fusedCompareOps (u32, GreaterThan) },
+        { 8, d_fusedCompareOps (i32, LessThanOrEqual) },        { 9, d_fusedCompareOps (u32, LessThanOrEqual) },
+        { 6, d_fusedCompareOps (i32, GreaterThanOrEqual) },     { 7, d_fusedCompareOps (u32, GreaterThanOrEqual) }     },
+
+    {   { 0, d_fusedCommutativeOps (i64, Equal) },              { 1, d_fusedCommutativeOps (i64, NotEqual) },
+        { 4, d_fusedCompareOps (i64, LessThan) },               { 5, d_fusedCompareOps (u64, LessThan) },
+        { 2, d_fusedCompareOps (i64, GreaterThan) },            { 3, d_fusedCompareOps (u64, GreaterThan) },
+        { 8, d_fusedCompareOps (i64, LessThanOrEqual) },        { 9, d_fusedCompareOps (u64, LessThanOrEqual) },
+        { 6, d_fusedCompareOps (i64, GreaterThanOrEqual) },     { 7, d_fusedCompareOps (u64, GreaterThanOrEqual) }     }
+};
+
+static const IM3Operation c_fusedEqualToZero [2] [2] [2] =  // [i32, i64] [BranchIf, ContinueLoopIf] [_r, _s]
+{
+    { { op_i32_EqualToZero_BranchIf_r, op_i32_EqualToZero_BranchIf_s }, { op_i32_EqualToZero_ContinueLoopIf_r, op_i32_EqualToZero_ContinueLoopIf_s } },
+    { { op_i64_EqualToZero_BranchIf_r, op_i64_EqualToZero_BranchIf_s }, { op_i64_EqualToZero_ContinueLoopIf_r, op_i64_EqualToZero_ContinueLoopIf_s } }
+};
+
+// An integer compare whose result feeds straight into a br_if is emitted as a
+// single operation that branches itself. Only branches that move no values are
+// fused: a loop without params, or a forward branch to a block without results.
 static
-M3Result  Compile_Operator  (IM3Compilation o, m3opcode_t i_opcode)
+M3Result  TryCompileCompareBranch  (IM3Compilation o, m3opcode_t i_opcode, bool * o_fused)
 {
-    M3Result result;
+    M3Result result = m3Err_none;
 
-    IM3OpInfo opInfo = GetOpInfo (i_opcode);
-    _throwif (m3Err_unknownOpcode, not opInfo);
+    * o_fused = false;
 
-    // Spec: validate operand types for load/store operations
-    if (not IsStackPolymorphic (o))
-    {
-        // For load ops (stackOffset == 0, unary), the operand is always i32 (address)
-        if (i_opcode >= 0x28 and i_opcode <= 0x35)
-        {
-            m3type_t topType = GetStackTopType (o);
-            _throwif (m3Err_typeMismatch, topType != c_m3Type_none and topType != c_m3Type_i32);
-        }
+    bool isEqz = (i_opcode == c_waOp_i32_eqz or i_opcode == c_waOp_i64_eqz);
+    bool is64Bit = (i_opcode >= c_waOp_i64_eqz);
 
-        // For store ops (stackOffset == -2), the address operand must be i32
-        if (i_opcode >= 0x36 and i_opcode <= 0x3e)
-        {
-            m3type_t addrType = GetStackTypeFromTop (o, 1);
-            _throwif (m3Err_typeMismatch, addrType != c_m3Type_none and addrType != c_m3Type_i32);
-        }
-    }
+    if (IsStackPolymorphic (o) or o->wasm >= o->wasmEnd or * o->wasm != c_waOp_branchIf)
+        return result;
 
-    IM3Operation op;
+    // operands must already have the compare's type; leave mismatches to the regular path
+    m3type_t type = is64Bit ? c_m3Type_i64 : c_m3Type_i32;
+    if (GetStackTopType (o) != type or (not isEqz and GetStackTypeFromTop (o, 1) != type))
+        return result;
 
-    // This preserve is for for FP compare operations.
-    // either need additional slot destination operations or the
-    // easy fix, move _r0 out of the way.
-    // moving out the way might be the optimal solution most often?
-    // otherwise, the _r0 reg can get buried down in the stack
-    // and be idle & wasted for a moment.
-    if (IsFpType (GetStackTopType (o)) and IsIntType (opInfo->type))
+    bytes_t wasm = o->wasm + 1;
+    u32 depth;
+_   (ReadLEB_u32 (& depth, & wasm, o->wasmEnd));
+
+    IM3CompilationScope scope;
+_   (GetBlockScope (o, & scope, depth));
+
+    u32 branch;
+    if (scope->opcode == c_waOp_loop)
     {
-_       (PreserveRegisterIfOccupied (o, opInfo->type));
+        if (GetFuncTypeNumParams (scope->type))
+            return result;
+        branch = 1;     // ContinueLoopIf
+    }
+    else
+    {
+        if (scope->depth == 0 or GetFuncTypeNumResults (scope->type))
+            return result;
+        branch = 0;     // BranchIf
     }
 
-    if (opInfo->stackOffset == 0)
+    if (isEqz)
     {
-        if (IsStackTopInRegister (o))
-        {
-            op = opInfo->operations [0]; // _s
-        }
-        else
-        {
-_           (PreserveRegisterIfOccupied (o, opInfo->type));
-            op = opInfo->operations [1]; // _r
-        }
+_       (EmitOp (o, c_fusedEqualToZero [is64Bit] [branch] [IsStackTopInSlot (o)]));
+_       (EmitSlotNumOfStackTopAndPop (o));
     }
     else
     {
-        if (IsStackTopInRegister (o))
-        {
-            op = opInfo->operations [0];  // _rs
+        u32 index = i_opcode - (is64Bit ? c_waOp_i64_eq : c_waOp_i32_eq);
+        const M3FusedCompare * compare = & c_fusedCompares [is64Bit] [index];
 
-            if (IsStackTopMinus1InRegister (o))
-            {                                       d_m3Assert (i_opcode == c_waOp_store_f32 or i_opcode == c_waOp_store_f64);
-                op = opInfo->operations [3]; // _rr for fp.store
+        u16 slotB = GetStackTopSlotNumber (o);                          // top of stack
+        u16 slotA = GetSlotForStackIndex (o, GetStackTopIndex (o) - 1);
+        bool inRegisterB = IsStackTopInRegister (o);
+        bool inRegisterA = IsStackTopMinus1InRegister (o);
+        bool isConstantB = not inRegisterB and IsConstantSlot (o, slotB);
+        bool isConstantA = not inRegisterA and IsConstantSlot (o, slotA);
+
+        // a constant in the deeper operand position becomes the immediate of the mirrored compare
+        if (isConstantA and not isConstantB)
+            compare = & c_fusedCompares [is64Bit] [compare->mirror];
+
+        IM3Operation const * ops = compare->operations [branch];
+
+        if (inRegisterB)
+        {
+            if (isConstantA)
+            {
+_               (EmitOp (o, ops [c_fusedOp_ir]));
+                EmitImmediate (o, GetConstantSlotValue (o, slotA, is64Bit), is64Bit);
+            }
+            else
+            {
+_               (EmitOp (o, ops [c_fusedOp_rs]));
+                EmitSlotOffset (o, slotA);
             }
         }
-        else if (IsStackTopMinus1InRegister (o))
+        else if (inRegisterA)
         {
-            op = opInfo->operations [1]; // _sr
-
-            if (not op)  // must be commutative, then
-                op = opInfo->operations [0];
+            if (isConstantB)
+            {
+_               (EmitOp (o, ops [c_fusedOp_ir]));
+                EmitImmediate (o, GetConstantSlotValue (o, slotB, is64Bit), is64Bit);
+            }
+            else
+            {
+_               (EmitOp (o, ops [c_fusedOp_sr] ? ops [c_fusedOp_sr] : ops [c_fusedOp_rs]));
+                EmitSlotOffset (o, slotB);
+            }
         }
-        else
+        else if (isConstantB)
         {
-_           (PreserveRegisterIfOccupied (o, opInfo->type));     // _ss
+_           (EmitOp (o, ops [c_fusedOp_is]));
+            EmitSlotOffset (o, slotA);
+            EmitImmediate (o, GetConstantSlotValue (o, slotB, is64Bit), is64Bit);
+        }
+        else if (isConstantA)
+        {
+_           (EmitOp (o, ops [c_fusedOp_is]));
+            EmitSlotOffset (o, slotB);
+            EmitImmediate (o, GetConstantSlotValue (o, slotA, is64Bit), is64Bit);
+        }
+        else
+        {
+_           (EmitOp (o, ops [c_fusedOp_ss]));
+            EmitSlotOffset (o, slotB);
+            EmitSlotOffset (o, slotA);
+        }
+
+_       (Pop (o));
+_       (Pop (o));
+    }
+
+    if (branch)
+        EmitPointer (o, scope->pc);
+    else
+        EmitPatchingBranchPointer (o, scope);
+
+    o->wasm = wasm;     // the br_if is consumed
+    * o_fused = true;
+
+    _catch: return result;
+}
+
+#endif // d_m3FuseCompareBranch
+
+
+// slot-to-slot forms of the common binary operators; indexed by opcode
+static const IM3Operation c_threeAddressOps [] =
+{
+    [0x6a] = op_i32_Add_sss,        [0x6b] = op_i32_Subtract_sss,   [0x6c] = op_i32_Multiply_sss,
+    [0x71] = op_u32_And_sss,        [0x72] = op_u32_Or_sss,         [0x73] = op_u32_Xor_sss,
+    [0x74] = op_u32_ShiftLeft_sss,  [0x75] = op_i32_ShiftRight_sss, [0x76] = op_u32_ShiftRight_sss,
+
+    [0x7c] = op_i64_Add_sss,        [0x7d] = op_i64_Subtract_sss,   [0x7e] = op_i64_Multiply_sss,
+    [0x83] = op_u64_And_sss,        [0x84] = op_u64_Or_sss,         [0x85] = op_u64_Xor_sss,
+    [0x86] = op_u64_ShiftLeft_sss,  [0x87] = op_i64_ShiftRight_sss, [0x88] = op_u64_ShiftRight_sss,
+
+# if d_m3HasFloat
+    [0x92] = op_f32_Add_sss,        [0x93] = op_f32_Subtract_sss,   [0x94] = op_f32_Multiply_sss,   [0x95] = op_f32_Divide_sss,
+    [0xa0] = op_f64_Add_sss,        [0xa1] = op_f64_Subtract_sss,   [0xa2] = op_f64_Multiply_sss,   [0xa3] = op_f64_Divide_sss,
+# endif
+};
+
+// When both operands are in slots and the result is immediately stored to a
+// local, write the result straight into the local's slot. The local.set (or
+// local.tee) is consumed here.
+static
+M3Result  TryCompileThreeAddress  (IM3Compilation o, m3opcode_t i_opcode, bool * o_fused)
+{
+    M3Result result = m3Err_none;
+
+    * o_fused = false;
+
+    IM3Operation op = (i_opcode < M3_COUNT_OF (c_threeAddressOps)) ? c_threeAddressOps [i_opcode] : NULL;
+
+    if (not op or IsStackPolymorphic (o) or o->wasm >= o->wasmEnd)
+        return result;
+
+    u8 nextOpcode = * o->wasm;
+    if (nextOpcode != c_waOp_setLocal and nextOpcode != c_waOp_teeLocal)
+        return result;
+
+    m3type_t type = GetOpInfo (i_opcode)->type;
+    u16 localSlot, preserveSlot;
+
+    bytes_t wasm = o->wasm + 1;
+    u32 localIndex;
+_   (ReadLEB_u32 (& localIndex, & wasm, o->wasmEnd));
+
+    // leave anything unusual, type errors included, to the regular path
+    if (localIndex >= GetFunctionNumArgsAndLocals (o->function) or GetStackTypeFromBottom (o, localIndex) != type or
+        GetStackTopType (o) != type or GetStackTypeFromTop (o, 1) != type)
+        return result;
+
+    localSlot = GetSlotForStackIndex (o, localIndex);
+
+    // the operands themselves are read before the local is written, so they don't need
+    // preserving; the scan is still done before they're popped, so the preserve slot
+    // can't reuse one of theirs
+_   (FindReferencedLocalBelow (o, & preserveSlot, localSlot, o->stackIndex - 2));
+
+    if (preserveSlot != localSlot)
+    {
+_       (EmitOp (o, Is64BitType (type) ? op_CopySlot_64 : op_CopySlot_32));
+        EmitSlotOffset (o, preserveSlot);
+        EmitSlotOffset (o, localSlot);
+    }
+
+_   (EmitOp (o, op));
+_   (EmitSlotNumOfStackTopAndPop (o));
+_   (EmitSlotNumOfStackTopAndPop (o));
+    EmitSlotOffset (o, localSlot);
+
+    if (nextOpcode == c_waOp_teeLocal)
+_       (Push (o, type, localSlot));
+
+    o->wasm = wasm;
+    * o_fused = true;
+
+    _catch: return result;
+}
+
+
+typedef struct M3ImmediateOp
+{
+    IM3Operation            operations  [2];    // [_ir, _is]
+    u8                      swapped;            // opcode giving the same result with the operands exchanged; 0 if none
+}
+M3ImmediateOp;
+
+#define d_immediateOp(TYPE, NAME, SWAPPED)      { { op_##TYPE##_##NAME##_ir, op_##TYPE##_##NAME##_is }, SWAPPED }
+
+// binary integer operators that can take their top operand as an immediate; indexed by opcode
+static const M3ImmediateOp c_immediateOps [] =
+{
+    [0x46] = d_immediateOp (i32, Equal,              0x46), [0x47] = d_immediateOp (i32, NotEqual,           0x47),
+    [0x48] = d_immediateOp (i32, LessThan,           0x4a), [0x49] = d_immediateOp (u32, LessThan,           0x4b),
+    [0x4a] = d_immediateOp (i32, GreaterThan,        0x48), [0x4b] = d_immediateOp (u32, GreaterThan,        0x49),
+    [0x4c] = d_immediateOp (i32, LessThanOrEqual,    0x4e), [0x4d] = d_immediateOp (u32, LessThanOrEqual,    0x4f),
+    [0x4e] = d_immediateOp (i32, GreaterThanOrEqual, 0x4c), [0x4f] = d_immediateOp (u32, GreaterThanOrEqual, 0x4d),
+
+    [0x51] = d_immediateOp (i64, Equal,              0x51), [0x52] = d_immediateOp (i64, NotEqual,           0x52),
+    [0x53] = d_immediateOp (i64, LessThan,           0x55), [0x54] = d_immediateOp (u64, LessThan,           0x56),
+    [0x55] = d_immediateOp (i64, GreaterThan,        0x53), [0x56] = d_immediateOp (u64, GreaterThan,        0x54),
+    [0x57] = d_immediateOp (i64, LessThanOrEqual,    0x59), [0x58] = d_immediateOp (u64, LessThanOrEqual,    0x5a),
+    [0x59] = d_immediateOp (i64, GreaterThanOrEqual, 0x57), [0x5a] = d_immediateOp (u64, GreaterThanOrEqual, 0x58),
+
+    [0x6a] = d_immediateOp (i32, Add,                0x6a), [0x6b] = d_immediateOp (i32, Subtract,           0),
+    [0x6c] = d_immediateOp (i32, Multiply,           0x6c), [0x6d] = d_immediateOp (i32, Divide,             0),
+    [0x6e] = d_immediateOp (u32, Divide,             0),    [0x6f] = d_immediateOp (i32, Remainder,          0),
+    [0x70] = d_immediateOp (u32, Remainder,          0),    [0x71] = d_immediateOp (u32, And,                0x71),
+    [0x72] = d_immediateOp (u32, Or,                 0x72), [0x73] = d_immediateOp (u32, Xor,                0x73),
+    [0x74] = d_immediateOp (u32, ShiftLeft,          0),    [0x75] = d_immediateOp (i32, ShiftRight,         0),
+    [0x76] = d_immediateOp (u32, ShiftRight,         0),
+
+    [0x7c] = d_immediateOp (i64, Add,                0x7c), [0x7d] = d_immediateOp (i64, Subtract,           0),
+    [0x7e] = d_immediateOp (i64, Multiply,           0x7e), [0x7f] = d_immediateOp (i64, Divide,             0),
+    [0x80] = d_immediateOp (u64, Divide,             0),    [0x81] = d_immediateOp (i64, Remainder,          0),
+    [0x82] = d_immediateOp (u64, Remainder,          0),    [0x83] = d_immediateOp (u64, And,                0x83),
+    [0x84] = d_immediateOp (u64, Or,                 0x84), [0x85] = d_immediateOp (u64, Xor,                0x85),
+    [0x86] = d_immediateOp (u64, ShiftLeft,          0),    [0x87] = d_immediateOp (i64, ShiftRight,         0),
+    [0x88] = d_immediateOp (u64, ShiftRight,         0),
+};
+
+// A binary operator with a constant operand carries the constant inline rather
+// than reading its table slot. Multiplication and unsigned division or
+// remainder by a power of two become shifts and masks.
+static
+M3Result  TryCompileImmediateOperand  (IM3Compilation o, m3opcode_t i_opcode, bool * o_fused)
+{
+    M3Result result = m3Err_none;
+
+    * o_fused = false;
+
+    if (i_opcode >= M3_COUNT_OF (c_immediateOps) or not c_immediateOps [i_opcode].operations [0] or IsStackPolymorphic (o))
+        return result;
+
+    bool is64Bit = (i_opcode >= c_waOp_i64_eq and i_opcode <= c_waOp_i64_geu) or i_opcode >= c_waOp_i64_add;
+    m3type_t type = is64Bit ? c_m3Type_i64 : c_m3Type_i32;
+    m3type_t resultType = GetOpInfo (i_opcode)->type;
+
+    if (GetStackTopType (o) != type or GetStackTypeFromTop (o, 1) != type)
+        return result;
+
+    u16 slotB = GetStackTopSlotNumber (o);                              // top of stack
+    u16 slotA = GetSlotForStackIndex (o, GetStackTopIndex (o) - 1);
+    bool isConstantB = IsStackTopInSlot (o) and IsConstantSlot (o, slotB);
+    bool isConstantA = not IsStackTopMinus1InRegister (o) and IsConstantSlot (o, slotA);
+
+    m3opcode_t opcode = i_opcode;
+    bool swap = false;
+
+    if (isConstantB)
+        {}
+    else if (isConstantA and c_immediateOps [i_opcode].swapped)
+    {
+        opcode = c_immediateOps [i_opcode].swapped;
+        swap = true;
+    }
+    else return result;
+
+    u64 constant = GetConstantSlotValue (o, swap ? slotA : slotB, is64Bit);
+    i64 signedConstant = is64Bit ? (i64) constant : (i32) constant;
+    bool isPowerOfTwo = constant and not (constant & (constant - 1));
+    u32 log2 = isPowerOfTwo ? (u32) __builtin_ctzll (constant) : 0;
+
+    m3opcode_t arithmeticBase = is64Bit ? c_waOp_i64_add : c_waOp_i32_add;
+
+    switch (opcode - arithmeticBase)
+    {
+        case c_waOp_i32_divs - c_waOp_i32_add:
+        case c_waOp_i32_rems - c_waOp_i32_add:
+            if (signedConstant == 0 or signedConstant == -1)    // keep the trap/overflow checks
+                return result;
+            break;
+
+        case c_waOp_i32_divu - c_waOp_i32_add:
+            if (not constant)
+                return result;
+            if (isPowerOfTwo)
+            {
+                opcode = arithmeticBase + (c_waOp_i32_shru - c_waOp_i32_add);
+                constant = log2;
+            }
+            break;
+
+        case c_waOp_i32_remu - c_waOp_i32_add:
+            if (not constant)
+                return result;
+            if (isPowerOfTwo)
+            {
+                opcode = arithmeticBase + (c_waOp_i32_and - c_waOp_i32_add);
+                constant = constant - 1;
+            }
+            break;
+
+        case c_waOp_i32_mul - c_waOp_i32_add:
+            if (isPowerOfTwo)
+            {
+                opcode = arithmeticBase + (c_waOp_i32_shl - c_waOp_i32_add);
+                constant = log2;
+            }
+            break;
+    }
+
+    bool inRegister = swap ? IsStackTopInRegister (o) : IsStackTopMinus1InRegister (o);
+
+    if (not inRegister)
+_       (DisplaceRegisterIfOccupied (o, resultType));
+
+_   (EmitOp (o, c_immediateOps [opcode].operations [inRegister ? 0 : 1]));
+
+    if (not inRegister)
+        EmitSlotOffset (o, swap ? slotB : slotA);
+
+    EmitImmediate (o, constant, is64Bit);
+
+_   (Pop (o));
+_   (Pop (o));
+_   (PushRegister (o, resultType));
+
+    * o_fused = true;
+
+    _catch: return result;
+}
+
+
+// OPTZ: currently all stack slot indices take up a full word, but
+// dual stack source operands could be packed together
+static
+M3Result  Compile_Operator  (IM3Compilation o, m3opcode_t i_opcode)
+{
+    M3Result result;
+
+    IM3OpInfo opInfo = GetOpInfo (i_opcode);
+    _throwif (m3Err_unknownOpcode, not opInfo);
+
+# if d_m3FuseCompareBranch
+    if (i_opcode >= c_waOp_i32_eqz and i_opcode <= c_waOp_i64_geu)
+    {
+        bool fused;
+_       (TryCompileCompareBranch (o, i_opcode, & fused));
+        if (fused)
+            goto _catch;
+    }
+# endif
+
+    // Spec: validate operand types for load/store operations
+    if (not IsStackPolymorphic (o))
+    {
+        // For load ops (stackOffset == 0, unary), the operand is always i32 (address)
+        if (i_opcode >= 0x28 and i_opcode <= 0x35)
+        {
+            m3type_t topType = GetStackTopType (o);
+            _throwif (m3Err_typeMismatch, topType != c_m3Type_none and topType != c_m3Type_i32);
+        }
+
+        // For store ops (stackOffset == -2), the address operand must be i32
+        if (i_opcode >= 0x36 and i_opcode <= 0x3e)
+        {
+            m3type_t addrType = GetStackTypeFromTop (o, 1);
+            _throwif (m3Err_typeMismatch, addrType != c_m3Type_none and addrType != c_m3Type_i32);
+        }
+    }
+
+    IM3Operation op;
+
+    // This preserve is for for FP compare operations.
+    // either need additional slot destination operations or the
+    // easy fix, move _r0 out of the way.
+    // moving out the way might be the optimal solution most often?
+    // otherwise, the _r0 reg can get buried down in the stack
+    // and be idle & wasted for a moment.
+    if (IsFpType (GetStackTopType (o)) and IsIntType (opInfo->type))
+    {
+_       (PreserveRegisterIfOccupied (o, opInfo->type));
+    }
+
+    if (opInfo->stackOffset == 0)
+    {
+        if (IsStackTopInRegister (o))
+        {
+            op = opInfo->operations [0]; // _s
+        }
+        else
+        {
+_           (DisplaceRegisterIfOccupied (o, opInfo->type));
+            op = opInfo->operations [1]; // _r
+        }
+    }
+    else
+    {
+# if d_m3HasSecondRegister
+        IM3Operation extraOp = GetExtraRegisterOp (o, i_opcode);
+        if (extraOp)
+        {
+_           (EmitOp (o, extraOp));
+            o->extraRegStackIndexPlusOne = c_m3RegisterUnallocated;
+
+_           (Pop (o));
+_           (Pop (o));
+_           (PushRegister (o, opInfo->type));
+            goto _catch;
+        }
+# endif
+
+        bool fused = false;
+
+        if (IsStackTopInSlot (o) and not IsStackTopMinus1InRegister (o))
+_           (TryCompileThreeAddress (o, i_opcode, & fused));
+
+        if (not fused)
+_           (TryCompileImmediateOperand (o, i_opcode, & fused));
+
+        if (fused)
+            goto _catch;
+
+        if (IsStackTopInRegister (o))
+        {
+            op = opInfo->operations [0];  // _rs
+
+            if (IsStackTopMinus1InRegister (o))
+            {                                       d_m3Assert (i_opcode == c_waOp_store_f32 or i_opcode == c_waOp_store_f64);
+                op = opInfo->operations [3]; // _rr for fp.store
+            }
+        }
+        else if (IsStackTopMinus1InRegister (o))
+        {
+            op = opInfo->operations [1]; // _sr
+
+            if (not op)  // must be commutative, then
+                op = opInfo->operations [0];
+        }
+        else
+        {
+_           (DisplaceRegisterIfOccupied (o, opInfo->type));     // _ss
             op = opInfo->operations [2];
         }
     }
@@ -2953,6 +3701,121 @@ _       (PushRegister (o, opInfo->type))
     _catch: return result;
 }
 
+#define d_loadModeOps(TYPE, NAME)       { op_##TYPE##_##NAME##_rz,  op_##TYPE##_##NAME##_sz,  op_##TYPE##_##NAME##_i }
+#define d_storeModeOps(TYPE, NAME)      { op_##TYPE##_##NAME##_rsz, op_##TYPE##_##NAME##_srz, op_##TYPE##_##NAME##_ssz, \
+                                          op_##TYPE##_##NAME##_ri,  op_##TYPE##_##NAME##_si }
+
+static const IM3Operation c_loadModeOps [] [3] =       // [_rz, _sz, _i]; indexed by opcode - i32.load
+{
+    d_loadModeOps (i32, Load_i32),  d_loadModeOps (i64, Load_i64),
+# if d_m3HasFloat
+    d_loadModeOps (f32, Load_f32),  d_loadModeOps (f64, Load_f64),
+# else
+    { NULL },                       { NULL },
+# endif
+    d_loadModeOps (i32, Load_i8),   d_loadModeOps (i32, Load_u8),   d_loadModeOps (i32, Load_i16),  d_loadModeOps (i32, Load_u16),
+    d_loadModeOps (i64, Load_i8),   d_loadModeOps (i64, Load_u8),   d_loadModeOps (i64, Load_i16),  d_loadModeOps (i64, Load_u16),
+    d_loadModeOps (i64, Load_i32),  d_loadModeOps (i64, Load_u32)
+};
+
+static const IM3Operation c_storeModeOps [] [5] =      // [_rsz, _srz, _ssz, _ri, _si]; indexed by opcode - i32.store
+{
+    d_storeModeOps (i32, Store_i32),    d_storeModeOps (i64, Store_i64),
+# if d_m3HasFloat
+    d_storeModeOps (f32, Store_f32),    d_storeModeOps (f64, Store_f64),
+# else
+    { NULL },                           { NULL },
+# endif
+    d_storeModeOps (i32, Store_u8),     d_storeModeOps (i32, Store_i16),
+    d_storeModeOps (i64, Store_u8),     d_storeModeOps (i64, Store_i16),    d_storeModeOps (i64, Store_i32)
+};
+
+// Specialized addressing for the two common shapes: a constant address (global
+// data, 'i32.const X; i32.load offset=Y') folds base and offset into a single
+// immediate, and a zero offset drops the offset immediate. A base that is a
+// local is already read straight from the local's slot by the regular ops.
+static
+M3Result  TryCompileAddressMode  (IM3Compilation o, m3opcode_t i_opcode, u32 i_offset, bool * o_done)
+{
+    M3Result result = m3Err_none;
+
+    * o_done = false;
+
+    if (IsStackPolymorphic (o))
+        return result;
+
+    bool isLoad = (i_opcode < c_waOp_i32_store);
+    u16 addressDepth = isLoad ? 0 : 1;
+
+    if (GetStackTypeFromTop (o, addressDepth) != c_m3Type_i32)
+        return result;
+
+    u16 addressIndex = (u16) GetStackTopIndex (o) - addressDepth;
+    u16 addressSlot = GetSlotForStackIndex (o, addressIndex);
+    bool addressInRegister = IsStackIndexInRegister (o, addressIndex);
+    bool isConstantAddress = not addressInRegister and IsConstantSlot (o, addressSlot);
+
+    u64 address = 0;
+    if (isConstantAddress)
+    {
+        address = GetConstantSlotValue (o, addressSlot, false) + i_offset;
+        isConstantAddress = (address <= UINT32_MAX);    // otherwise the regular op raises the trap
+    }
+
+    if (not isConstantAddress and i_offset)
+        return result;
+
+    if (isLoad)
+    {
+        const IM3Operation * ops = c_loadModeOps [i_opcode - c_waOp_i32_load];
+        m3type_t type = GetOpInfo (i_opcode)->type;
+
+        if (not addressInRegister)
+_           (DisplaceRegisterIfOccupied (o, type));
+
+_       (EmitOp (o, isConstantAddress ? ops [2] : addressInRegister ? ops [0] : ops [1]));
+
+        if (isConstantAddress)
+            EmitConstant32 (o, (u32) address);
+        else if (not addressInRegister)
+            EmitSlotOffset (o, addressSlot);
+
+_       (Pop (o));
+_       (PushRegister (o, type));
+    }
+    else
+    {
+        const IM3Operation * ops = c_storeModeOps [i_opcode - c_waOp_i32_store];
+        bool valueInRegister = IsStackTopInRegister (o);
+
+        if (valueInRegister and addressInRegister)      // fp value with the address in _r0
+            return result;
+
+        IM3Operation op;
+        if (isConstantAddress)
+            op = valueInRegister ? ops [3] : ops [4];
+        else
+            op = valueInRegister ? ops [0] : addressInRegister ? ops [1] : ops [2];
+
+_       (EmitOp (o, op));
+
+        if (not valueInRegister)
+            EmitSlotOffset (o, GetStackTopSlotNumber (o));
+
+        if (isConstantAddress)
+            EmitConstant32 (o, (u32) address);
+        else if (not addressInRegister)
+            EmitSlotOffset (o, addressSlot);
+
+_       (Pop (o));
+_       (Pop (o));
+    }
+
+    * o_done = true;
+
+    _catch: return result;
+}
+
 static
 M3Result  Compile_Load_Store  (IM3Compilation o, m3opcode_t i_opcode)
 {
@@ -2968,9 +3831,15 @@ _   (ReadLEB_u32 (& memoryOffset, & o->wasm, o->wasmEnd));
     if (IsFpType (opInfo->type))
 _       (PreserveRegisterIfOccupied (o, c_m3Type_f64));
 
-_   (Compile_Operator (o, i_opcode));
+    bool done;
+_   (TryCompileAddressMode (o, i_opcode, memoryOffset, & done));
 
-    EmitConstant32 (o, memoryOffset);
+    if (not done)
+    {
+_       (Compile_Operator (o, i_opcode));
+
+        EmitConstant32 (o, memoryOffset);
+    }
 }
     _catch: return result;
 }
@@ -2984,7 +3853,7 @@ M3Result  CompileRawFunction  (IM3Module io_module,  IM3Function io_function, co
 
     if (page)
     {
-        io_function->compiled = GetPagePC (page);
+        pc_t pc = GetPagePC (page);
         io_function->module = io_module;
 
         EmitWord (page, op_CallRawFunction);
@@ -2992,6 +3861,8 @@ M3Result  CompileRawFunction  (IM3Module io_module,  IM3Function io_function, co
         EmitWord (page, io_function);
         EmitWord (page, i_userdata);
 
+        StoreCompiled (io_function, pc);
+
         ReleaseCodePage (io_module->runtime, page);
         return m3Err_none;
     }
@@ -3402,6 +4273,51 @@ IM3OpInfo  GetOpInfo  (m3opcode_t opcode)
     return (info and IsImplementedOp (info)) ? info : NULL;
 }
 
+#if d_m3HasSecondRegister
+// The value parked in _r1 must be flushed before anything can read it as a
+// slot. Pushes, and operators that don't take it as an operand, leave it alone.
+static
+M3Result  FlushExtraRegisterIfExposed  (IM3Compilation o, m3opcode_t i_opcode, IM3OpInfo i_opInfo)
+{
+    if (not IsExtraRegisterAllocated (o))
+        return m3Err_none;
+
+    if (not IsStackPolymorphic (o))
+    {
+        i32 parkedIndex = GetExtraRegisterStackIndex (o);
+        i32 stackTop = GetStackTopIndex (o);
+
+        switch (i_opcode)
+        {
+            case c_waOp_getLocal:
+            case c_waOp_i32_const:  case c_waOp_i64_const:
+            case c_waOp_f32_const:  case c_waOp_f64_const:
+                return m3Err_none;
+
+            case c_waOp_setLocal:   case c_waOp_teeLocal:
+                if (parkedIndex < stackTop)
+                    return m3Err_none;
+                break;
+        }
+
+        M3Compiler compiler = i_opInfo->compiler;
+
+        if (not compiler or compiler == Compile_Operator or compiler == Compile_Convert or compiler == Compile_Load_Store)
+        {
+            if (GetExtraRegisterOp (o, i_opcode))
+                return m3Err_none;
+
+            i32 numOperands = (i_opInfo->type != c_m3Type_none) ? 1 - i_opInfo->stackOffset : - i_opInfo->stackOffset;
+
+            if (parkedIndex <= stackTop - numOperands)
+                return m3Err_none;
+        }
+    }
+
+    return FlushExtraRegister (o);
+}
+#endif
+
 M3Result  CompileBlockStatements  (IM3Compilation o)
 {
     M3Result result = m3Err_none;
@@ -3423,6 +4339,9 @@ M3Result  CompileBlockStatements  (IM3Compilation o)
         m3opcode_t opcode;
         o->lastOpcodeStart = o->wasm;
 _       (Read_opcode (& opcode, & o->wasm, o->wasmEnd));                log_opcode (o, opcode);
+#if d_m3HasFuel
+        o->fuelCost++;
+#endif
 
         // Restrict opcodes when evaluating expressions
         if (not o->function) {
@@ -3448,6 +4367,10 @@ _       (Read_opcode (& opcode, & o->wasm, o->wasmEnd));                log_opco
         if (opinfo == NULL)
             _throw (ErrorCompile (m3Err_unknownOpcode, o, "opcode '%x' not available", opcode));
 
+# if d_m3HasSecondRegister
+_       (FlushExtraRegisterIfExposed (o, opcode, opinfo));
+# endif
+
         if (opinfo->compiler) {
 _           ((* opinfo->compiler) (o, opcode))
         } else {
@@ -3506,6 +4429,10 @@ M3Result  CompileBlock  (IM3Compilation o, IM3FuncType i_blockType, m3opcode_t i
 
     block->outer            = & outerScope;
     block->pc               = GetPagePC (o->page);
+#if d_m3Stackless
+    if (i_blockOpcode == c_waOp_loop)
+        block->pc           = o->loopHead;
+#endif
     block->patches          = NULL;
     block->type             = i_blockType;
     block->depth            ++;
@@ -3702,6 +4629,146 @@ _   (CompileBlockStatements (o));
 }
 
 
+#if d_m3HasJit
+
+// the operations the native tier can stand in for; see m3_jit.h
+#define d_m3JitOp(OP, KIND, MODE, CODE, TYPE)       { op_##OP, c_m3JitKind_##KIND, c_m3JitMode_##MODE, CODE, c_m3JitType_##TYPE }
+
+#define d_m3JitBinary(TYPE, NAME, ALU)              d_m3JitOp (TYPE##_##NAME##_rs,  binary, rs,  c_m3JitAlu_##ALU, TYPE),   \
+                                                    d_m3JitOp (TYPE##_##NAME##_ss,  binary, ss,  c_m3JitAlu_##ALU, TYPE),   \
+                                                    d_m3JitOp (TYPE##_##NAME##_ir,  binary, ir,  c_m3JitAlu_##ALU, TYPE),   \
+                                                    d_m3JitOp (TYPE##_##NAME##_is,  binary, is,  c_m3JitAlu_##ALU, TYPE),   \
+                                                    d_m3JitOp (TYPE##_##NAME##_sss, binary, sss, c_m3JitAlu_##ALU, TYPE)
+#define d_m3JitBinarySr(TYPE, NAME, ALU)            d_m3JitBinary (TYPE, NAME, ALU),                                        \
+                                                    d_m3JitOp (TYPE##_##NAME##_sr,  binary, sr,  c_m3JitAlu_##ALU, TYPE)
+
+#define d_m3JitCompare(TYPE, NAME, COND)            d_m3JitOp (TYPE##_##NAME##_rs,  compare, rs, c_m3JitCond_##COND, TYPE), \
+                                                    d_m3JitOp (TYPE##_##NAME##_ss,  compare, ss, c_m3JitCond_##COND, TYPE), \
+                                                    d_m3JitOp (TYPE##_##NAME##_ir,  compare, ir, c_m3JitCond_##COND, TYPE), \
+                                                    d_m3JitOp (TYPE##_##NAME##_is,  compare, is, c_m3JitCond_##COND, TYPE)
+#define d_m3JitCompareSr(TYPE, NAME, COND)          d_m3JitCompare (TYPE, NAME, COND),                                      \
+                                                    d_m3JitOp (TYPE##_##NAME##_sr,  compare, sr, c_m3JitCond_##COND, TYPE)
+
+#define d_m3JitBranch(TYPE, NAME, BRANCH, KIND, COND)                                                                       \
+                                                    d_m3JitOp (TYPE##_##NAME##_##BRANCH##_rs, KIND, rs, c_m3JitCond_##COND, TYPE), \
+                                                    d_m3JitOp (TYPE##_##NAME##_##BRANCH##_ss, KIND, ss, c_m3JitCond_##COND, TYPE), \
+                                                    d_m3JitOp (TYPE##_##NAME##_##BRANCH##_ir, KIND, ir, c_m3JitCond_##COND, TYPE), \
+                                                    d_m3JitOp (TYPE##_##NAME##_##BRANCH##_is, KIND, is, c_m3JitCond_##COND, TYPE)
+#define d_m3JitBranchSr(TYPE, NAME, BRANCH, KIND, COND)                                                                     \
+                                                    d_m3JitBranch (TYPE, NAME, BRANCH, KIND, COND),                         \
+                                                    d_m3JitOp (TYPE##_##NAME##_##BRANCH##_sr, KIND, sr, c_m3JitCond_##COND, TYPE)
+#define d_m3JitBranches(BRANCH, KIND)                                                                                       \
+    d_m3JitBranch   (i32, Equal, BRANCH, KIND, eq),                 d_m3JitBranch   (i64, Equal, BRANCH, KIND, eq),                 \
+    d_m3JitBranch   (i32, NotEqual, BRANCH, KIND, ne),              d_m3JitBranch   (i64, NotEqual, BRANCH, KIND, ne),              \
+    d_m3JitBranchSr (i32, LessThan, BRANCH, KIND, lt),              d_m3JitBranchSr (i64, LessThan, BRANCH, KIND, lt),              \
+    d_m3JitBranchSr (i32, GreaterThan, BRANCH, KIND, gt),           d_m3JitBranchSr (i64, GreaterThan, BRANCH, KIND, gt),           \
+    d_m3JitBranchSr (i32, LessThanOrEqual, BRANCH, KIND, le),       d_m3JitBranchSr (i64, LessThanOrEqual, BRANCH, KIND, le),       \
+    d_m3JitBranchSr (i32, GreaterThanOrEqual, BRANCH, KIND, ge),    d_m3JitBranchSr (i64, GreaterThanOrEqual, BRANCH, KIND, ge),    \
+    d_m3JitBranchSr (u32, LessThan, BRANCH, KIND, lt),              d_m3JitBranchSr (u64, LessThan, BRANCH, KIND, lt),              \
+    d_m3JitBranchSr (u32, GreaterThan, BRANCH, KIND, gt),           d_m3JitBranchSr (u64, GreaterThan, BRANCH, KIND, gt),           \
+    d_m3JitBranchSr (u32, LessThanOrEqual, BRANCH, KIND, le),       d_m3JitBranchSr (u64, LessThanOrEqual, BRANCH, KIND, le),       \
+    d_m3JitBranchSr (u32, GreaterThanOrEqual, BRANCH, KIND, ge),    d_m3JitBranchSr (u64, GreaterThanOrEqual, BRANCH, KIND, ge),    \
+    d_m3JitOp (i32_EqualToZero_##BRANCH##_r, KIND, r, c_m3JitCond_eq, i32),  d_m3JitOp (i64_EqualToZero_##BRANCH##_r, KIND, r, c_m3JitCond_eq, i64), \
+    d_m3JitOp (i32_EqualToZero_##BRANCH##_s, KIND, s, c_m3JitCond_eq, i32),  d_m3JitOp (i64_EqualToZero_##BRANCH##_s, KIND, s, c_m3JitCond_eq, i64)
+
+// loads: the code is the width read from memory, the type what _r0 holds
+#define d_m3JitLoad(DEST, SRC)                      d_m3JitOp (DEST##_Load_##SRC##_r,  load, r,  c_m3JitType_##SRC, DEST),  \
+                                                    d_m3JitOp (DEST##_Load_##SRC##_s,  load, s,  c_m3JitType_##SRC, DEST),  \
+                                                    d_m3JitOp (DEST##_Load_##SRC##_rz, load, rz, c_m3JitType_##SRC, DEST),  \
+                                                    d_m3JitOp (DEST##_Load_##SRC##_sz, load, sz, c_m3JitType_##SRC, DEST),  \
+                                                    d_m3JitOp (DEST##_Load_##SRC##_i,  load, i,  c_m3JitType_##SRC, DEST)
+
+// stores: the code is the width written to memory, the type that of the value
+#define d_m3JitStore(SRC, DEST)                     d_m3JitOp (SRC##_Store_##DEST##_rs,  store, rs,  c_m3JitType_##DEST, SRC), \
+                                                    d_m3JitOp (SRC##_Store_##DEST##_sr,  store, sr,  c_m3JitType_##DEST, SRC), \
+                                                    d_m3JitOp (SRC##_Store_##DEST##_ss,  store, ss,  c_m3JitType_##DEST, SRC), \
+                                                    d_m3JitOp (SRC##_Store_##DEST##_rsz, store, rsz, c_m3JitType_##DEST, SRC), \
+                                                    d_m3JitOp (SRC##_Store_##DEST##_srz, store, srz, c_m3JitType_##DEST, SRC), \
+                                                    d_m3JitOp (SRC##_Store_##DEST##_ssz, store, ssz, c_m3JitType_##DEST, SRC), \
+                                                    d_m3JitOp (SRC##_Store_##DEST##_ri,  store, ri,  c_m3JitType_##DEST, SRC), \
+                                                    d_m3JitOp (SRC##_Store_##DEST##_si,  store, si,  c_m3JitType_##DEST, SRC)
+
+static const M3JitOp c_jitOps [] =
+{
+    d_m3JitBinary   (i32, Add, add),                d_m3JitBinary   (i64, Add, add),
+    d_m3JitBinarySr (i32, Subtract, sub),           d_m3JitBinarySr (i64, Subtract, sub),
+    d_m3JitBinary   (i32, Multiply, mul),           d_m3JitBinary   (i64, Multiply, mul),
+    d_m3JitBinary   (u32, And, and),                d_m3JitBinary   (u64, And, and),
+    d_m3JitBinary   (u32, Or, or),                  d_m3JitBinary   (u64, Or, or),
+    d_m3JitBinary   (u32, Xor, xor),                d_m3JitBinary   (u64, Xor, xor),
+    d_m3JitBinarySr (u32, ShiftLeft, shl),          d_m3JitBinarySr (u64, ShiftLeft, shl),
+    d_m3JitBinarySr (i32, ShiftRight, shr),         d_m3JitBinarySr (i64, ShiftRight, shr),
+    d_m3JitBinarySr (u32, ShiftRight, shr),         d_m3JitBinarySr (u64, ShiftRight, shr),
+
+    d_m3JitCompare   (i32, Equal, eq),              d_m3JitCompare   (i64, Equal, eq),
+    d_m3JitCompare   (i32, NotEqual, ne),           d_m3JitCompare   (i64, NotEqual, ne),
+    d_m3JitCompareSr (i32, LessThan, lt),           d_m3JitCompareSr (i64, LessThan, lt),
+    d_m3JitCompareSr (i32, GreaterThan, gt),        d_m3JitCompareSr (i64, GreaterThan, gt),
+    d_m3JitCompareSr (i32, LessThanOrEqual, le),    d_m3JitCompareSr (i64, LessThanOrEqual, le),
+    d_m3JitCompareSr (i32, GreaterThanOrEqual, ge), d_m3JitCompareSr (i64, GreaterThanOrEqual, ge),
+    d_m3JitCompareSr (u32, LessThan, lt),           d_m3JitCompareSr (u64, LessThan, lt),
+    d_m3JitCompareSr (u32, GreaterThan, gt),        d_m3JitCompareSr (u64, GreaterThan, gt),
+    d_m3JitCompareSr (u32, LessThanOrEqual, le),    d_m3JitCompareSr (u64, LessThanOrEqual, le),
+    d_m3JitCompareSr (u32, GreaterThanOrEqual, ge), d_m3JitCompareSr (u64, GreaterThanOrEqual, ge),
+
+    d_m3JitOp (i32_EqualToZero_r, compare, r, c_m3JitCond_eq, i32),     d_m3JitOp (i64_EqualToZero_r, compare, r, c_m3JitCond_eq, i64),
+    d_m3JitOp (i32_EqualToZero_s, compare, s, c_m3JitCond_eq, i32),     d_m3JitOp (i64_EqualToZero_s, compare, s, c_m3JitCond_eq, i64),
+
+# if d_m3FuseCompareBranch
+    d_m3JitBranches (BranchIf, branchIf),
+    d_m3JitBranches (ContinueLoopIf, loopIf),
+# endif
+
+    d_m3JitOp (BranchIf_r,          branchIf, r, c_m3JitCond_ne, i32),  d_m3JitOp (BranchIf_s,          branchIf, s, c_m3JitCond_ne, i32),
+    d_m3JitOp (If_r,                branchIf, r, c_m3JitCond_eq, i32),  d_m3JitOp (If_s,                branchIf, s, c_m3JitCond_eq, i32),
+    d_m3JitOp (BranchIfPrologue_r,  branchIf, r, c_m3JitCond_eq, i32),  d_m3JitOp (BranchIfPrologue_s,  branchIf, s, c_m3JitCond_eq, i32),
+    d_m3JitOp (ContinueLoopIf,      loopIf,   r, c_m3JitCond_ne, i32),
+
+    d_m3JitOp (i64_Extend_i32_r,    extend, r, 0, i32),                 d_m3JitOp (i64_Extend_i32_s,    extend, s, 0, i32),
+    d_m3JitOp (i64_Extend_u32_r,    extend, r, 0, u32),                 d_m3JitOp (i64_Extend_u32_s,    extend, s, 0, u32),
+    d_m3JitOp (i32_Wrap_i64_r,      extend, r, 0, u32),                 d_m3JitOp (i32_Wrap_i64_s,      extend, s, 0, u32),
+
+    d_m3JitLoad (i32, i8),  d_m3JitLoad (i32, u8),  d_m3JitLoad (i32, i16), d_m3JitLoad (i32, u16), d_m3JitLoad (i32, i32),
+    d_m3JitLoad (i64, i8),  d_m3JitLoad (i64, u8),  d_m3JitLoad (i64, i16), d_m3JitLoad (i64, u16), d_m3JitLoad (i64, i32),
+    d_m3JitLoad (i64, u32), d_m3JitLoad (i64, i64),
+
+    d_m3JitStore (i32, u8), d_m3JitStore (i32, i16), d_m3JitStore (i32, i32),
+    d_m3JitStore (i64, u8), d_m3JitStore (i64, i16), d_m3JitStore (i64, i32), d_m3JitStore (i64, i64),
+
+    d_m3JitOp (SetRegister_i32,     setRegister, none, 0, i32),         d_m3JitOp (SetRegister_i64,     setRegister, none, 0, i64),
+    d_m3JitOp (SetSlot_i32,         setSlot, none, 0, i32),             d_m3JitOp (SetSlot_i64,         setSlot, none, 0, i64),
+    d_m3JitOp (PreserveSetSlot_i32, preserveSetSlot, none, 0, i32),     d_m3JitOp (PreserveSetSlot_i64, preserveSetSlot, none, 0, i64),
+    d_m3JitOp (CopySlot_32,         copySlot, none, 0, u32),            d_m3JitOp (CopySlot_64,         copySlot, none, 0, u64),
+    d_m3JitOp (PreserveCopySlot_32, preserveCopySlot, none, 0, u32),    d_m3JitOp (PreserveCopySlot_64, preserveCopySlot, none, 0, u64),
+    d_m3JitOp (Const32,             const, none, 0, u32),               d_m3JitOp (Const64,             const, none, 0, u64),
+
+    d_m3JitOp (GetGlobal_s32,       getGlobal, none, 0, u32),           d_m3JitOp (GetGlobal_s64,       getGlobal, none, 0, u64),
+    d_m3JitOp (SetGlobal_i32,       setGlobal, r, 0, u32),              d_m3JitOp (SetGlobal_i64,       setGlobal, r, 0, u64),
+    d_m3JitOp (SetGlobal_s32,       setGlobal, s, 0, u32),              d_m3JitOp (SetGlobal_s64,       setGlobal, s, 0, u64),
+
+    d_m3JitOp (Branch,              branch, none, 0, i32),
+    d_m3JitOp (ContinueLoop,        continueLoop, none, 0, i32),
+# if !d_m3Stackless
+    // a stackless return pops its frame, which is left to op_Return
+    d_m3JitOp (Return,              return, none, 0, i32),
+    d_m3JitOp (End,                 return, none, 0, i32),
+# endif
+};
+
+
+static
+void  JitCompileOperations  (IM3Runtime io_runtime, pc_t * i_opStarts, u32 i_numOpStarts)
+{
+    if (not io_runtime->jit)
+        io_runtime->jit = NewJitArena (c_jitOps, M3_COUNT_OF (c_jitOps));
+
+    if (io_runtime->jit)
+        JitCompileFunction (io_runtime->jit, i_opStarts, i_numOpStarts);
+}
+
+#endif // d_m3HasJit
+
+
 M3Result  CompileFunction  (IM3Function io_function)
 {
     if (!io_function->wasm)
@@ -3713,6 +4780,23 @@ M3Result  CompileFunction  (IM3Function io_function)
         return io_function->compiled ? m3Err_none : "function body is missing";
     }
 
+    IM3Runtime runtime = io_function->module->runtime;
+
+#if d_m3HasBackgroundCompile
+    if (runtime->compiler)
+        return ClaimAndCompileFunction (runtime, io_function);
+#endif
+
+    return CompileFunctionInto (runtime, io_function, NULL, NULL);
+}
+
+
+// Compiles into io_runtime's code pages and compilation state, which need not be the
+// module's runtime. With io_deferredCalls, calls into the module are left unbound and
+// recorded there, so that nothing is read from functions being compiled concurrently.
+// With io_pointerSites, every emitted word that holds a pointer is recorded there.
+M3Result  CompileFunctionInto  (IM3Runtime io_runtime, IM3Function io_function, M3CodeSites * io_deferredCalls, M3CodeSites * io_pointerSites)
+{
 #if d_m3EnableValidation
     M3Result vr = ValidateFunction(io_function);
     if (vr) return vr;
@@ -3720,9 +4804,20 @@ M3Result  CompileFunction  (IM3Function io_function)
 
     IM3FuncType funcType = io_function->funcType;                   m3log (compile, "compiling: [%d] %s %s; wasm-size: %d",
                                                                         io_function->index, m3_GetFunctionName (io_function), SPrintFuncTypeSignature (funcType), (u32) (io_function->wasmEnd - io_function->wasm));
-    IM3Runtime runtime = io_function->module->runtime;
+    IM3Runtime runtime = io_runtime;
 
     IM3Compilation o = & runtime->compilation;                      d_m3Assert (d_m3MaxFunctionSlots >= d_m3MaxFunctionStackHeight * (d_m3Use32BitSlots + 1))  // need twice as many slots in 32-bit mode
+
+    // a call being compiled can resolve an import that needs compiling first; the call's
+    // compilation is set aside meanwhile, and put back where it was, for the scopes pointing into it
+    IM3Compilation outer = NULL;
+    if (o->function)
+    {
+        outer = m3_CopyMem (o, sizeof (M3Compilation));
+        if (not outer)
+            return m3Err_mallocFailed;
+    }
+
     memset (o, 0x0, sizeof (M3Compilation));
 
     o->runtime  = runtime;
@@ -3731,8 +4826,19 @@ M3Result  CompileFunction  (IM3Function io_function)
     o->wasm     = io_function->wasm;
     o->wasmEnd  = io_function->wasmEnd;
     o->block.type = funcType;
+    o->deferredCalls = io_deferredCalls;
+    o->pointerSites = io_pointerSites;
 
 _try {
+#if d_m3HasJit
+    // with a hotness, the operations are kept until the function is promoted
+    if (runtime->jitEnabled and (not runtime->jitHotness or not o->module->codeIsShared))
+    {
+        o->maxJitOpStarts = 256;
+        o->jitOpStarts = m3_AllocArray (pc_t, o->maxJitOpStarts);
+    }
+#endif
+
     // skip over code size. the end was already calculated during parse phase
     u32 size;
 _   (ReadLEB_u32 (& size, & o->wasm, o->wasmEnd));                  d_m3Assert (size == (o->wasmEnd - o->wasm))
@@ -3786,8 +4892,10 @@ _   (CompileBlockStatements (o));
     // TODO: validate opcode sequences
     _throwif(m3Err_wasmMalformed, o->previousOpcode != c_waOp_end);
 
-    io_function->compiled = pc;
     io_function->maxStackSlots = o->maxStackSlots;
+#if d_m3HasFuel
+    io_function->fuelCost = o->fuelCost;
+#endif
 
     u16 numConstantSlots = o->slotMaxConstIndex - o->slotFirstConstIndex;                           m3log (compile, "unique constant slots: %u; unused slots: %u",
                                                                                                            numConstantSlots, o->slotFirstDynamicIndex - o->slotMaxConstIndex);
@@ -3799,9 +4907,204 @@ _   (CompileBlockStatements (o));
         _throwifnull(io_function->constants);
     }
 
+#if d_m3HasJit
+    // shared code is never promoted: other runtimes may be running it
+    io_function->hotness = (runtime->jitEnabled and not o->module->codeIsShared) ? runtime->jitHotness : 0;
+
+    if (o->jitOpStarts)
+    {
+        if (io_function->hotness)
+        {
+            io_function->jitOpStarts = o->jitOpStarts;
+            io_function->numJitOpStarts = o->numJitOpStarts;
+            o->jitOpStarts = NULL;
+        }
+        else JitCompileOperations (runtime, o->jitOpStarts, o->numJitOpStarts);
+    }
+#endif
+
+    StoreCompiled (io_function, pc);
+
 } _catch:
 
+#if d_m3HasJit
+    m3_Free (o->jitOpStarts);
+#endif
+
     ReleaseCompilationCodePage (o);
 
+    if (outer)
+    {
+        memcpy (o, outer, sizeof (M3Compilation));
+        m3_Free (outer);
+    }
+    else o->function = NULL;
+
     return result;
 }
+
+
+#if d_m3HasJit
+// Turns a function that has run hot native. Its metacode is patched where it stands:
+// each run the JIT takes on starts with the native code instead, so callers bound to
+// it, and frames already running in it, pick that up from the next run they reach.
+// Metacode loaded from a code cache has no operations recorded and is recompiled
+// instead; callers get there through its op_Entry, which becomes a branch to the new
+// one. Returns whether the function's code moved.
+bool  PromoteFunction  (IM3Function io_function)
+{
+    IM3Runtime runtime = io_function->module->runtime;
+
+    if (io_function->jitOpStarts)
+    {
+        JitCompileOperations (runtime, io_function->jitOpStarts, io_function->numJitOpStarts);
+
+        m3_Free (io_function->jitOpStarts);
+        io_function->numJitOpStarts = 0;
+
+        return false;
+    }
+
+    M3Function baseline = * io_function;
+
+    u32 hotness = runtime->jitHotness;
+    runtime->jitHotness = 0;
+    M3Result result = CompileFunctionInto (runtime, io_function, NULL, NULL);
+    runtime->jitHotness = hotness;
+
+    if (result)
+    {
+        if (io_function->constants != baseline.constants)
+            m3_Free (io_function->constants);
+
+        * io_function = baseline;
+        io_function->hotness = 0;                                   m3log (compile, "promotion failed: %s", result);
+        return false;
+    }
+
+    m3_Free (baseline.constants);
+
+    void ** entry = (void **) baseline.compiled;
+    entry [1] = (void *) io_function->compiled;
+    entry [0] = (void *) op_Branch;
+
+    return true;
+}
+#endif
+
+
+// Binds the recorded call sites to their callees' metacode. A callee that failed to
+// compile keeps its op_Compile and gets another chance on its first call.
+void  ResolveDeferredCalls  (M3CodeSites * io_deferredCalls)
+{
+    for (u32 i = 0; i < io_deferredCalls->numSites; ++i)
+    {
+        void ** site = (void **) io_deferredCalls->sites [i];
+        IM3Function function = (IM3Function) site [1];
+        pc_t compiled = LoadCompiled (function);
+
+        if (compiled)
+        {
+            site [0] = (site [0] == (void *) op_CompileReturnCall) ? (void *) op_ReturnCall : (void *) op_Call;
+            site [1] = (void *) compiled;
+        }
+    }
+}
+
+
+static
+void  AddOperations  (IM3Operation * o_operations, u32 i_maxOperations, u32 * io_numOperations, const IM3Operation * i_operations, u32 i_count)
+{
+    for (u32 i = 0; i < i_count; ++i)
+    {
+        if (i_operations [i])
+        {
+            if (* io_numOperations < i_maxOperations)
+                o_operations [* io_numOperations] = i_operations [i];
+
+            ++(* io_numOperations);
+        }
+    }
+}
+
+#define d_addOperations(OPS, COUNT)     AddOperations (o_operations, i_maxOperations, & numOperations, (OPS), (COUNT))
+#define d_addOperationTable(TABLE)      d_addOperations ((const IM3Operation *) (TABLE), sizeof (TABLE) / sizeof (IM3Operation))
+
+// Every operation the compiler can emit, in an order fixed for the build; the code cache
+// stores operations as indices into it. Some appear more than once. Returns the count,
+// of which at most i_maxOperations are written.
+u32  ListOperations  (IM3Operation * o_operations, u32 i_maxOperations)
+{
+    u32 numOperations = 0;
+
+    static const IM3Operation c_namedOps [] =
+    {
+        op_Entry,                   op_Branch,                  op_Return,                  op_Unreachable,
+        op_Call,                    op_ReturnCall,              op_Compile,                 op_CompileReturnCall,
+        op_CallIndirect,            op_ReturnCallIndirect,      op_CallRef,                 op_ReturnCallRef,
+        op_CallRawFunction,         op_RefAsNonNull,            op_RefFuncShared,
+        op_Loop,                    op_ContinueLoop,            op_ContinueLoopIf,          op_BranchTable,
+        op_If_r,                    op_If_s,                    op_BranchIf_r,              op_BranchIf_s,
+        op_BranchIfPrologue_r,      op_BranchIfPrologue_s,
+        op_Const32,                 op_Const64,
+        op_CopySlot_32,             op_CopySlot_64,             op_PreserveCopySlot_32,     op_PreserveCopySlot_64,
+        op_GetGlobal_s32,           op_GetGlobal_s64,           op_SetGlobal_s32,           op_SetGlobal_s64,
+        op_MemSize,                 op_MemGrow,                 op_MemCopy,                 op_MemFill,
+        op_MemInit,                 op_DataDrop,
+        op_CallIndirectShared,      op_ReturnCallIndirectShared,
+        op_GetGlobalShared_s32,     op_GetGlobalShared_s64,     op_SetGlobalShared_s32,     op_SetGlobalShared_s64,
+        op_MemInitShared,           op_DataDropShared,
+# if d_m3HasRefTypes
+        op_TableGet,                op_TableSet,                op_TableSize,               op_TableGrow,
+        op_TableFill,               op_TableCopy,               op_TableInit,               op_ElemDrop,
+        op_TableGetShared,          op_TableSetShared,          op_TableSizeShared,         op_TableGrowShared,
+        op_TableFillShared,         op_TableCopyShared,         op_TableInitShared,         op_ElemDropShared,
+# endif
+# if d_m3HasSecondRegister
+        op_MoveToExtraRegister,     op_SetSlotFromExtra_i32,    op_SetSlotFromExtra_i64,
+# endif
+# if d_m3EnableOpTracing
+        op_DumpStack,
+# endif
+    };
+
+    d_addOperationTable (c_namedOps);
+
+    for (u32 i = 0; i < c_numOperations; ++i)
+        d_addOperations (c_operations [i].operations, 4);
+
+    for (u32 i = 0; i < c_numOperationsFC; ++i)
+        d_addOperations (c_operationsFC [i].operations, 4);
+
+    d_addOperationTable (c_preserveSetSlot);
+    d_addOperationTable (c_setSetOps);
+    d_addOperationTable (c_setGlobalOps);
+    d_addOperationTable (c_setGlobalSharedOps);
+    d_addOperationTable (c_setRegisterOps);
+    d_addOperationTable (c_intSelectOps);
+# if d_m3HasFloat
+    d_addOperationTable (c_fpSelectOps);
+# endif
+    d_addOperationTable (c_threeAddressOps);
+    d_addOperationTable (c_loadModeOps);
+    d_addOperationTable (c_storeModeOps);
+
+    for (u32 i = 0; i < M3_COUNT_OF (c_immediateOps); ++i)
+        d_addOperations (c_immediateOps [i].operations, 2);
+
+# if d_m3HasSecondRegister
+    d_addOperationTable (c_extraRegisterOps);
+# endif
+
+# if d_m3FuseCompareBranch
+    for (u32 i = 0; i < 2; ++i)
+    {
+        for (u32 j = 0; j < 10; ++j)
+            d_addOperationTable (c_fusedCompares [i] [j].operations);
+    }
+
+    d_addOperationTable (c_fusedEqualToZero);
+# endif
+
+    return numOperations;
+}
@@ -39,6 +39,8 @@ enum
     c_waOp_tableGet             = 0x25,
     c_waOp_tableSet             = 0x26,
 
+    c_waOp_i32_load             = 0x28,
+    c_waOp_i32_store            = 0x36,
     c_waOp_store_f32            = 0x38,
     c_waOp_store_f64            = 0x39,
 
@@ -47,6 +49,12 @@ enum
     c_waOp_f32_const            = 0x43,
     c_waOp_f64_const            = 0x44,
 
+    c_waOp_i32_eqz              = 0x45,
+    c_waOp_i32_eq               = 0x46,
+    c_waOp_i64_eqz              = 0x50,
+    c_waOp_i64_eq               = 0x51,
+    c_waOp_i64_geu              = 0x5a,
+
     // the arithmetic the extended-const proposal admits into constant expressions
     c_waOp_i32_add              = 0x6a,
     c_waOp_i32_sub              = 0x6b,
@@ -55,6 +63,14 @@ enum
     c_waOp_i64_sub              = 0x7d,
     c_waOp_i64_mul              = 0x7e,
 
+    c_waOp_i32_divs             = 0x6d,
+    c_waOp_i32_divu             = 0x6e,
+    c_waOp_i32_rems             = 0x6f,
+    c_waOp_i32_remu             = 0x70,
+    c_waOp_i32_and              = 0x71,
+    c_waOp_i32_shl              = 0x74,
+    c_waOp_i32_shru             = 0x76,
+
     c_waOp_refNull              = 0xd0,
     c_waOp_refIsNull            = 0xd1,
     c_waOp_refFunc              = 0xd2,
@@ -102,6 +118,18 @@ M3CompilationScope;
 
 typedef M3CompilationScope *        IM3CompilationScope;
 
+// Words of emitted code to revisit once compilation is done: the calls into the module
+// left as op_Compile / op_CompileReturnCall while their callees are compiled elsewhere,
+// or, for the code cache, every word holding a pointer
+typedef struct M3CodeSites
+{
+    pc_t *                          sites;
+    u32                             numSites;
+    u32                             maxSites;
+    bool                            isIncomplete;       // a site couldn't be recorded
+}
+M3CodeSites;
+
 typedef struct
 {
     IM3Runtime          runtime;
@@ -134,6 +162,13 @@ typedef struct
 
     u16                 maxStackSlots;
 
+#if d_m3HasFuel
+    u32                 fuelCost;                   // operations so far in the innermost loop, or outside any
+#endif
+#if d_m3Stackless
+    pc_t                loopHead;                   // the op_Loop of the loop about to be compiled, its continues' target
+#endif
+
     m3slot_t            constants                   [d_m3MaxConstantTableSize];
 
     // 'wasmStack' holds slot locations
@@ -146,9 +181,19 @@ typedef struct
     u16                 slotMaxAllocatedIndexPlusOne;
 
     u16                 regStackIndexPlusOne        [2];
+    u16                 extraRegStackIndexPlusOne;  // the stack entry parked in _r1 (d_m3HasSecondRegister)
 
     m3opcode_t          previousOpcode;
 
+#if d_m3HasJit
+    pc_t *              jitOpStarts;                // where each operation of the function was emitted, when the runtime has the JIT on
+    u32                 numJitOpStarts;
+    u32                 maxJitOpStarts;
+#endif
+
+    M3CodeSites *       deferredCalls;              // set while compiling in parallel; calls into the module are bound afterwards
+    M3CodeSites *       pointerSites;               // set while compiling for the code cache; its relocations
+
     bool                isInitExpr;                 // walking a constant expression, not a function body
 }
 M3Compilation;
@@ -241,6 +286,15 @@ M3Result    CompileBlock                (IM3Compilation io, IM3FuncType i_blockT
 M3Result    CompileBlockStatements      (IM3Compilation io);
 M3Result    CompileExpression           (IM3Compilation io, IM3FuncType i_resultType);
 M3Result    CompileFunction             (IM3Function io_function);
+M3Result    CompileFunctionInto         (IM3Runtime io_runtime, IM3Function io_function, M3CodeSites * io_deferredCalls, M3CodeSites * io_pointerSites);
+M3Result    ResolveImportedFunction     (IM3Function io_function);
+void        ResolveDeferredCalls        (M3CodeSites * io_deferredCalls);
+
+u32         ListOperations              (IM3Operation * o_operations, u32 i_maxOperations);
+
+#if d_m3HasJit
+bool        PromoteFunction             (IM3Function io_function);
+#endif
 
 M3Result    CompileRawFunction          (IM3Module io_module, IM3Function io_function, const void * i_function, const void * i_userdata);
 
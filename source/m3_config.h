@@ -48,12 +48,20 @@
 #   define d_m3CascadedOpcodes                  1       // Adds ~3Kb to operations table in m3_compile.c
 # endif
 
+# ifndef d_m3FuseCompareBranch                         // Fuse integer compares with the br_if that follows them
+#   define d_m3FuseCompareBranch                1       // adds ~200 operations to the interpreter
+# endif
+
+# ifndef d_m3HasSecondRegister                         // Pass a second integer register (_r1) through every operation, so a
+#   define d_m3HasSecondRegister                0       // value displaced from _r0 can wait there instead of in a slot
+# endif
+
 # ifndef d_m3VerboseErrorMessages
 #   define d_m3VerboseErrorMessages             1
 # endif
 
 # ifndef d_m3FixedHeap
-#   define d_m3FixedHeap                        false
+#   define d_m3FixedHeap                        0
 //# define d_m3FixedHeap                        (32*1024)
 # endif
 
@@ -77,11 +85,27 @@
 #   define d_m3EnableExceptionBreakpoint        0       // see m3_exception.h
 # endif
 
+// Calls push a return frame at the end of the m3 stack and jump to the callee, instead of
+// calling it natively, and loops jump back to their head, instead of having op_Loop call
+// the body each iteration. The native stack stays the same depth however deep the Wasm
+// calls go, so recursion is bounded by the m3 stack alone, and interpreter threads get by
+// on small stacks. That takes tail-called dispatch, which is checked for below.
+# ifndef d_m3Stackless
+#   define d_m3Stackless                        0
+# endif
+
+// without tail-called dispatch each op nests in the last, so the native stack would grow
+// with every loop iteration; force d_m3CanTailCall where the compiler is known to sibling-call
+# if d_m3Stackless && !M3_GUARANTEED_TAIL_CALL && !(defined(d_m3CanTailCall) && d_m3CanTailCall)
+#   error "d_m3Stackless needs guaranteed tail calls (musttail), or -Dd_m3CanTailCall=1 with an optimised build"
+# endif
+
 // Backtraces and structured traces need op_Entry to still be around when the function
 // body returns, so it can't tail-call into it.  Everywhere else it can, which keeps the
 // native stack flat across calls -- and is what makes return_call actually iterative.
+// Stackless calls don't return to op_Entry; their backtraces come from the return frames.
 # ifndef d_m3EntryKeepsFrame
-#   define d_m3EntryKeepsFrame                  (d_m3RecordBacktraces || (d_m3EnableStrace >= 2))
+#   define d_m3EntryKeepsFrame                  (!d_m3Stackless && (d_m3RecordBacktraces || (d_m3EnableStrace >= 2)))
 # endif
 
 // Whether return_call/return_call_indirect can reuse the caller's frame.  Reusing it stops
@@ -214,6 +238,172 @@
 #   define d_m3SkipMemoryBoundsCheck            0       // skip memory bounds checks
 # endif
 
+# ifndef d_m3UseGuardPages
+                                                        // reserve the whole addressable range of linear memory behind
+                                                        // inaccessible guard pages, and let the MMU catch out-of-bounds
+                                                        // loads and stores instead of checking each one. 64-bit POSIX only
+#   define d_m3UseGuardPages                    0
+# endif
+
+# ifndef d_m3UseMemoryReservation
+                                                        // keep linear memory in reserved address space, so memory.grow commits
+                                                        // pages in place instead of reallocating and copying the whole memory
+#   if d_m3UseGuardPages || (M3_SIZEOF_PTR == 8 && (defined(__unix__) || defined(__APPLE__) || defined(_WIN32)))
+#     define d_m3UseMemoryReservation           1
+#   else
+#     define d_m3UseMemoryReservation           0
+#   endif
+# endif
+
+# ifndef d_m3HasJit
+                                                        // native code for straight-line integer metacode, selected per runtime with
+                                                        // m3_EnableJit. x86-64 System V only, and only with the plain op signature
+#   if defined(__x86_64__) && !defined(__ILP32__) && defined(__linux__) && \
+       !d_m3EnableOpProfiling && !d_m3EnableOpTracing && !d_m3EnableStrace && !d_m3LogNativeStack
+#     define d_m3HasJit                         1
+#   else
+#     define d_m3HasJit                         0
+#   endif
+# endif
+
+# ifndef d_m3JitHotness
+#   define d_m3JitHotness                       1000    // function entries plus loop iterations before a function is promoted to native code
+# endif
+
+# ifndef d_m3HasParallelCompile
+                                                        // m3_CompileModuleParallel spreads a module's functions over POSIX threads,
+                                                        // each with its own code pages. Without it that call compiles serially
+#   if (defined(__unix__) || defined(__APPLE__)) && !defined(__wasi__) && (!defined(d_m3FixedHeap) || !d_m3FixedHeap)
+#     define d_m3HasParallelCompile             1
+#   else
+#     define d_m3HasParallelCompile             0
+#   endif
+# endif
+
+# ifndef d_m3HasBackgroundCompile
+                                                        // m3_EnableBackgroundCompile: a thread that compiles the callees named by
+                                                        // op_Compile ahead of their first call. Needs the GCC atomic builtins
+#   if d_m3HasParallelCompile && defined(__GNUC__)
+#     define d_m3HasBackgroundCompile           1
+#   else
+#     define d_m3HasBackgroundCompile           0
+#   endif
+# endif
+
+# ifndef d_m3HasCodeCache
+                                                        // m3_SaveCompiledModule and m3_LoadCompiledModule: compiled code kept in a file
+#   if (defined(__unix__) || defined(__APPLE__) || defined(_WIN32) || defined(__wasi__)) && (!defined(d_m3FixedHeap) || !d_m3FixedHeap)
+#     define d_m3HasCodeCache                   1
+#   else
+#     define d_m3HasCodeCache                   0
+#   endif
+# endif
+
+# ifndef d_m3HasMemoryImages
+                                                        // m3_NewSnapshot keeps linear memory in an anonymous file that forks map
+                                                        // copy-on-write; without it, each fork copies the snapshot's memory
+#   if d_m3UseMemoryReservation && defined(__linux__)
+#     define d_m3HasMemoryImages                1
+#   else
+#     define d_m3HasMemoryImages                0
+#   endif
+# endif
+
+# ifndef d_m3HasCheckpoints
+                                                        // m3_Checkpoint: linear memory write-protected, so that restoring copies
+                                                        // back just the pages written since. Catches the writes with a signal handler
+#   if d_m3UseMemoryReservation && (defined(__unix__) || defined(__APPLE__)) && !defined(__wasi__) && (!defined(d_m3FixedHeap) || !d_m3FixedHeap)
+#     define d_m3HasCheckpoints                 1
+#   else
+#     define d_m3HasCheckpoints                 0
+#   endif
+# endif
+
+# ifndef d_m3MaxCheckpoints
+#   define d_m3MaxCheckpoints                   64      // runtimes holding a checkpoint at once, process-wide
+# endif
+
+# ifndef d_m3HasPool
+                                                        // m3_NewPool: runtimes forked from a snapshot, handed out lock-free and reset
+                                                        // on release. Needs the GCC atomic builtins
+#   if defined(__GNUC__) && (!defined(d_m3FixedHeap) || !d_m3FixedHeap)
+#     define d_m3HasPool                        1
+#   else
+#     define d_m3HasPool                        0
+#   endif
+# endif
+
+# ifndef d_m3HasFuel
+                                                        // m3_SetFuel: function entries and loop iterations are charged the wasm
+                                                        // operations in them, and a call that runs out of fuel traps
+#   define d_m3HasFuel                          1
+# endif
+
+# ifndef d_m3HasEpochs
+                                                        // m3_IncrementEpoch: function entries and loop iterations check the runtime's
+                                                        // epoch against its deadline, so another thread can stop a call. Needs the
+                                                        // GCC atomic builtins on 64-bit values, which a bare-metal 32-bit target
+                                                        // may only have from libatomic; so hosted targets only, like the threads
+#   if defined(__GNUC__) && (defined(__unix__) || defined(__APPLE__) || defined(_WIN32)) && !defined(__wasi__) && (!defined(d_m3FixedHeap) || !d_m3FixedHeap)
+#     define d_m3HasEpochs                      1
+#   else
+#     define d_m3HasEpochs                      0
+#   endif
+# endif
+
+# ifndef d_m3HasSuspend
+                                                        // m3_EnableSuspend: outermost calls run on a native stack of their own, so
+                                                        // that a host function can suspend one and m3_Resume carry on with it later.
+                                                        // Needs ucontext
+#   if defined(__linux__) && !defined(__ANDROID__) && (!defined(d_m3FixedHeap) || !d_m3FixedHeap)
+#     define d_m3HasSuspend                     1
+#   else
+#     define d_m3HasSuspend                     0
+#   endif
+# endif
+
+# ifndef d_m3SuspendStackSize
+#   if d_m3MaxNativeStack > 0
+#     define d_m3SuspendStackSize               (d_m3MaxNativeStack + 256 * 1024)   // the native stack each suspendable runtime keeps
+#   else
+#     define d_m3SuspendStackSize               (8 * 1024 * 1024)
+#   endif
+# endif
+
+# ifndef d_m3HasScheduler
+                                                        // m3_NewScheduler: worker threads running the calls scheduled on runtimes,
+                                                        // which they steal from each other's queues. Calls are time-sliced where the
+                                                        // build has fuel and suspension. Needs POSIX threads and GCC atomic builtins
+#   if d_m3HasParallelCompile && defined(__GNUC__)
+#     define d_m3HasScheduler                   1
+#   else
+#     define d_m3HasScheduler                   0
+#   endif
+# endif
+
+# ifndef d_m3HasConcurrentEnvironment
+                                                        // one environment parsed into from several threads at once: function types
+                                                        // are interned without a lock and released code pages kept in shards, each
+                                                        // behind its own spin lock. Needs GCC atomic builtins
+#   if d_m3HasParallelCompile && defined(__GNUC__)
+#     define d_m3HasConcurrentEnvironment       1
+#   else
+#     define d_m3HasConcurrentEnvironment       0
+#   endif
+# endif
+
+# ifndef d_m3CodePageShards
+#   if d_m3HasConcurrentEnvironment
+#     define d_m3CodePageShards                 8       // released code page lists in an environment; a runtime starts at its own
+#   else
+#     define d_m3CodePageShards                 1
+#   endif
+# endif
+
+# ifndef d_m3CompileThreadStackSize
+#   define d_m3CompileThreadStackSize           (8 * 1024 * 1024)   // native stack for each compiling thread; block nesting recurses
+# endif
+
 #define d_m3EnableCodePageRefCounting           0       // not supported currently
 
 #endif // m3_config_h
@@ -161,6 +161,494 @@ void *  m3_CopyMem  (const void * i_from, size_t i_size)
     return ptr;
 }
 
+#if d_m3UseMemoryReservation
+
+#if defined(_WIN32)
+#   include <windows.h>
+#else
+#   include <sys/mman.h>
+#   include <unistd.h>
+#endif
+
+#if d_m3UseGuardPages || d_m3HasCheckpoints
+static bool  InstallFaultHandler  (void);
+#endif
+
+size_t  m3_GetSystemPageSize  (void)
+{
+    static size_t pageSize = 0;
+
+    if (not pageSize)
+    {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo (& info);
+        pageSize = (size_t) info.dwPageSize;
+#else
+        pageSize = (size_t) sysconf (_SC_PAGESIZE);
+#endif
+    }
+
+    return pageSize;
+}
+
+void *  m3_ReserveMemory  (size_t i_size)
+{
+#if d_m3UseGuardPages
+    if (not InstallFaultHandler ())
+        return NULL;
+#endif
+
+#if defined(_WIN32)
+    return VirtualAlloc (NULL, i_size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    void * ptr = mmap (NULL, i_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    return (ptr == MAP_FAILED) ? NULL : ptr;
+#endif
+}
+
+bool  m3_CommitMemory  (void * i_ptr, size_t i_size)
+{
+#if defined(_WIN32)
+    return (VirtualAlloc (i_ptr, i_size, MEM_COMMIT, PAGE_READWRITE) != NULL);
+#else
+    return (mprotect (i_ptr, i_size, PROT_READ | PROT_WRITE) == 0);
+#endif
+}
+
+void  m3_DecommitMemory  (void * i_ptr, size_t i_size)
+{
+#if defined(_WIN32)
+    VirtualFree (i_ptr, i_size, MEM_DECOMMIT);
+#else
+    // a fresh mapping in place drops the pages, whatever they were mapped from
+    mmap (i_ptr, i_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+}
+
+void  m3_ReleaseMemory  (void * i_ptr, size_t i_size)
+{
+#if defined(_WIN32)
+    VirtualFree (i_ptr, 0, MEM_RELEASE);
+#else
+    munmap (i_ptr, i_size);
+#endif
+}
+
+#if d_m3HasMemoryImages
+
+#include <sys/syscall.h>
+
+int  m3_NewMemoryImage  (const void * i_bytes, size_t i_size)
+{
+    // memfd_create itself needs _GNU_SOURCE; 1 is MFD_CLOEXEC
+    int image = (int) syscall (SYS_memfd_create, "wasm3-memory", 1u);
+
+    if (image >= 0)
+    {
+        const u8 * bytes = (const u8 *) i_bytes;
+        size_t numWritten = 0;
+
+        if (ftruncate (image, (off_t) i_size) == 0)
+        {
+            while (numWritten < i_size)
+            {
+                ssize_t n = pwrite (image, bytes + numWritten, i_size - numWritten, (off_t) numWritten);
+                if (n <= 0)
+                    break;
+
+                numWritten += (size_t) n;
+            }
+        }
+
+        if (numWritten < i_size)
+        {
+            close (image);
+            image = -1;
+        }
+    }
+
+    return image;
+}
+
+bool  m3_MapMemoryImage  (void * i_ptr, size_t i_size, int i_image)
+{
+    return (mmap (i_ptr, i_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, i_image, 0) != MAP_FAILED);
+}
+
+void  m3_FreeMemoryImage  (int i_image)
+{
+    close (i_image);
+}
+
+#endif // d_m3HasMemoryImages
+
+#endif // d_m3UseMemoryReservation
+
+
+#if d_m3UseGuardPages || d_m3HasCheckpoints
+
+# if d_m3UseGuardPages && (M3_SIZEOF_PTR != 8 || !(defined(__unix__) || defined(__APPLE__)))
+#   error "d_m3UseGuardPages needs a 64-bit POSIX target"
+# endif
+
+#include <signal.h>
+
+#if d_m3UseGuardPages
+static __thread M3GuardFrame *  s_guardFrame = NULL;
+#endif
+
+#if d_m3HasCheckpoints
+static bool  HandleWriteFault  (const u8 * i_address);
+#endif
+
+static struct sigaction         s_previousSegv;
+static struct sigaction         s_previousBus;
+
+static
+void  FaultHandler  (int i_signal, siginfo_t * i_info, void * i_context)
+{
+    const u8 * address = (const u8 *) i_info->si_addr;
+
+#if d_m3HasCheckpoints
+    // the write goes through when the faulting instruction reruns
+    if (HandleWriteFault (address))
+        return;
+#endif
+
+#if d_m3UseGuardPages
+    M3GuardFrame * frame = s_guardFrame;
+
+    if (frame and address >= frame->reservedStart and address < frame->reservedEnd)
+    {
+        s_guardFrame = frame->previous;
+        siglongjmp (frame->jump, 1);
+    }
+#endif
+
+    // not a linear memory access; hand the fault to whoever had it before us
+    struct sigaction * previous = (i_signal == SIGBUS) ? & s_previousBus : & s_previousSegv;
+
+    if (previous->sa_flags & SA_SIGINFO)
+        previous->sa_sigaction (i_signal, i_info, i_context);
+    else if (previous->sa_handler == SIG_DFL or previous->sa_handler == SIG_IGN)
+        sigaction (i_signal, previous, NULL);   // the faulting instruction reruns under the old action
+    else
+        previous->sa_handler (i_signal);
+}
+
+static
+bool  InstallFaultHandler  (void)
+{
+    static int state = 0;   // 0: not installed, 1: installing, 2: installed
+
+    if (__atomic_load_n (& state, __ATOMIC_ACQUIRE) == 2)
+        return true;
+
+    int expected = 0;
+    if (__atomic_compare_exchange_n (& state, & expected, 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        struct sigaction action;
+        memset (& action, 0, sizeof (action));
+        action.sa_sigaction = FaultHandler;
+        // SA_NODEFER: the handler leaves through siglongjmp without restoring the signal mask
+        action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+        sigemptyset (& action.sa_mask);
+
+        bool installed = (sigaction (SIGSEGV, & action, & s_previousSegv) == 0 and
+                          sigaction (SIGBUS,  & action, & s_previousBus) == 0);
+
+        __atomic_store_n (& state, installed ? 2 : 0, __ATOMIC_RELEASE);
+        return installed;
+    }
+
+    while (__atomic_load_n (& state, __ATOMIC_ACQUIRE) == 1) {}
+
+    return (__atomic_load_n (& state, __ATOMIC_ACQUIRE) == 2);
+}
+
+#if d_m3UseGuardPages
+
+void  m3_PushGuardFrame  (M3GuardFrame * io_frame, const void * i_reserved, size_t i_numReservedBytes)
+{
+    io_frame->previous      = s_guardFrame;
+    io_frame->reservedStart = (const u8 *) i_reserved;
+    io_frame->reservedEnd   = (const u8 *) i_reserved + i_numReservedBytes;
+
+    s_guardFrame = io_frame;
+}
+
+void  m3_PopGuardFrame  (M3GuardFrame * io_frame)
+{
+    s_guardFrame = io_frame->previous;
+}
+
+#endif // d_m3UseGuardPages
+
+#if d_m3HasCheckpoints
+
+// The fault handler looks trackers up here rather than through their runtimes, so
+// that a slot it reads is never freed under it
+static M3WriteTracker           s_writeTrackers [d_m3MaxCheckpoints];
+
+static inline
+bool  IsPageDirty  (M3WriteTracker * i_tracker, size_t i_page)
+{
+    return __atomic_load_n (& i_tracker->dirty [i_page / 8], __ATOMIC_ACQUIRE) & (1 << (i_page % 8));
+}
+
+// Called from the fault handler: nothing here may allocate or lock. Threads writing
+// the same page at once all fault on it, and only the first to claim it copies it;
+// the rest wait for the copy, since the page can't be writable before it's made.
+static
+void  SavePage  (M3WriteTracker * io_tracker, size_t i_page)
+{
+    size_t pageSize = m3_GetSystemPageSize ();
+    size_t offset = i_page * pageSize;
+    u8 bit = (u8) (1 << (i_page % 8));
+
+    if (not IsPageDirty (io_tracker, i_page))
+    {
+        if (not (__atomic_fetch_or (& io_tracker->claimed [i_page / 8], bit, __ATOMIC_ACQ_REL) & bit))
+        {
+            memcpy (io_tracker->saved + offset, io_tracker->start + offset, pageSize);
+            __atomic_fetch_or (& io_tracker->dirty [i_page / 8], bit, __ATOMIC_RELEASE);
+        }
+        else while (not IsPageDirty (io_tracker, i_page)) {}
+    }
+
+    mprotect (io_tracker->start + offset, pageSize, PROT_READ | PROT_WRITE);
+}
+
+static
+bool  HandleWriteFault  (const u8 * i_address)
+{
+    for (u32 i = 0; i < d_m3MaxCheckpoints; ++i)
+    {
+        M3WriteTracker * tracker = & s_writeTrackers [i];
+        u8 * start = __atomic_load_n (& tracker->start, __ATOMIC_ACQUIRE);
+
+        if (start and i_address >= start and i_address < start + tracker->numBytes)
+        {
+            SavePage (tracker, (size_t) (i_address - start) / m3_GetSystemPageSize ());
+            return true;
+        }
+    }
+
+    return false;
+}
+
+M3WriteTracker *  m3_TrackWrites  (void * i_start, size_t i_numBytes)
+{
+    if (not InstallFaultHandler ())
+        return NULL;
+
+    M3WriteTracker * tracker = NULL;
+
+    for (u32 i = 0; i < d_m3MaxCheckpoints and not tracker; ++i)
+    {
+        bool expected = false;
+        if (__atomic_compare_exchange_n (& s_writeTrackers [i].inUse, & expected, true, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            tracker = & s_writeTrackers [i];
+    }
+
+    if (tracker)
+    {
+        size_t numPages = i_numBytes / m3_GetSystemPageSize ();
+
+        // the copies are only made as pages are first written, so most of this is never touched
+        void * saved = i_numBytes ? mmap (NULL, i_numBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) : NULL;
+
+        tracker->saved = (saved == MAP_FAILED) ? NULL : (u8 *) saved;
+        tracker->dirty = m3_AllocArray (u8, numPages / 8 + 1);
+        tracker->claimed = m3_AllocArray (u8, numPages / 8 + 1);
+        tracker->numBytes = i_numBytes;
+
+        if ((i_numBytes and not tracker->saved) or not tracker->dirty or not tracker->claimed or
+            (i_numBytes and mprotect (i_start, i_numBytes, PROT_READ) != 0))
+        {
+            m3_StopTrackingWrites (tracker);
+            return NULL;
+        }
+
+        __atomic_store_n (& tracker->start, (u8 *) i_start, __ATOMIC_RELEASE);
+    }
+
+    return tracker;
+}
+
+void  m3_MarkWritten  (M3WriteTracker * io_tracker, void * i_ptr, size_t i_size)
+{
+    u8 * ptr = (u8 *) i_ptr;
+
+    if (i_size and ptr < io_tracker->start + io_tracker->numBytes and ptr + i_size > io_tracker->start)
+    {
+        size_t pageSize = m3_GetSystemPageSize ();
+
+        size_t first = (size_t) (M3_MAX (ptr, io_tracker->start) - io_tracker->start) / pageSize;
+        size_t end = (size_t) (M3_MIN (ptr + i_size, io_tracker->start + io_tracker->numBytes) - io_tracker->start + pageSize - 1) / pageSize;
+
+        for (size_t page = first; page < end; ++page)
+        {
+            if (not IsPageDirty (io_tracker, page))
+                SavePage (io_tracker, page);
+        }
+    }
+}
+
+void  m3_RestoreWrites  (M3WriteTracker * io_tracker)
+{
+    size_t pageSize = m3_GetSystemPageSize ();
+    size_t numPages = io_tracker->numBytes / pageSize;
+
+    for (size_t page = 0; page < numPages; ++page)
+    {
+        if (IsPageDirty (io_tracker, page))
+        {
+            size_t offset = page * pageSize;
+
+            memcpy (io_tracker->start + offset, io_tracker->saved + offset, pageSize);
+            mprotect (io_tracker->start + offset, pageSize, PROT_READ);
+        }
+    }
+
+    memset (io_tracker->dirty, 0, numPages / 8 + 1);
+    memset (io_tracker->claimed, 0, numPages / 8 + 1);
+}
+
+void  m3_StopTrackingWrites  (M3WriteTracker * io_tracker)
+{
+    if (io_tracker)
+    {
+        u8 * start = io_tracker->start;
+        __atomic_store_n (& io_tracker->start, NULL, __ATOMIC_RELEASE);
+
+        if (start and io_tracker->numBytes)
+            mprotect (start, io_tracker->numBytes, PROT_READ | PROT_WRITE);
+
+        if (io_tracker->saved)
+            munmap (io_tracker->saved, io_tracker->numBytes);
+
+        m3_Free (io_tracker->dirty);
+        m3_Free (io_tracker->claimed);
+
+        io_tracker->saved = NULL;
+        io_tracker->numBytes = 0;
+
+        __atomic_store_n (& io_tracker->inUse, false, __ATOMIC_RELEASE);
+    }
+}
+
+#endif // d_m3HasCheckpoints
+
+#endif // d_m3UseGuardPages || d_m3HasCheckpoints
+
+
+#if d_m3HasSuspend
+
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct M3Fiber
+{
+    ucontext_t              context;        // the fiber's own, while it's away
+    ucontext_t              caller;         // where it was last entered from
+
+    u8 *                    stack;          // with an inaccessible page at the bottom
+    size_t                  numStackBytes;
+
+    void                 (* main) (void *);
+    void *                  arg;
+
+#if d_m3UseGuardPages
+    M3GuardFrame *          guardFrame;     // the fiber's guard frames, kept off the thread's while it's away
+#endif
+}
+M3Fiber;
+
+static __thread M3Fiber *       s_startingFiber;
+
+static
+void  StartFiber  (void)
+{
+    M3Fiber * fiber = s_startingFiber;
+    fiber->main (fiber->arg);
+}
+
+static
+bool  MakeFiberContext  (M3Fiber * io_fiber)
+{
+    if (getcontext (& io_fiber->context))
+        return false;
+
+    io_fiber->context.uc_stack.ss_sp = io_fiber->stack;
+    io_fiber->context.uc_stack.ss_size = io_fiber->numStackBytes;
+    io_fiber->context.uc_link = NULL;
+    makecontext (& io_fiber->context, StartFiber, 0);
+
+    return true;
+}
+
+M3Fiber *  m3_NewFiber  (size_t i_numStackBytes, void (* i_main) (void *), void * i_arg)
+{
+    M3Fiber * fiber = m3_AllocStruct (M3Fiber);
+
+    if (fiber)
+    {
+        size_t pageSize = (size_t) sysconf (_SC_PAGESIZE);
+        fiber->numStackBytes = ((i_numStackBytes + pageSize - 1) & ~(pageSize - 1)) + pageSize;
+        fiber->main = i_main;
+        fiber->arg = i_arg;
+
+        void * stack = mmap (NULL, fiber->numStackBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        fiber->stack = (u8 *) stack;
+
+        if (stack == MAP_FAILED or mprotect (stack, pageSize, PROT_NONE) != 0 or not MakeFiberContext (fiber))
+        {
+            if (stack != MAP_FAILED)
+                munmap (stack, fiber->numStackBytes);
+
+            m3_Free (fiber);
+        }
+    }
+
+    return fiber;
+}
+
+void  m3_FreeFiber  (M3Fiber * i_fiber)
+{
+    if (i_fiber)
+    {
+        munmap (i_fiber->stack, i_fiber->numStackBytes);
+        m3_Free (i_fiber);
+    }
+}
+
+void  m3_EnterFiber  (M3Fiber * io_fiber)
+{
+    s_startingFiber = io_fiber;     // for StartFiber, the first time
+#if d_m3UseGuardPages
+    M3GuardFrame * threadFrame = s_guardFrame;
+    s_guardFrame = io_fiber->guardFrame;
+#endif
+
+    swapcontext (& io_fiber->caller, & io_fiber->context);
+
+#if d_m3UseGuardPages
+    io_fiber->guardFrame = s_guardFrame;
+    s_guardFrame = threadFrame;
+#endif
+}
+
+void  m3_LeaveFiber  (M3Fiber * io_fiber)
+{
+    swapcontext (& io_fiber->context, & io_fiber->caller);
+}
+
+#endif // d_m3HasSuspend
+
 //--------------------------------------------------------------------------------------------
 
 #if d_m3LogNativeStack
@@ -142,6 +142,27 @@ typedef struct M3MemoryHeader
 }
 M3MemoryHeader;
 
+#if d_m3Stackless
+// What a stackless call leaves for the callee's return: frames stack down from the end of
+// the m3 stack, and the memory header's maxStack is the innermost, so that op_Entry's
+// overflow check keeps slots and frames apart.
+typedef struct M3CallFrame
+{
+    pc_t            pc;             // where the caller carries on; NULL returns from RunCode
+    m3stack_t       sp;
+#if d_m3RecordBacktraces
+    struct M3Function * function;   // the callee, once its op_Entry has run
+#endif
+}
+M3CallFrame;
+
+#   if d_m3RecordBacktraces
+#       define d_m3SetFrameFunction(FRAME, FUNCTION)    (FRAME)->function = (FUNCTION)
+#   else
+#       define d_m3SetFrameFunction(FRAME, FUNCTION)    do {} while (0)
+#   endif
+#endif
+
 struct M3CodeMappingPage;
 
 typedef struct M3CodePageHeader
@@ -171,8 +192,7 @@ M3CodePageHeader;
 // a heap type index has to fit in the spare bits of an m3type_t, see below
 #  define d_m3MaxSaneTypesCount             8190
 #else
-// M3Environment.numFuncTypes is the u16 that hands out M3FuncType.canonicalIndex,
-// so the count has to stay below 65536 here as well
+// M3FuncType.canonicalIndex is a u16, so the count has to stay below 65536 here as well
 #  define d_m3MaxSaneTypesCount             65500
 #endif
 #define d_m3MaxSaneFunctionsCount           1000000
@@ -257,6 +277,75 @@ void *      m3_Realloc_Impl         (void * i_ptr, size_t i_newSize, size_t i_ol
 void        m3_Free_Impl            (void * i_ptr);
 void *      m3_CopyMem              (const void * i_from, size_t i_size);
 
+#if d_m3UseMemoryReservation
+// Linear memory lives in address space that is reserved inaccessible up front
+// and committed as it grows, so it never has to move while it fits.
+size_t      m3_GetSystemPageSize    (void);
+void *      m3_ReserveMemory        (size_t i_size);
+bool        m3_CommitMemory         (void * i_ptr, size_t i_size);
+void        m3_DecommitMemory       (void * i_ptr, size_t i_size);      // back to reserved; zeroed when committed again
+void        m3_ReleaseMemory        (void * i_ptr, size_t i_size);
+#endif
+
+#if d_m3HasMemoryImages
+// An image is an anonymous file holding a copy of linear memory. Mapping it privately over
+// committed memory shares its pages until they're written. Returns -1 when it can't be made.
+int         m3_NewMemoryImage       (const void * i_bytes, size_t i_size);
+bool        m3_MapMemoryImage       (void * i_ptr, size_t i_size, int i_image);
+void        m3_FreeMemoryImage      (int i_image);
+#endif
+
+#if d_m3UseGuardPages
+#include <setjmp.h>
+
+// A fault inside the reservation recorded by the innermost M3GuardFrame of the
+// faulting thread long-jumps back to the frame's owner.
+typedef struct M3GuardFrame
+{
+    struct M3GuardFrame *   previous;
+    const u8 *              reservedStart;
+    const u8 *              reservedEnd;
+    sigjmp_buf              jump;
+}
+M3GuardFrame;
+
+void        m3_PushGuardFrame       (M3GuardFrame * io_frame, const void * i_reserved, size_t i_numReservedBytes);
+void        m3_PopGuardFrame        (M3GuardFrame * io_frame);
+#endif
+
+#if d_m3HasSuspend
+// A native stack to run code on, and switch away from partway through. The first entry
+// calls i_main, which must never return; each later one carries on where the fiber left.
+// It may be entered from a different thread than the one it last left.
+struct M3Fiber;
+
+struct M3Fiber *    m3_NewFiber             (size_t i_numStackBytes, void (* i_main) (void *), void * i_arg);
+void                m3_FreeFiber            (struct M3Fiber * i_fiber);
+void                m3_EnterFiber           (struct M3Fiber * io_fiber);    // returns once the fiber leaves
+void                m3_LeaveFiber           (struct M3Fiber * io_fiber);    // from the fiber; returns once it's entered again
+#endif
+
+#if d_m3HasCheckpoints
+// A tracked range is read-only until written. The first write to each page faults, and the
+// handler saves the page as it was and lets the write through; restoring copies back just
+// those pages. The range mustn't move or shrink while tracked.
+typedef struct M3WriteTracker
+{
+    u8 *                    start;          // NULL while not tracking
+    size_t                  numBytes;       // whole OS pages
+    u8 *                    saved;          // pages as they were before their first write, at the same offsets
+    u8 *                    dirty;          // a bit for each page written since tracking began, or the last restore
+    u8 *                    claimed;        // a bit for each page whose saving a thread has taken on
+    bool                    inUse;
+}
+M3WriteTracker;
+
+M3WriteTracker *    m3_TrackWrites          (void * i_start, size_t i_numBytes);    // NULL when it can't
+void                m3_MarkWritten          (M3WriteTracker * io_tracker, void * i_ptr, size_t i_size);
+void                m3_RestoreWrites        (M3WriteTracker * io_tracker);
+void                m3_StopTrackingWrites   (M3WriteTracker * io_tracker);
+#endif
+
 #if d_m3LogHeapOps
 
 // Tracing format: timestamp;heap:OpCode;name;size(bytes);new items;new ptr;old items;old ptr
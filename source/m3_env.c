@@ -9,9 +9,16 @@
 #include <limits.h>
 
 #include "m3_env.h"
+#include "m3_bind.h"
 #include "m3_compile.h"
 #include "m3_exception.h"
 #include "m3_info.h"
+#include "m3_jit.h"
+
+#if d_m3HasParallelCompile
+#   include <pthread.h>
+#   include <unistd.h>
+#endif
 
 
 IM3Environment  m3_NewEnvironment  ()
@@ -65,8 +72,22 @@ void  Environment_Release  (IM3Environment i_environment)
         ftype = next;
     }
 
-    m3log (runtime, "freeing %d pages from environment", CountCodePages (i_environment->pagesReleased));
-    FreeCodePages (& i_environment->pagesReleased);
+    M3FuncTypeTable * table = i_environment->funcTypeTable;
+
+    while (table)
+    {
+        M3FuncTypeTable * replaced = table->replaced;
+        m3_Free (table);
+        table = replaced;
+    }
+
+    for (u32 i = 0; i < d_m3CodePageShards; ++i)
+    {
+        M3CodePageShard * shard = & i_environment->pagesReleased [i];
+
+        m3log (runtime, "freeing %d pages from environment", CountCodePages (shard->pages));
+        FreeCodePages (& shard->pages);
+    }
 }
 
 
@@ -86,42 +107,167 @@ void m3_SetCustomSectionHandler  (IM3Environment i_environment, M3SectionHandler
 }
 
 
-// returns the same io_funcType or replaces it with an equivalent that's already in the type linked list
-M3Result  Environment_AddFuncType  (IM3Environment i_environment, IM3FuncType * io_funcType)
+#if d_m3HasConcurrentEnvironment
+
+static inline
+void  SpinLock  (u32 * io_lock)
 {
-    IM3FuncType addType = * io_funcType;
-    IM3FuncType newType = i_environment->funcTypes;
+    while (__atomic_exchange_n (io_lock, 1, __ATOMIC_ACQUIRE))
+    {
+        while (__atomic_load_n (io_lock, __ATOMIC_RELAXED)) {}
+    }
+}
+
+static inline
+void  SpinUnlock  (u32 * io_lock)
+{
+    __atomic_store_n (io_lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline void  LockFuncTypes      (IM3Environment io_environment)     { SpinLock (& io_environment->funcTypesLock); }
+static inline void  UnlockFuncTypes    (IM3Environment io_environment)     { SpinUnlock (& io_environment->funcTypesLock); }
+static inline void  LockPageShard      (M3CodePageShard * io_shard)        { SpinLock (& io_shard->lock); }
+static inline void  UnlockPageShard    (M3CodePageShard * io_shard)        { SpinUnlock (& io_shard->lock); }
+
+// a type is written out before it goes in a slot, and a table before it's published
+#   define d_m3LoadShared(PTR)                  __atomic_load_n (PTR, __ATOMIC_ACQUIRE)
+#   define d_m3StoreShared(PTR, VALUE)          __atomic_store_n (PTR, VALUE, __ATOMIC_RELEASE)
+
+#else
+
+static inline void  LockFuncTypes      (IM3Environment io_environment)     {}
+static inline void  UnlockFuncTypes    (IM3Environment io_environment)     {}
+static inline void  LockPageShard      (M3CodePageShard * io_shard)        {}
+static inline void  UnlockPageShard    (M3CodePageShard * io_shard)        {}
+
+#   define d_m3LoadShared(PTR)                  (* (PTR))
+#   define d_m3StoreShared(PTR, VALUE)          (* (PTR) = (VALUE))
+
+#endif // d_m3HasConcurrentEnvironment
+
+
+static
+u32  HashFuncType  (const IM3FuncType i_funcType)
+{
+    // FNV-1a over the counts and then the types
+    u32 hash = 0x811c9dc5;
+    hash = (hash ^ i_funcType->numRets) * 0x01000193;
+    hash = (hash ^ i_funcType->numArgs) * 0x01000193;
+
+    const u8 * bytes = (const u8 *) i_funcType->types;
+    u32 numBytes = (i_funcType->numRets + i_funcType->numArgs) * sizeof (m3type_t);
 
-    while (newType)
+    for (u32 i = 0; i < numBytes; ++i)
+        hash = (hash ^ bytes [i]) * 0x01000193;
+
+    return hash;
+}
+
+
+static
+IM3FuncType  FindFuncType  (const M3FuncTypeTable * i_table, const IM3FuncType i_funcType)
+{
+    if (i_table)
     {
-        if (AreFuncTypesEqual (newType, addType))
+        u32 h = i_funcType->hash & i_table->mask;
+        IM3FuncType type;
+
+        while ((type = d_m3LoadShared (& i_table->slots [h])))
         {
-            m3_Free (addType);
-            break;
-        }
+            if (type->hash == i_funcType->hash and AreFuncTypesEqual (type, i_funcType))
+                return type;
 
-        newType = newType->next;
+            h = (h + 1) & i_table->mask;
+        }
     }
 
-    if (newType == NULL)
+    return NULL;
+}
+
+
+static
+void  InsertFuncType  (M3FuncTypeTable * io_table, IM3FuncType i_funcType)
+{
+    u32 h = i_funcType->hash & io_table->mask;
+
+    while (io_table->slots [h])
+        h = (h + 1) & io_table->mask;
+
+    d_m3StoreShared (& io_table->slots [h], i_funcType);
+}
+
+
+// doubles the table, keeping the one it replaces for lookups that may still be reading it
+static
+M3Result  GrowFuncTypeTable  (IM3Environment io_environment)
+{
+    M3FuncTypeTable * table = io_environment->funcTypeTable;
+    u32 size = table ? (table->mask + 1) * 2 : 64;
+
+    M3FuncTypeTable * grown = (M3FuncTypeTable *) m3_Malloc ("M3FuncTypeTable", sizeof (M3FuncTypeTable) + size * sizeof (IM3FuncType));
+    if (not grown)
+        return m3Err_mallocFailed;
+
+    grown->replaced = table;
+    grown->mask = size - 1;
+
+    for (IM3FuncType type = io_environment->funcTypes; type; type = type->next)
+        InsertFuncType (grown, type);
+
+    d_m3StoreShared (& io_environment->funcTypeTable, grown);
+
+    return m3Err_none;
+}
+
+
+// returns the same io_funcType or replaces it with an equivalent that's already in the environment.
+// types are never taken out, so a lookup goes without the lock that adding one takes
+M3Result  Environment_AddFuncType  (IM3Environment i_environment, IM3FuncType * io_funcType)
+{
+    M3Result result = m3Err_none;
+
+    IM3FuncType addType = * io_funcType;
+    addType->hash = HashFuncType (addType);
+
+    IM3FuncType type = FindFuncType (d_m3LoadShared (& i_environment->funcTypeTable), addType);
+
+    if (not type)
     {
-        // a type index has to fit in the heap type field of an m3type_t
-        if (i_environment->numFuncTypes >= d_m3MaxSaneTypesCount)
+        LockFuncTypes (i_environment);
+
+        // it may have gone in since
+        type = FindFuncType (i_environment->funcTypeTable, addType);
+
+        if (not type)
         {
-            m3_Free (addType);
-            * io_funcType = NULL;
-            return "too many distinct function types";
+            M3FuncTypeTable * table = i_environment->funcTypeTable;
+
+            // a type index has to fit in the heap type field of an m3type_t
+            if (i_environment->numFuncTypes >= d_m3MaxSaneTypesCount)
+                result = "too many distinct function types";
+            else if (not table or (i_environment->numFuncTypes + 1u) * 2 > table->mask + 1)
+                result = GrowFuncTypeTable (i_environment);
+
+            if (not result)
+            {
+                type = addType;
+                type->canonicalIndex = i_environment->numFuncTypes++;
+                type->next = i_environment->funcTypes;
+                i_environment->funcTypes = type;
+
+                InsertFuncType (i_environment->funcTypeTable, type);
+            }
         }
 
-        newType = addType;
-        newType->canonicalIndex = i_environment->numFuncTypes++;
-        newType->next = i_environment->funcTypes;
-        i_environment->funcTypes = newType;
+        UnlockFuncTypes (i_environment);
     }
 
-    * io_funcType = newType;
+    if (type != addType)
+        m3_Free (addType);
 
-    return m3Err_none;
+    * io_funcType = type;
+
+    return result;
 }
 
 
@@ -151,13 +297,33 @@ IM3CodePage RemoveCodePageOfCapacity (M3CodePage ** io_list, u32 i_minimumLineCo
 }
 
 
-IM3CodePage  Environment_AcquireCodePage (IM3Environment i_environment, u32 i_minimumLineCount)
+// spreads the runtimes over the released page shards
+static inline
+u32  PageShardOf  (IM3Runtime i_runtime)
+{
+    return (u32) (((uintptr_t) i_runtime >> 4) * 0x9E3779B1u >> 16) % d_m3CodePageShards;
+}
+
+
+// looks in the runtime's own shard first, then in the others
+IM3CodePage  Environment_AcquireCodePage (IM3Environment i_environment, u32 i_shard, u32 i_minimumLineCount)
 {
-    return RemoveCodePageOfCapacity (& i_environment->pagesReleased, i_minimumLineCount);
+    IM3CodePage page = NULL;
+
+    for (u32 i = 0; i < d_m3CodePageShards and not page; ++i)
+    {
+        M3CodePageShard * shard = & i_environment->pagesReleased [(i_shard + i) % d_m3CodePageShards];
+
+        LockPageShard (shard);
+        page = RemoveCodePageOfCapacity (& shard->pages, i_minimumLineCount);
+        UnlockPageShard (shard);
+    }
+
+    return page;
 }
 
 
-void  Environment_ReleaseCodePages  (IM3Environment i_environment, IM3CodePage i_codePageList)
+void  Environment_ReleaseCodePages  (IM3Environment i_environment, u32 i_shard, IM3CodePage i_codePageList)
 {
     IM3CodePage end = i_codePageList;
 
@@ -177,9 +343,13 @@ void  Environment_ReleaseCodePages  (IM3Environment i_environment, IM3CodePage i
 
     if (end)
     {
+        M3CodePageShard * shard = & i_environment->pagesReleased [i_shard];
+
         // push list to front
-        end->info.next = i_environment->pagesReleased;
-        i_environment->pagesReleased = i_codePageList;
+        LockPageShard (shard);
+        end->info.next = shard->pages;
+        shard->pages = i_codePageList;
+        UnlockPageShard (shard);
     }
 }
 
@@ -201,6 +371,15 @@ IM3Runtime  m3_NewRuntime  (IM3Environment i_environment, u32 i_stackSizeInBytes
         {
             runtime->stack = runtime->originStack;
             runtime->numStackSlots = i_stackSizeInBytes / sizeof (m3slot_t);         m3log (runtime, "new stack: %p, slots: %u", runtime->originStack, runtime->numStackSlots);
+#if d_m3HasJit
+            runtime->jitHotness = d_m3JitHotness;
+#endif
+#if d_m3HasFuel
+            runtime->fuel = INT64_MAX;
+#endif
+#if d_m3HasEpochs
+            runtime->epochDeadline = UINT64_MAX;
+#endif
         }
         else m3_Free (runtime);
     }
@@ -243,13 +422,31 @@ void *  _FreeModule  (IM3Module i_module, void * i_info)
 
 void  Runtime_Release  (IM3Runtime i_runtime)
 {
+#if d_m3HasBackgroundCompile
+    m3_EnableBackgroundCompile (i_runtime, false);
+#endif
+#if d_m3HasCheckpoints
+    m3_DropCheckpoint (i_runtime);
+#endif
+#if d_m3HasSuspend
+    m3_EnableSuspend (i_runtime, false);
+#endif
+
     ForEachModule (i_runtime, _FreeModule, NULL);                   d_m3Assert (i_runtime->numActiveCodePages == 0);
 
-    Environment_ReleaseCodePages (i_runtime->environment, i_runtime->pagesOpen);
-    Environment_ReleaseCodePages (i_runtime->environment, i_runtime->pagesFull);
+    Environment_ReleaseCodePages (i_runtime->environment, PageShardOf (i_runtime), i_runtime->pagesOpen);
+    Environment_ReleaseCodePages (i_runtime->environment, PageShardOf (i_runtime), i_runtime->pagesFull);
 
     m3_Free (i_runtime->originStack);
+#if d_m3HasJit
+    FreeJitArena (i_runtime->jit);
+#endif
+#if d_m3UseMemoryReservation
+    if (i_runtime->memory.reserved)
+        m3_ReleaseMemory (i_runtime->memory.reserved, i_runtime->memory.numReservedBytes);
+#else
     m3_Free (i_runtime->memory.mallocated);
+#endif
 }
 
 
@@ -353,6 +550,11 @@ M3Result  InitMemory  (IM3Runtime io_runtime, IM3Module i_module)
         u32 maxPages = i_module->memoryInfo.maxPages;
         u32 pageSize = i_module->memoryInfo.pageSize ? i_module->memoryInfo.pageSize : d_m3DefaultMemPageSize;
 
+#if d_m3UseGuardPages
+        // the end of memory has to land on an OS page boundary for the guard to catch the first byte past it
+        _throwif ("guard-page memory needs pages sized in whole OS pages", pageSize % m3_GetSystemPageSize ());
+#endif
+
         io_runtime->memory.pageSize = pageSize;
 
         // Without a declared maximum a memory may grow to the spec limit of
@@ -363,12 +565,104 @@ M3Result  InitMemory  (IM3Runtime io_runtime, IM3Module i_module)
         io_runtime->memory.maxPages = maxPages ? maxPages
                                     : (u32) M3_MIN (pageLimit, 0xFFFFFFFFull);
 
-        result = ResizeMemory (io_runtime, i_module->memoryInfo.initPages);
+_       (ResizeMemory (io_runtime, i_module->memoryInfo.initPages));
     }
 
-    return result;
+    _catch: return result;
+}
+
+
+#if d_m3UseMemoryReservation
+
+#if d_m3UseGuardPages
+// A u32 address plus a u32 offset reaches just under 8 GiB, so that much (and a
+// page of slack for the access width) is reserved behind every linear memory.
+static const u64 c_m3GuardedMemoryRange = (2ull << 32) + 65536;
+#endif
+
+static inline
+u64  AlignToPage  (u64 i_size, size_t i_pageSize)
+{
+    return (i_size + i_pageSize - 1) & ~ (u64) (i_pageSize - 1);
+}
+
+// Linear memory grows in place inside its reservation and only moves, once, when
+// it outgrows it. The header sits at the tail of the first OS page so that the
+// memory itself starts page-aligned.
+static
+M3Result  CommitReservedMemory  (IM3Runtime io_runtime, u64 i_numBytes)
+{
+    M3Result result = m3Err_none;
+
+    M3Memory * memory = & io_runtime->memory;
+    size_t osPageSize = m3_GetSystemPageSize ();
+
+    u64 numBytesNeeded = osPageSize + AlignToPage (i_numBytes, osPageSize);
+    _throwif ("linear memory limitation exceeded", numBytesNeeded > (u64) SIZE_MAX);
+
+    if (numBytesNeeded > memory->numReservedBytes)
+    {
+#if d_m3UseGuardPages
+        u64 numReservedBytes = osPageSize + c_m3GuardedMemoryRange;
+#else
+        u64 reservation = io_runtime->memoryReservation;
+
+        if (not reservation)
+        {
+            reservation = (u64) memory->maxPages * memory->pageSize;
+# if d_m3MaxLinearMemoryPages > 0
+            reservation = M3_MIN (reservation, (u64) d_m3MaxLinearMemoryPages * d_m3DefaultMemPageSize);
+# endif
+            if (io_runtime->memoryLimit)
+                reservation = M3_MIN (reservation, (u64) io_runtime->memoryLimit);
+        }
+
+        u64 numReservedBytes = M3_MAX (numBytesNeeded, osPageSize + AlignToPage (reservation, osPageSize));
+        numReservedBytes = M3_MIN (numReservedBytes, (u64) SIZE_MAX & ~ (u64) (osPageSize - 1));
+#endif
+#if d_m3HasCheckpoints
+        // the tracked pages would be left behind
+        _throwif ("linear memory can't move while checkpointed", memory->reserved and io_runtime->checkpoint);
+#endif
+
+        u8 * reserved = (u8 *) m3_ReserveMemory ((size_t) numReservedBytes);
+        _throwifnull (reserved);
+
+        if (not m3_CommitMemory (reserved, (size_t) numBytesNeeded))
+        {
+            m3_ReleaseMemory (reserved, (size_t) numReservedBytes);
+            _throw (m3Err_mallocFailed);
+        }
+
+        M3MemoryHeader * header = (M3MemoryHeader *) (reserved + osPageSize) - 1;
+
+        if (memory->reserved)
+        {
+            memcpy (header, memory->mallocated, sizeof (M3MemoryHeader) + memory->mallocated->length);
+            m3_ReleaseMemory (memory->reserved, memory->numReservedBytes);
+        }
+
+        memory->reserved            = reserved;
+        memory->numReservedBytes    = (size_t) numReservedBytes;
+        memory->mallocated          = header;
+    }
+    else
+    {
+        // pages past the committed ones are still untouched, so they come up zeroed
+        u64 numCommittedBytes = osPageSize + AlignToPage (memory->mallocated->length, osPageSize);
+
+        if (numBytesNeeded > numCommittedBytes)
+        {
+            u8 * tail = (u8 *) memory->reserved + numCommittedBytes;
+            _throwif (m3Err_mallocFailed, not m3_CommitMemory (tail, (size_t) (numBytesNeeded - numCommittedBytes)));
+        }
+    }
+
+    _catch: return result;
 }
 
+#endif // d_m3UseMemoryReservation
+
 
 M3Result  ResizeMemory  (IM3Runtime io_runtime, u32 i_numPages)
 {
@@ -405,6 +699,18 @@ M3Result  ResizeMemory  (IM3Runtime io_runtime, u32 i_numPages)
             numPageBytes = M3_MIN (numPageBytes, (u64) io_runtime->memoryLimit);
         }
 
+# if d_m3LogRuntime
+        M3MemoryHeader * oldMallocated = memory->mallocated;
+# endif
+
+#if d_m3UseMemoryReservation
+#   if d_m3UseGuardPages
+        // a limit that isn't a whole number of OS pages would leave a readable tail past the end
+        numPageBytes -= numPageBytes % m3_GetSystemPageSize ();
+#   endif
+
+_       (CommitReservedMemory (io_runtime, numPageBytes));
+#else
         _throwif("linear memory limitation exceeded", numPageBytes > (u64) SIZE_MAX - sizeof (M3MemoryHeader));
 
         size_t numBytes = (size_t) numPageBytes + sizeof (M3MemoryHeader);
@@ -417,17 +723,24 @@ M3Result  ResizeMemory  (IM3Runtime io_runtime, u32 i_numPages)
         _throwifnull(newMem);
 
         memory->mallocated = (M3MemoryHeader*)newMem;
-
-# if d_m3LogRuntime
-        M3MemoryHeader * oldMallocated = memory->mallocated;
-# endif
+#endif
 
         memory->numPages = numPagesToAlloc;
 
         memory->mallocated->length =  numPageBytes;
         memory->mallocated->runtime = io_runtime;
 
+#if d_m3Stackless
+        // it's the innermost call frame as well, so a call in progress moves it and a move
+        // of the memory carries it along; frames stack down from the end, aligned
+        if (not memory->mallocated->maxStack)
+        {
+            uintptr_t end = (uintptr_t) ((m3slot_t *) io_runtime->stack + io_runtime->numStackSlots);
+            memory->mallocated->maxStack = (void *) (end & ~(uintptr_t) (sizeof (void *) - 1));
+        }
+#else
         memory->mallocated->maxStack = (m3slot_t *) io_runtime->stack + io_runtime->numStackSlots;
+#endif
 
         m3log (runtime, "resized old: %p; mem: %p; length: %zu; pages: %d", oldMallocated, memory->mallocated, memory->mallocated->length, memory->numPages);
     }
@@ -646,7 +959,7 @@ M3Result  m3_CompileModule  (IM3Module io_module)
     for (u32 i = 0; i < io_module->numFunctions; ++i)
     {
         IM3Function f = & io_module->functions [i];
-        if (f->wasm and not f->compiled)
+        if (f->wasm and not LoadCompiled (f))
         {
 _           (CompileFunction (f));
         }
@@ -655,106 +968,1267 @@ _           (CompileFunction (f));
     _catch: return result;
 }
 
-// Run compiled code on the runtime's stack, bounding native recursion for the
-// duration of the call. The outermost invocation establishes the stack limit;
-// nested ones (an imported function calling back into Wasm) inherit it.
-static inline
-M3Result  RunCodeChecked  (IM3Runtime i_runtime, pc_t i_pc)
-{
-    d_m3StackLimitEnter (i_runtime);
-# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
-    M3Result result = (M3Result) RunCode (i_pc, (m3stack_t) i_runtime->stack, i_runtime->memory.mallocated, d_m3OpDefaultArgs, d_m3BaseCstr);
-# else
-    M3Result result = (M3Result) RunCode (i_pc, (m3stack_t) i_runtime->stack, i_runtime->memory.mallocated, d_m3OpDefaultArgs);
-# endif
-    d_m3StackLimitLeave (i_runtime);
 
-    return result;
+#if d_m3HasParallelCompile
+
+typedef struct M3CompileQueue
+{
+    pthread_mutex_t             lock;
+    IM3Module                   module;
+    u32                         next;           // index of the next function to hand out
+    M3Result                    result;         // the first failure; stops the others taking more work
+    struct M3CompileWorker *    failed;
 }
+M3CompileQueue;
 
-M3Result  m3_RunStart  (IM3Module io_module)
+typedef struct M3CompileWorker
 {
-#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-    // Execution disabled for fuzzing builds
-    return m3Err_none;
-#endif
+    M3Runtime                   runtime;        // private compilation state and code pages
+    M3Environment               environment;    // empty, so pages never come from the shared released list
+    M3CodeSites                 calls;
+    M3CompileQueue *            queue;
+    pthread_t                   thread;
+}
+M3CompileWorker;
 
-    M3Result result = m3Err_none;
-    i32 startFunctionTmp = -1;
 
-    if (io_module and io_module->startFunction >= 0)
+static
+void *  CompileWorker  (void * i_worker)
+{
+    M3CompileWorker * worker = (M3CompileWorker *) i_worker;
+    M3CompileQueue * queue = worker->queue;
+    IM3Module module = queue->module;
+
+    while (true)
     {
-        IM3Function function = & io_module->functions [io_module->startFunction];
+        IM3Function function = NULL;
 
-        if (not function->compiled)
+        pthread_mutex_lock (& queue->lock);
+        while (not queue->result and queue->next < module->numFunctions)
         {
-_           (CompileFunction (function));
+            IM3Function f = & module->functions [queue->next++];
+            if (f->wasm and not LoadCompiled (f))
+            {
+                function = f;
+                break;
+            }
         }
+        pthread_mutex_unlock (& queue->lock);
 
-        IM3FuncType ftype = function->funcType;
-        if (ftype->numArgs != 0 || ftype->numRets != 0)
-            _throw (m3Err_argumentCountMismatch);
-
-        IM3Module module = function->module;
-        IM3Runtime runtime = module->runtime;
-
-        startFunctionTmp = io_module->startFunction;
-        io_module->startFunction = -1;
+        if (not function)
+            break;
 
-        result = RunCodeChecked (runtime, function->compiled);
+        M3Result result = CompileFunctionInto (& worker->runtime, function, & worker->calls, NULL);
 
         if (result)
         {
-            io_module->startFunction = startFunctionTmp;
-            EXCEPTION_PRINT(result);
-            goto _catch;
+            pthread_mutex_lock (& queue->lock);
+            if (not queue->result)
+            {
+                queue->result = result;
+                queue->failed = worker;
+            }
+            pthread_mutex_unlock (& queue->lock);
+            break;
         }
     }
 
-    _catch: return result;
+    return NULL;
 }
 
-// TODO: deal with main + side-modules loading efforcement
-M3Result  m3_LoadModule  (IM3Runtime io_runtime, IM3Module io_module)
-{
-    M3Result result = m3Err_none;
 
-    if (M3_UNLIKELY(io_module->runtime)) {
-        return m3Err_moduleAlreadyLinked;
+static
+void  AdoptCodePages  (IM3Runtime io_runtime, IM3CodePage * io_list, IM3CodePage * io_pages)
+{
+    while (* io_pages)
+    {
+        IM3CodePage page = PopCodePage (io_pages);
+        page->info.sequence = ++io_runtime->newCodePageSequence;
+        PushCodePage (io_list, page);
     }
+}
 
-    io_module->runtime = io_runtime;
-    M3Memory * memory = & io_runtime->memory;
-
-_   (InitMemory (io_runtime, io_module));
-_   (InitGlobals (io_module));
-_   (InitDataSegments (memory, io_module));
-_   (InitTableAndElements (io_module));
+#endif // d_m3HasParallelCompile
 
-    // Start func might use imported functions, which are not liked here yet,
-    // so it will be called before a function call is attempted (in m3_FindFunction)
 
-#ifdef DEBUG
-    Module_GenerateNames(io_module);
-#endif
+#if d_m3HasBackgroundCompile
 
-    io_module->next = io_runtime->modules;
-    io_runtime->modules = io_module;
-    return result; // ok
+// Kept on the runtime's thread's stack for as long as it compiles the function; compiling
+// one can resolve an import that needs another compiled, so they nest
+typedef struct M3CompileClaim
+{
+    IM3Function                 function;
+    struct M3CompileClaim *     previous;
+}
+M3CompileClaim;
 
-_catch:
-    io_module->runtime = NULL;
-    return result;
+typedef struct M3BackgroundCompiler
+{
+    pthread_mutex_t             lock;
+    pthread_cond_t              wake;           // functions queued, or a pause or stop requested
+    pthread_cond_t              done;           // a claimed function was finished with
+    pthread_t                   thread;
+
+    M3Runtime                   scratch;        // the thread's compilation state and code pages
+    M3Environment               environment;    // empty, so pages never come from the shared released list
+
+    IM3Function *               queue;
+    u32                         queueStart;
+    u32                         queueEnd;
+    u32                         queueCapacity;
+
+    IM3Function                 compiling;      // by the background thread
+    M3CompileClaim *            claims;         // by the runtime's thread, the innermost first
+    u32                         numPauses;
+    bool                        stop;
+
+    bool                        jitEnabled;     // the runtime's settings as last set through the API;
+    u32                         jitHotness;     // promotion changes them briefly, on its own thread
 }
+M3BackgroundCompiler;
 
-IM3Global  m3_FindGlobal  (IM3Module               io_module,
-                           const char * const      i_globalName)
+
+static
+void  UpdateBackgroundJitSettings  (IM3Runtime i_runtime)
 {
-    // Search exports
-    for (u32 i = 0; i < io_module->numGlobals; ++i)
+    M3BackgroundCompiler * compiler = i_runtime->compiler;
+
+    if (compiler)
     {
-        IM3Global g = & io_module->globals [i];
-        if (g->name and strcmp (g->name, i_globalName) == 0)
+        pthread_mutex_lock (& compiler->lock);
+# if d_m3HasJit
+        compiler->jitEnabled = i_runtime->jitEnabled;
+        compiler->jitHotness = i_runtime->jitHotness;
+# endif
+        pthread_mutex_unlock (& compiler->lock);
+    }
+}
+
+
+static
+bool  IsClaimed  (M3BackgroundCompiler * i_compiler, IM3Function i_function)
+{
+    for (M3CompileClaim * claim = i_compiler->claims; claim; claim = claim->previous)
+    {
+        if (claim->function == i_function)
+            return true;
+    }
+
+    return false;
+}
+
+
+static
+void *  BackgroundCompileThread  (void * i_compiler)
+{
+    M3BackgroundCompiler * compiler = (M3BackgroundCompiler *) i_compiler;
+
+    pthread_mutex_lock (& compiler->lock);
+
+    while (not compiler->stop)
+    {
+        if (compiler->numPauses or compiler->queueStart == compiler->queueEnd)
+        {
+            pthread_cond_wait (& compiler->wake, & compiler->lock);
+            continue;
+        }
+
+        IM3Function function = compiler->queue [compiler->queueStart++];
+
+        if (compiler->queueStart == compiler->queueEnd)
+            compiler->queueStart = compiler->queueEnd = 0;
+
+        if (IsClaimed (compiler, function) or LoadCompiled (function))
+            continue;
+
+        compiler->compiling = function;
+
+# if d_m3HasJit
+        // the JIT arena belongs to the runtime's thread: a function due to go native
+        // straight away is promoted on its first call instead
+        compiler->scratch.jitEnabled = compiler->jitEnabled;
+        compiler->scratch.jitHotness = M3_MAX (compiler->jitHotness, 1);
+# endif
+
+        pthread_mutex_unlock (& compiler->lock);
+
+        // a failure is left for the runtime's thread to meet, and report, on the first call
+        M3Result result = CompileFunctionInto (& compiler->scratch, function, NULL, NULL);    m3log (compile, "background compile: %s: %s", m3_GetFunctionName (function), result ? result : "ok");
+
+        pthread_mutex_lock (& compiler->lock);
+        compiler->compiling = NULL;
+        pthread_cond_broadcast (& compiler->done);
+    }
+
+    pthread_mutex_unlock (& compiler->lock);
+
+    return NULL;
+}
+
+
+void  QueueBackgroundCompile  (IM3Runtime i_runtime, IM3Function i_function)
+{
+    M3BackgroundCompiler * compiler = i_runtime->compiler;
+
+    if (not compiler)
+        return;
+
+    pthread_mutex_lock (& compiler->lock);
+
+    if (compiler->queueEnd == compiler->queueCapacity)
+    {
+        u32 capacity = compiler->queueCapacity ? compiler->queueCapacity * 2 : 256;
+        IM3Function * queue = m3_ReallocArray (IM3Function, compiler->queue, capacity, compiler->queueCapacity);
+
+        // speculative: if the queue can't grow, the function is compiled when first called
+        if (queue)
+        {
+            compiler->queue = queue;
+            compiler->queueCapacity = capacity;
+        }
+    }
+
+    if (compiler->queueEnd < compiler->queueCapacity)
+    {
+        compiler->queue [compiler->queueEnd++] = i_function;
+        pthread_cond_signal (& compiler->wake);
+    }
+
+    pthread_mutex_unlock (& compiler->lock);
+}
+
+
+// Compiles a function on the runtime's thread, unless the background thread has it already,
+// in which case this waits for that instead: no longer than compiling it here would take.
+M3Result  ClaimAndCompileFunction  (IM3Runtime i_runtime, IM3Function io_function)
+{
+    M3BackgroundCompiler * compiler = i_runtime->compiler;
+    M3CompileClaim claim = { io_function, NULL };
+
+    pthread_mutex_lock (& compiler->lock);
+
+    while (io_function == compiler->compiling)
+        pthread_cond_wait (& compiler->done, & compiler->lock);
+
+    bool isCompiled = LoadCompiled (io_function);
+    if (not isCompiled)
+    {
+        claim.previous = compiler->claims;
+        compiler->claims = & claim;
+    }
+
+    pthread_mutex_unlock (& compiler->lock);
+
+    if (isCompiled)
+        return m3Err_none;
+
+    M3Result result = CompileFunctionInto (i_runtime, io_function, NULL, NULL);
+
+    // the claims made while compiling it are gone already
+    pthread_mutex_lock (& compiler->lock);
+    compiler->claims = claim.previous;
+    pthread_mutex_unlock (& compiler->lock);
+
+    return result;
+}
+
+
+static
+void  PauseBackgroundCompile  (IM3Runtime i_runtime)
+{
+    M3BackgroundCompiler * compiler = i_runtime->compiler;
+
+    if (compiler)
+    {
+        pthread_mutex_lock (& compiler->lock);
+
+        compiler->numPauses++;
+        while (compiler->compiling)
+            pthread_cond_wait (& compiler->done, & compiler->lock);
+
+        pthread_mutex_unlock (& compiler->lock);
+    }
+}
+
+
+static
+void  ResumeBackgroundCompile  (IM3Runtime i_runtime)
+{
+    M3BackgroundCompiler * compiler = i_runtime->compiler;
+
+    if (compiler)
+    {
+        pthread_mutex_lock (& compiler->lock);
+
+        compiler->numPauses--;
+        pthread_cond_signal (& compiler->wake);
+
+        pthread_mutex_unlock (& compiler->lock);
+    }
+}
+
+#endif // d_m3HasBackgroundCompile
+
+
+M3Result  m3_EnableBackgroundCompile  (IM3Runtime io_runtime, int i_enable)
+{
+#if d_m3HasBackgroundCompile
+    M3Result result = m3Err_none;
+
+    M3BackgroundCompiler * compiler = io_runtime->compiler;
+
+    if (i_enable and not compiler)
+    {
+        compiler = m3_AllocStruct (M3BackgroundCompiler);
+        _throwifnull (compiler);
+
+        compiler->scratch.environment = & compiler->environment;
+
+        pthread_mutex_init (& compiler->lock, NULL);
+        pthread_cond_init (& compiler->wake, NULL);
+        pthread_cond_init (& compiler->done, NULL);
+
+        pthread_attr_t attr;
+        pthread_attr_init (& attr);
+        pthread_attr_setstacksize (& attr, d_m3CompileThreadStackSize);
+
+        io_runtime->compiler = compiler;
+        UpdateBackgroundJitSettings (io_runtime);
+
+        if (pthread_create (& compiler->thread, & attr, BackgroundCompileThread, compiler))
+            result = m3Err_backgroundCompileUnsupported;
+
+        pthread_attr_destroy (& attr);
+    }
+    else if (not i_enable and compiler)
+    {
+        pthread_mutex_lock (& compiler->lock);
+        compiler->stop = true;
+        pthread_cond_signal (& compiler->wake);
+        pthread_mutex_unlock (& compiler->lock);
+
+        pthread_join (compiler->thread, NULL);
+    }
+
+    if (compiler and (result or not i_enable))
+    {                                                               d_m3Assert (compiler->scratch.numActiveCodePages == 0);
+        // what was compiled stays; its pages now belong to the runtime
+        AdoptCodePages (io_runtime, & io_runtime->pagesOpen, & compiler->scratch.pagesOpen);
+        AdoptCodePages (io_runtime, & io_runtime->pagesFull, & compiler->scratch.pagesFull);
+        io_runtime->numCodePages += compiler->scratch.numCodePages;
+
+        pthread_cond_destroy (& compiler->done);
+        pthread_cond_destroy (& compiler->wake);
+        pthread_mutex_destroy (& compiler->lock);
+
+        m3_Free (compiler->queue);
+        m3_Free (compiler);
+        io_runtime->compiler = NULL;
+    }
+
+    _catch: return result;
+#else
+    return m3Err_backgroundCompileUnsupported;
+#endif
+}
+
+
+M3Result  m3_CompileModuleParallel  (IM3Module io_module, uint32_t i_numThreads)
+{
+#if d_m3HasParallelCompile
+    M3Result result = m3Err_none;
+
+    IM3Runtime runtime = io_module->runtime;
+    M3CompileWorker * workers = NULL;
+    u32 numPending = 0, numStarted = 1;
+
+    // bind imports to other modules here, so the workers only ever read them
+    for (u32 i = 0; i < io_module->numFunctions; ++i)
+    {
+        IM3Function f = & io_module->functions [i];
+
+        if (LoadCompiled (f))
+            continue;
+
+        if (f->wasm)
+            ++numPending;
+        else
+_           (ResolveImportedFunction (f));
+    }
+
+    if (i_numThreads == 0)
+    {
+        long numCores = sysconf (_SC_NPROCESSORS_ONLN);
+        i_numThreads = (numCores > 0) ? (u32) numCores : 1;
+    }
+
+    i_numThreads = M3_MIN (i_numThreads, numPending);
+
+    if (i_numThreads <= 1)
+        return m3_CompileModule (io_module);
+
+    workers = m3_AllocArray (M3CompileWorker, i_numThreads);
+    _throwifnull (workers);
+
+    M3CompileQueue queue;
+    M3_INIT (queue);
+    queue.module = io_module;
+    pthread_mutex_init (& queue.lock, NULL);
+
+    for (u32 i = 0; i < i_numThreads; ++i)
+    {
+        M3CompileWorker * worker = & workers [i];
+
+        worker->runtime.environment = & worker->environment;
+        worker->queue = & queue;
+# if d_m3HasJit
+        // the JIT arena isn't shared with the workers: a function due to go native
+        // straight away is promoted on its first call instead
+        worker->runtime.jitEnabled = runtime->jitEnabled;
+        worker->runtime.jitHotness = M3_MAX (runtime->jitHotness, 1);
+# endif
+    }
+
+# if d_m3HasBackgroundCompile
+    // the workers don't take claims; keep the background thread to the functions they leave
+    PauseBackgroundCompile (runtime);
+# endif
+
+    // the calling thread is worker 0; if a thread can't be started the rest share its work
+    pthread_attr_t attr;
+    pthread_attr_init (& attr);
+    pthread_attr_setstacksize (& attr, d_m3CompileThreadStackSize);
+
+    while (numStarted < i_numThreads and
+           pthread_create (& workers [numStarted].thread, & attr, CompileWorker, & workers [numStarted]) == 0)
+        ++numStarted;
+
+    pthread_attr_destroy (& attr);
+
+    CompileWorker (& workers [0]);
+
+    for (u32 i = 1; i < numStarted; ++i)
+        pthread_join (workers [i].thread, NULL);
+
+# if d_m3HasBackgroundCompile
+    ResumeBackgroundCompile (runtime);
+# endif
+
+    pthread_mutex_destroy (& queue.lock);
+
+    for (u32 i = 0; i < i_numThreads; ++i)
+    {
+        M3CompileWorker * worker = & workers [i];                   d_m3Assert (worker->runtime.numActiveCodePages == 0);
+
+        AdoptCodePages (runtime, & runtime->pagesOpen, & worker->runtime.pagesOpen);
+        AdoptCodePages (runtime, & runtime->pagesFull, & worker->runtime.pagesFull);
+        runtime->numCodePages += worker->runtime.numCodePages;
+
+        ResolveDeferredCalls (& worker->calls);
+        m3_Free (worker->calls.sites);
+    }
+
+    if (queue.result)
+    {
+# if d_m3VerboseErrorMessages
+        M3ErrorInfo * error = & queue.failed->runtime.error;
+
+        if (error->result)
+            m3Error (error->result, runtime, error->module, error->function, error->file, error->line, "%s", error->message);
+# endif
+        _throw (queue.result);
+    }
+
+    _catch:
+    m3_Free (workers);
+
+    return result;
+#else
+    return m3_CompileModule (io_module);
+#endif
+}
+
+#if d_m3Stackless
+
+// A run starts with a frame that has nowhere to return to, so that returning from the
+// function it calls returns from RunCode. NULL when there's no room left for it.
+static
+M3CallFrame *  PushRunFrame  (IM3Runtime io_runtime)
+{
+    M3MemoryHeader * header = io_runtime->memory.mallocated;
+    M3CallFrame * frame = (M3CallFrame *) header->maxStack - 1;
+
+    if ((void *) frame < io_runtime->stack)
+        return NULL;
+
+    frame->pc = NULL;
+    frame->sp = NULL;
+    d_m3SetFrameFunction (frame, NULL);
+    header->maxStack = frame;
+
+    return frame;
+}
+
+// Pops the frames a run left, all of them when it trapped. They're where a backtrace
+// finds the functions a trap came through.
+static
+void  PopRunFrames  (IM3Runtime io_runtime, M3CallFrame * i_runFrame, M3Result i_result)
+{
+    M3MemoryHeader * header = io_runtime->memory.mallocated;
+
+# if d_m3RecordBacktraces
+    M3CallFrame * frame = (M3CallFrame *) header->maxStack;
+
+    if (i_result and frame <= i_runFrame)
+    {
+        FillBacktraceFunctionInfo (io_runtime, frame->function);
+
+        for (; frame < i_runFrame; ++frame)
+        {
+            PushBacktraceFrame (io_runtime, frame->pc - 1);
+            FillBacktraceFunctionInfo (io_runtime, (frame + 1)->function);
+        }
+    }
+# else
+    (void) i_result;
+# endif
+
+    header->maxStack = i_runFrame + 1;
+}
+
+# define d_m3PushRunFrame(RT)           M3CallFrame * _m3RunFrame = PushRunFrame (RT);    \
+                                        if (not _m3RunFrame) return m3Err_trapStackOverflow;
+# define d_m3PopRunFrames(RT, RESULT)   PopRunFrames (RT, _m3RunFrame, RESULT);
+#else
+# define d_m3PushRunFrame(RT)
+# define d_m3PopRunFrames(RT, RESULT)
+#endif
+
+// Run compiled code on the runtime's stack, bounding native recursion for the
+// duration of the call. The outermost invocation establishes the stack limit;
+// nested ones (an imported function calling back into Wasm) inherit it.
+static inline
+M3Result  RunCodeChecked  (IM3Runtime i_runtime, pc_t i_pc)
+{
+    M3Result result;
+
+    d_m3PushRunFrame (i_runtime);
+    d_m3StackLimitEnter (i_runtime);
+# if d_m3UseGuardPages
+    // loads and stores don't check bounds; one that strays past the end of
+    // memory faults in the guard region and the handler unwinds to here
+    M3GuardFrame guard;
+    m3_PushGuardFrame (& guard, i_runtime->memory.reserved, i_runtime->memory.numReservedBytes);
+
+    if (sigsetjmp (guard.jump, 0))
+        result = m3Err_trapOutOfBoundsMemoryAccess;
+    else
+# endif
+# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
+    result = (M3Result) RunCode (i_pc, (m3stack_t) i_runtime->stack, i_runtime->memory.mallocated, d_m3OpDefaultArgs, d_m3BaseCstr);
+# else
+    result = (M3Result) RunCode (i_pc, (m3stack_t) i_runtime->stack, i_runtime->memory.mallocated, d_m3OpDefaultArgs);
+# endif
+# if d_m3UseGuardPages
+    m3_PopGuardFrame (& guard);
+# endif
+    d_m3StackLimitLeave (i_runtime);
+    d_m3PopRunFrames (i_runtime, result);
+
+    return result;
+}
+
+#if d_m3HasSuspend
+
+// The fiber's life: each entry runs the call set up for it, and leaves once it's done
+static
+void  RunFiberCalls  (void * i_runtime)
+{
+    IM3Runtime runtime = (IM3Runtime) i_runtime;
+    M3CallFiber * call = runtime->callFiber;
+
+    while (true)
+    {
+        call->result = RunCodeChecked (runtime, call->pc);
+        call->running = false;
+
+        m3_LeaveFiber (call->fiber);
+    }
+}
+
+static
+M3Result  EnterCallFiber  (IM3Runtime io_runtime)
+{
+    M3CallFiber * call = io_runtime->callFiber;
+
+    m3_EnterFiber (call->fiber);
+
+    return call->suspended ? call->reason : call->result;
+}
+
+M3Result  SuspendCall  (IM3Runtime io_runtime, u64 * io_slots, u32 i_numResults, M3Result i_reason)
+{
+    M3CallFiber * call = io_runtime->callFiber;
+
+    if (not call or not call->running)
+        return m3Err_trapCannotSuspend;
+
+    call->resultSlots = io_slots;
+    call->numResults = i_numResults;
+    call->resumeTrap = m3Err_none;
+    call->suspended = true;
+    call->reason = i_reason;
+
+    m3_LeaveFiber (call->fiber);
+
+    return call->resumeTrap;
+}
+
+static
+M3Result  ResumeCall  (IM3Runtime io_runtime, M3Result i_trap)
+{
+    M3CallFiber * call = io_runtime->callFiber;
+
+    call->suspended = false;
+    call->resumeTrap = i_trap;
+
+    M3Result result = EnterCallFiber (io_runtime);
+
+    if (not call->suspended)
+        io_runtime->lastCalled = result ? NULL : call->function;
+
+    return result;
+}
+
+#endif // d_m3HasSuspend
+
+// Giving way is a request, not a reason to trap, so a call that can't be suspended carries on
+M3Result  GiveWay  (IM3Runtime io_runtime)
+{
+#if d_m3HasSuspend
+    M3Result result = SuspendCall (io_runtime, NULL, 0, m3Err_yielded);
+
+    return (result == m3Err_trapCannotSuspend) ? m3Err_none : result;
+#else
+    return m3Err_none;
+#endif
+}
+
+#if d_m3HasFuel
+M3Result  FuelRanOut  (IM3Runtime io_runtime)
+{
+# if d_m3HasSuspend
+    if (io_runtime->fuelYields)
+    {
+        M3Result result = SuspendCall (io_runtime, NULL, 0, m3Err_yielded);
+
+        if (result != m3Err_trapCannotSuspend)
+            return result;
+    }
+# endif
+
+    return m3Err_trapOutOfFuel;
+}
+#endif
+
+// Runs a call made through the API. The outermost ones go on the runtime's fiber, when it has
+// one, and come back with m3Err_suspended when a host function suspends them.
+static
+M3Result  RunCall  (IM3Runtime io_runtime, IM3Function i_function, pc_t i_pc)
+{
+#if d_m3HasSuspend
+    M3CallFiber * call = io_runtime->callFiber;
+
+    // one nested in a call from the thread's own stack stays there, under that call's stack limit
+    if (call and not call->running and not io_runtime->stackLimit)
+    {
+        call->pc = i_pc;
+        call->function = i_function;
+        call->running = true;
+
+        return EnterCallFiber (io_runtime);
+    }
+#endif
+
+    return RunCodeChecked (io_runtime, i_pc);
+}
+
+static
+bool  IsSuspended  (IM3Runtime i_runtime)
+{
+#if d_m3HasSuspend
+    return i_runtime->callFiber and i_runtime->callFiber->suspended;
+#else
+    return false;
+#endif
+}
+
+M3Result  m3_RunStart  (IM3Module io_module)
+{
+#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+    // Execution disabled for fuzzing builds
+    return m3Err_none;
+#endif
+
+    M3Result result = m3Err_none;
+    i32 startFunctionTmp = -1;
+
+    if (io_module and io_module->startFunction >= 0)
+    {
+        IM3Function function = & io_module->functions [io_module->startFunction];
+
+        if (not LoadCompiled (function))
+        {
+_           (CompileFunction (function));
+        }
+
+        IM3FuncType ftype = function->funcType;
+        if (ftype->numArgs != 0 || ftype->numRets != 0)
+            _throw (m3Err_argumentCountMismatch);
+
+        IM3Module module = function->module;
+        IM3Runtime runtime = module->runtime;
+
+        // the suspended call's frames are where this would run
+        _throwif (m3Err_runtimeSuspended, IsSuspended (runtime));
+
+        startFunctionTmp = io_module->startFunction;
+        io_module->startFunction = -1;
+
+        result = RunCodeChecked (runtime, function->compiled);
+
+        if (result)
+        {
+            io_module->startFunction = startFunctionTmp;
+            EXCEPTION_PRINT(result);
+            goto _catch;
+        }
+    }
+
+    _catch: return result;
+}
+
+// TODO: deal with main + side-modules loading efforcement
+M3Result  m3_LoadModule  (IM3Runtime io_runtime, IM3Module io_module)
+{
+    M3Result result = m3Err_none;
+
+    if (M3_UNLIKELY(io_module->runtime)) {
+        return m3Err_moduleAlreadyLinked;
+    }
+
+    io_module->runtime = io_runtime;
+    M3Memory * memory = & io_runtime->memory;
+
+_   (InitMemory (io_runtime, io_module));
+_   (InitGlobals (io_module));
+_   (InitDataSegments (memory, io_module));
+_   (InitTableAndElements (io_module));
+
+    // Start func might use imported functions, which are not liked here yet,
+    // so it will be called before a function call is attempted (in m3_FindFunction)
+
+#ifdef DEBUG
+    Module_GenerateNames(io_module);
+#endif
+
+    io_module->next = io_runtime->modules;
+    io_runtime->modules = io_module;
+    return result; // ok
+
+_catch:
+    io_module->runtime = NULL;
+    return result;
+}
+
+M3Result  m3_ShareModule  (IM3Module io_module)
+{
+    M3Result result = m3Err_none;
+
+    IM3Runtime runtime = io_module->runtime;
+    M3CodeSites calls;
+    M3_INIT (calls);
+
+    _throwif (m3Err_moduleNotLinked, not runtime);
+
+    if (io_module->codeIsShared)
+        return m3Err_none;
+
+    _throwif (m3Err_runtimeHasSharedModule, runtime->sharedInstance);
+
+    for (u32 i = 0; i < io_module->numFunctions; ++i)
+    {
+        IM3Function f = & io_module->functions [i];
+        _throwif (m3Err_moduleAlreadyCompiled, f->wasm and LoadCompiled (f));
+    }
+
+    io_module->codeIsShared = true;
+    io_module->sharedStartFunction = io_module->startFunction;
+    runtime->sharedInstance = io_module;
+
+    // all of it up front, with the calls between functions bound at the end, so that nothing
+    // is left for a first call to compile and patch in while other runtimes are running it
+    for (u32 i = 0; i < io_module->numFunctions; ++i)
+    {
+        IM3Function f = & io_module->functions [i];
+
+        if (f->wasm)
+_           (CompileFunctionInto (runtime, f, & calls, NULL));
+    }
+
+    _throwif (m3Err_mallocFailed, calls.isIncomplete);
+
+    _catch:
+    ResolveDeferredCalls (& calls);
+    m3_Free (calls.sites);
+
+    return result;
+}
+
+
+static
+M3Result  CopyInstanceArray  (void * o_copy, const void * i_array, size_t i_size)
+{
+    void ** copy = (void **) o_copy;
+    * copy = NULL;
+
+    if (i_size)
+    {
+        * copy = m3_CopyMem (i_array, i_size);
+        if (not * copy)
+            return m3Err_mallocFailed;
+    }
+
+    return m3Err_none;
+}
+
+
+// An instance of a shared module, not yet set up: its own copies of the functions, globals,
+// tables and segments, in the state they were parsed in
+static
+M3Result  NewInstance  (IM3Runtime io_runtime, IM3Module i_module, IM3Module * o_instance)
+{
+    M3Result result = m3Err_none;
+
+    IM3Module instance = NULL;
+
+    _throwif (m3Err_moduleNotShared, not i_module->codeIsShared or i_module->sharedFrom);
+    _throwif (m3Err_runtimeHasSharedModule, io_runtime->sharedInstance);
+
+    instance = m3_AllocStruct (M3Module);
+    _throwifnull (instance);
+
+    // the parse and the code are borrowed; functions, globals, tables and segments are copied
+    // afresh, and then set up as m3_LoadModule would
+    * instance = * i_module;
+
+    instance->runtime = io_runtime;
+    instance->sharedFrom = i_module;
+    instance->startFunction = i_module->sharedStartFunction;
+    instance->next = NULL;
+
+    instance->functions = NULL;
+    instance->globals = NULL;
+    instance->tables = NULL;
+    instance->dataSegments = NULL;
+    instance->elementSegments = NULL;
+
+    // m3_FreeModule frees the table elements and resolved segments it finds; until the copies
+    // have let go of the home module's, there are none for it to find
+    instance->numTables = 0;
+    instance->numElementSegments = 0;
+
+_   (CopyInstanceArray (& instance->functions, i_module->functions, i_module->numFunctions * sizeof (M3Function)));
+_   (CopyInstanceArray (& instance->globals, i_module->globals, i_module->numGlobals * sizeof (M3Global)));
+_   (CopyInstanceArray (& instance->tables, i_module->tables, i_module->numTables * sizeof (M3Table)));
+
+    instance->numTables = i_module->numTables;
+
+    for (u32 i = 0; i < instance->numTables; ++i)
+    {
+        instance->tables [i].elements = NULL;
+        instance->tables [i].size = instance->tables [i].initSize;
+    }
+
+_   (CopyInstanceArray (& instance->dataSegments, i_module->dataSegments, i_module->numDataSegments * sizeof (M3DataSegment)));
+_   (CopyInstanceArray (& instance->elementSegments, i_module->elementSegments, i_module->numElementSegments * sizeof (M3ElementSegment)));
+
+    instance->numElementSegments = i_module->numElementSegments;
+
+    for (u32 i = 0; i < instance->numElementSegments; ++i)
+    {
+        instance->elementSegments [i].resolved = NULL;
+        instance->elementSegments [i].dropped = false;
+    }
+
+    instance->allFunctions = instance->numFunctions;
+
+    for (u32 i = 0; i < instance->numFunctions; ++i)
+        instance->functions [i].module = instance;
+
+    for (u32 i = 0; i < instance->numDataSegments; ++i)
+        instance->dataSegments [i].dropped = false;
+
+    * o_instance = instance;
+
+    _catch:
+    if (result)
+        m3_FreeModule (instance);
+
+    return result;
+}
+
+
+static
+void  AddInstance  (IM3Runtime io_runtime, IM3Module i_instance)
+{
+    i_instance->next = io_runtime->modules;
+    io_runtime->modules = i_instance;
+    io_runtime->sharedInstance = i_instance;
+}
+
+
+M3Result  m3_InstantiateModule  (IM3Runtime io_runtime, IM3Module i_module, IM3Module * o_instance)
+{
+    M3Result result = m3Err_none;
+
+    IM3Module instance = NULL;
+
+_   (NewInstance (io_runtime, i_module, & instance));
+
+_   (InitMemory (io_runtime, instance));
+_   (InitGlobals (instance));
+_   (InitDataSegments (& io_runtime->memory, instance));
+_   (InitTableAndElements (instance));
+
+    AddInstance (io_runtime, instance);
+    * o_instance = instance;
+
+    _catch:
+    if (result)
+        m3_FreeModule (instance);
+
+    return result;
+}
+
+
+// Function references are kept relative to the shared module while in a snapshot, and
+// moved onto each fork's own functions when restored
+static
+void *  RebaseFunctionRef  (void * i_ref, IM3Module i_from, IM3Module i_to)
+{
+    IM3Function function = (IM3Function) i_ref;
+
+    if (function >= i_from->functions and function < i_from->functions + i_from->numFunctions)
+        return & i_to->functions [function - i_from->functions];
+
+    return i_ref;
+}
+
+
+static
+void  RebaseGlobals  (M3Global * io_globals, IM3Module i_from, IM3Module i_to)
+{
+    for (u32 i = 0; i < i_to->numGlobals; ++i)
+    {
+        M3Global * g = & io_globals [i];
+
+        if (BaseTypeOf (g->type) == c_m3Type_funcref)
+            g->i64Value = (i64) (uintptr_t) RebaseFunctionRef ((void *) (uintptr_t) g->i64Value, i_from, i_to);
+    }
+}
+
+
+// A table the same size as before keeps its array
+static
+M3Result  CopyTableElements  (M3Table * io_table, const M3Table * i_table, IM3Module i_from, IM3Module i_to)
+{
+    if (io_table->size != i_table->size or not io_table->elements)
+    {
+        m3_Free (io_table->elements);
+        io_table->size = 0;
+
+        if (i_table->size)
+        {
+            io_table->elements = m3_AllocArray (void *, i_table->size);
+            if (not io_table->elements)
+                return m3Err_mallocFailed;
+        }
+    }
+
+    io_table->size = i_table->size;
+
+    bool isFuncref = (BaseTypeOf (i_table->type) == c_m3Type_funcref);
+
+    for (u32 e = 0; e < i_table->size; ++e)
+    {
+        void * ref = i_table->elements [e];
+        io_table->elements [e] = isFuncref ? RebaseFunctionRef (ref, i_from, i_to) : ref;
+    }
+
+    return m3Err_none;
+}
+
+
+M3Result  m3_NewSnapshot  (IM3Snapshot * o_snapshot, IM3Runtime i_runtime)
+{
+    M3Result result = m3Err_none;
+
+    IM3Module instance = i_runtime->sharedInstance;
+    if (not instance)
+        return m3Err_moduleNotShared;
+
+    IM3Snapshot snapshot = NULL;
+    M3Memory * memory = & i_runtime->memory;
+
+    u32 numSegments = instance->numDataSegments + instance->numElementSegments;
+    IM3Module module = instance->sharedFrom ? instance->sharedFrom : instance;
+
+    snapshot = m3_AllocStruct (M3Snapshot);
+    _throwifnull (snapshot);
+
+    snapshot->module = module;
+    snapshot->startFunction = instance->startFunction;
+#if d_m3HasMemoryImages
+    snapshot->image = -1;
+#endif
+
+_   (CopyInstanceArray (& snapshot->globals, instance->globals, instance->numGlobals * sizeof (M3Global)));
+    RebaseGlobals (snapshot->globals, instance, module);
+
+    if (instance->numTables)
+    {
+        snapshot->tables = m3_AllocArray (M3Table, instance->numTables);
+        _throwifnull (snapshot->tables);
+
+        for (u32 i = 0; i < instance->numTables; ++i)
+        {
+            snapshot->tables [i] = instance->tables [i];
+            snapshot->tables [i].elements = NULL;
+_           (CopyTableElements (& snapshot->tables [i], & instance->tables [i], instance, module));
+        }
+    }
+
+    if (numSegments)
+    {
+        snapshot->dropped = m3_AllocArray (bool, numSegments);
+        _throwifnull (snapshot->dropped);
+
+        for (u32 i = 0; i < instance->numDataSegments; ++i)
+            snapshot->dropped [i] = instance->dataSegments [i].dropped;
+
+        for (u32 i = 0; i < instance->numElementSegments; ++i)
+            snapshot->dropped [instance->numDataSegments + i] = instance->elementSegments [i].dropped;
+    }
+
+    snapshot->numPages = memory->numPages;
+    snapshot->maxPages = memory->maxPages;
+    snapshot->pageSize = memory->pageSize;
+
+    if (memory->mallocated and memory->mallocated->length)
+    {
+        snapshot->numBytes = memory->mallocated->length;
+        u8 * bytes = m3MemData (memory->mallocated);
+
+#if d_m3HasMemoryImages
+        snapshot->image = m3_NewMemoryImage (bytes, (size_t) AlignToPage (snapshot->numBytes, m3_GetSystemPageSize ()));
+
+        if (snapshot->image < 0)
+#endif
+        {
+            // no anonymous files here: forks copy the memory instead of mapping it
+            snapshot->memory = (u8 *) m3_CopyMem (bytes, snapshot->numBytes);
+            _throwifnull (snapshot->memory);
+        }
+    }
+
+    * o_snapshot = snapshot;
+
+    _catch:
+    if (result)
+        m3_FreeSnapshot (snapshot);
+
+    return result;
+}
+
+
+static
+M3Result  RestoreMemory  (IM3Runtime io_runtime, IM3Snapshot i_snapshot)
+{
+    M3Result result = m3Err_none;
+
+    M3Memory * memory = & io_runtime->memory;
+
+    // an imported memory is the host's to set up, for forks as for the rest
+    if (i_snapshot->module->memoryImported)
+        return result;
+
+    memory->pageSize = i_snapshot->pageSize;
+    memory->maxPages = i_snapshot->maxPages;
+
+_   (ResizeMemory (io_runtime, i_snapshot->numPages));
+
+    if (i_snapshot->numBytes)
+    {
+        _throwif ("linear memory limitation exceeded", memory->mallocated->length < i_snapshot->numBytes);
+
+        u8 * bytes = m3MemData (memory->mallocated);
+
+#if d_m3HasMemoryImages
+        // the image replaces the freshly committed pages, which were never touched
+        if (i_snapshot->image >= 0)
+        {
+            size_t numImageBytes = (size_t) AlignToPage (i_snapshot->numBytes, m3_GetSystemPageSize ());
+            _throwif (m3Err_mallocFailed, not m3_MapMemoryImage (bytes, numImageBytes, i_snapshot->image));
+        }
+        else
+#endif
+        memcpy (bytes, i_snapshot->memory, i_snapshot->numBytes);
+    }
+
+    _catch: return result;
+}
+
+
+static
+M3Result  RestoreInstance  (IM3Module io_instance, IM3Snapshot i_snapshot)
+{
+    M3Result result = m3Err_none;
+
+    IM3Module module = i_snapshot->module;
+
+    io_instance->startFunction = i_snapshot->startFunction;
+
+    if (io_instance->numGlobals)
+    {
+        memcpy (io_instance->globals, i_snapshot->globals, io_instance->numGlobals * sizeof (M3Global));
+        RebaseGlobals (io_instance->globals, module, io_instance);
+    }
+
+    for (u32 i = 0; i < io_instance->numTables; ++i)
+    {
+_       (CopyTableElements (& io_instance->tables [i], & i_snapshot->tables [i], module, io_instance));
+    }
+
+    for (u32 i = 0; i < io_instance->numDataSegments; ++i)
+        io_instance->dataSegments [i].dropped = i_snapshot->dropped [i];
+
+    for (u32 i = 0; i < io_instance->numElementSegments; ++i)
+    {
+        M3ElementSegment * segment = & io_instance->elementSegments [i];
+        segment->dropped = i_snapshot->dropped [io_instance->numDataSegments + i];
+
+        if (segment->mode == c_m3Elem_passive and not segment->dropped and segment->numElements and not segment->resolved)
+        {
+            segment->resolved = m3_AllocArray (void *, segment->numElements);
+            _throwifnull (segment->resolved);
+_           (ResolveElements (io_instance, segment, segment->resolved));
+        }
+    }
+
+    _catch: return result;
+}
+
+
+M3Result  m3_ForkSnapshot  (IM3Runtime io_runtime, IM3Snapshot i_snapshot, IM3Module * o_instance)
+{
+    M3Result result = m3Err_none;
+
+    IM3Module instance = NULL;
+
+_   (NewInstance (io_runtime, i_snapshot->module, & instance));
+_   (RestoreInstance (instance, i_snapshot));
+_   (RestoreMemory (io_runtime, i_snapshot));
+
+    AddInstance (io_runtime, instance);
+    * o_instance = instance;
+
+    _catch:
+    if (result)
+        m3_FreeModule (instance);
+
+    return result;
+}
+
+
+M3Result  Runtime_Reset  (IM3Runtime io_runtime, IM3Snapshot i_snapshot)
+{
+    M3Result result = m3Err_none;
+
+    IM3Module instance = io_runtime->sharedInstance;
+    M3Memory * memory = & io_runtime->memory;
+
+    _throwif (m3Err_moduleNotShared, not instance or instance->sharedFrom != i_snapshot->module);
+
+    // a call left suspended unwinds before its instance is reset under it
+    while (m3_AbortSuspended (io_runtime, m3Err_trapAbort) == m3Err_suspended) {}
+
+#if d_m3HasCheckpoints
+    // the memory is about to be mapped afresh
+    m3_DropCheckpoint (io_runtime);
+#endif
+
+_   (RestoreInstance (instance, i_snapshot));
+
+#if d_m3UseMemoryReservation
+    if (memory->mallocated and not i_snapshot->module->memoryImported)
+    {
+        // pages grown into since go back to being only reserved, so that growing again finds them zeroed;
+        // the rest of the OS page the snapshot's memory ends in stays, and is zeroed here instead
+        size_t osPageSize = m3_GetSystemPageSize ();
+        u64 numKeptBytes = AlignToPage (i_snapshot->numBytes, osPageSize);
+        u64 numCommittedBytes = AlignToPage (memory->mallocated->length, osPageSize);
+        u8 * bytes = m3MemData (memory->mallocated);
+
+        if (numCommittedBytes > i_snapshot->numBytes)
+            memset (bytes + i_snapshot->numBytes, 0, (size_t) (M3_MIN (numKeptBytes, numCommittedBytes) - i_snapshot->numBytes));
+
+        if (numCommittedBytes > numKeptBytes)
+            m3_DecommitMemory (bytes + numKeptBytes, (size_t) (numCommittedBytes - numKeptBytes));
+    }
+#endif
+
+_   (RestoreMemory (io_runtime, i_snapshot));
+
+    io_runtime->lastCalled = NULL;
+    m3_ResetErrorInfo (io_runtime);
+
+    _catch: return result;
+}
+
+
+void  m3_FreeSnapshot  (IM3Snapshot i_snapshot)
+{
+    if (i_snapshot)
+    {
+        if (i_snapshot->tables)
+        {
+            for (u32 i = 0; i < i_snapshot->module->numTables; ++i)
+                m3_Free (i_snapshot->tables [i].elements);
+        }
+
+#if d_m3HasMemoryImages
+        if (i_snapshot->image >= 0)
+            m3_FreeMemoryImage (i_snapshot->image);
+#endif
+
+        m3_Free (i_snapshot->tables);
+        m3_Free (i_snapshot->globals);
+        m3_Free (i_snapshot->dropped);
+        m3_Free (i_snapshot->memory);
+        m3_Free (i_snapshot);
+    }
+}
+
+
+IM3Global  m3_FindGlobal  (IM3Module               io_module,
+                           const char * const      i_globalName)
+{
+    // Search exports
+    for (u32 i = 0; i < io_module->numGlobals; ++i)
+    {
+        IM3Global g = & io_module->globals [i];
+        if (g->name and strcmp (g->name, i_globalName) == 0)
         {
             return g;
         }
@@ -867,7 +2341,7 @@ M3Result  m3_FindFunction  (IM3Function * o_function, IM3Runtime i_runtime, cons
 
     if (function)
     {
-        if (not function->compiled)
+        if (not LoadCompiled (function))
         {
 _           (CompileFunction (function))
         }
@@ -899,7 +2373,7 @@ _try {
 
     if (function)
     {
-        if (not function->compiled)
+        if (not LoadCompiled (function))
         {
 _           (CompileFunction (function))
         }
@@ -916,8 +2390,13 @@ M3Result checkStartFunction(IM3Module i_module)
 {
     M3Result result = m3Err_none;                               d_m3Assert(i_module);
 
+    // nothing else runs until a suspended call's resumed, or aborted
+    if (IsSuspended (i_module->runtime))
+    {
+        result = m3Err_runtimeSuspended;
+    }
     // Check if start function needs to be called
-    if (i_module->startFunction >= 0)
+    else if (i_module->startFunction >= 0)
     {
         result = m3_RunStart (i_module);
     }
@@ -1008,7 +2487,7 @@ M3Result  m3_CallVL  (IM3Function i_function, va_list i_args)
     M3Result result = m3Err_none;
     u8* s = NULL;
 
-    if (!i_function->compiled) {
+    if (not LoadCompiled (i_function)) {
         return m3Err_missingCompiledCode;
     }
 
@@ -1037,7 +2516,7 @@ _   (checkStartFunction(i_function->module))
         }
     }
 
-    result = RunCodeChecked (runtime, i_function->compiled);
+    result = RunCall (runtime, i_function, i_function->compiled);
     ReportNativeStackUsage ();
 
     runtime->lastCalled = result ? NULL : i_function;
@@ -1052,10 +2531,176 @@ M3Result  m3_Call  (IM3Function i_function, uint32_t i_argc, const void * i_argp
     M3Result result = m3Err_none;
     u8* s = NULL;
 
-    if (i_argc != ftype->numArgs) {
-        return m3Err_argumentCountMismatch;
-    }
-    if (!i_function->compiled) {
+    if (i_argc != ftype->numArgs) {
+        return m3Err_argumentCountMismatch;
+    }
+    if (not LoadCompiled (i_function)) {
+        return m3Err_missingCompiledCode;
+    }
+
+# if d_m3RecordBacktraces
+    ClearBacktrace (runtime);
+# endif
+
+    m3StackCheckInit();
+
+_   (checkStartFunction(i_function->module))
+
+    s = GetStackPointerForArgs (i_function);
+
+    for (u32 i = 0; i < ftype->numArgs; ++i)
+    {
+        switch (d_FuncArgType(ftype, i)) {
+        case c_m3Type_i32:  *(i32*)(s) = *(i32*)i_argptrs[i];  s += 8; break;
+        case c_m3Type_i64:  *(i64*)(s) = *(i64*)i_argptrs[i];  s += 8; break;
+        case c_m3Type_funcref:
+        case c_m3Type_externref: *(uintptr_t*)(s) = *(uintptr_t*)i_argptrs[i]; s += 8; break;
+# if d_m3HasFloat
+        case c_m3Type_f32:  *(f32*)(s) = *(f32*)i_argptrs[i];  s += 8; break;
+        case c_m3Type_f64:  *(f64*)(s) = *(f64*)i_argptrs[i];  s += 8; break;
+# endif
+        default: return "unknown argument type";
+        }
+    }
+
+    result = RunCall (runtime, i_function, i_function->compiled);
+
+    ReportNativeStackUsage ();
+
+    runtime->lastCalled = result ? NULL : i_function;
+
+    _catch: return result;
+}
+
+M3Result  m3_CallArgv  (IM3Function i_function, uint32_t i_argc, const char * i_argv[])
+{
+    IM3FuncType ftype = i_function->funcType;
+    IM3Runtime runtime = i_function->module->runtime;
+    M3Result result = m3Err_none;
+    u8* s = NULL;
+
+    if (i_argc != ftype->numArgs) {
+        return m3Err_argumentCountMismatch;
+    }
+    if (not LoadCompiled (i_function)) {
+        return m3Err_missingCompiledCode;
+    }
+
+# if d_m3RecordBacktraces
+    ClearBacktrace (runtime);
+# endif
+
+    m3StackCheckInit();
+
+_   (checkStartFunction(i_function->module))
+
+    s = GetStackPointerForArgs (i_function);
+
+    for (u32 i = 0; i < ftype->numArgs; ++i)
+    {
+        switch (d_FuncArgType(ftype, i)) {
+        case c_m3Type_i32:  *(i32*)(s) = strtoul(i_argv[i], NULL, 10);  s += 8; break;
+        case c_m3Type_i64:  *(i64*)(s) = strtoull(i_argv[i], NULL, 10); s += 8; break;
+        case c_m3Type_funcref:
+        case c_m3Type_externref: *(uintptr_t*)(s) = (uintptr_t)strtoull(i_argv[i], NULL, 10); s += 8; break;
+# if d_m3HasFloat
+        case c_m3Type_f32:  *(f32*)(s) = strtod(i_argv[i], NULL);       s += 8; break;  // strtof would be less portable
+        case c_m3Type_f64:  *(f64*)(s) = strtod(i_argv[i], NULL);       s += 8; break;
+# endif
+        default: return "unknown argument type";
+        }
+    }
+
+    result = RunCall (runtime, i_function, i_function->compiled);
+
+    ReportNativeStackUsage ();
+
+    runtime->lastCalled = result ? NULL : i_function;
+
+    _catch: return result;
+}
+
+
+// The calls of a batch from * io_numCompleted on, counted off as they return. The arguments
+// are already in slots, and are copied in as they are.
+static
+M3Result  RunBatch  (IM3Runtime i_runtime, IM3FuncType i_ftype, pc_t i_pc,
+                     u32 i_numCalls, const u64 * i_args, u64 * o_results, volatile u32 * io_numCompleted)
+{
+    M3Result result = m3Err_none;
+
+    u64 * stack = (u64 *) i_runtime->stack;
+    u32 numArgs = i_ftype->numArgs;
+    u32 numRets = i_ftype->numRets;
+
+# if d_m3Stackless
+    // every call returns through the run frame pushed for the lot, popping it
+    void * runFrame = i_runtime->memory.mallocated->maxStack;
+# endif
+
+    for (u32 i = * io_numCompleted; i < i_numCalls; ++i)
+    {
+        memcpy (stack + numRets, i_args + (size_t) i * numArgs, numArgs * sizeof (u64));
+
+# if d_m3Stackless
+        i_runtime->memory.mallocated->maxStack = runFrame;
+# endif
+        // memory.grow may have moved the memory since the last call
+# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
+        result = (M3Result) RunCode (i_pc, (m3stack_t) stack, i_runtime->memory.mallocated, d_m3OpDefaultArgs, d_m3BaseCstr);
+# else
+        result = (M3Result) RunCode (i_pc, (m3stack_t) stack, i_runtime->memory.mallocated, d_m3OpDefaultArgs);
+# endif
+        if (result)
+            break;
+
+        memcpy (o_results + (size_t) i * numRets, stack, numRets * sizeof (u64));
+        * io_numCompleted = i + 1;
+    }
+
+    return result;
+}
+
+// RunBatch with the stack limit and guard frame set up once for the lot, rather than per
+// call as RunCodeChecked would. Kept apart from m3_CallBatch so that nothing of the
+// caller's is live across the sigsetjmp.
+static
+M3Result  RunBatchChecked  (IM3Runtime i_runtime, IM3FuncType i_ftype, pc_t i_pc,
+                            u32 i_numCalls, const u64 * i_args, u64 * o_results, volatile u32 * io_numCompleted)
+{
+    M3Result result;
+
+    d_m3PushRunFrame (i_runtime);
+    d_m3StackLimitEnter (i_runtime);
+# if d_m3UseGuardPages
+    M3GuardFrame guard;
+    m3_PushGuardFrame (& guard, i_runtime->memory.reserved, i_runtime->memory.numReservedBytes);
+
+    if (sigsetjmp (guard.jump, 0))
+        result = m3Err_trapOutOfBoundsMemoryAccess;
+    else
+# endif
+    result = RunBatch (i_runtime, i_ftype, i_pc, i_numCalls, i_args, o_results, io_numCompleted);
+# if d_m3UseGuardPages
+    m3_PopGuardFrame (& guard);
+# endif
+    d_m3StackLimitLeave (i_runtime);
+    d_m3PopRunFrames (i_runtime, result);
+
+    return result;
+}
+
+
+M3Result  m3_CallBatch  (IM3Function i_function, uint32_t i_numCalls, const uint64_t * i_args, uint64_t * o_results, uint32_t * o_numCompleted)
+{
+    IM3Runtime runtime = i_function->module->runtime;
+    M3Result result = m3Err_none;
+    pc_t pc = LoadCompiled (i_function);
+
+    // volatile: a guard page fault comes back through sigsetjmp partway through
+    volatile u32 numCompleted = 0;
+
+    if (not pc) {
         return m3Err_missingCompiledCode;
     }
 
@@ -1067,45 +2712,55 @@ M3Result  m3_Call  (IM3Function i_function, uint32_t i_argc, const void * i_argp
 
 _   (checkStartFunction(i_function->module))
 
-    s = GetStackPointerForArgs (i_function);
+    result = RunBatchChecked (runtime, i_function->funcType, pc, i_numCalls, i_args, o_results, & numCompleted);
 
-    for (u32 i = 0; i < ftype->numArgs; ++i)
+    ReportNativeStackUsage ();
+
+    runtime->lastCalled = result ? NULL : i_function;
+
+    _catch:
+    if (o_numCompleted)
+        * o_numCompleted = numCompleted;
+
+    return result;
+}
+
+
+M3Result  m3_PrepareCall  (IM3PreparedCall * o_call, IM3Function i_function, const char * i_signature)
+{
+    M3Result result = m3Err_none;
+    IM3PreparedCall call = NULL;
+
+_   (ValidateSignature (i_function, i_signature));
+
+    if (not LoadCompiled (i_function))
     {
-        switch (d_FuncArgType(ftype, i)) {
-        case c_m3Type_i32:  *(i32*)(s) = *(i32*)i_argptrs[i];  s += 8; break;
-        case c_m3Type_i64:  *(i64*)(s) = *(i64*)i_argptrs[i];  s += 8; break;
-        case c_m3Type_funcref:
-        case c_m3Type_externref: *(uintptr_t*)(s) = *(uintptr_t*)i_argptrs[i]; s += 8; break;
-# if d_m3HasFloat
-        case c_m3Type_f32:  *(f32*)(s) = *(f32*)i_argptrs[i];  s += 8; break;
-        case c_m3Type_f64:  *(f64*)(s) = *(f64*)i_argptrs[i];  s += 8; break;
-# endif
-        default: return "unknown argument type";
-        }
+_       (CompileFunction (i_function))
     }
 
-    result = RunCodeChecked (runtime, i_function->compiled);
+    // the start function runs now: run lazily, by the first call, its locals would land on
+    // the arguments the caller has already written into the slots
+_   (checkStartFunction (i_function->module))
 
-    ReportNativeStackUsage ();
+    call = m3_AllocStruct (M3PreparedCall);
+    _throwifnull (call);
 
-    runtime->lastCalled = result ? NULL : i_function;
+    call->function = i_function;
+    call->pc = LoadCompiled (i_function);
+    call->results = (u64 *) i_function->module->runtime->stack;
+    call->args = call->results + i_function->funcType->numRets;
+
+    * o_call = call;
 
     _catch: return result;
 }
 
-M3Result  m3_CallArgv  (IM3Function i_function, uint32_t i_argc, const char * i_argv[])
+
+M3Result  m3_CallPrepared  (IM3PreparedCall i_call)
 {
-    IM3FuncType ftype = i_function->funcType;
-    IM3Runtime runtime = i_function->module->runtime;
+    IM3Function function = i_call->function;
+    IM3Runtime runtime = function->module->runtime;
     M3Result result = m3Err_none;
-    u8* s = NULL;
-
-    if (i_argc != ftype->numArgs) {
-        return m3Err_argumentCountMismatch;
-    }
-    if (!i_function->compiled) {
-        return m3Err_missingCompiledCode;
-    }
 
 # if d_m3RecordBacktraces
     ClearBacktrace (runtime);
@@ -1113,32 +2768,34 @@ M3Result  m3_CallArgv  (IM3Function i_function, uint32_t i_argc, const char * i_
 
     m3StackCheckInit();
 
-_   (checkStartFunction(i_function->module))
+    // the start function ran in m3_PrepareCall; this only turns away a suspended runtime
+_   (checkStartFunction(function->module))
 
-    s = GetStackPointerForArgs (i_function);
+    // the arguments are already in place, and the results stay where they land
+    result = RunCall (runtime, function, i_call->pc);
+    ReportNativeStackUsage ();
 
-    for (u32 i = 0; i < ftype->numArgs; ++i)
-    {
-        switch (d_FuncArgType(ftype, i)) {
-        case c_m3Type_i32:  *(i32*)(s) = strtoul(i_argv[i], NULL, 10);  s += 8; break;
-        case c_m3Type_i64:  *(i64*)(s) = strtoull(i_argv[i], NULL, 10); s += 8; break;
-        case c_m3Type_funcref:
-        case c_m3Type_externref: *(uintptr_t*)(s) = (uintptr_t)strtoull(i_argv[i], NULL, 10); s += 8; break;
-# if d_m3HasFloat
-        case c_m3Type_f32:  *(f32*)(s) = strtod(i_argv[i], NULL);       s += 8; break;  // strtof would be less portable
-        case c_m3Type_f64:  *(f64*)(s) = strtod(i_argv[i], NULL);       s += 8; break;
-# endif
-        default: return "unknown argument type";
-        }
-    }
+    runtime->lastCalled = result ? NULL : function;
 
-    result = RunCodeChecked (runtime, i_function->compiled);
+    _catch: return result;
+}
 
-    ReportNativeStackUsage ();
 
-    runtime->lastCalled = result ? NULL : i_function;
+uint64_t *  m3_GetPreparedArgs  (IM3PreparedCall i_call)
+{
+    return i_call->args;
+}
 
-    _catch: return result;
+
+const uint64_t *  m3_GetPreparedResults  (IM3PreparedCall i_call)
+{
+    return i_call->results;
+}
+
+
+void  m3_FreePreparedCall  (IM3PreparedCall i_call)
+{
+    m3_Free (i_call);
 }
 
 
@@ -1239,7 +2896,7 @@ IM3CodePage  AcquireCodePageWithCapacity  (IM3Runtime i_runtime, u32 i_minLineCo
 
     if (not page)
     {
-        page = Environment_AcquireCodePage (i_runtime->environment, i_minLineCount);
+        page = Environment_AcquireCodePage (i_runtime->environment, PageShardOf (i_runtime), i_minLineCount);
 
         if (not page)
             page = NewCodePage (i_runtime, i_minLineCount);
@@ -1345,12 +3002,335 @@ uint8_t *  m3_GetMemory  (IM3Runtime i_runtime, uint32_t * o_memorySizeInBytes,
 }
 
 
+M3Result  m3_SetMemoryReservation  (IM3Runtime io_runtime, uint64_t i_numBytes)
+{
+#if d_m3UseMemoryReservation
+    io_runtime->memoryReservation = i_numBytes;
+    return m3Err_none;
+#else
+    return m3Err_memoryReservationUnsupported;
+#endif
+}
+
+
+M3Result  m3_EnableJit  (IM3Runtime io_runtime, int i_enable)
+{
+#if d_m3HasJit
+    io_runtime->jitEnabled = (i_enable != 0);
+# if d_m3HasBackgroundCompile
+    UpdateBackgroundJitSettings (io_runtime);
+# endif
+    return m3Err_none;
+#else
+    return m3Err_jitUnsupported;
+#endif
+}
+
+
+M3Result  m3_SetJitHotness  (IM3Runtime io_runtime, uint32_t i_hotness)
+{
+#if d_m3HasJit
+    io_runtime->jitHotness = i_hotness;
+# if d_m3HasBackgroundCompile
+    UpdateBackgroundJitSettings (io_runtime);
+# endif
+    return m3Err_none;
+#else
+    return m3Err_jitUnsupported;
+#endif
+}
+
+
+M3Result  m3_SetFuel  (IM3Runtime io_runtime, uint64_t i_fuel)
+{
+#if d_m3HasFuel
+    io_runtime->fuel = (i64) M3_MIN (i_fuel, (u64) INT64_MAX);
+    io_runtime->fuelMetered = true;
+    return m3Err_none;
+#else
+    return m3Err_fuelUnsupported;
+#endif
+}
+
+
+M3Result  m3_AddFuel  (IM3Runtime io_runtime, uint64_t i_fuel)
+{
+#if d_m3HasFuel
+    u64 fuel = (u64) io_runtime->fuel + i_fuel;
+    io_runtime->fuel = (i64) M3_MIN (fuel < i_fuel ? UINT64_MAX : fuel, (u64) INT64_MAX);
+    io_runtime->fuelMetered = true;
+    return m3Err_none;
+#else
+    return m3Err_fuelUnsupported;
+#endif
+}
+
+
+M3Result  m3_EnableFuelYield  (IM3Runtime io_runtime, int i_enable)
+{
+#if d_m3HasFuel && d_m3HasSuspend
+    io_runtime->fuelYields = i_enable;
+    return m3Err_none;
+#elif d_m3HasFuel
+    return i_enable ? m3Err_suspendUnsupported : m3Err_none;
+#else
+    return i_enable ? m3Err_fuelUnsupported : m3Err_none;
+#endif
+}
+
+
+uint64_t  m3_GetFuel  (IM3Runtime i_runtime)
+{
+#if d_m3HasFuel
+    return (u64) i_runtime->fuel;
+#else
+    return UINT64_MAX;
+#endif
+}
+
+
+uint64_t  m3_IncrementEpoch  (IM3Runtime io_runtime)
+{
+#if d_m3HasEpochs
+    return __atomic_add_fetch (& io_runtime->epoch, 1, __ATOMIC_RELAXED);
+#else
+    return 0;
+#endif
+}
+
+
+M3Result  m3_SetEpochDeadline  (IM3Runtime io_runtime, uint64_t i_numTicks)
+{
+#if d_m3HasEpochs
+    u64 epoch = __atomic_load_n (& io_runtime->epoch, __ATOMIC_RELAXED);
+    u64 deadline = epoch + i_numTicks;
+
+    io_runtime->epochDeadline = (deadline < epoch) ? UINT64_MAX : deadline;
+    return m3Err_none;
+#else
+    return m3Err_epochsUnsupported;
+#endif
+}
+
+
+M3Result  m3_EnableSuspend  (IM3Runtime io_runtime, int i_enable)
+{
+#if d_m3HasSuspend
+    M3Result result = m3Err_none;
+    M3CallFiber * call = io_runtime->callFiber;
+
+    if (i_enable and not call)
+    {
+        call = m3_AllocStruct (M3CallFiber);
+        _throwifnull (call);
+
+        call->fiber = m3_NewFiber (d_m3SuspendStackSize, RunFiberCalls, io_runtime);
+        if (not call->fiber)
+        {
+            m3_Free (call);
+            _throw (m3Err_mallocFailed);
+        }
+
+        io_runtime->callFiber = call;
+    }
+    else if (not i_enable and call)
+    {
+        while (m3_AbortSuspended (io_runtime, m3Err_trapAbort) == m3Err_suspended) {}
+
+        m3_FreeFiber (call->fiber);
+        m3_Free (call);
+        io_runtime->callFiber = NULL;
+    }
+
+    _catch: return result;
+#else
+    return i_enable ? m3Err_suspendUnsupported : m3Err_none;
+#endif
+}
+
+
+M3Result  m3_Resume  (IM3Runtime io_runtime, uint32_t i_numResults, const uint64_t * i_results)
+{
+#if d_m3HasSuspend
+    M3Result result = m3Err_none;
+    M3CallFiber * call = io_runtime->callFiber;
+
+    _throwif (m3Err_notSuspended, not IsSuspended (io_runtime));
+    _throwif (m3Err_argumentCountMismatch, i_numResults != call->numResults);
+
+    if (i_numResults)
+        memcpy (call->resultSlots, i_results, i_numResults * sizeof (u64));
+
+    result = ResumeCall (io_runtime, m3Err_none);
+
+    _catch: return result;
+#else
+    return m3Err_suspendUnsupported;
+#endif
+}
+
+
+M3Result  m3_AbortSuspended  (IM3Runtime io_runtime, M3Result i_trap)
+{
+#if d_m3HasSuspend
+    if (not IsSuspended (io_runtime))
+        return m3Err_notSuspended;
+
+    return ResumeCall (io_runtime, i_trap ? i_trap : m3Err_trapAbort);
+#else
+    return m3Err_suspendUnsupported;
+#endif
+}
+
+
 uint32_t  m3_GetMemorySize  (IM3Runtime i_runtime)
 {
     return i_runtime->memory.mallocated->length;
 }
 
 
+#if d_m3HasCheckpoints
+
+M3Result  m3_Checkpoint  (IM3Runtime io_runtime)
+{
+    M3Result result = m3Err_none;
+
+    M3Memory * memory = & io_runtime->memory;
+    M3Checkpoint * checkpoint = NULL;
+    u32 numGlobals = 0;
+
+    m3_DropCheckpoint (io_runtime);
+
+    for (IM3Module module = io_runtime->modules; module; module = module->next)
+        numGlobals += module->numGlobals;
+
+    checkpoint = m3_AllocStruct (M3Checkpoint);
+    _throwifnull (checkpoint);
+
+    if (numGlobals)
+    {
+        checkpoint->globals = m3_AllocArray (M3SavedGlobal, numGlobals);
+        _throwifnull (checkpoint->globals);
+
+        for (IM3Module module = io_runtime->modules; module; module = module->next)
+        {
+            for (u32 i = 0; i < module->numGlobals; ++i)
+            {
+                M3SavedGlobal * saved = & checkpoint->globals [checkpoint->numGlobals++];
+                saved->global = & module->globals [i];
+                saved->value = module->globals [i].i64Value;
+            }
+        }
+    }
+
+    if (memory->mallocated)
+    {
+        checkpoint->numPages = memory->numPages;
+        checkpoint->numBytes = memory->mallocated->length;
+
+        size_t numTrackedBytes = (size_t) AlignToPage (checkpoint->numBytes, m3_GetSystemPageSize ());
+
+        if (numTrackedBytes)
+        {
+            checkpoint->tracker = m3_TrackWrites (m3MemData (memory->mallocated), numTrackedBytes);
+            _throwif (m3Err_checkpointFailed, not checkpoint->tracker);
+        }
+    }
+
+    io_runtime->checkpoint = checkpoint;
+
+    _catch:
+    if (result and checkpoint)
+    {
+        m3_Free (checkpoint->globals);
+        m3_Free (checkpoint);
+    }
+
+    return result;
+}
+
+
+M3Result  m3_RestoreCheckpoint  (IM3Runtime io_runtime)
+{
+    M3Result result = m3Err_none;
+
+    M3Memory * memory = & io_runtime->memory;
+    M3Checkpoint * checkpoint = io_runtime->checkpoint;
+
+    _throwif (m3Err_noCheckpoint, not checkpoint);
+
+    if (memory->mallocated and memory->numPages != checkpoint->numPages)
+    {
+        // pages grown into since go back to being only reserved, so that growing again finds them zeroed;
+        // the rest of the OS page the checkpoint's memory ends in is tracked with it, and comes back
+        // zeroed from m3_RestoreWrites below (clearing it here would only fault it in to be saved)
+        size_t osPageSize = m3_GetSystemPageSize ();
+        u64 numKeptBytes = AlignToPage (checkpoint->numBytes, osPageSize);
+        u64 numCommittedBytes = AlignToPage (memory->mallocated->length, osPageSize);
+
+        if (numCommittedBytes > numKeptBytes)
+            m3_DecommitMemory (m3MemData (memory->mallocated) + numKeptBytes, (size_t) (numCommittedBytes - numKeptBytes));
+
+_       (ResizeMemory (io_runtime, checkpoint->numPages));
+    }
+
+    if (checkpoint->tracker)
+        m3_RestoreWrites (checkpoint->tracker);
+
+    for (u32 i = 0; i < checkpoint->numGlobals; ++i)
+        checkpoint->globals [i].global->i64Value = checkpoint->globals [i].value;
+
+    _catch: return result;
+}
+
+
+void  m3_DropCheckpoint  (IM3Runtime io_runtime)
+{
+    M3Checkpoint * checkpoint = io_runtime->checkpoint;
+
+    if (checkpoint)
+    {
+        m3_StopTrackingWrites (checkpoint->tracker);
+
+        m3_Free (checkpoint->globals);
+        m3_Free (checkpoint);
+
+        io_runtime->checkpoint = NULL;
+    }
+}
+
+
+void  m3_TouchMemory  (IM3Runtime i_runtime, const void * i_ptr, uint32_t i_size)
+{
+    M3Checkpoint * checkpoint = i_runtime->checkpoint;
+
+    if (checkpoint and checkpoint->tracker)
+        m3_MarkWritten (checkpoint->tracker, (void *) i_ptr, i_size);
+}
+
+#else
+
+M3Result  m3_Checkpoint  (IM3Runtime io_runtime)
+{
+    return m3Err_checkpointUnsupported;
+}
+
+M3Result  m3_RestoreCheckpoint  (IM3Runtime io_runtime)
+{
+    return m3Err_checkpointUnsupported;
+}
+
+void  m3_DropCheckpoint  (IM3Runtime io_runtime)
+{
+}
+
+void  m3_TouchMemory  (IM3Runtime i_runtime, const void * i_ptr, uint32_t i_size)
+{
+}
+
+#endif // d_m3HasCheckpoints
+
+
 M3BacktraceInfo *  m3_GetBacktrace  (IM3Runtime i_runtime)
 {
 # if d_m3RecordBacktraces
@@ -33,6 +33,11 @@ typedef struct M3Memory
     u32                     numPages;
     u32                     maxPages;
     u32                     pageSize;
+
+#if d_m3UseMemoryReservation
+    void *                  reserved;           // start of the address space reservation; mallocated lies inside it
+    size_t                  numReservedBytes;
+#endif
 }
 M3Memory;
 
@@ -48,6 +53,7 @@ typedef struct M3Table
     void **                 elements;
     u32                     size;
     u32                     maxSize;            // 0 when the module declared no maximum
+    u32                     initSize;           // as declared, for the instances of a shared module
     m3type_t                type;
 
     // Every slot starts out holding this, rather than null. A table whose
@@ -144,6 +150,13 @@ typedef struct M3Module
     M3Function *            functions;
 
     i32                     startFunction;
+    i32                     sharedStartFunction;    // startFunction when the module was shared, before it ran
+
+    // m3_ShareModule compiles a module's code to run in any runtime holding an instance of it.
+    // An instance has its own globals, tables, segments and functions, and borrows the rest,
+    // code included, from the module it was made from.
+    bool                    codeIsShared;
+    struct M3Module *       sharedFrom;             // set in an instance
 
     u32                     numDataSegments;
     M3DataSegment *         dataSegments;
@@ -185,6 +198,105 @@ M3Result                    Module_DeclareFunction      (IM3Module io_module, u3
 bool                        Module_IsFunctionDeclared   (IM3Module i_module, u32 i_index);
 
 M3Result                    Module_PreallocFunctions    (IM3Module io_module, u32 i_totalFunctions);
+
+//---------------------------------------------------------------------------------------------------------------------------------
+
+// A call whose signature was checked up front by m3_PrepareCall, with its arguments
+// and results left in place on the runtime's stack
+typedef struct M3PreparedCall
+{
+    IM3Function             function;
+    pc_t                    pc;
+
+    u64 *                   args;           // the slots after the results
+    u64 *                   results;        // the bottom of the stack
+}
+M3PreparedCall;
+
+
+#if d_m3HasSuspend
+// The native stack a runtime's outermost calls run on, once m3_EnableSuspend is on, and
+// the call in progress on it. A host function suspending the call leaves the fiber with
+// the call's frames intact on it; m3_Resume enters it again to carry on.
+typedef struct M3CallFiber
+{
+    struct M3Fiber *        fiber;
+
+    pc_t                    pc;             // the call to run next time the fiber's entered
+    M3Result                result;         // and how it went, once it has
+
+    u64 *                   resultSlots;    // the suspended host function's
+    u32                     numResults;
+    M3Result                resumeTrap;     // what the suspended host function returns, when it's aborted
+
+    bool                    running;        // a call is on the fiber, suspended or not
+    bool                    suspended;
+    M3Result                reason;         // what the suspended call returns: m3Err_suspended or m3Err_yielded
+    IM3Function             function;       // the suspended call's, for m3_Resume to report
+}
+M3CallFiber;
+
+// Suspends the call running on the runtime's fiber from the host function whose results are
+// at io_slots, or from a call giving way (i_reason m3Err_yielded, with no results). Returns
+// once the call's resumed, with what the host function, or the yield, should return.
+M3Result                    SuspendCall                 (IM3Runtime io_runtime, u64 * io_slots, u32 i_numResults, M3Result i_reason);
+#endif
+
+// The call asked to give way by m3_Yield is suspended, if it can be, and carries on otherwise
+M3Result                    GiveWay                     (IM3Runtime io_runtime);
+
+#if d_m3HasFuel
+// What a call that's run out of fuel does: trap, or give way (see m3_EnableFuelYield)
+M3Result                    FuelRanOut                  (IM3Runtime io_runtime);
+#endif
+
+
+// An initialised instance of a shared module, frozen by m3_NewSnapshot for m3_ForkSnapshot
+// to make others from without running any of their initialisation
+typedef struct M3Snapshot
+{
+    IM3Module               module;             // the shared module; function references point into it
+
+    M3Global *              globals;
+    M3Table *               tables;
+    bool *                  dropped;            // the data segments', then the element segments'
+    i32                     startFunction;
+
+    u32                     numPages;
+    u32                     maxPages;
+    u32                     pageSize;
+    size_t                  numBytes;
+    u8 *                    memory;             // a copy, when there's no image to map
+#if d_m3HasMemoryImages
+    int                     image;              // -1 for none
+#endif
+}
+M3Snapshot;
+
+// Puts the runtime's instance of the snapshot's module back as it was in the snapshot
+M3Result                    Runtime_Reset               (IM3Runtime io_runtime, IM3Snapshot i_snapshot);
+
+#if d_m3HasCheckpoints
+typedef struct M3SavedGlobal
+{
+    M3Global *              global;
+    i64                     value;
+}
+M3SavedGlobal;
+
+// A runtime's linear memory and globals as they were at m3_Checkpoint. The memory is
+// write-tracked, so only what has changed since is kept, and copied back.
+typedef struct M3Checkpoint
+{
+    M3WriteTracker *        tracker;            // NULL for a memory of no pages
+    u32                     numPages;
+    size_t                  numBytes;
+
+    M3SavedGlobal *         globals;
+    u32                     numGlobals;
+}
+M3Checkpoint;
+#endif
 M3Result                    Module_AddFunction          (IM3Module io_module, u32 i_typeIndex, IM3ImportInfo i_importInfo /* can be null */);
 IM3Function                 Module_GetFunction          (IM3Module i_module, u32 i_functionIndex);
 
@@ -194,16 +306,38 @@ void                        FreeImportInfo              (M3ImportInfo * i_info);
 
 //---------------------------------------------------------------------------------------------------------------------------------
 
+typedef struct M3CodePageShard
+{
+    M3CodePage *            pages;
+#if d_m3HasConcurrentEnvironment
+    u32                     lock;
+#endif
+}
+M3CodePageShard;
+
+// open addressed on M3FuncType.hash; kept at most half full
+typedef struct M3FuncTypeTable
+{
+    struct M3FuncTypeTable *    replaced;                       // the smaller one before it, which lookups may still be reading
+    u32                         mask;
+    IM3FuncType                 slots [];
+}
+M3FuncTypeTable;
+
 typedef struct M3Environment
 {
 //    struct M3Runtime *      runtimes;
 
     IM3FuncType             funcTypes;                          // linked list of unique M3FuncType structs that can be compared using pointer-equivalence
+    M3FuncTypeTable *       funcTypeTable;                      // finds them by their types
 
     IM3FuncType             retFuncTypes [c_m3Type_count];      // these 'point' to elements in the linked list above.
                                                                 // the number of elements must match the basic types as per M3ValueType
     u16                     numFuncTypes;                       // hands out M3FuncType.canonicalIndex
-    M3CodePage *            pagesReleased;
+#if d_m3HasConcurrentEnvironment
+    u32                     funcTypesLock;                      // held to add a type; finding one goes without
+#endif
+    M3CodePageShard         pagesReleased [d_m3CodePageShards];
 
     M3SectionHandler        customSectionHandler;
 }
@@ -234,6 +368,7 @@ typedef struct M3Runtime
     u32                     numActiveCodePages;
 
     IM3Module               modules;        // linked list of imported modules
+    IM3Module               sharedInstance; // the one module here running shared code (see m3_ShareModule)
 
     void *                  stack;
     void *                  originStack;
@@ -246,11 +381,63 @@ typedef struct M3Runtime
 
     M3Memory                memory;
     u32                     memoryLimit;
+#if d_m3UseMemoryReservation
+    u64                     memoryReservation;  // address space set aside for linear memory (0 = up to its maximum)
+#endif
 
 #if d_m3EnableStrace >= 2
     u32                     callDepth;
 #endif
 
+#if d_m3HasFuel
+    i64                     fuel;           // see m3_SetFuel; INT64_MAX until set
+    bool                    fuelMetered;    // once fuel is set or added; until then calls leave it be
+#endif
+
+#if d_m3HasEpochs
+    u64                     epoch;          // bumped by m3_IncrementEpoch, from any thread
+    u64                     epochDeadline;  // calls trap once epoch reaches it; UINT64_MAX until set
+#endif
+
+#if d_m3HasSuspend
+    M3CallFiber *           callFiber;      // see m3_EnableSuspend; NULL when off
+    bool                    fuelYields;     // see m3_EnableFuelYield
+#endif
+
+#if d_m3HasJit
+    bool                    jitEnabled;
+    u32                     jitHotness;     // 0 compiles every function natively straight away
+    struct M3JitArena *     jit;            // native code generated for this runtime's functions
+#endif
+
+#if d_m3HasBackgroundCompile
+    struct M3BackgroundCompiler *   compiler;   // compiles ahead of first calls on its own thread; NULL when off
+#endif
+
+#if d_m3HasCheckpoints
+    struct M3Checkpoint *   checkpoint;     // see m3_Checkpoint
+#endif
+
+#if d_m3HasPool
+    struct M3Pool *         pool;           // the pool the runtime is handed out from, if any
+    u32                     poolIndex;
+    bool                    poolNeedsReset; // its reset on release failed, so it's tried again when handed out
+#endif
+
+#if d_m3HasScheduler
+    struct M3Task *         tasks;          // calls scheduled on the runtime, the one running or next first
+    struct M3Task *         lastTask;
+    u32                     tasksLock;      // a spin lock over those and 'queued'
+    bool                    queued;         // it's in a worker's queue, or running on the worker
+    struct M3Runtime *      nextQueued;     // behind it in the worker's queue
+
+    bool                    sliced;         // set up for the scheduler's time-slicing; what it
+    bool                    ownSuspend;     // found set before, and puts back after the last call
+    bool                    ownFuelYields;
+    bool                    ownFuelMetered;
+    i64                     ownFuel;
+#endif
+
     M3ErrorInfo             error;
 #if d_m3VerboseErrorMessages
     char                    error_message[256]; // the actual buffer. M3ErrorInfo can point to this
@@ -293,6 +480,11 @@ IM3CodePage                 AcquireCodePage             (IM3Runtime io_runtime);
 IM3CodePage                 AcquireCodePageWithCapacity (IM3Runtime io_runtime, u32 i_lineCount);
 void                        ReleaseCodePage             (IM3Runtime io_runtime, IM3CodePage i_codePage);
 
+#if d_m3HasBackgroundCompile
+void                        QueueBackgroundCompile      (IM3Runtime i_runtime, IM3Function i_function);
+M3Result                    ClaimAndCompileFunction     (IM3Runtime i_runtime, IM3Function io_function);
+#endif
+
 d_m3EndExternC
 
 #endif // m3_env_h
@@ -87,6 +87,69 @@ d_m3BeginExternC
 #   define d_m3CheckNativeStack()           do {} while (0)
 #endif
 
+// Charge a function entry or loop iteration to the runtime's fuel (see m3_SetFuel),
+// and trap once it has run out. A trap leaves the fuel at 0, so later calls trap too;
+// a call that gives way instead carries on with whatever it's resumed with. A runtime
+// whose fuel was never set isn't charged, and doesn't write it back each time.
+#if d_m3HasFuel
+#   define d_m3ChargeFuel(COST)                                                 \
+        do {                                                                    \
+            IM3Runtime _m3Fuel = m3MemRuntime (_mem);                           \
+            if (M3_UNLIKELY (_m3Fuel->fuelMetered) and                          \
+                M3_UNLIKELY ((_m3Fuel->fuel -= (COST)) < 0)) {                  \
+                _m3Fuel->fuel = 0;                                              \
+                M3Result _m3Trap = FuelRanOut (_m3Fuel);                        \
+                if (_m3Trap)                                                    \
+                    newTrap (_m3Trap);                                          \
+            }                                                                   \
+        } while (0)
+#else
+#   define d_m3ChargeFuel(COST)             do {} while (0)
+#endif
+
+// Trap once another thread has moved the runtime's epoch up to its deadline
+// (see m3_SetEpochDeadline). Checked wherever fuel is charged.
+#if d_m3HasEpochs
+#   define d_m3CheckEpoch()                                                     \
+        do {                                                                    \
+            IM3Runtime _m3Epoch = m3MemRuntime (_mem);                          \
+            if (M3_UNLIKELY (__atomic_load_n (& _m3Epoch->epoch, __ATOMIC_RELAXED) >= _m3Epoch->epochDeadline)) \
+                newTrap (m3Err_trapInterrupted);                                \
+        } while (0)
+#else
+#   define d_m3CheckEpoch()                 do {} while (0)
+#endif
+
+// Stackless calls (see d_m3Stackless): a call pushes a frame with where the caller carries on,
+// and jumps to the callee, whose return pops it and jumps back. The frame a run starts with
+// (see RunCodeChecked) has no pc, and returns from RunCode instead.
+#if d_m3Stackless
+#   define d_m3PushCallFrame()                                                  \
+        do {                                                                    \
+            M3CallFrame * _m3Frame = (M3CallFrame *) _mem->maxStack - 1;        \
+            _m3Frame->pc = _pc;                                                 \
+            _m3Frame->sp = _sp;                                                 \
+            d_m3SetFrameFunction (_m3Frame, NULL);                              \
+            _mem->maxStack = _m3Frame;                                          \
+        } while (0)
+
+#   define d_m3ReturnToCaller()                                                 \
+        do {                                                                    \
+            M3CallFrame * _m3Frame = (M3CallFrame *) _mem->maxStack;            \
+            _mem->maxStack = _m3Frame + 1;                                      \
+            if (M3_UNLIKELY (not _m3Frame->pc))                                 \
+                return m3Err_none;                                              \
+            _sp = _m3Frame->sp;                                                 \
+            jumpOp (_m3Frame->pc);                                              \
+        } while (0)
+
+    // op_Entry leaves room above the function's slots for the frame of a call it makes,
+    // and for the one a host function it calls may start a nested run with
+#   define d_m3FrameReserveSlots            (2 * sizeof (M3CallFrame) / sizeof (m3slot_t))
+#else
+#   define d_m3FrameReserveSlots            0
+#endif
+
 
 #if d_m3EnableStrace == 1
     // Flat trace
@@ -124,13 +187,25 @@ d_m3BeginExternC
 
 #endif
 
+// m3_Yield, at every call; see GiveWay for its m3Err_yielded
+static inline
+M3Result  YieldCall  (IM3Runtime io_runtime)
+{
+    M3Result result = m3_Yield ();
+
+    if (M3_UNLIKELY (result == m3Err_yielded))
+        result = GiveWay (io_runtime);
+
+    return result;
+}
+
 # if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
 d_m3RetSig  Call  (d_m3OpSig, cstr_t i_operationName)
 # else
 d_m3RetSig  Call  (d_m3OpSig)
 # endif
 {
-    m3ret_t possible_trap = m3_Yield ();
+    m3ret_t possible_trap = YieldCall (m3MemRuntime (_mem));
     if (M3_UNLIKELY(possible_trap)) return possible_trap;
 
     nextOpDirect();
@@ -273,6 +348,134 @@ d_m3OpFunc_f(f32, CopySign, copysignf);
 d_m3OpFunc_f(f64, CopySign, copysign);
 #endif
 
+// Three-address operations: both operands and the result are slots, so a
+// local.get/local.get/op/local.set run needs neither _r0 nor a trailing copy.
+#define d_m3ThreeAddressMacro(TYPE, NAME, OP, ...)      \
+d_m3Op(TYPE##_##NAME##_sss)                             \
+{                                                       \
+    TYPE operand2 = slot (TYPE);                        \
+    TYPE operand1 = slot (TYPE);                        \
+    TYPE value;                                         \
+    OP(value, operand1, operand2, ##__VA_ARGS__);       \
+    slot (TYPE) = value;                                \
+    nextOp ();                                          \
+}
+
+#define d_m3ThreeAddressOp(TYPE, NAME, OP)          d_m3ThreeAddressMacro       (TYPE, NAME, M3_OPER, OP)
+#define d_m3ThreeAddressFunc(TYPE, NAME, OP)        d_m3ThreeAddressMacro       (TYPE, NAME, M3_FUNC, OP)
+
+d_m3ThreeAddressFunc (i32, Add,         OP_ADD_32)  d_m3ThreeAddressFunc (i64, Add,         OP_ADD_64)
+d_m3ThreeAddressFunc (i32, Subtract,    OP_SUB_32)  d_m3ThreeAddressFunc (i64, Subtract,    OP_SUB_64)
+d_m3ThreeAddressFunc (i32, Multiply,    OP_MUL_32)  d_m3ThreeAddressFunc (i64, Multiply,    OP_MUL_64)
+
+d_m3ThreeAddressOp   (u32, And,         &)          d_m3ThreeAddressOp   (u64, And,         &)
+d_m3ThreeAddressOp   (u32, Or,          |)          d_m3ThreeAddressOp   (u64, Or,          |)
+d_m3ThreeAddressOp   (u32, Xor,         ^)          d_m3ThreeAddressOp   (u64, Xor,         ^)
+
+d_m3ThreeAddressFunc (u32, ShiftLeft,   OP_SHL_32)  d_m3ThreeAddressFunc (u64, ShiftLeft,   OP_SHL_64)
+d_m3ThreeAddressFunc (i32, ShiftRight,  OP_SHR_32)  d_m3ThreeAddressFunc (i64, ShiftRight,  OP_SHR_64)
+d_m3ThreeAddressFunc (u32, ShiftRight,  OP_SHR_32)  d_m3ThreeAddressFunc (u64, ShiftRight,  OP_SHR_64)
+
+#if d_m3HasFloat
+d_m3ThreeAddressOp   (f32, Add,         +)          d_m3ThreeAddressOp   (f64, Add,         +)
+d_m3ThreeAddressOp   (f32, Subtract,    -)          d_m3ThreeAddressOp   (f64, Subtract,    -)
+d_m3ThreeAddressOp   (f32, Multiply,    *)          d_m3ThreeAddressOp   (f64, Multiply,    *)
+d_m3ThreeAddressOp   (f32, Divide,      /)          d_m3ThreeAddressOp   (f64, Divide,      /)
+#endif
+
+#if d_m3HasSecondRegister
+
+// _r1 holds the one value the compiler has displaced from _r0. It is either
+// consumed by an _xr operation (the deeper operand in _r1, the top in _r0) or
+// flushed to its backing slot before anything else can see it.
+d_m3Op  (MoveToExtraRegister)
+{
+    _r1 = _r0;
+    nextOp ();
+}
+
+d_m3Op  (SetSlotFromExtra_i32)
+{
+    slot (i32) = (i32) _r1;
+    nextOp ();
+}
+
+d_m3Op  (SetSlotFromExtra_i64)
+{
+    slot (i64) = (i64) _r1;
+    nextOp ();
+}
+
+#define d_m3ExtraRegisterOpMacro(TYPE, NAME, OP, ...)   \
+d_m3Op(TYPE##_##NAME##_xr)                              \
+{                                                       \
+    OP(_r0, ((TYPE) _r1), ((TYPE) _r0), ##__VA_ARGS__); \
+    nextOp ();                                          \
+}
+
+d_m3ExtraRegisterOpMacro (i32, Add,      M3_FUNC, OP_ADD_32)    d_m3ExtraRegisterOpMacro (i64, Add,      M3_FUNC, OP_ADD_64)
+d_m3ExtraRegisterOpMacro (i32, Subtract, M3_FUNC, OP_SUB_32)    d_m3ExtraRegisterOpMacro (i64, Subtract, M3_FUNC, OP_SUB_64)
+d_m3ExtraRegisterOpMacro (i32, Multiply, M3_FUNC, OP_MUL_32)    d_m3ExtraRegisterOpMacro (i64, Multiply, M3_FUNC, OP_MUL_64)
+d_m3ExtraRegisterOpMacro (u32, And,      M3_OPER, &)            d_m3ExtraRegisterOpMacro (u64, And,      M3_OPER, &)
+d_m3ExtraRegisterOpMacro (u32, Or,       M3_OPER, |)            d_m3ExtraRegisterOpMacro (u64, Or,       M3_OPER, |)
+d_m3ExtraRegisterOpMacro (u32, Xor,      M3_OPER, ^)            d_m3ExtraRegisterOpMacro (u64, Xor,      M3_OPER, ^)
+
+#endif // d_m3HasSecondRegister
+
+// Immediate-operand operations: the top operand is a constant carried in the
+// code stream (after any slot), in place of a constant table slot.
+// A 64-bit immediate takes two lines on 32-bit targets, as in op_Const64.
+#define d_m3ImmediateOperand(TYPE)                      \
+    TYPE constant = * (TYPE *) _pc;                     \
+    _pc += (sizeof (TYPE) > M3_SIZEOF_PTR) ? 2 : 1;
+
+#define d_m3ImmediateOpMacro(RES, REG, TYPE, NAME, OP, ...) \
+d_m3Op(TYPE##_##NAME##_ir)                              \
+{                                                       \
+    d_m3ImmediateOperand (TYPE)                         \
+    OP((RES), ((TYPE) REG), constant, ##__VA_ARGS__);   \
+    nextOp ();                                          \
+}                                                       \
+d_m3Op(TYPE##_##NAME##_is)                              \
+{                                                       \
+    TYPE operand = slot (TYPE);                         \
+    d_m3ImmediateOperand (TYPE)                         \
+    OP((RES), operand, constant, ##__VA_ARGS__);        \
+    nextOp ();                                          \
+}
+
+#define d_m3ImmediateOp_i(TYPE, NAME, OP)           d_m3ImmediateOpMacro        (_r0, _r0, TYPE, NAME, M3_OPER, OP)
+#define d_m3ImmediateOpFunc_i(TYPE, NAME, OP)       d_m3ImmediateOpMacro        (_r0, _r0, TYPE, NAME, M3_FUNC, OP)
+
+d_m3ImmediateOp_i (i32, Equal,              ==)     d_m3ImmediateOp_i (i64, Equal,              ==)
+d_m3ImmediateOp_i (i32, NotEqual,           !=)     d_m3ImmediateOp_i (i64, NotEqual,           !=)
+d_m3ImmediateOp_i (i32, LessThan,           < )     d_m3ImmediateOp_i (i64, LessThan,           < )
+d_m3ImmediateOp_i (i32, GreaterThan,        > )     d_m3ImmediateOp_i (i64, GreaterThan,        > )
+d_m3ImmediateOp_i (i32, LessThanOrEqual,    <=)     d_m3ImmediateOp_i (i64, LessThanOrEqual,    <=)
+d_m3ImmediateOp_i (i32, GreaterThanOrEqual, >=)     d_m3ImmediateOp_i (i64, GreaterThanOrEqual, >=)
+d_m3ImmediateOp_i (u32, LessThan,           < )     d_m3ImmediateOp_i (u64, LessThan,           < )
+d_m3ImmediateOp_i (u32, GreaterThan,        > )     d_m3ImmediateOp_i (u64, GreaterThan,        > )
+d_m3ImmediateOp_i (u32, LessThanOrEqual,    <=)     d_m3ImmediateOp_i (u64, LessThanOrEqual,    <=)
+d_m3ImmediateOp_i (u32, GreaterThanOrEqual, >=)     d_m3ImmediateOp_i (u64, GreaterThanOrEqual, >=)
+
+d_m3ImmediateOpFunc_i (i32, Add,        OP_ADD_32)  d_m3ImmediateOpFunc_i (i64, Add,        OP_ADD_64)
+d_m3ImmediateOpFunc_i (i32, Subtract,   OP_SUB_32)  d_m3ImmediateOpFunc_i (i64, Subtract,   OP_SUB_64)
+d_m3ImmediateOpFunc_i (i32, Multiply,   OP_MUL_32)  d_m3ImmediateOpFunc_i (i64, Multiply,   OP_MUL_64)
+
+d_m3ImmediateOp_i (u32, And,                &)      d_m3ImmediateOp_i (u64, And,                &)
+d_m3ImmediateOp_i (u32, Or,                 |)      d_m3ImmediateOp_i (u64, Or,                 |)
+d_m3ImmediateOp_i (u32, Xor,                ^)      d_m3ImmediateOp_i (u64, Xor,                ^)
+
+d_m3ImmediateOpFunc_i (u32, ShiftLeft,  OP_SHL_32)  d_m3ImmediateOpFunc_i (u64, ShiftLeft,  OP_SHL_64)
+d_m3ImmediateOpFunc_i (i32, ShiftRight, OP_SHR_32)  d_m3ImmediateOpFunc_i (i64, ShiftRight, OP_SHR_64)
+d_m3ImmediateOpFunc_i (u32, ShiftRight, OP_SHR_32)  d_m3ImmediateOpFunc_i (u64, ShiftRight, OP_SHR_64)
+
+// the compiler only emits these for a divisor that can't trap: not 0, nor -1 when signed
+d_m3ImmediateOp_i (i32, Divide,             /)      d_m3ImmediateOp_i (i64, Divide,             /)
+d_m3ImmediateOp_i (u32, Divide,             /)      d_m3ImmediateOp_i (u64, Divide,             /)
+d_m3ImmediateOp_i (i32, Remainder,          %)      d_m3ImmediateOp_i (i64, Remainder,          %)
+d_m3ImmediateOp_i (u32, Remainder,          %)      d_m3ImmediateOp_i (u64, Remainder,          %)
+
 // Unary operations
 // Note: This macro follows the principle of d_m3OpMacro
 
@@ -523,44 +726,61 @@ d_m3ReinterpretOp (_fp0, f64, _r0, i64)
 #endif
 
 
-d_m3Op  (GetGlobal_s32)
-{
-    u32 * global = immediate (u32 *);
-    slot (u32) = * global;                        //  printf ("get global: %p %" PRIi64 "\n", global, *global);
-
-    nextOp ();
-}
-
+// Code compiled by m3_ShareModule runs in every runtime holding an instance of its module,
+// so it carries the index of a table or segment instead of the address (for a global, the
+// value's offset into the globals) and finds it in the instance of the runtime running it.
+#define d_m3SharedInstance                  (m3MemRuntime (_mem)->sharedInstance)
+#define sharedGlobal(TYPE)                  ((TYPE *) ((u8 *) d_m3SharedInstance->globals + immediate (u32)))
+#define sharedTable()                       (& d_m3SharedInstance->tables [immediate (u32)])
+#define sharedDataSegment()                 (& d_m3SharedInstance->dataSegments [immediate (u32)])
+#define sharedElementSegment()              (& d_m3SharedInstance->elementSegments [immediate (u32)])
+#define sharedFunction()                    (& d_m3SharedInstance->functions [immediate (u32)])
 
-d_m3Op  (GetGlobal_s64)
-{
-    u64 * global = immediate (u64 *);
-    slot (u64) = * global;                        // printf ("get global: %p %" PRIi64 "\n", global, *global);
 
-    nextOp ();
+#define d_m3GetGlobalOp(NAME, TYPE, GLOBAL)                 \
+d_m3Op  (NAME)                                              \
+{                                                           \
+    TYPE * global = GLOBAL;                                 \
+    slot (TYPE) = * global;                                 \
+                                                            \
+    nextOp ();                                              \
 }
 
+#define d_m3SetGlobalOp(NAME, TYPE, GLOBAL, VALUE)          \
+d_m3Op  (NAME)                                              \
+{                                                           \
+    TYPE * global = GLOBAL;                                 \
+    * global = VALUE;                                       \
+                                                            \
+    nextOp ();                                              \
+}
 
-d_m3Op  (SetGlobal_i32)
-{
-    u32 * global = immediate (u32 *);
-    * global = (u32) _r0;                         //  printf ("set global: %p %" PRIi64 "\n", global, _r0);
+d_m3GetGlobalOp (GetGlobal_s32,         u32,    immediate (u32 *))
+d_m3GetGlobalOp (GetGlobal_s64,         u64,    immediate (u64 *))
+d_m3SetGlobalOp (SetGlobal_i32,         u32,    immediate (u32 *),      (u32) _r0)
+d_m3SetGlobalOp (SetGlobal_i64,         u64,    immediate (u64 *),      (u64) _r0)
 
-    nextOp ();
-}
+d_m3GetGlobalOp (GetGlobalShared_s32,   u32,    sharedGlobal (u32))
+d_m3GetGlobalOp (GetGlobalShared_s64,   u64,    sharedGlobal (u64))
+d_m3SetGlobalOp (SetGlobalShared_i32,   u32,    sharedGlobal (u32),     (u32) _r0)
+d_m3SetGlobalOp (SetGlobalShared_i64,   u64,    sharedGlobal (u64),     (u64) _r0)
 
 
-d_m3Op  (SetGlobal_i64)
+d_m3Op  (Call)
 {
-    u64 * global = immediate (u64 *);
-    * global = (u64) _r0;                         //  printf ("set global: %p %" PRIi64 "\n", global, _r0);
+#if d_m3Stackless
+    pc_t callPC                 = immediate (pc_t);
+    i32 stackOffset             = immediate (i32);
 
-    nextOp ();
-}
+    m3ret_t possible_trap = YieldCall (m3MemRuntime (_mem));
+    if (M3_UNLIKELY(possible_trap))
+        newTrap (possible_trap);
 
+    d_m3PushCallFrame ();
+    _sp += stackOffset;
 
-d_m3Op  (Call)
-{
+    jumpOp (callPC);
+#else
     d_m3CheckNativeStack ();
 
     pc_t callPC                 = immediate (pc_t);
@@ -584,9 +804,49 @@ d_m3Op  (Call)
         pushBacktraceFrame ();
         forwardTrap (r);
     }
+#endif
 }
 
 
+# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
+#   define d_m3CallCompiled(PC, SP)         Call (PC, SP, _mem, d_m3OpDefaultArgs, d_m3BaseCstr)
+# else
+#   define d_m3CallCompiled(PC, SP)         Call (PC, SP, _mem, d_m3OpDefaultArgs)
+# endif
+
+// Calls the compiled function at PC with its frame at SP, and carries on once it returns
+// (leaving r set to a trap, if there is one)
+#if d_m3Stackless
+#   define d_m3EnterCallee(PC, SP)                                              \
+        {                                                                       \
+            (void) memory;                                                      \
+            r = YieldCall (m3MemRuntime (_mem));                                \
+            if (M3_UNLIKELY (r))                                                \
+                newTrap (r);                                                    \
+                                                                                \
+            d_m3PushCallFrame ();                                               \
+            _sp = (SP);                                                         \
+            jumpOp (PC);                                                        \
+        }
+#else
+#   define d_m3EnterCallee(PC, SP)                                              \
+        {                                                                       \
+            d_m3CheckNativeStack ();                                            \
+            r = d_m3CallCompiled (PC, SP);                                      \
+                                                                                \
+            _mem = memory->mallocated;                                          \
+                                                                                \
+            if (M3_LIKELY(not r))                                               \
+                nextOpDirect ();                                                \
+            else                                                                \
+            {                                                                   \
+                pushBacktraceFrame ();                                          \
+                forwardTrap (r);                                                \
+            }                                                                   \
+        }
+#endif
+
+
 // call_ref / return_call_ref: like the indirect calls, except the callee comes
 // straight off the stack instead of out of a table, so there is no bounds check
 // and no index. The type still has to match: a (ref null $t) can hold a
@@ -606,27 +866,11 @@ d_m3Op  (CallRef)
     {
         if (M3_LIKELY(type == function->funcType))
         {
-            if (M3_UNLIKELY(not function->compiled))
+            if (M3_UNLIKELY(not LoadCompiled (function)))
                 r = CompileFunction (function);
 
             if (M3_LIKELY(not r))
-            {
-# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
-                r = Call (function->compiled, sp, _mem, d_m3OpDefaultArgs, d_m3BaseCstr);
-# else
-                r = Call (function->compiled, sp, _mem, d_m3OpDefaultArgs);
-# endif
-
-                _mem = memory->mallocated;
-
-                if (M3_LIKELY(not r))
-                    nextOpDirect ();
-                else
-                {
-                    pushBacktraceFrame ();
-                    forwardTrap (r);
-                }
-            }
+                d_m3EnterCallee (function->compiled, sp)
         }
         else r = m3Err_trapIndirectCallTypeMismatch;
     }
@@ -651,61 +895,57 @@ d_m3Op  (RefAsNonNull)
 }
 
 
-d_m3Op  (CallIndirect)
+// ref.func in shared code: the function's address is only known once the running
+// instance is, so it goes into a slot instead of the constant table.
+d_m3Op  (RefFuncShared)
 {
-    d_m3CheckNativeStack ();
-
-    u32 tableIndex              = slot (u32);
-    M3Table * table             = immediate (M3Table *);
-    IM3FuncType type            = immediate (IM3FuncType);
-    i32 stackOffset             = immediate (i32);
-    IM3Memory memory            = m3MemInfo (_mem);
-
-    m3stack_t sp = _sp + stackOffset;
-
-    m3ret_t r = m3Err_none;
-
-    if (M3_LIKELY(tableIndex < table->size))
-    {
-        IM3Function function = (IM3Function) table->elements [tableIndex];
-
-        if (M3_LIKELY(function))
-        {
-            if (M3_LIKELY(type == function->funcType))
-            {
-                if (M3_UNLIKELY(not function->compiled))
-                    r = CompileFunction (function);
+    IM3Function function = sharedFunction ();
+    slot (IM3Function) = function;
 
-                if (M3_LIKELY(not r))
-                {
+    nextOp ();
+}
 
-# if (d_m3EnableOpProfiling || d_m3EnableOpTracing)
-                    r = Call (function->compiled, sp, _mem, d_m3OpDefaultArgs, d_m3BaseCstr);
-# else
-                    r = Call (function->compiled, sp, _mem, d_m3OpDefaultArgs);
-# endif
 
-                    _mem = memory->mallocated;
-
-                    if (M3_LIKELY(not r))
-                        nextOpDirect ();
-                    else
-                    {
-                        pushBacktraceFrame ();
-                        forwardTrap (r);
-                    }
-                }
-            }
-            else r = m3Err_trapIndirectCallTypeMismatch;
-        }
-        else r = m3Err_trapTableElementIsNull;
-    }
-    else r = m3Err_trapTableIndexOutOfRange;
-
-    if (M3_UNLIKELY(r))
-        newTrap (r);
-    else forwardTrap (r);
-}
+#define d_m3CallIndirectOp(NAME, TABLE)                                                             \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    u32 tableIndex              = slot (u32);                                                       \
+    M3Table * table             = TABLE;                                                            \
+    IM3FuncType type            = immediate (IM3FuncType);                                          \
+    i32 stackOffset             = immediate (i32);                                                  \
+    IM3Memory memory            = m3MemInfo (_mem);                                                 \
+                                                                                                    \
+    m3stack_t sp = _sp + stackOffset;                                                               \
+                                                                                                    \
+    m3ret_t r = m3Err_none;                                                                         \
+                                                                                                    \
+    if (M3_LIKELY(tableIndex < table->size))                                                        \
+    {                                                                                               \
+        IM3Function function = (IM3Function) table->elements [tableIndex];                          \
+                                                                                                    \
+        if (M3_LIKELY(function))                                                                    \
+        {                                                                                           \
+            if (M3_LIKELY(type == function->funcType))                                              \
+            {                                                                                       \
+                if (M3_UNLIKELY(not LoadCompiled (function)))                                       \
+                    r = CompileFunction (function);                                                 \
+                                                                                                    \
+                if (M3_LIKELY(not r))                                                               \
+                    d_m3EnterCallee (function->compiled, sp)                                        \
+            }                                                                                       \
+            else r = m3Err_trapIndirectCallTypeMismatch;                                            \
+        }                                                                                           \
+        else r = m3Err_trapTableElementIsNull;                                                      \
+    }                                                                                               \
+    else r = m3Err_trapTableIndexOutOfRange;                                                        \
+                                                                                                    \
+    if (M3_UNLIKELY(r))                                                                             \
+        newTrap (r);                                                                                \
+    else forwardTrap (r);                                                                           \
+}
+
+d_m3CallIndirectOp (CallIndirect,               immediate (M3Table *))
+d_m3CallIndirectOp (CallIndirectShared,         sharedTable ())
 
 
 // return_call / return_call_indirect: the callee takes over this function's stack frame
@@ -726,7 +966,7 @@ d_m3Op  (ReturnCall)
     i32 returnSlots             = immediate (i32);
     u32 numArgSlots             = immediate (u32);
 
-    m3ret_t possible_trap = m3_Yield ();
+    m3ret_t possible_trap = YieldCall (m3MemRuntime (_mem));
     if (M3_UNLIKELY(possible_trap))
         newTrap (possible_trap);
 
@@ -750,12 +990,12 @@ d_m3Op  (ReturnCallRef)
     {
         if (M3_LIKELY(type == function->funcType))
         {
-            if (M3_UNLIKELY(not function->compiled))
+            if (M3_UNLIKELY(not LoadCompiled (function)))
                 r = CompileFunction (function);
 
             if (M3_LIKELY(not r))
             {
-                r = m3_Yield ();
+                r = YieldCall (m3MemRuntime (_mem));
 
                 if (M3_LIKELY(not r))
                 {
@@ -773,54 +1013,63 @@ d_m3Op  (ReturnCallRef)
 }
 
 
-d_m3Op  (ReturnCallIndirect)
-{
-    u32 tableIndex              = slot (u32);
-    M3Table * table             = immediate (M3Table *);
-    IM3FuncType type            = immediate (IM3FuncType);
-    i32 stackOffset             = immediate (i32);
-    i32 returnSlots             = immediate (i32);
-    u32 numArgSlots             = immediate (u32);
-
-    m3ret_t r = m3Err_none;
-
-    if (M3_LIKELY(tableIndex < table->size))
-    {
-        IM3Function function = (IM3Function) table->elements [tableIndex];
-
-        if (M3_LIKELY(function))
-        {
-            if (M3_LIKELY(type == function->funcType))
-            {
-                if (M3_UNLIKELY(not function->compiled))
-                    r = CompileFunction (function);
-
-                if (M3_LIKELY(not r))
-                {
-                    r = m3_Yield ();
-
-                    if (M3_LIKELY(not r))
-                    {
-                        d_m3TailCallArgs (returnSlots, stackOffset, numArgSlots);
-
-                        jumpOpDirect (function->compiled);
-                    }
-                }
-            }
-            else r = m3Err_trapIndirectCallTypeMismatch;
-        }
-        else r = m3Err_trapTableElementIsNull;
-    }
-    else r = m3Err_trapTableIndexOutOfRange;
-
-    newTrap (r);
-}
+#define d_m3ReturnCallIndirectOp(NAME, TABLE)                                                       \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    u32 tableIndex              = slot (u32);                                                       \
+    M3Table * table             = TABLE;                                                            \
+    IM3FuncType type            = immediate (IM3FuncType);                                          \
+    i32 stackOffset             = immediate (i32);                                                  \
+    i32 returnSlots             = immediate (i32);                                                  \
+    u32 numArgSlots             = immediate (u32);                                                  \
+                                                                                                    \
+    m3ret_t r = m3Err_none;                                                                         \
+                                                                                                    \
+    if (M3_LIKELY(tableIndex < table->size))                                                        \
+    {                                                                                               \
+        IM3Function function = (IM3Function) table->elements [tableIndex];                          \
+                                                                                                    \
+        if (M3_LIKELY(function))                                                                    \
+        {                                                                                           \
+            if (M3_LIKELY(type == function->funcType))                                              \
+            {                                                                                       \
+                if (M3_UNLIKELY(not LoadCompiled (function)))                                       \
+                    r = CompileFunction (function);                                                 \
+                                                                                                    \
+                if (M3_LIKELY(not r))                                                               \
+                {                                                                                   \
+                    r = YieldCall (m3MemRuntime (_mem));                                            \
+                                                                                                    \
+                    if (M3_LIKELY(not r))                                                           \
+                    {                                                                               \
+                        d_m3TailCallArgs (returnSlots, stackOffset, numArgSlots);                   \
+                                                                                                    \
+                        jumpOpDirect (function->compiled);                                          \
+                    }                                                                               \
+                }                                                                                   \
+            }                                                                                       \
+            else r = m3Err_trapIndirectCallTypeMismatch;                                            \
+        }                                                                                           \
+        else r = m3Err_trapTableElementIsNull;                                                      \
+    }                                                                                               \
+    else r = m3Err_trapTableIndexOutOfRange;                                                        \
+                                                                                                    \
+    newTrap (r);                                                                                    \
+}
+
+d_m3ReturnCallIndirectOp (ReturnCallIndirect,         immediate (M3Table *))
+d_m3ReturnCallIndirectOp (ReturnCallIndirectShared,   sharedTable ())
 
 
 d_m3Op  (CallRawFunction)
 {
     d_m3TracePrepare
 
+#if d_m3Stackless
+    // the one place left where the native stack grows: a host function calling back in
+    d_m3CheckNativeStack ();
+#endif
+
     M3ImportContext ctx;
 
     M3RawCall call = (M3RawCall) (* _pc++);
@@ -868,6 +1117,11 @@ d_m3Op  (CallRawFunction)
     m3ret_t possible_trap = call (runtime, &ctx, sp, m3MemData(_mem));
     runtime->stack = stack_backup;
 
+#if d_m3HasSuspend
+    if (M3_UNLIKELY (possible_trap == m3Err_suspended))
+        possible_trap = SuspendCall (runtime, sp, ctx.function->funcType->numRets, m3Err_suspended);
+#endif
+
 #if d_m3EnableStrace
     if (M3_UNLIKELY(possible_trap)) {
         d_m3TracePrint("%s -> %s", outbuff, (char*)possible_trap);
@@ -886,6 +1140,13 @@ d_m3Op  (CallRawFunction)
         _mem = memory->mallocated;
         pushBacktraceFrame ();
     }
+#if d_m3Stackless
+    else
+    {
+        _mem = memory->mallocated;
+        d_m3ReturnToCaller ();
+    }
+#endif
     forwardTrap (possible_trap);
 }
 
@@ -967,185 +1228,225 @@ d_m3Op  (MemFill)
 }
 
 
-d_m3Op  (MemInit)
-{
-    M3DataSegment * segment = immediate (M3DataSegment *);
-
-    u32 size = (u32) _r0;
-    u64 source = slot (u32);
-    u64 destination = slot (u32);
-
-    u64 available = segment->dropped ? 0 : segment->size;
-
-    if (M3_LIKELY(destination + size <= _mem->length))
-    {
-        if (M3_LIKELY(source + size <= available))
-        {
-            memcpy (m3MemData (_mem) + destination, segment->data + source, size);
-            nextOp ();
-        }
-        else d_outOfBoundsMemOp (source, size);
-    }
-    else d_outOfBoundsMemOp (destination, size);
-}
-
-
-d_m3Op  (DataDrop)
-{
-    M3DataSegment * segment = immediate (M3DataSegment *);
-    segment->dropped = true;
-
-    nextOp ();
-}
-
-
-#if d_m3HasRefTypes
-
-d_m3Op  (TableGet)
-{
-    M3Table * table = immediate (M3Table *);
-    u32 index       = slot (u32);
-
-    if (M3_LIKELY(index < table->size))
-    {
-        _r0 = (u64) (uintptr_t) table->elements [index];
-        nextOp ();
-    }
-    else newTrap (m3Err_trapTableOutOfBounds);
+#define d_m3MemInitOp(NAME, SEGMENT)                                                                \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3DataSegment * segment = SEGMENT;                                                              \
+                                                                                                    \
+    u32 size = (u32) _r0;                                                                           \
+    u64 source = slot (u32);                                                                        \
+    u64 destination = slot (u32);                                                                   \
+                                                                                                    \
+    u64 available = segment->dropped ? 0 : segment->size;                                           \
+                                                                                                    \
+    if (M3_LIKELY(destination + size <= _mem->length))                                              \
+    {                                                                                               \
+        if (M3_LIKELY(source + size <= available))                                                  \
+        {                                                                                           \
+            memcpy (m3MemData (_mem) + destination, segment->data + source, size);                  \
+            nextOp ();                                                                              \
+        }                                                                                           \
+        else d_outOfBoundsMemOp (source, size);                                                     \
+    }                                                                                               \
+    else d_outOfBoundsMemOp (destination, size);                                                    \
 }
 
+d_m3MemInitOp (MemInit,                    immediate (M3DataSegment *))
+d_m3MemInitOp (MemInitShared,              sharedDataSegment ())
 
-d_m3Op  (TableSet)
-{
-    M3Table * table = immediate (M3Table *);
-    void * value    = slot (void *);
-    u32 index       = slot (u32);
 
-    if (M3_LIKELY(index < table->size))
-    {
-        table->elements [index] = value;
-        nextOp ();
-    }
-    else newTrap (m3Err_trapTableOutOfBounds);
+#define d_m3DataDropOp(NAME, SEGMENT)                                                               \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3DataSegment * segment = SEGMENT;                                                              \
+    segment->dropped = true;                                                                        \
+                                                                                                    \
+    nextOp ();                                                                                      \
 }
 
+d_m3DataDropOp (DataDrop,                  immediate (M3DataSegment *))
+d_m3DataDropOp (DataDropShared,            sharedDataSegment ())
 
-d_m3Op  (TableSize)
-{
-    M3Table * table = immediate (M3Table *);
-
-    _r0 = table->size;
 
-    nextOp ();
-}
-
-
-d_m3Op  (TableGrow)
-{
-    M3Table * table = immediate (M3Table *);
-    u32 delta       = slot (u32);
-    void * value    = slot (void *);
-
-    u32 oldSize = table->size;
-    u64 newSize = (u64) oldSize + delta;
-    u32 maxSize = table->maxSize ? table->maxSize : d_m3MaxSaneTableSize;
-
-    if (newSize == oldSize)         // a zero delta never reallocates, and the table may have no storage yet
-    {
-        _r0 = oldSize;
-        nextOp ();
-    }
-
-    if (newSize <= maxSize)
-    {
-        void ** elements = m3_ReallocArray (void *, table->elements, (size_t) newSize, oldSize);
-
-        if (elements)
-        {
-            table->elements = elements;
-            table->size = (u32) newSize;
-
-            for (u32 i = oldSize; i < table->size; ++i)
-                table->elements [i] = value;
-
-            _r0 = oldSize;
-            nextOp ();
-        }
-    }
-
-    // spec: a failed grow returns -1 and leaves the table alone
-    _r0 = (u32) -1;
-
-    nextOp ();
-}
-
-
-d_m3Op  (TableInit)
-{
-    M3Table * table             = immediate (M3Table *);
-    M3ElementSegment * segment  = immediate (M3ElementSegment *);
-    u32 count                   = slot (u32);
-    u32 source                  = slot (u32);
-    u32 destination             = slot (u32);
-
-    u64 available = segment->dropped ? 0 : segment->numElements;
-
-    if (M3_LIKELY((u64) destination + count <= table->size and
-                  (u64) source + count <= available))
-    {
-        for (u32 i = 0; i < count; ++i)
-            table->elements [destination + i] = segment->resolved [source + i];
-
-        nextOp ();
-    }
-    else newTrap (m3Err_trapTableOutOfBounds);
-}
-
-
-d_m3Op  (ElemDrop)
-{
-    M3ElementSegment * segment = immediate (M3ElementSegment *);
-    segment->dropped = true;
-
-    nextOp ();
-}
-
-
-d_m3Op  (TableCopy)
-{
-    M3Table * dst   = immediate (M3Table *);
-    M3Table * src   = immediate (M3Table *);
-    u32 count       = slot (u32);
-    u32 source      = slot (u32);
-    u32 destination = slot (u32);
-
-    if (M3_LIKELY((u64) destination + count <= dst->size and
-                  (u64) source + count <= src->size))
-    {
-        memmove (dst->elements + destination, src->elements + source, count * sizeof (void *));
-
-        nextOp ();
-    }
-    else newTrap (m3Err_trapTableOutOfBounds);
-}
-
-
-d_m3Op  (TableFill)
-{
-    M3Table * table = immediate (M3Table *);
-    u32 count       = slot (u32);
-    void * value    = slot (void *);
-    u32 index       = slot (u32);
-
-    if (M3_LIKELY((u64) index + count <= table->size))
-    {
-        for (u32 i = 0; i < count; ++i)
-            table->elements [index + i] = value;
+#if d_m3HasRefTypes
 
-        nextOp ();
-    }
-    else newTrap (m3Err_trapTableOutOfBounds);
-}
+#define d_m3TableGetOp(NAME, TABLE)                                                                 \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3Table * table = TABLE;                                                                        \
+    u32 index       = slot (u32);                                                                   \
+                                                                                                    \
+    if (M3_LIKELY(index < table->size))                                                             \
+    {                                                                                               \
+        _r0 = (u64) (uintptr_t) table->elements [index];                                            \
+        nextOp ();                                                                                  \
+    }                                                                                               \
+    else newTrap (m3Err_trapTableOutOfBounds);                                                      \
+}
+
+d_m3TableGetOp (TableGet,               immediate (M3Table *))
+d_m3TableGetOp (TableGetShared,         sharedTable ())
+
+
+#define d_m3TableSetOp(NAME, TABLE)                                                                 \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3Table * table = TABLE;                                                                        \
+    void * value    = slot (void *);                                                                \
+    u32 index       = slot (u32);                                                                   \
+                                                                                                    \
+    if (M3_LIKELY(index < table->size))                                                             \
+    {                                                                                               \
+        table->elements [index] = value;                                                            \
+        nextOp ();                                                                                  \
+    }                                                                                               \
+    else newTrap (m3Err_trapTableOutOfBounds);                                                      \
+}
+
+d_m3TableSetOp (TableSet,               immediate (M3Table *))
+d_m3TableSetOp (TableSetShared,         sharedTable ())
+
+
+#define d_m3TableSizeOp(NAME, TABLE)                                                                \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3Table * table = TABLE;                                                                        \
+                                                                                                    \
+    _r0 = table->size;                                                                              \
+                                                                                                    \
+    nextOp ();                                                                                      \
+}
+
+d_m3TableSizeOp (TableSize,             immediate (M3Table *))
+d_m3TableSizeOp (TableSizeShared,       sharedTable ())
+
+
+#define d_m3TableGrowOp(NAME, TABLE)                                                                \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3Table * table = TABLE;                                                                        \
+    u32 delta       = slot (u32);                                                                   \
+    void * value    = slot (void *);                                                                \
+                                                                                                    \
+    u32 oldSize = table->size;                                                                      \
+    u64 newSize = (u64) oldSize + delta;                                                            \
+    u32 maxSize = table->maxSize ? table->maxSize : d_m3MaxSaneTableSize;                           \
+                                                                                                    \
+    if (newSize == oldSize)                                                                         \
+    {                                                                                               \
+        _r0 = oldSize;                                                                              \
+        nextOp ();                                                                                  \
+    }                                                                                               \
+                                                                                                    \
+    if (newSize <= maxSize)                                                                         \
+    {                                                                                               \
+        void ** elements = m3_ReallocArray (void *, table->elements, (size_t) newSize, oldSize);    \
+                                                                                                    \
+        if (elements)                                                                               \
+        {                                                                                           \
+            table->elements = elements;                                                             \
+            table->size = (u32) newSize;                                                            \
+                                                                                                    \
+            for (u32 i = oldSize; i < table->size; ++i)                                             \
+                table->elements [i] = value;                                                        \
+                                                                                                    \
+            _r0 = oldSize;                                                                          \
+            nextOp ();                                                                              \
+        }                                                                                           \
+    }                                                                                               \
+                                                                                                    \
+                                                                                                    \
+    _r0 = (u32) -1;                                                                                 \
+                                                                                                    \
+    nextOp ();                                                                                      \
+}
+
+d_m3TableGrowOp (TableGrow,             immediate (M3Table *))
+d_m3TableGrowOp (TableGrowShared,       sharedTable ())
+
+
+#define d_m3TableInitOp(NAME, TABLE, SEGMENT)                                                       \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3Table * table             = TABLE;                                                            \
+    M3ElementSegment * segment  = SEGMENT;                                                          \
+    u32 count                   = slot (u32);                                                       \
+    u32 source                  = slot (u32);                                                       \
+    u32 destination             = slot (u32);                                                       \
+                                                                                                    \
+    u64 available = segment->dropped ? 0 : segment->numElements;                                    \
+                                                                                                    \
+    if (M3_LIKELY((u64) destination + count <= table->size and                                      \
+                  (u64) source + count <= available))                                               \
+    {                                                                                               \
+        for (u32 i = 0; i < count; ++i)                                                             \
+            table->elements [destination + i] = segment->resolved [source + i];                     \
+                                                                                                    \
+        nextOp ();                                                                                  \
+    }                                                                                               \
+    else newTrap (m3Err_trapTableOutOfBounds);                                                      \
+}
+
+d_m3TableInitOp (TableInit,                immediate (M3Table *),  immediate (M3ElementSegment *))
+d_m3TableInitOp (TableInitShared,          sharedTable (),         sharedElementSegment ())
+
+
+#define d_m3ElemDropOp(NAME, SEGMENT)                                                               \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3ElementSegment * segment = SEGMENT;                                                           \
+    segment->dropped = true;                                                                        \
+                                                                                                    \
+    nextOp ();                                                                                      \
+}
+
+d_m3ElemDropOp (ElemDrop,                  immediate (M3ElementSegment *))
+d_m3ElemDropOp (ElemDropShared,            sharedElementSegment ())
+
+
+#define d_m3TableCopyOp(NAME, DST, SRC)                                                             \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3Table * dst   = DST;                                                                          \
+    M3Table * src   = SRC;                                                                          \
+    u32 count       = slot (u32);                                                                   \
+    u32 source      = slot (u32);                                                                   \
+    u32 destination = slot (u32);                                                                   \
+                                                                                                    \
+    if (M3_LIKELY((u64) destination + count <= dst->size and                                        \
+                  (u64) source + count <= src->size))                                               \
+    {                                                                                               \
+        memmove (dst->elements + destination, src->elements + source, count * sizeof (void *));     \
+                                                                                                    \
+        nextOp ();                                                                                  \
+    }                                                                                               \
+    else newTrap (m3Err_trapTableOutOfBounds);                                                      \
+}
+
+d_m3TableCopyOp (TableCopy,                immediate (M3Table *),  immediate (M3Table *))
+d_m3TableCopyOp (TableCopyShared,          sharedTable (),         sharedTable ())
+
+
+#define d_m3TableFillOp(NAME, TABLE)                                                                \
+d_m3Op  (NAME)                                                                                      \
+{                                                                                                   \
+    M3Table * table = TABLE;                                                                        \
+    u32 count       = slot (u32);                                                                   \
+    void * value    = slot (void *);                                                                \
+    u32 index       = slot (u32);                                                                   \
+                                                                                                    \
+    if (M3_LIKELY((u64) index + count <= table->size))                                              \
+    {                                                                                               \
+        for (u32 i = 0; i < count; ++i)                                                             \
+            table->elements [index + i] = value;                                                    \
+                                                                                                    \
+        nextOp ();                                                                                  \
+    }                                                                                               \
+    else newTrap (m3Err_trapTableOutOfBounds);                                                      \
+}
+
+d_m3TableFillOp (TableFill,             immediate (M3Table *))
+d_m3TableFillOp (TableFillShared,       sharedTable ())
 
 #endif // d_m3HasRefTypes
 
@@ -1163,7 +1464,7 @@ d_m3Op  (Compile)
 
     m3ret_t result = m3Err_none;
 
-    if (M3_UNLIKELY(not function->compiled)) // check to see if function was compiled since this operation was emitted.
+    if (M3_UNLIKELY(not LoadCompiled (function))) // check to see if function was compiled since this operation was emitted.
         result = CompileFunction (function);
 
     if (not result)
@@ -1187,7 +1488,7 @@ d_m3Op  (CompileReturnCall)
 
     m3ret_t result = m3Err_none;
 
-    if (M3_UNLIKELY(not function->compiled))
+    if (M3_UNLIKELY(not LoadCompiled (function)))
         result = CompileFunction (function);
 
     if (not result)
@@ -1213,14 +1514,29 @@ d_m3Op  (Entry)
     IM3Memory memory = m3MemInfo (_mem);
 #endif
 
+#if d_m3HasJit
+    if (M3_UNLIKELY (function->hotness) and --function->hotness == 0)
+    {
+        if (PromoteFunction (function))
+            jumpOp (function->compiled);
+    }
+#endif
+
 #if d_m3SkipStackCheck
     if (true)
 #else
-    if (M3_LIKELY ((void *) (_sp + function->maxStackSlots) < _mem->maxStack))
+    if (M3_LIKELY ((void *) (_sp + function->maxStackSlots + d_m3FrameReserveSlots) < _mem->maxStack))
 #endif
     {
+        // a call that overflows traps before it's charged for
+        d_m3ChargeFuel (function->fuelCost);
+        d_m3CheckEpoch ();
+
 #if defined(DEBUG)
         function->hits++;
+#endif
+#if d_m3Stackless
+        d_m3SetFrameFunction ((M3CallFrame *) _mem->maxStack, function);
 #endif
         u8 * stack = (u8 *) ((m3slot_t *) _sp + function->numRetAndArgSlots);
 
@@ -1273,6 +1589,34 @@ d_m3Op  (Entry)
 }
 
 
+#if d_m3Stackless
+
+// Loops continue by jumping back here, rather than by returning to an op_Loop that's still
+// around, so it charges for and counts every iteration and carries on into the body.
+d_m3Op  (Loop)
+{
+    d_m3ClearRegisters
+
+#if d_m3HasJit
+    IM3Function function = immediate (IM3Function);
+#endif
+#if d_m3HasFuel
+    u32 fuelCost = immediate (u32);
+#endif
+
+    d_m3ChargeFuel (fuelCost);
+    d_m3CheckEpoch ();
+
+#if d_m3HasJit
+    if (M3_UNLIKELY (function->hotness) and --function->hotness == 0)
+        PromoteFunction (function);
+#endif
+
+    nextOp ();
+}
+
+#else
+
 d_m3Op  (Loop)
 {
     d_m3TracePrepare
@@ -1285,7 +1629,17 @@ d_m3Op  (Loop)
 
     IM3Memory memory = m3MemInfo (_mem);
 
-    do
+#if d_m3HasJit
+    // patched in place, the next iteration runs native; recompiled, the function's next call does
+    IM3Function function = immediate (IM3Function);
+#endif
+#if d_m3HasFuel
+    u32 fuelCost = immediate (u32);
+#endif
+
+    // the first pass is charged with what encloses the loop (see Compile_LoopOrBlock), so
+    // that only going round again pays here
+    while (true)
     {
 #if d_m3EnableStrace >= 3
         d_m3TracePrint("iter {");
@@ -1300,12 +1654,24 @@ d_m3Op  (Loop)
         // linear memory pointer needs refreshed here because the block it's looping over
         // can potentially invoke the grow operation.
         _mem = memory->mallocated;
+
+        if (r != _pc)
+            break;
+
+#if d_m3HasJit
+        if (M3_UNLIKELY (function->hotness) and --function->hotness == 0)
+            PromoteFunction (function);
+#endif
+
+        d_m3ChargeFuel (fuelCost);
+        d_m3CheckEpoch ();
     }
-    while (r == _pc);
 
     forwardTrap (r);
 }
 
+#endif // d_m3Stackless
+
 
 d_m3Op  (Branch)
 {
@@ -1566,7 +1932,11 @@ d_m3Select_f (f64, _fp0, s, slot (i32))
 d_m3Op  (Return)
 {
     m3StackCheck();
+#if d_m3Stackless
+    d_m3ReturnToCaller ();
+#else
     return m3Err_none;
+#endif
 }
 
 
@@ -1624,6 +1994,14 @@ d_m3Op  (BranchIfPrologue_s)
 }
 
 
+// Stackless, a loop's id is the pc of its op_Loop, jumped back to; otherwise it's returned to
+// the op_Loop still running the body, which runs it again.
+#if d_m3Stackless
+#   define d_m3ContinueLoop(LOOP_ID)        jumpOp (LOOP_ID)
+#else
+#   define d_m3ContinueLoop(LOOP_ID)        return (void *) (LOOP_ID)
+#endif
+
 d_m3Op  (ContinueLoop)
 {
     m3StackCheck();
@@ -1633,7 +2011,7 @@ d_m3Op  (ContinueLoop)
     // has the potential to increase its native-stack usage. (don't forget ContinueLoopIf too.)
 
     void * loopId = immediate (void *);
-    return loopId;
+    d_m3ContinueLoop (loopId);
 }
 
 
@@ -1644,12 +2022,97 @@ d_m3Op  (ContinueLoopIf)
 
     if (condition)
     {
-        return loopId;
+        d_m3ContinueLoop (loopId);
     }
     else nextOp ();
 }
 
 
+#if d_m3FuseCompareBranch
+
+// An integer compare fused with the br_if that consumes it: one dispatch, and
+// the condition never passes through _r0. A BranchIf jumps to its target pc; a
+// ContinueLoopIf continues the loop, as op_ContinueLoopIf does.
+
+#define M3_BRANCH_BranchIf(TARGET)          jumpOp (TARGET)
+#define M3_BRANCH_ContinueLoopIf(TARGET)    d_m3ContinueLoop (TARGET)
+
+#define d_m3CommutativeCompareBranch(TYPE, NAME, OP, BRANCH)   \
+d_m3Op(TYPE##_##NAME##_##BRANCH##_rs)                       \
+{                                                           \
+    TYPE operand = slot (TYPE);                             \
+    pc_t target = immediate (pc_t);                         \
+    if (operand OP ((TYPE) _r0)) { M3_BRANCH_##BRANCH (target); } \
+    else nextOp ();                                         \
+}                                                           \
+d_m3Op(TYPE##_##NAME##_##BRANCH##_ss)                       \
+{                                                           \
+    TYPE operand2 = slot (TYPE);                            \
+    TYPE operand1 = slot (TYPE);                            \
+    pc_t target = immediate (pc_t);                         \
+    if (operand1 OP operand2) { M3_BRANCH_##BRANCH (target); } \
+    else nextOp ();                                         \
+}                                                           \
+d_m3Op(TYPE##_##NAME##_##BRANCH##_ir)                       \
+{                                                           \
+    d_m3ImmediateOperand (TYPE)                             \
+    pc_t target = immediate (pc_t);                         \
+    if (((TYPE) _r0) OP constant) { M3_BRANCH_##BRANCH (target); } \
+    else nextOp ();                                         \
+}                                                           \
+d_m3Op(TYPE##_##NAME##_##BRANCH##_is)                       \
+{                                                           \
+    TYPE operand = slot (TYPE);                             \
+    d_m3ImmediateOperand (TYPE)                             \
+    pc_t target = immediate (pc_t);                         \
+    if (operand OP constant) { M3_BRANCH_##BRANCH (target); } \
+    else nextOp ();                                         \
+}
+
+#define d_m3CompareBranch(TYPE, NAME, OP, BRANCH)           \
+d_m3Op(TYPE##_##NAME##_##BRANCH##_sr)                       \
+{                                                           \
+    TYPE operand = slot (TYPE);                             \
+    pc_t target = immediate (pc_t);                         \
+    if (((TYPE) _r0) OP operand) { M3_BRANCH_##BRANCH (target); } \
+    else nextOp ();                                         \
+}                                                           \
+d_m3CommutativeCompareBranch(TYPE, NAME, OP, BRANCH)
+
+#define d_m3EqzBranch(TYPE, BRANCH)                         \
+d_m3Op(TYPE##_EqualToZero_##BRANCH##_r)                     \
+{                                                           \
+    pc_t target = immediate (pc_t);                         \
+    if (((TYPE) _r0) == 0) { M3_BRANCH_##BRANCH (target); } \
+    else nextOp ();                                         \
+}                                                           \
+d_m3Op(TYPE##_EqualToZero_##BRANCH##_s)                     \
+{                                                           \
+    TYPE operand = slot (TYPE);                             \
+    pc_t target = immediate (pc_t);                         \
+    if (operand == 0) { M3_BRANCH_##BRANCH (target); }      \
+    else nextOp ();                                         \
+}
+
+#define d_m3CompareBranchOps(BRANCH)                                                                                        \
+d_m3CommutativeCompareBranch (i32, Equal,       ==, BRANCH)     d_m3CommutativeCompareBranch (i64, Equal,       ==, BRANCH) \
+d_m3CommutativeCompareBranch (i32, NotEqual,    !=, BRANCH)     d_m3CommutativeCompareBranch (i64, NotEqual,    !=, BRANCH) \
+d_m3CompareBranch (i32, LessThan,               < , BRANCH)     d_m3CompareBranch (i64, LessThan,               < , BRANCH) \
+d_m3CompareBranch (i32, GreaterThan,            > , BRANCH)     d_m3CompareBranch (i64, GreaterThan,            > , BRANCH) \
+d_m3CompareBranch (i32, LessThanOrEqual,        <=, BRANCH)     d_m3CompareBranch (i64, LessThanOrEqual,        <=, BRANCH) \
+d_m3CompareBranch (i32, GreaterThanOrEqual,     >=, BRANCH)     d_m3CompareBranch (i64, GreaterThanOrEqual,     >=, BRANCH) \
+d_m3CompareBranch (u32, LessThan,               < , BRANCH)     d_m3CompareBranch (u64, LessThan,               < , BRANCH) \
+d_m3CompareBranch (u32, GreaterThan,            > , BRANCH)     d_m3CompareBranch (u64, GreaterThan,            > , BRANCH) \
+d_m3CompareBranch (u32, LessThanOrEqual,        <=, BRANCH)     d_m3CompareBranch (u64, LessThanOrEqual,        <=, BRANCH) \
+d_m3CompareBranch (u32, GreaterThanOrEqual,     >=, BRANCH)     d_m3CompareBranch (u64, GreaterThanOrEqual,     >=, BRANCH) \
+d_m3EqzBranch (i32, BRANCH)                                     d_m3EqzBranch (i64, BRANCH)
+
+d_m3CompareBranchOps (BranchIf)
+d_m3CompareBranchOps (ContinueLoopIf)
+
+#endif // d_m3FuseCompareBranch
+
+
 d_m3Op  (Const32)
 {
     u32 value = * (u32 *)_pc++;
@@ -1685,44 +2148,20 @@ d_m3Op  (End)
 }
 
 
-d_m3Op  (SetGlobal_s32)
-{
-    u32 * global = immediate (u32 *);
-    * global = slot (u32);
-
-    nextOp ();
-}
-
-
-d_m3Op  (SetGlobal_s64)
-{
-    u64 * global = immediate (u64 *);
-    * global = slot (u64);
-
-    nextOp ();
-}
+d_m3SetGlobalOp (SetGlobal_s32,         u32,    immediate (u32 *),      slot (u32))
+d_m3SetGlobalOp (SetGlobal_s64,         u64,    immediate (u64 *),      slot (u64))
+d_m3SetGlobalOp (SetGlobalShared_s32,   u32,    sharedGlobal (u32),     slot (u32))
+d_m3SetGlobalOp (SetGlobalShared_s64,   u64,    sharedGlobal (u64),     slot (u64))
 
 #if d_m3HasFloat
-d_m3Op  (SetGlobal_f32)
-{
-    f32 * global = immediate (f32 *);
-    * global = _fp0;
-
-    nextOp ();
-}
-
-
-d_m3Op  (SetGlobal_f64)
-{
-    f64 * global = immediate (f64 *);
-    * global = _fp0;
-
-    nextOp ();
-}
+d_m3SetGlobalOp (SetGlobal_f32,         f32,    immediate (f32 *),      _fp0)
+d_m3SetGlobalOp (SetGlobal_f64,         f64,    immediate (f64 *),      _fp0)
+d_m3SetGlobalOp (SetGlobalShared_f32,   f32,    sharedGlobal (f32),     _fp0)
+d_m3SetGlobalOp (SetGlobalShared_f64,   f64,    sharedGlobal (f64),     _fp0)
 #endif
 
 
-#if d_m3SkipMemoryBoundsCheck
+#if d_m3SkipMemoryBoundsCheck || d_m3UseGuardPages
 #  define m3MemCheck(x) true
 #else
 #  define m3MemCheck(x) M3_LIKELY(x)
@@ -1730,14 +2169,8 @@ d_m3Op  (SetGlobal_f64)
 
 // memcpy here is to support non-aligned access on some platforms.
 
-#define d_m3Load(REG,DEST_TYPE,SRC_TYPE)                \
-d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_r)                 \
-{                                                       \
-    d_m3TracePrepare                                    \
-    u32 offset = immediate (u32);                       \
-    u64 operand = (u32) _r0;                            \
-    operand += offset;                                  \
-                                                        \
+// loads from the u64 'operand' address computed by the enclosing operation
+#define d_m3LoadFrom(REG, DEST_TYPE, SRC_TYPE)          \
     if (m3MemCheck(                                     \
         operand + sizeof (SRC_TYPE) <= _mem->length     \
     )) {                                                \
@@ -1750,7 +2183,20 @@ d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_r)                 \
             d_m3TraceLoad(DEST_TYPE, operand, REG);     \
         }                                               \
         nextOp ();                                      \
-    } else d_outOfBounds;                               \
+    } else d_outOfBounds;
+
+// _r/_s: base in the register or a slot, plus an offset immediate
+// _rz/_sz: the same, with a zero offset and no immediate
+// _i: constant address (base + offset) as the immediate
+#define d_m3Load(REG,DEST_TYPE,SRC_TYPE)                \
+d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_r)                 \
+{                                                       \
+    d_m3TracePrepare                                    \
+    u32 offset = immediate (u32);                       \
+    u64 operand = (u32) _r0;                            \
+    operand += offset;                                  \
+                                                        \
+    d_m3LoadFrom (REG, DEST_TYPE, SRC_TYPE)             \
 }                                                       \
 d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_s)                 \
 {                                                       \
@@ -1759,19 +2205,28 @@ d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_s)                 \
     u32 offset = immediate (u32);                       \
     operand += offset;                                  \
                                                         \
-    if (m3MemCheck(                                     \
-        operand + sizeof (SRC_TYPE) <= _mem->length     \
-    )) {                                                \
-        {                                               \
-            u8* src8 = m3MemData(_mem) + operand;       \
-            SRC_TYPE value;                             \
-            memcpy(&value, src8, sizeof(value));        \
-            M3_BSWAP_##SRC_TYPE(value);                 \
-            REG = (DEST_TYPE)value;                     \
-            d_m3TraceLoad(DEST_TYPE, operand, REG);     \
-        }                                               \
-        nextOp ();                                      \
-    } else d_outOfBounds;                               \
+    d_m3LoadFrom (REG, DEST_TYPE, SRC_TYPE)             \
+}                                                       \
+d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_rz)                \
+{                                                       \
+    d_m3TracePrepare                                    \
+    u64 operand = (u32) _r0;                            \
+                                                        \
+    d_m3LoadFrom (REG, DEST_TYPE, SRC_TYPE)             \
+}                                                       \
+d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_sz)                \
+{                                                       \
+    d_m3TracePrepare                                    \
+    u64 operand = slot (u32);                           \
+                                                        \
+    d_m3LoadFrom (REG, DEST_TYPE, SRC_TYPE)             \
+}                                                       \
+d_m3Op(DEST_TYPE##_Load_##SRC_TYPE##_i)                 \
+{                                                       \
+    d_m3TracePrepare                                    \
+    u64 operand = immediate (u32);                      \
+                                                        \
+    d_m3LoadFrom (REG, DEST_TYPE, SRC_TYPE)             \
 }
 
 //  printf ("get: %d -> %d\n", operand + offset, (i64) REG);
@@ -1799,26 +2254,33 @@ d_m3Load_i (i64, i32);
 d_m3Load_i (i64, u32);
 d_m3Load_i (i64, i64);
 
-#define d_m3Store(REG, SRC_TYPE, DEST_TYPE)             \
-d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_rs)             \
-{                                                       \
-    d_m3TracePrepare                                    \
-    u64 operand = slot (u32);                           \
-    u32 offset = immediate (u32);                       \
-    operand += offset;                                  \
-                                                        \
+// stores 'VALUE' to the u64 'operand' address computed by the enclosing operation
+#define d_m3StoreTo(SRC_TYPE, DEST_TYPE, VALUE)         \
     if (m3MemCheck(                                     \
         operand + sizeof (DEST_TYPE) <= _mem->length    \
     )) {                                                \
         {                                               \
-            d_m3TraceStore(SRC_TYPE, operand, REG);     \
+            d_m3TraceStore(SRC_TYPE, operand, VALUE);   \
             u8* mem8 = m3MemData(_mem) + operand;       \
-            DEST_TYPE val = (DEST_TYPE) REG;            \
+            DEST_TYPE val = (DEST_TYPE) VALUE;          \
             M3_BSWAP_##DEST_TYPE(val);                  \
             memcpy(mem8, &val, sizeof(val));            \
         }                                               \
         nextOp ();                                      \
-    } else d_outOfBounds;                               \
+    } else d_outOfBounds;
+
+// the first suffix letter locates the value, the second the base address;
+// a trailing z means a zero offset with no immediate, and an i address is
+// the constant (base + offset) carried as the immediate
+#define d_m3Store(REG, SRC_TYPE, DEST_TYPE)             \
+d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_rs)             \
+{                                                       \
+    d_m3TracePrepare                                    \
+    u64 operand = slot (u32);                           \
+    u32 offset = immediate (u32);                       \
+    operand += offset;                                  \
+                                                        \
+    d_m3StoreTo (SRC_TYPE, DEST_TYPE, REG)              \
 }                                                       \
 d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_sr)             \
 {                                                       \
@@ -1828,18 +2290,7 @@ d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_sr)             \
     u32 offset = immediate (u32);                       \
     operand += offset;                                  \
                                                         \
-    if (m3MemCheck(                                     \
-        operand + sizeof (DEST_TYPE) <= _mem->length    \
-    )) {                                                \
-        {                                               \
-            d_m3TraceStore(SRC_TYPE, operand, value);   \
-            u8* mem8 = m3MemData(_mem) + operand;       \
-            DEST_TYPE val = (DEST_TYPE) value;          \
-            M3_BSWAP_##DEST_TYPE(val);                  \
-            memcpy(mem8, &val, sizeof(val));            \
-        }                                               \
-        nextOp ();                                      \
-    } else d_outOfBounds;                               \
+    d_m3StoreTo (SRC_TYPE, DEST_TYPE, value)            \
 }                                                       \
 d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_ss)             \
 {                                                       \
@@ -1849,18 +2300,45 @@ d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_ss)             \
     u32 offset = immediate (u32);                       \
     operand += offset;                                  \
                                                         \
-    if (m3MemCheck(                                     \
-        operand + sizeof (DEST_TYPE) <= _mem->length    \
-    )) {                                                \
-        {                                               \
-            d_m3TraceStore(SRC_TYPE, operand, value);   \
-            u8* mem8 = m3MemData(_mem) + operand;       \
-            DEST_TYPE val = (DEST_TYPE) value;          \
-            M3_BSWAP_##DEST_TYPE(val);                  \
-            memcpy(mem8, &val, sizeof(val));            \
-        }                                               \
-        nextOp ();                                      \
-    } else d_outOfBounds;                               \
+    d_m3StoreTo (SRC_TYPE, DEST_TYPE, value)            \
+}                                                       \
+d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_rsz)            \
+{                                                       \
+    d_m3TracePrepare                                    \
+    u64 operand = slot (u32);                           \
+                                                        \
+    d_m3StoreTo (SRC_TYPE, DEST_TYPE, REG)              \
+}                                                       \
+d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_srz)            \
+{                                                       \
+    d_m3TracePrepare                                    \
+    const SRC_TYPE value = slot (SRC_TYPE);             \
+    u64 operand = (u32) _r0;                            \
+                                                        \
+    d_m3StoreTo (SRC_TYPE, DEST_TYPE, value)            \
+}                                                       \
+d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_ssz)            \
+{                                                       \
+    d_m3TracePrepare                                    \
+    const SRC_TYPE value = slot (SRC_TYPE);             \
+    u64 operand = slot (u32);                           \
+                                                        \
+    d_m3StoreTo (SRC_TYPE, DEST_TYPE, value)            \
+}                                                       \
+d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_ri)             \
+{                                                       \
+    d_m3TracePrepare                                    \
+    u64 operand = immediate (u32);                      \
+                                                        \
+    d_m3StoreTo (SRC_TYPE, DEST_TYPE, REG)              \
+}                                                       \
+d_m3Op  (SRC_TYPE##_Store_##DEST_TYPE##_si)             \
+{                                                       \
+    d_m3TracePrepare                                    \
+    const SRC_TYPE value = slot (SRC_TYPE);             \
+    u64 operand = immediate (u32);                      \
+                                                        \
+    d_m3StoreTo (SRC_TYPE, DEST_TYPE, value)            \
 }
 
 // both operands can be in regs when storing a float
@@ -1872,18 +2350,7 @@ d_m3Op  (TYPE##_Store_##TYPE##_rr)                      \
     u32 offset = immediate (u32);                       \
     operand += offset;                                  \
                                                         \
-    if (m3MemCheck(                                     \
-        operand + sizeof (TYPE) <= _mem->length         \
-    )) {                                                \
-        {                                               \
-            d_m3TraceStore(TYPE, operand, REG);         \
-            u8* mem8 = m3MemData(_mem) + operand;       \
-            TYPE val = (TYPE) REG;                      \
-            M3_BSWAP_##TYPE(val);                       \
-            memcpy(mem8, &val, sizeof(val));            \
-        }                                               \
-        nextOp ();                                      \
-    } else d_outOfBounds;                               \
+    d_m3StoreTo (TYPE, TYPE, REG)                       \
 }
 
 
@@ -16,11 +16,19 @@ d_m3BeginExternC
 # define m3MemRuntime(mem)              (((M3MemoryHeader*)(mem))->runtime)
 # define m3MemInfo(mem)                 (&(((M3MemoryHeader*)(mem))->runtime->memory))
 
+# if d_m3HasSecondRegister
+# define d_m3BaseOpSig                  pc_t _pc, m3stack_t _sp, M3MemoryHeader * _mem, m3reg_t _r0, m3reg_t _r1
+# define d_m3BaseOpArgs                 _sp, _mem, _r0, _r1
+# define d_m3BaseOpAllArgs              _pc, _sp, _mem, _r0, _r1
+# define d_m3BaseOpDefaultArgs          0, 0
+# define d_m3BaseClearRegisters         _r0 = 0; _r1 = 0;
+# else
 # define d_m3BaseOpSig                  pc_t _pc, m3stack_t _sp, M3MemoryHeader * _mem, m3reg_t _r0
 # define d_m3BaseOpArgs                 _sp, _mem, _r0
 # define d_m3BaseOpAllArgs              _pc, _sp, _mem, _r0
 # define d_m3BaseOpDefaultArgs          0
 # define d_m3BaseClearRegisters         _r0 = 0;
+# endif
 # define d_m3BaseCstr                   ""
 
 # define d_m3ExpOpSig(...)              d_m3BaseOpSig, __VA_ARGS__
@@ -116,6 +116,10 @@ void  Function_Release  (IM3Function i_function)
     if (i_function->ownsWasmCode)
         m3_Free (i_function->wasm);
 
+#   if d_m3HasJit
+    m3_Free (i_function->jitOpStarts);
+#   endif
+
     // Function_FreeCompiledCode (func);
 
 #   if (d_m3EnableCodePageRefCounting)
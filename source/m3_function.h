@@ -26,6 +26,7 @@ typedef struct M3FuncType
     // index a (ref $t) carries, and comparing two of them is exactly the
     // structural equivalence the spec asks for.
     u16                     canonicalIndex;
+    u32                     hash;           // of the types, set as the environment takes it in
 
     m3type_t                types [];        // returns, then args
 }
@@ -89,9 +90,29 @@ typedef struct M3Function
 
     u16                     numConstantBytes;
     void *                  constants;
+
+# if d_m3HasFuel
+    u32                     fuelCost;                               // charged on entry: the operations outside its loops
+# endif
+
+# if d_m3HasJit
+    u32                     hotness;                                // entries and loop iterations left before promotion; 0 once it's native
+    pc_t *                  jitOpStarts;                            // where each of its operations starts, kept for the promotion
+    u32                     numJitOpStarts;
+# endif
 }
 M3Function;
 
+// 'compiled' is stored last, once the rest of the function is filled in. With a background
+// compiler it is published from another thread, so it is read with acquire semantics.
+# if d_m3HasBackgroundCompile
+#   define LoadCompiled(FUNCTION)           __atomic_load_n (& (FUNCTION)->compiled, __ATOMIC_ACQUIRE)
+#   define StoreCompiled(FUNCTION, PC)      __atomic_store_n (& (FUNCTION)->compiled, (PC), __ATOMIC_RELEASE)
+# else
+#   define LoadCompiled(FUNCTION)           ((FUNCTION)->compiled)
+#   define StoreCompiled(FUNCTION, PC)      ((FUNCTION)->compiled = (PC))
+# endif
+
 void        Function_Release            (IM3Function i_function);
 void        Function_FreeCompiledCode   (IM3Function i_function);
 
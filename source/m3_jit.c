@@ -0,0 +1,824 @@
+//
+//  m3_jit.c
+//
+//  Copy-and-patch for metacode: a run of consecutive operations the table in
+//  m3_compile.c describes is turned into one native operation by appending a
+//  hand-assembled stencil per operation, with its slot offsets and immediates
+//  patched in. The result has the IM3Operation calling convention and takes
+//  the place of the run's first operation, so everything else - branches into
+//  the middle of the run included - still finds the metacode it expects.
+//
+//  On entry (System V): rdi = _pc, rsi = _sp, rdx = _mem, rcx = _r0 (and r8 =
+//  _r1, xmm0 = _fp0, which are left alone). rax, r9, r10 are scratch. A run
+//  leaves the way an operation does: by jumping through the next operation's
+//  code word with rdi pointing past it, or by returning. Anything unusual, such
+//  as an out-of-bounds access, jumps to the interpreter's own operation with
+//  _r0 untouched so it can trap exactly as it would have.
+//
+
+#include "m3_jit.h"
+
+#if d_m3HasJit
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define d_m3JitChunkSize            (64 * 1024)
+#define d_m3JitMaxRunOps            128
+#define d_m3JitMaxExits             (2 * d_m3JitMaxRunOps)
+#define d_m3JitMaxOpBytes           64                  // the largest stencil, with room to spare
+#define d_m3JitMaxExitBytes         24                  // the largest exit stub
+
+enum
+{
+    c_rax = 0, c_rcx = 1, c_rdx = 2, c_rsi = 6, c_rdi = 7,
+    c_r9 = 9, c_r10 = 10
+};
+
+enum { c_ccB = 0x2, c_ccAE = 0x3, c_ccE = 0x4, c_ccNE = 0x5, c_ccBE = 0x6, c_ccA = 0x7,
+       c_ccL = 0xc, c_ccGE = 0xd, c_ccLE = 0xe, c_ccG = 0xf };
+
+typedef struct M3JitChunk
+{
+    struct M3JitChunk *     next;
+    u8 *                    code;
+    size_t                  size;
+    size_t                  used;
+}
+M3JitChunk;
+
+typedef struct M3JitArena
+{
+    M3JitChunk *            chunks;
+
+    IM3JitOp *              map;                    // operation -> description, open addressed
+    u32                     mapMask;
+
+    u8                      scratch                 [d_m3JitMaxRunOps * d_m3JitMaxOpBytes + d_m3JitMaxExits * d_m3JitMaxExitBytes];
+}
+M3JitArena;
+
+
+typedef enum
+{
+    c_exitJump,                 // continue at a metacode pc
+    c_exitInterpret,            // run the original operation at a metacode pc
+    c_exitReturn,               // return a loop id
+}
+M3JitExitType;
+
+typedef struct M3JitExit
+{
+    u32                     rel32;                  // where the jcc displacement goes
+    u8                      type;
+    pc_t                    pc;
+    const void *            value;
+}
+M3JitExit;
+
+typedef struct M3JitCode
+{
+    u8 *                    bytes;
+    u32                     size;
+
+    u32                     numExits;
+    M3JitExit               exits                   [d_m3JitMaxExits];
+}
+M3JitCode;
+
+typedef M3JitCode *         IM3JitCode;
+
+
+//---------------------------------------------------------------------------------------------------------------------------------
+// operation lookup
+//---------------------------------------------------------------------------------------------------------------------------------
+
+static inline
+u32  HashOperation  (IM3Operation i_operation, u32 i_mask)
+{
+    u64 key = (u64) (uintptr_t) i_operation;
+    return (u32) ((key * 0x9E3779B97F4A7C15ull) >> 32) & i_mask;
+}
+
+static
+IM3JitOp  FindJitOp  (IM3JitArena i_arena, IM3Operation i_operation)
+{
+    u32 i = HashOperation (i_operation, i_arena->mapMask);
+
+    while (i_arena->map [i])
+    {
+        if (i_arena->map [i]->operation == i_operation)
+            return i_arena->map [i];
+
+        i = (i + 1) & i_arena->mapMask;
+    }
+
+    return NULL;
+}
+
+
+IM3JitArena  NewJitArena  (const M3JitOp * i_ops, u32 i_numOps)
+{
+    IM3JitArena arena = m3_AllocStruct (M3JitArena);
+
+    if (arena)
+    {
+        u32 mapSize = 1;
+        while (mapSize < i_numOps * 2)
+            mapSize <<= 1;
+
+        arena->map = m3_AllocArray (IM3JitOp, mapSize);
+        arena->mapMask = mapSize - 1;
+
+        if (arena->map)
+        {
+            for (u32 i = 0; i < i_numOps; ++i)
+            {
+                IM3Operation operation = i_ops [i].operation;
+
+                if (operation and not FindJitOp (arena, operation))
+                {
+                    u32 h = HashOperation (operation, arena->mapMask);
+
+                    while (arena->map [h])
+                        h = (h + 1) & arena->mapMask;
+
+                    arena->map [h] = & i_ops [i];
+                }
+            }
+        }
+        else m3_Free (arena);
+    }
+
+    return arena;
+}
+
+
+void  FreeJitArena  (IM3JitArena i_arena)
+{
+    if (i_arena)
+    {
+        M3JitChunk * chunk = i_arena->chunks;
+
+        while (chunk)
+        {
+            M3JitChunk * next = chunk->next;
+
+            munmap (chunk->code, chunk->size);
+            m3_Free (chunk);
+
+            chunk = next;
+        }
+
+        m3_Free (i_arena->map);
+        m3_Free (i_arena);
+    }
+}
+
+
+// copies finished code into executable memory; pages are only ever writable
+// or executable, never both
+static
+void *  InstallCode  (IM3JitArena io_arena, const u8 * i_bytes, u32 i_size)
+{
+    M3JitChunk * chunk = io_arena->chunks;
+    size_t size = (i_size + 15) & ~15;
+
+    if (not chunk or chunk->used + size > chunk->size)
+    {
+        chunk = m3_AllocStruct (M3JitChunk);
+        if (not chunk)
+            return NULL;
+
+        chunk->size = M3_MAX (size, d_m3JitChunkSize);
+        chunk->code = (u8 *) mmap (NULL, chunk->size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if (chunk->code == MAP_FAILED)
+        {
+            m3_Free (chunk);
+            return NULL;
+        }
+
+        chunk->next = io_arena->chunks;
+        io_arena->chunks = chunk;
+    }
+
+    if (mprotect (chunk->code, chunk->size, PROT_READ | PROT_WRITE))
+        return NULL;
+
+    u8 * code = chunk->code + chunk->used;
+    memcpy (code, i_bytes, i_size);
+    chunk->used += size;
+
+    if (mprotect (chunk->code, chunk->size, PROT_READ | PROT_EXEC))
+        return NULL;
+
+    return code;
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------------------
+// x86-64 encoding
+//---------------------------------------------------------------------------------------------------------------------------------
+
+static inline void  Byte    (IM3JitCode o, u8 i_byte)       { o->bytes [o->size++] = i_byte; }
+static inline void  Bytes32 (IM3JitCode o, u32 i_word)      { memcpy (o->bytes + o->size, & i_word, 4); o->size += 4; }
+static inline void  Bytes64 (IM3JitCode o, u64 i_word)      { memcpy (o->bytes + o->size, & i_word, 8); o->size += 8; }
+
+static
+void  Rex  (IM3JitCode o, bool i_wide, u32 i_reg, u32 i_index, u32 i_base)
+{
+    u8 rex = 0x40 | (i_wide << 3) | ((i_reg & 8) >> 1) | ((i_index & 8) >> 2) | ((i_base & 8) >> 3);
+
+    if (rex != 0x40)
+        Byte (o, rex);
+}
+
+static
+void  Opcode  (IM3JitCode o, u32 i_opcode)
+{
+    if (i_opcode > 0xff)
+        Byte (o, 0x0f);
+
+    Byte (o, i_opcode & 0xff);
+}
+
+// <op> reg, rm
+static
+void  RegReg  (IM3JitCode o, bool i_wide, u32 i_opcode, u32 i_reg, u32 i_rm)
+{
+    Rex (o, i_wide, i_reg, 0, i_rm);
+    Opcode (o, i_opcode);
+    Byte (o, 0xc0 | ((i_reg & 7) << 3) | (i_rm & 7));
+}
+
+// <op> reg, [_sp + slot]
+static
+void  RegSlot  (IM3JitCode o, bool i_wide, u32 i_opcode, u32 i_reg, i32 i_slot)
+{
+    Rex (o, i_wide, i_reg, 0, c_rsi);
+    Opcode (o, i_opcode);
+    Byte (o, 0x80 | ((i_reg & 7) << 3) | c_rsi);
+    Bytes32 (o, (u32) (i_slot * (i32) sizeof (m3slot_t)));
+}
+
+// <op> reg, [base]; base can't be rsp, rbp, r12 or r13
+static
+void  RegIndirect  (IM3JitCode o, bool i_wide, u32 i_opcode, u32 i_reg, u32 i_base)
+{
+    Rex (o, i_wide, i_reg, 0, i_base);
+    Opcode (o, i_opcode);
+    Byte (o, ((i_reg & 7) << 3) | (i_base & 7));
+}
+
+// <op> reg, [_mem + rax + header]: an access to linear memory
+static
+void  RegMemory  (IM3JitCode o, u8 i_prefix, bool i_wide, u32 i_opcode, u32 i_reg)
+{
+    if (i_prefix)
+        Byte (o, i_prefix);
+
+    Rex (o, i_wide, i_reg, c_rax, c_rdx);
+    Opcode (o, i_opcode);
+    Byte (o, 0x84 | ((i_reg & 7) << 3));
+    Byte (o, (c_rax << 3) | c_rdx);
+    Bytes32 (o, sizeof (M3MemoryHeader));
+}
+
+static
+void  MovImmediate  (IM3JitCode o, u32 i_reg, u64 i_value)
+{
+    bool wide = (i_value > UINT32_MAX);
+
+    Rex (o, wide, 0, 0, i_reg);
+    Byte (o, 0xb8 + (i_reg & 7));
+
+    if (wide)   Bytes64 (o, i_value);
+    else        Bytes32 (o, (u32) i_value);
+}
+
+static
+void  JumpToExit  (IM3JitCode o, u8 i_condition, M3JitExitType i_type, pc_t i_pc, const void * i_value)
+{
+    Byte (o, 0x0f);
+    Byte (o, 0x80 + i_condition);
+
+    M3JitExit * exit = & o->exits [o->numExits++];
+    exit->rel32 = o->size;
+    exit->type  = i_type;
+    exit->pc    = i_pc;
+    exit->value = i_value;
+
+    Bytes32 (o, 0);
+}
+
+// continue at i_pc the way jumpOp () would
+static
+void  EmitJump  (IM3JitCode o, pc_t i_pc)
+{
+    Rex (o, true, 0, 0, c_rdi);
+    Byte (o, 0xb8 + (c_rdi & 7));   Bytes64 (o, (u64) (uintptr_t) (i_pc + 1));         // mov rdi, pc + 1
+    Byte (o, 0xff); Byte (o, 0x67); Byte (o, (u8) -8);                                  // jmp [rdi - 8]
+}
+
+static
+void  EmitExit  (IM3JitCode o, M3JitExit * i_exit)
+{
+    i32 displacement = (i32) (o->size - (i_exit->rel32 + 4));
+    memcpy (o->bytes + i_exit->rel32, & displacement, 4);
+
+    if (i_exit->type == c_exitJump)
+    {
+        EmitJump (o, i_exit->pc);
+    }
+    else if (i_exit->type == c_exitInterpret)
+    {
+        Rex (o, true, 0, 0, c_rdi);
+        Byte (o, 0xb8 + (c_rdi & 7));   Bytes64 (o, (u64) (uintptr_t) (i_exit->pc + 1));
+        Rex (o, true, 0, 0, c_rax);
+        Byte (o, 0xb8 + c_rax);         Bytes64 (o, (u64) (uintptr_t) i_exit->value);
+        Byte (o, 0xff); Byte (o, 0xe0);                                                 // jmp rax
+    }
+    else
+    {
+        Rex (o, true, 0, 0, c_rax);
+        Byte (o, 0xb8 + c_rax);         Bytes64 (o, (u64) (uintptr_t) i_exit->value);
+        Byte (o, 0xc3);                                                                 // ret
+    }
+}
+
+
+//---------------------------------------------------------------------------------------------------------------------------------
+// stencils
+//---------------------------------------------------------------------------------------------------------------------------------
+
+typedef enum { c_inRegister, c_inSlot, c_isImmediate } M3JitWhere;
+
+typedef struct M3JitOperand
+{
+    M3JitWhere              where;
+    i64                     value;                  // slot index or constant
+}
+M3JitOperand;
+
+static inline bool  IsWideType      (u8 i_type)     { return (i_type == c_m3JitType_i64 or i_type == c_m3JitType_u64); }
+static inline bool  IsSignedType    (u8 i_type)     { return (i_type == c_m3JitType_i32 or i_type == c_m3JitType_i64 or
+                                                              i_type == c_m3JitType_i8 or i_type == c_m3JitType_i16); }
+
+static inline i32  ReadSlot  (pc_t * io_pc)             { return * (i32 *) (* io_pc)++; }
+static inline u32  ReadU32   (pc_t * io_pc)             { return * (u32 *) (* io_pc)++; }
+static inline const void *  ReadPointer  (pc_t * io_pc) { return * (void * const *) (* io_pc)++; }
+
+static
+i64  ReadConstant  (pc_t * io_pc, bool i_wide)
+{
+    i64 value = i_wide ? * (i64 *) * io_pc : * (i32 *) * io_pc;
+    (* io_pc)++;
+    return value;
+}
+
+static
+void  LoadOperand  (IM3JitCode o, bool i_wide, u32 i_reg, M3JitOperand i_operand)
+{
+    if (i_operand.where == c_inRegister)
+        RegReg (o, i_wide, 0x8b, i_reg, c_rcx);
+    else if (i_operand.where == c_inSlot)
+        RegSlot (o, i_wide, 0x8b, i_reg, (i32) i_operand.value);
+    else
+        MovImmediate (o, i_reg, i_wide ? (u64) i_operand.value : (u32) i_operand.value);
+}
+
+// reads the operands of a binary, compare or branch operation in the order its
+// interpreter version does: A <op> B
+static
+void  ReadOperands  (pc_t * io_pc, u8 i_mode, bool i_wide, M3JitOperand * o_a, M3JitOperand * o_b, i32 * o_dest)
+{
+    M3JitOperand r0 = { c_inRegister, 0 }, zero = { c_isImmediate, 0 };
+
+    switch (i_mode)
+    {
+        case c_m3JitMode_r:     * o_a = r0;                                             * o_b = zero;   break;
+        case c_m3JitMode_s:     o_a->where = c_inSlot; o_a->value = ReadSlot (io_pc);   * o_b = zero;   break;
+        case c_m3JitMode_rs:    o_a->where = c_inSlot; o_a->value = ReadSlot (io_pc);   * o_b = r0;     break;
+        case c_m3JitMode_sr:    o_b->where = c_inSlot; o_b->value = ReadSlot (io_pc);   * o_a = r0;     break;
+
+        case c_m3JitMode_ss:
+        case c_m3JitMode_sss:
+            o_b->where = c_inSlot;      o_b->value = ReadSlot (io_pc);
+            o_a->where = c_inSlot;      o_a->value = ReadSlot (io_pc);
+            if (i_mode == c_m3JitMode_sss)
+                * o_dest = ReadSlot (io_pc);
+            break;
+
+        case c_m3JitMode_ir:
+            * o_a = r0;
+            o_b->where = c_isImmediate; o_b->value = ReadConstant (io_pc, i_wide);
+            break;
+
+        case c_m3JitMode_is:
+            o_a->where = c_inSlot;      o_a->value = ReadSlot (io_pc);
+            o_b->where = c_isImmediate; o_b->value = ReadConstant (io_pc, i_wide);
+            break;
+    }
+}
+
+// cmp rax, B (or test rax, rax against zero); returns the condition code
+static
+u8  EmitCompare  (IM3JitCode o, IM3JitOp i_op, M3JitOperand i_a, M3JitOperand i_b)
+{
+    bool wide = IsWideType (i_op->type);
+    bool isSigned = IsSignedType (i_op->type);
+
+    LoadOperand (o, wide, c_rax, i_a);
+
+    if (i_b.where == c_isImmediate and i_b.value == 0)
+        RegReg (o, wide, 0x85, c_rax, c_rax);
+    else if (i_b.where == c_inSlot)
+        RegSlot (o, wide, 0x3b, c_rax, (i32) i_b.value);
+    else
+    {
+        if (i_b.where == c_isImmediate)
+            LoadOperand (o, wide, c_r10, i_b);
+
+        RegReg (o, wide, 0x3b, c_rax, (i_b.where == c_inRegister) ? c_rcx : c_r10);
+    }
+
+    switch (i_op->code)
+    {
+        case c_m3JitCond_eq:    return c_ccE;
+        case c_m3JitCond_ne:    return c_ccNE;
+        case c_m3JitCond_lt:    return isSigned ? c_ccL  : c_ccB;
+        case c_m3JitCond_gt:    return isSigned ? c_ccG  : c_ccA;
+        case c_m3JitCond_le:    return isSigned ? c_ccLE : c_ccBE;
+        default:                return isSigned ? c_ccGE : c_ccAE;
+    }
+}
+
+static
+void  EmitBinary  (IM3JitCode o, IM3JitOp i_op, pc_t * io_pc)
+{
+    bool wide = IsWideType (i_op->type);
+
+    M3JitOperand a, b;
+    i32 dest = -1;
+    ReadOperands (io_pc, i_op->mode, wide, & a, & b, & dest);
+
+    LoadOperand (o, wide, c_rax, a);
+
+    if (i_op->code == c_m3JitAlu_shl or i_op->code == c_m3JitAlu_shr)
+    {
+        u8 digit = (i_op->code == c_m3JitAlu_shl) ? 4 : IsSignedType (i_op->type) ? 7 : 5;
+
+        if (b.where == c_isImmediate)
+        {
+            RegReg (o, wide, 0xc1, digit, c_rax);
+            Byte (o, (u8) (b.value & (wide ? 63 : 31)));
+        }
+        else
+        {
+            // the count has to be in cl, where _r0 lives
+            if (dest >= 0)
+                RegReg (o, true, 0x8b, c_r9, c_rcx);
+
+            if (b.where == c_inSlot)
+                RegSlot (o, false, 0x8b, c_rcx, (i32) b.value);
+
+            RegReg (o, wide, 0xd3, digit, c_rax);
+
+            if (dest >= 0)
+                RegReg (o, true, 0x8b, c_rcx, c_r9);
+        }
+    }
+    else
+    {
+        static const u32 c_aluOpcodes [] = { 0x03, 0x2b, 0x0faf, 0x23, 0x0b, 0x33 };
+        u32 opcode = c_aluOpcodes [i_op->code];
+
+        if (b.where == c_inSlot)
+            RegSlot (o, wide, opcode, c_rax, (i32) b.value);
+        else
+        {
+            if (b.where == c_isImmediate)
+                LoadOperand (o, wide, c_r10, b);
+
+            RegReg (o, wide, opcode, c_rax, (b.where == c_inRegister) ? c_rcx : c_r10);
+        }
+    }
+
+    if (dest >= 0)
+        RegSlot (o, wide, 0x89, c_rax, dest);
+    else if (wide)
+        RegReg (o, true, 0x8b, c_rcx, c_rax);
+    else if (IsSignedType (i_op->type))
+        RegReg (o, true, 0x63, c_rcx, c_rax);                   // movsxd rcx, eax
+    else
+        RegReg (o, false, 0x8b, c_rcx, c_rax);
+}
+
+// rax = the u32 address plus offset, then trap through the interpreter unless
+// [rax, rax + size) is inside linear memory
+static
+void  EmitAddress  (IM3JitCode o, M3JitOperand i_base, u32 i_offset, u32 i_size, pc_t i_opPC, IM3Operation i_operation)
+{
+    LoadOperand (o, false, c_rax, i_base);
+
+    if (i_offset)
+    {
+        MovImmediate (o, c_r10, i_offset);
+        RegReg (o, true, 0x03, c_rax, c_r10);
+    }
+
+# if !(d_m3SkipMemoryBoundsCheck || d_m3UseGuardPages)
+    Byte (o, 0x4c); Byte (o, 0x8d); Byte (o, 0x50); Byte (o, (u8) i_size);                         // lea r10, [rax + size]
+    Byte (o, 0x4c); Byte (o, 0x3b); Byte (o, 0x52); Byte (o, offsetof (M3MemoryHeader, length));   // cmp r10, [rdx + length]
+    JumpToExit (o, c_ccA, c_exitInterpret, i_opPC, (const void *) i_operation);
+# endif
+}
+
+static
+void  EmitLoad  (IM3JitCode o, IM3JitOp i_op, pc_t * io_pc, pc_t i_opPC)
+{
+    M3JitOperand base = { c_inRegister, 0 };
+    u32 offset = 0;
+
+    switch (i_op->mode)
+    {
+        case c_m3JitMode_r:     offset = ReadU32 (io_pc);                                                   break;
+        case c_m3JitMode_s:     base.where = c_inSlot; base.value = ReadSlot (io_pc); offset = ReadU32 (io_pc); break;
+        case c_m3JitMode_sz:    base.where = c_inSlot; base.value = ReadSlot (io_pc);                       break;
+        case c_m3JitMode_i:     base.where = c_isImmediate; base.value = ReadU32 (io_pc);                   break;
+    }
+
+    static const u8 c_sizes [] = { 4, 4, 8, 8, 1, 1, 2, 2 };
+    EmitAddress (o, base, offset, c_sizes [i_op->code], i_opPC, i_op->operation);
+
+    switch (i_op->code)
+    {
+        case c_m3JitType_i8:    RegMemory (o, 0, true,  0x0fbe, c_rcx);     break;
+        case c_m3JitType_u8:    RegMemory (o, 0, false, 0x0fb6, c_rcx);     break;
+        case c_m3JitType_i16:   RegMemory (o, 0, true,  0x0fbf, c_rcx);     break;
+        case c_m3JitType_u16:   RegMemory (o, 0, false, 0x0fb7, c_rcx);     break;
+        case c_m3JitType_i32:   RegMemory (o, 0, true,  0x63,   c_rcx);     break;
+        case c_m3JitType_u32:   RegMemory (o, 0, false, 0x8b,   c_rcx);     break;
+        default:                RegMemory (o, 0, true,  0x8b,   c_rcx);     break;
+    }
+}
+
+static
+void  EmitStore  (IM3JitCode o, IM3JitOp i_op, pc_t * io_pc, pc_t i_opPC)
+{
+    M3JitOperand base = { c_inRegister, 0 };
+    i32 valueSlot = -1;
+    u32 offset = 0;
+    u8 mode = i_op->mode;
+
+    if (mode == c_m3JitMode_sr or mode == c_m3JitMode_ss or mode == c_m3JitMode_srz or mode == c_m3JitMode_ssz or mode == c_m3JitMode_si)
+        valueSlot = ReadSlot (io_pc);
+
+    if (mode == c_m3JitMode_rs or mode == c_m3JitMode_ss or mode == c_m3JitMode_rsz or mode == c_m3JitMode_ssz)
+    {
+        base.where = c_inSlot;  base.value = ReadSlot (io_pc);
+    }
+    else if (mode == c_m3JitMode_ri or mode == c_m3JitMode_si)
+    {
+        base.where = c_isImmediate;  base.value = ReadU32 (io_pc);
+    }
+
+    if (mode == c_m3JitMode_rs or mode == c_m3JitMode_sr or mode == c_m3JitMode_ss)
+        offset = ReadU32 (io_pc);
+
+    static const u8 c_sizes [] = { 4, 4, 8, 8, 1, 1, 2, 2 };
+    u8 size = c_sizes [i_op->code];
+
+    u32 value = c_rcx;
+    if (valueSlot >= 0)
+    {
+        value = c_r9;
+        RegSlot (o, IsWideType (i_op->type), 0x8b, c_r9, valueSlot);
+    }
+
+    EmitAddress (o, base, offset, size, i_opPC, i_op->operation);
+
+    if      (size == 1)     RegMemory (o, 0,    false, 0x88, value);
+    else if (size == 2)     RegMemory (o, 0x66, false, 0x89, value);
+    else                    RegMemory (o, 0,    size == 8, 0x89, value);
+}
+
+
+// emits one operation; returns the pc following it, and whether it ends the run
+static
+pc_t  EmitOperation  (IM3JitCode o, IM3JitOp i_op, pc_t i_pc, bool * o_ends)
+{
+    pc_t opPC = i_pc;
+    pc_t pc = i_pc + 1;
+    bool wide = IsWideType (i_op->type);
+
+    M3JitOperand a, b;
+    i32 dest = -1;
+
+    * o_ends = false;
+
+    switch (i_op->kind)
+    {
+        case c_m3JitKind_binary:
+            EmitBinary (o, i_op, & pc);
+            break;
+
+        case c_m3JitKind_compare:
+        {
+            ReadOperands (& pc, i_op->mode, wide, & a, & b, & dest);
+            u8 condition = EmitCompare (o, i_op, a, b);
+
+            Byte (o, 0x0f); Byte (o, 0x90 + condition); Byte (o, 0xc0);     // setcc al
+            RegReg (o, false, 0x0fb6, c_rcx, c_rax);                        // movzx ecx, al
+            break;
+        }
+
+        case c_m3JitKind_branchIf:
+        case c_m3JitKind_loopIf:
+        {
+            ReadOperands (& pc, i_op->mode, wide, & a, & b, & dest);
+            u8 condition = EmitCompare (o, i_op, a, b);
+            const void * target = ReadPointer (& pc);
+
+            if (i_op->kind == c_m3JitKind_branchIf or d_m3Stackless)
+                JumpToExit (o, condition, c_exitJump, (pc_t) target, NULL);
+            else
+                JumpToExit (o, condition, c_exitReturn, NULL, target);
+            break;
+        }
+
+        case c_m3JitKind_extend:
+            if (i_op->mode == c_m3JitMode_r)
+                RegReg (o, IsSignedType (i_op->type), IsSignedType (i_op->type) ? 0x63 : 0x8b, c_rcx, c_rcx);
+            else
+                RegSlot (o, IsSignedType (i_op->type), IsSignedType (i_op->type) ? 0x63 : 0x8b, c_rcx, ReadSlot (& pc));
+            break;
+
+        case c_m3JitKind_load:
+            EmitLoad (o, i_op, & pc, opPC);
+            break;
+
+        case c_m3JitKind_store:
+            EmitStore (o, i_op, & pc, opPC);
+            break;
+
+        case c_m3JitKind_setRegister:
+            RegSlot (o, true, wide ? 0x8b : 0x63, c_rcx, ReadSlot (& pc));
+            break;
+
+        case c_m3JitKind_setSlot:
+            RegSlot (o, wide, 0x89, c_rcx, ReadSlot (& pc));
+            break;
+
+        case c_m3JitKind_preserveSetSlot:
+        {
+            i32 stack = ReadSlot (& pc), preserve = ReadSlot (& pc);
+            RegSlot (o, wide, 0x8b, c_rax, stack);
+            RegSlot (o, wide, 0x89, c_rax, preserve);
+            RegSlot (o, wide, 0x89, c_rcx, stack);
+            break;
+        }
+
+        case c_m3JitKind_copySlot:
+        {
+            i32 to = ReadSlot (& pc), from = ReadSlot (& pc);
+            RegSlot (o, wide, 0x8b, c_rax, from);
+            RegSlot (o, wide, 0x89, c_rax, to);
+            break;
+        }
+
+        case c_m3JitKind_preserveCopySlot:
+        {
+            i32 to = ReadSlot (& pc), from = ReadSlot (& pc), preserve = ReadSlot (& pc);
+            RegSlot (o, wide, 0x8b, c_rax, to);
+            RegSlot (o, wide, 0x89, c_rax, preserve);
+            RegSlot (o, wide, 0x8b, c_rax, from);
+            RegSlot (o, wide, 0x89, c_rax, to);
+            break;
+        }
+
+        case c_m3JitKind_const:
+        {
+            i64 value = ReadConstant (& pc, wide);
+            MovImmediate (o, c_rax, wide ? (u64) value : (u32) value);
+            RegSlot (o, wide, 0x89, c_rax, ReadSlot (& pc));
+            break;
+        }
+
+        case c_m3JitKind_getGlobal:
+            MovImmediate (o, c_rax, (u64) (uintptr_t) ReadPointer (& pc));
+            RegIndirect (o, wide, 0x8b, c_rax, c_rax);
+            RegSlot (o, wide, 0x89, c_rax, ReadSlot (& pc));
+            break;
+
+        case c_m3JitKind_setGlobal:
+        {
+            MovImmediate (o, c_r10, (u64) (uintptr_t) ReadPointer (& pc));
+            u32 value = c_rcx;
+
+            if (i_op->mode == c_m3JitMode_s)
+            {
+                RegSlot (o, wide, 0x8b, c_rax, ReadSlot (& pc));
+                value = c_rax;
+            }
+
+            RegIndirect (o, wide, 0x89, value, c_r10);
+            break;
+        }
+
+        case c_m3JitKind_branch:
+            EmitJump (o, (pc_t) ReadPointer (& pc));
+            * o_ends = true;
+            break;
+
+        case c_m3JitKind_continueLoop:
+#if d_m3Stackless
+            // back to the loop's op_Loop
+            EmitJump (o, (pc_t) ReadPointer (& pc));
+#else
+            MovImmediate (o, c_rax, (u64) (uintptr_t) ReadPointer (& pc));
+            Byte (o, 0xc3);
+#endif
+            * o_ends = true;
+            break;
+
+        case c_m3JitKind_return:
+            RegReg (o, false, 0x33, c_rax, c_rax);                          // xor eax, eax
+            Byte (o, 0xc3);
+            * o_ends = true;
+            break;
+
+        default:
+            return NULL;
+    }
+
+    return pc;
+}
+
+
+// returns the number of operations the run starting at i_opStarts [0] covers
+static
+u32  CompileRun  (IM3JitArena io_arena, pc_t * i_opStarts, u32 i_numOpStarts)
+{
+    M3JitCode code;
+    code.bytes = io_arena->scratch;
+    code.size = 0;
+    code.numExits = 0;
+
+    pc_t pc = i_opStarts [0];
+    u32 numOps = 0;
+    bool ends = false;
+
+    while (numOps < i_numOpStarts and numOps < d_m3JitMaxRunOps and not ends)
+    {
+        // a run stops at a code page bridge; the op_Branch there isn't in the list
+        if (i_opStarts [numOps] != pc)
+            break;
+
+        IM3JitOp op = FindJitOp (io_arena, * (IM3Operation *) pc);
+        if (not op)
+            break;
+
+        u32 size = code.size, numExits = code.numExits;
+
+        pc_t next = EmitOperation (& code, op, pc, & ends);
+
+        if (not next)
+        {
+            code.size = size;  code.numExits = numExits;
+            break;
+        }
+
+        pc = next;
+        ++numOps;
+    }
+
+    // a single operation gains nothing
+    if (numOps < 2)
+        return 1;
+
+    if (not ends)
+        EmitJump (& code, pc);
+
+    for (u32 i = 0; i < code.numExits; ++i)
+        EmitExit (& code, & code.exits [i]);
+
+    void * native = InstallCode (io_arena, code.bytes, code.size);
+
+    if (native)
+        * (void **) i_opStarts [0] = native;
+
+    return numOps;
+}
+
+
+void  JitCompileFunction  (IM3JitArena io_arena, pc_t * i_opStarts, u32 i_numOpStarts)
+{
+    u32 i = 0;
+
+    while (i < i_numOpStarts)
+        i += CompileRun (io_arena, i_opStarts + i, i_numOpStarts - i);
+}
+
+#endif // d_m3HasJit
@@ -0,0 +1,101 @@
+//
+//  m3_jit.h
+//
+//  Native code for straight-line runs of metacode (x86-64 System V only).
+//
+
+#ifndef m3_jit_h
+#define m3_jit_h
+
+#include "m3_exec_defs.h"
+
+d_m3BeginExternC
+
+#if d_m3HasJit
+
+// what an operation does, as far as the code generator is concerned
+typedef enum
+{
+    c_m3JitKind_none,
+
+    c_m3JitKind_binary,             // _r0 (or a slot for _sss) = A <code> B
+    c_m3JitKind_compare,            // _r0 = A <code> B
+    c_m3JitKind_branchIf,           // jump to the target if A <code> B
+    c_m3JitKind_loopIf,             // return the loop id if A <code> B
+    c_m3JitKind_extend,             // _r0 = A, sign- or zero-extended from 32 bits
+    c_m3JitKind_load,               // _r0 = memory [address]; <code> is the source width
+    c_m3JitKind_store,              // memory [address] = value; <code> is the destination width
+
+    c_m3JitKind_setRegister,
+    c_m3JitKind_setSlot,
+    c_m3JitKind_preserveSetSlot,
+    c_m3JitKind_copySlot,
+    c_m3JitKind_preserveCopySlot,
+    c_m3JitKind_const,
+    c_m3JitKind_getGlobal,
+    c_m3JitKind_setGlobal,
+
+    c_m3JitKind_branch,             // these end a run
+    c_m3JitKind_continueLoop,
+    c_m3JitKind_return,
+}
+M3JitKind;
+
+// where the operands are, in the operation-name suffix convention
+typedef enum
+{
+    c_m3JitMode_none,
+    c_m3JitMode_r,  c_m3JitMode_s,
+    c_m3JitMode_rs, c_m3JitMode_sr, c_m3JitMode_ss,
+    c_m3JitMode_ir, c_m3JitMode_is, c_m3JitMode_sss,
+    c_m3JitMode_rz, c_m3JitMode_sz, c_m3JitMode_i,
+    c_m3JitMode_rsz, c_m3JitMode_srz, c_m3JitMode_ssz,
+    c_m3JitMode_ri, c_m3JitMode_si,
+}
+M3JitMode;
+
+enum
+{
+    c_m3JitAlu_add, c_m3JitAlu_sub, c_m3JitAlu_mul,
+    c_m3JitAlu_and, c_m3JitAlu_or, c_m3JitAlu_xor,
+    c_m3JitAlu_shl, c_m3JitAlu_shr,
+
+    c_m3JitCond_eq, c_m3JitCond_ne,
+    c_m3JitCond_lt, c_m3JitCond_gt, c_m3JitCond_le, c_m3JitCond_ge,
+};
+
+// operand types; signedness picks sar/shr, the condition codes and how a
+// 32-bit result is widened into _r0
+enum
+{
+    c_m3JitType_i32, c_m3JitType_u32, c_m3JitType_i64, c_m3JitType_u64,
+    c_m3JitType_i8, c_m3JitType_u8, c_m3JitType_i16, c_m3JitType_u16,
+};
+
+typedef struct M3JitOp
+{
+    IM3Operation        operation;
+    u8                  kind;
+    u8                  mode;
+    u8                  code;
+    u8                  type;
+}
+M3JitOp;
+
+typedef const M3JitOp *         IM3JitOp;
+typedef struct M3JitArena *     IM3JitArena;
+
+IM3JitArena     NewJitArena             (const M3JitOp * i_ops, u32 i_numOps);
+void            FreeJitArena            (IM3JitArena i_arena);
+
+// Replaces each run of supported operations in a freshly compiled function
+// with one native operation. i_opStarts holds the address of every operation
+// emitted for the function, in order. Anything that fails leaves the
+// metacode as it was.
+void            JitCompileFunction      (IM3JitArena io_arena, pc_t * i_opStarts, u32 i_numOpStarts);
+
+#endif // d_m3HasJit
+
+d_m3EndExternC
+
+#endif // m3_jit_h
@@ -26,11 +26,14 @@ void  m3_FreeModule  (IM3Module i_module)
         m3log (module, "freeing module: %s (funcs: %d; segments: %d)",
                i_module->name, i_module->numFunctions, i_module->numDataSegments);
 
-        Module_FreeFunctions (i_module);
+        // an instance of a shared module owns its arrays, but not what they point into
+        bool ownsParse = not i_module->sharedFrom;
+
+        if (ownsParse)
+            Module_FreeFunctions (i_module);
 
         m3_Free (i_module->functions);
         //m3_Free (i_module->imports);
-        m3_Free (i_module->funcTypes);
         m3_Free (i_module->dataSegments);
 
         for (u32 i = 0; i < i_module->numTables; ++i)
@@ -40,19 +43,24 @@ void  m3_FreeModule  (IM3Module i_module)
         for (u32 i = 0; i < i_module->numElementSegments; ++i)
             m3_Free (i_module->elementSegments[i].resolved);
         m3_Free (i_module->elementSegments);
-        m3_Free (i_module->declaredFuncs);
 
-        for (u32 i = 0; i < i_module->numGlobals; ++i)
+        if (ownsParse)
         {
-            m3_Free (i_module->globals[i].name);
-            FreeImportInfo(&(i_module->globals[i].import));
+            m3_Free (i_module->funcTypes);
+            m3_Free (i_module->declaredFuncs);
+
+            for (u32 i = 0; i < i_module->numGlobals; ++i)
+            {
+                m3_Free (i_module->globals[i].name);
+                FreeImportInfo(&(i_module->globals[i].import));
+            }
+            m3_Free (i_module->memoryExportName);
+            m3_Free (i_module->table0ExportName);
+
+            FreeImportInfo(&i_module->memoryImport);
         }
-        m3_Free (i_module->globals);
-        m3_Free (i_module->memoryExportName);
-        m3_Free (i_module->table0ExportName);
-
-        FreeImportInfo(&i_module->memoryImport);
 
+        m3_Free (i_module->globals);
         m3_Free (i_module);
     }
 }
@@ -141,6 +149,7 @@ _try {
     table->type = i_type;
     table->size = i_size;
     table->maxSize = i_maxSize;
+    table->initSize = i_size;
 
 } _catch:
     return result;
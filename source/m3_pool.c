@@ -0,0 +1,183 @@
+//
+//  m3_pool.c
+//
+//  Runtimes forked from a snapshot up front, handed out to threads and reset on
+//  their way back, so that a request costs neither allocation nor compilation.
+//
+//  The free runtimes form a stack linked through their indices. Its head packs
+//  the top runtime's index, plus one, into the low half and a count of the pops
+//  into the high half, so that a pop racing a pop and push of the same runtime
+//  fails its compare-and-swap instead of linking in a stale next.
+//
+
+#include "m3_env.h"
+#include "m3_exception.h"
+
+#if d_m3HasPool
+
+typedef struct M3Pool
+{
+    IM3Snapshot             snapshot;
+
+    IM3Runtime *            runtimes;
+    u32 *                   next;           // below each free runtime on the stack, as index + 1
+    u32                     numRuntimes;
+
+    u64                     head;
+}
+M3Pool;
+
+
+static
+void  PushRuntime  (IM3Pool io_pool, u32 i_index)
+{
+    u64 head = __atomic_load_n (& io_pool->head, __ATOMIC_RELAXED);
+    u64 newHead;
+
+    do
+    {
+        __atomic_store_n (& io_pool->next [i_index], (u32) head, __ATOMIC_RELAXED);
+        newHead = (head & 0xFFFFFFFF00000000ull) | (i_index + 1);
+    }
+    while (not __atomic_compare_exchange_n (& io_pool->head, & head, newHead, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+M3Result  m3_NewPool  (IM3Pool * o_pool, IM3Snapshot i_snapshot, uint32_t i_stackSizeInBytes, uint32_t i_numRuntimes)
+{
+    M3Result result = m3Err_none;
+
+    IM3Environment env = i_snapshot->module->environment;
+    IM3Pool pool = m3_AllocStruct (M3Pool);
+    _throwifnull (pool);
+
+    pool->snapshot = i_snapshot;
+
+    if (i_numRuntimes)
+    {
+        pool->runtimes = m3_AllocArray (IM3Runtime, i_numRuntimes);
+        _throwifnull (pool->runtimes);
+
+        pool->next = m3_AllocArray (u32, i_numRuntimes);
+        _throwifnull (pool->next);
+    }
+
+    for (u32 i = 0; i < i_numRuntimes; ++i)
+    {
+        IM3Runtime runtime = m3_NewRuntime (env, i_stackSizeInBytes, NULL);
+        _throwifnull (runtime);
+
+        pool->runtimes [i] = runtime;
+        pool->numRuntimes = i + 1;
+
+        IM3Module instance;
+_       (m3_ForkSnapshot (runtime, i_snapshot, & instance));
+
+        runtime->pool = pool;
+        runtime->poolIndex = i;
+    }
+
+    // pushed last first, so that they're handed out in order
+    for (u32 i = i_numRuntimes; i > 0; --i)
+        PushRuntime (pool, i - 1);
+
+    * o_pool = pool;
+
+    _catch:
+    if (result)
+        m3_FreePool (pool);
+
+    return result;
+}
+
+
+M3Result  m3_AcquireRuntime  (IM3Pool i_pool, IM3Runtime * o_runtime)
+{
+    u64 head = __atomic_load_n (& i_pool->head, __ATOMIC_ACQUIRE);
+    u64 newHead;
+    u32 top;
+
+    do
+    {
+        top = (u32) head;
+        if (not top)
+            return m3Err_poolExhausted;
+
+        u32 next = __atomic_load_n (& i_pool->next [top - 1], __ATOMIC_RELAXED);
+        newHead = ((head & 0xFFFFFFFF00000000ull) + 0x100000000ull) | next;
+    }
+    while (not __atomic_compare_exchange_n (& i_pool->head, & head, newHead, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    IM3Runtime runtime = i_pool->runtimes [top - 1];
+
+    if (runtime->poolNeedsReset)
+    {
+        M3Result result = Runtime_Reset (runtime, i_pool->snapshot);
+
+        if (result)
+        {
+            PushRuntime (i_pool, top - 1);
+            return result;
+        }
+
+        runtime->poolNeedsReset = false;
+    }
+
+    * o_runtime = runtime;
+
+    return m3Err_none;
+}
+
+
+M3Result  m3_ReleaseRuntime  (IM3Runtime io_runtime)
+{
+    M3Result result = m3Err_none;
+
+    IM3Pool pool = io_runtime->pool;
+    _throwif (m3Err_runtimeNotPooled, not pool);
+
+    // one that can't be reset goes back all the same, for m3_AcquireRuntime to try again
+    result = Runtime_Reset (io_runtime, pool->snapshot);
+    io_runtime->poolNeedsReset = (result != m3Err_none);
+
+    PushRuntime (pool, io_runtime->poolIndex);
+
+    _catch: return result;
+}
+
+
+void  m3_FreePool  (IM3Pool i_pool)
+{
+    if (i_pool)
+    {
+        for (u32 i = 0; i < i_pool->numRuntimes; ++i)
+            m3_FreeRuntime (i_pool->runtimes [i]);
+
+        m3_Free (i_pool->runtimes);
+        m3_Free (i_pool->next);
+        m3_Free (i_pool);
+    }
+}
+
+#else
+
+M3Result  m3_NewPool  (IM3Pool * o_pool, IM3Snapshot i_snapshot, uint32_t i_stackSizeInBytes, uint32_t i_numRuntimes)
+{
+    return m3Err_poolUnsupported;
+}
+
+M3Result  m3_AcquireRuntime  (IM3Pool i_pool, IM3Runtime * o_runtime)
+{
+    return m3Err_poolUnsupported;
+}
+
+M3Result  m3_ReleaseRuntime  (IM3Runtime io_runtime)
+{
+    return m3Err_poolUnsupported;
+}
+
+void  m3_FreePool  (IM3Pool i_pool)
+{
+}
+
+#endif // d_m3HasPool
@@ -0,0 +1,559 @@
+//
+//  m3_sched.c
+//
+//  Worker threads running the calls scheduled on runtimes. A runtime with calls to
+//  run sits in one worker's queue, and is only ever taken off by one worker at a time,
+//  which runs its next call; so its calls run in order, and the runtimes in parallel.
+//  Workers queue the runtimes they've run that have more to run on their own queue, and
+//  one whose queue is empty takes from the others' before it sleeps.
+//
+//  Time-slicing is fuel: a call is given a slice of it at a time, and suspended when
+//  it's used up (see m3_EnableFuelYield), the runtime going to the back of the queue.
+//
+
+#include "m3_env.h"
+#include "m3_exception.h"
+
+#if d_m3HasScheduler
+
+#include <pthread.h>
+#include <unistd.h>
+
+// An argument or result at its type's size, for m3_Call and m3_GetResults to point at
+typedef union M3TaskValue
+{
+    i32                     i32Value;
+    i64                     i64Value;
+    f32                     f32Value;
+    f64                     f64Value;
+    uintptr_t               refValue;
+}
+M3TaskValue;
+
+typedef struct M3Task
+{
+    struct M3Task *         next;
+
+    IM3Function             function;
+    M3CallDone              done;
+    void *                  userdata;
+
+    M3TaskValue *           values;         // the arguments, then the results
+    const void **           pointers;       // to each of values
+    u64 *                   results;        // as they're handed to done
+    bool                    started;        // it has given way, and is to be resumed
+}
+M3Task;
+
+typedef struct M3Worker
+{
+    struct M3Scheduler *    scheduler;
+    pthread_t               thread;
+    u32                     index;
+    u32                     seed;           // picks the worker to steal from first
+
+    pthread_mutex_t         lock;           // over the queue
+    IM3Runtime              first;          // the queue, linked through nextQueued
+    IM3Runtime              last;
+}
+M3Worker;
+
+typedef struct M3Scheduler
+{
+    M3Worker *              workers;
+    u32                     numWorkers;
+    u32                     numStarted;
+    u32                     nextWorker;     // where the next runtime scheduled from outside is queued
+
+    u64                     fuelSlice;
+
+    pthread_mutex_t         lock;           // for sleeping and waiting on
+    pthread_cond_t          wake;           // workers out of runtimes to run sleep on this
+    pthread_cond_t          done;           // and m3_WaitScheduler on this
+
+    u32                     numQueued;      // runtimes in the queues, counted before they're put in
+    u32                     numSleeping;
+    u64                     numPending;     // calls scheduled and not yet done
+    bool                    stopping;
+}
+M3Scheduler;
+
+
+// A value in the scheduler's layout, a uint64_t holding it in its low bits, is moved in and
+// out of its type's member, so that it comes out the same on either byte order
+static
+void  SetTaskValue  (M3TaskValue * o_value, u8 i_type, u64 i_slot)
+{
+    u32 bits = (u32) i_slot;
+
+    switch (i_type)
+    {
+        case c_m3Type_i32:          o_value->i32Value = (i32) bits; break;
+        case c_m3Type_f32:          memcpy (& o_value->f32Value, & bits, sizeof (f32)); break;
+        case c_m3Type_f64:          memcpy (& o_value->f64Value, & i_slot, sizeof (f64)); break;
+        case c_m3Type_funcref:
+        case c_m3Type_externref:    o_value->refValue = (uintptr_t) i_slot; break;
+        default:                    o_value->i64Value = (i64) i_slot; break;
+    }
+}
+
+static
+u64  GetTaskValue  (const M3TaskValue * i_value, u8 i_type)
+{
+    u32 bits;
+    u64 slot;
+
+    switch (i_type)
+    {
+        case c_m3Type_i32:          return (u32) i_value->i32Value;
+        case c_m3Type_f32:          memcpy (& bits, & i_value->f32Value, sizeof (f32)); return bits;
+        case c_m3Type_f64:          memcpy (& slot, & i_value->f64Value, sizeof (f64)); return slot;
+        case c_m3Type_funcref:
+        case c_m3Type_externref:    return (u64) i_value->refValue;
+        default:                    return (u64) i_value->i64Value;
+    }
+}
+
+
+static inline
+void  LockTasks  (IM3Runtime io_runtime)
+{
+    while (__atomic_exchange_n (& io_runtime->tasksLock, 1, __ATOMIC_ACQUIRE))
+    {
+        while (__atomic_load_n (& io_runtime->tasksLock, __ATOMIC_RELAXED)) {}
+    }
+}
+
+static inline
+void  UnlockTasks  (IM3Runtime io_runtime)
+{
+    __atomic_store_n (& io_runtime->tasksLock, 0, __ATOMIC_RELEASE);
+}
+
+
+static
+void  QueueRuntime  (M3Worker * io_worker, IM3Runtime io_runtime)
+{
+    M3Scheduler * scheduler = io_worker->scheduler;
+
+    // counted first, so that a worker looking for it doesn't go to sleep meanwhile
+    __atomic_add_fetch (& scheduler->numQueued, 1, __ATOMIC_SEQ_CST);
+
+    io_runtime->nextQueued = NULL;
+
+    pthread_mutex_lock (& io_worker->lock);
+
+    if (io_worker->last)
+        io_worker->last->nextQueued = io_runtime;
+    else
+        __atomic_store_n (& io_worker->first, io_runtime, __ATOMIC_RELAXED);
+
+    io_worker->last = io_runtime;
+
+    pthread_mutex_unlock (& io_worker->lock);
+
+    if (__atomic_load_n (& scheduler->numSleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock (& scheduler->lock);
+        pthread_cond_signal (& scheduler->wake);
+        pthread_mutex_unlock (& scheduler->lock);
+    }
+}
+
+
+static
+IM3Runtime  DequeueRuntime  (M3Worker * io_worker)
+{
+    IM3Runtime runtime = NULL;
+
+    // an unlocked look first, since thieves try every queue
+    if (__atomic_load_n (& io_worker->first, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock (& io_worker->lock);
+
+        runtime = io_worker->first;
+
+        if (runtime)
+        {
+            __atomic_store_n (& io_worker->first, runtime->nextQueued, __ATOMIC_RELAXED);
+
+            if (not io_worker->first)
+                io_worker->last = NULL;
+        }
+
+        pthread_mutex_unlock (& io_worker->lock);
+
+        if (runtime)
+            __atomic_sub_fetch (& io_worker->scheduler->numQueued, 1, __ATOMIC_SEQ_CST);
+    }
+
+    return runtime;
+}
+
+
+// The worker's own queue first, then the others', starting at one picked at random so that
+// thieves spread out; NULL once the scheduler is stopping
+static
+IM3Runtime  NextRuntime  (M3Worker * io_worker)
+{
+    M3Scheduler * scheduler = io_worker->scheduler;
+    u32 numWorkers = scheduler->numWorkers;
+
+    while (true)
+    {
+        IM3Runtime runtime = DequeueRuntime (io_worker);
+
+        if (not runtime and numWorkers > 1)
+        {
+            io_worker->seed ^= io_worker->seed << 13;
+            io_worker->seed ^= io_worker->seed >> 17;
+            io_worker->seed ^= io_worker->seed << 5;
+
+            u32 victim = io_worker->seed % numWorkers;
+
+            for (u32 i = 0; not runtime and i < numWorkers; ++i)
+            {
+                if (victim != io_worker->index)
+                    runtime = DequeueRuntime (& scheduler->workers [victim]);
+
+                victim = (victim + 1) % numWorkers;
+            }
+        }
+
+        if (runtime)
+            return runtime;
+
+        pthread_mutex_lock (& scheduler->lock);
+
+        __atomic_add_fetch (& scheduler->numSleeping, 1, __ATOMIC_SEQ_CST);
+
+        while (not __atomic_load_n (& scheduler->numQueued, __ATOMIC_SEQ_CST) and not scheduler->stopping)
+            pthread_cond_wait (& scheduler->wake, & scheduler->lock);
+
+        __atomic_sub_fetch (& scheduler->numSleeping, 1, __ATOMIC_SEQ_CST);
+
+        bool stop = scheduler->stopping;
+
+        pthread_mutex_unlock (& scheduler->lock);
+
+        if (stop)
+            return NULL;
+    }
+}
+
+
+// The first of a run of sliced calls on a runtime puts aside the fuel and suspend settings
+// it finds, and the last puts them back, so that calls made otherwise meet them unchanged
+static
+M3Result  StartSlicing  (IM3Runtime io_runtime)
+{
+    M3Result result = m3Err_none;
+
+# if d_m3HasFuel && d_m3HasSuspend
+    if (not io_runtime->sliced)
+    {
+        io_runtime->ownSuspend = (io_runtime->callFiber != NULL);
+        io_runtime->ownFuelYields = io_runtime->fuelYields;
+        io_runtime->ownFuel = io_runtime->fuel;
+        io_runtime->ownFuelMetered = io_runtime->fuelMetered;
+
+        result = m3_EnableSuspend (io_runtime, true);
+
+        if (not result)
+        {
+            io_runtime->fuelYields = true;
+            io_runtime->sliced = true;
+        }
+    }
+# endif
+
+    return result;
+}
+
+static
+void  StopSlicing  (IM3Runtime io_runtime)
+{
+# if d_m3HasFuel && d_m3HasSuspend
+    if (io_runtime->sliced)
+    {
+        if (not io_runtime->ownSuspend)
+            m3_EnableSuspend (io_runtime, false);
+
+        io_runtime->fuelYields = io_runtime->ownFuelYields;
+        io_runtime->fuel = io_runtime->ownFuel;
+        io_runtime->fuelMetered = io_runtime->ownFuelMetered;
+        io_runtime->sliced = false;
+    }
+# endif
+}
+
+
+// Runs the runtime's next call, until it's done or gives way
+static
+void  RunTask  (M3Worker * io_worker, IM3Runtime io_runtime)
+{
+    M3Scheduler * scheduler = io_worker->scheduler;
+    M3Result result = m3Err_none;
+
+    // only the worker running the runtime takes calls off, so this one stays first
+    LockTasks (io_runtime);
+    M3Task * task = io_runtime->tasks;
+    UnlockTasks (io_runtime);
+
+    IM3FuncType type = task->function->funcType;
+
+    if (task->started)
+    {
+        m3_SetFuel (io_runtime, scheduler->fuelSlice);
+        result = m3_Resume (io_runtime, 0, NULL);
+    }
+    else
+    {
+        task->started = true;
+
+        if (scheduler->fuelSlice)
+        {
+            result = StartSlicing (io_runtime);
+
+            if (not result)
+                m3_SetFuel (io_runtime, scheduler->fuelSlice);
+        }
+
+        if (not result)
+            result = m3_Call (task->function, type->numArgs, task->pointers);
+    }
+
+    if (result == m3Err_yielded)
+    {
+        // behind the runtimes waiting for their turn
+        QueueRuntime (io_worker, io_runtime);
+        return;
+    }
+
+    // the scheduler's calls are suspended for time-slicing alone
+    if (result == m3Err_suspended)
+        result = m3_AbortSuspended (io_runtime, m3Err_trapCannotSuspend);
+
+    if (not result)
+        result = m3_GetResults (task->function, type->numRets, task->pointers);
+
+    for (u32 i = 0; i < type->numRets; ++i)
+        task->results [i] = result ? 0 : GetTaskValue (& task->values [i], d_FuncRetType (type, i));
+
+    // the last call for now: the runtime still can't be queued again, by a call scheduled
+    // meanwhile or from the callback, and the next call sets up again if there is one
+    LockTasks (io_runtime);
+    bool last = not task->next;
+    UnlockTasks (io_runtime);
+
+    if (last)
+        StopSlicing (io_runtime);
+
+    if (task->done)
+        task->done (task->function, result, task->results, task->userdata);
+
+    LockTasks (io_runtime);
+
+    io_runtime->tasks = task->next;
+
+    if (not io_runtime->tasks)
+    {
+        io_runtime->lastTask = NULL;
+        io_runtime->queued = false;
+    }
+
+    bool more = io_runtime->queued;
+
+    UnlockTasks (io_runtime);
+
+    m3_Free (task);
+
+    if (more)
+        QueueRuntime (io_worker, io_runtime);
+
+    if (__atomic_sub_fetch (& scheduler->numPending, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        pthread_mutex_lock (& scheduler->lock);
+        pthread_cond_broadcast (& scheduler->done);
+        pthread_mutex_unlock (& scheduler->lock);
+    }
+}
+
+
+static
+void *  RunWorker  (void * i_worker)
+{
+    M3Worker * worker = (M3Worker *) i_worker;
+    IM3Runtime runtime;
+
+    while ((runtime = NextRuntime (worker)))
+        RunTask (worker, runtime);
+
+    return NULL;
+}
+
+
+M3Result  m3_NewScheduler  (IM3Scheduler * o_scheduler, uint32_t i_numWorkers, uint64_t i_fuelSlice)
+{
+    M3Result result = m3Err_none;
+
+    IM3Scheduler scheduler = m3_AllocStruct (M3Scheduler);
+    _throwifnull (scheduler);
+
+    pthread_mutex_init (& scheduler->lock, NULL);
+    pthread_cond_init (& scheduler->wake, NULL);
+    pthread_cond_init (& scheduler->done, NULL);
+
+# if d_m3HasFuel && d_m3HasSuspend
+    scheduler->fuelSlice = i_fuelSlice;
+# endif
+
+    if (i_numWorkers == 0)
+    {
+        long numCores = sysconf (_SC_NPROCESSORS_ONLN);
+        i_numWorkers = (numCores > 0) ? (u32) numCores : 1;
+    }
+
+    scheduler->workers = m3_AllocArray (M3Worker, i_numWorkers);
+    _throwifnull (scheduler->workers);
+
+    for (u32 i = 0; i < i_numWorkers; ++i)
+    {
+        M3Worker * worker = & scheduler->workers [i];
+
+        worker->scheduler = scheduler;
+        worker->index = i;
+        worker->seed = i * 2654435761u + 1;
+
+        pthread_mutex_init (& worker->lock, NULL);
+        scheduler->numWorkers = i + 1;
+    }
+
+    // the queues of workers that couldn't be started are emptied by the others
+    while (scheduler->numStarted < i_numWorkers and
+           pthread_create (& scheduler->workers [scheduler->numStarted].thread, NULL, RunWorker, & scheduler->workers [scheduler->numStarted]) == 0)
+        ++scheduler->numStarted;
+
+    _throwif (m3Err_schedulerUnsupported, scheduler->numStarted == 0);
+
+    * o_scheduler = scheduler;
+
+    _catch:
+    if (result)
+        m3_FreeScheduler (scheduler);
+
+    return result;
+}
+
+
+M3Result  m3_ScheduleCall  (IM3Scheduler i_scheduler, IM3Function i_function, const uint64_t * i_args, M3CallDone i_done, void * i_userdata)
+{
+    IM3Runtime runtime = i_function->module->runtime;
+    IM3FuncType type = i_function->funcType;
+    u32 numValues = M3_MAX (type->numArgs, type->numRets);
+
+    M3Task * task = (M3Task *) m3_Malloc ("M3Task", sizeof (M3Task) + numValues * sizeof (M3TaskValue)
+                                                    + type->numRets * sizeof (u64) + numValues * sizeof (void *));
+    if (not task)
+        return m3Err_mallocFailed;
+
+    task->next = NULL;
+    task->function = i_function;
+    task->done = i_done;
+    task->userdata = i_userdata;
+    task->values = (M3TaskValue *) (task + 1);
+    task->results = (u64 *) (task->values + numValues);
+    task->pointers = (const void **) (task->results + type->numRets);
+    task->started = false;
+
+    for (u32 i = 0; i < numValues; ++i)
+        task->pointers [i] = & task->values [i];
+
+    for (u32 i = 0; i < type->numArgs; ++i)
+        SetTaskValue (& task->values [i], d_FuncArgType (type, i), i_args [i]);
+
+    // counted before it can be done
+    __atomic_add_fetch (& i_scheduler->numPending, 1, __ATOMIC_RELAXED);
+
+    LockTasks (runtime);
+
+    if (runtime->lastTask)
+        runtime->lastTask->next = task;
+    else
+        runtime->tasks = task;
+
+    runtime->lastTask = task;
+
+    bool idle = not runtime->queued;
+    runtime->queued = true;
+
+    UnlockTasks (runtime);
+
+    if (idle)
+    {
+        u32 worker = __atomic_fetch_add (& i_scheduler->nextWorker, 1, __ATOMIC_RELAXED) % i_scheduler->numWorkers;
+        QueueRuntime (& i_scheduler->workers [worker], runtime);
+    }
+
+    return m3Err_none;
+}
+
+
+void  m3_WaitScheduler  (IM3Scheduler i_scheduler)
+{
+    pthread_mutex_lock (& i_scheduler->lock);
+
+    while (__atomic_load_n (& i_scheduler->numPending, __ATOMIC_ACQUIRE))
+        pthread_cond_wait (& i_scheduler->done, & i_scheduler->lock);
+
+    pthread_mutex_unlock (& i_scheduler->lock);
+}
+
+
+void  m3_FreeScheduler  (IM3Scheduler i_scheduler)
+{
+    if (i_scheduler)
+    {
+        m3_WaitScheduler (i_scheduler);
+
+        pthread_mutex_lock (& i_scheduler->lock);
+        i_scheduler->stopping = true;
+        pthread_cond_broadcast (& i_scheduler->wake);
+        pthread_mutex_unlock (& i_scheduler->lock);
+
+        for (u32 i = 0; i < i_scheduler->numStarted; ++i)
+            pthread_join (i_scheduler->workers [i].thread, NULL);
+
+        for (u32 i = 0; i < i_scheduler->numWorkers; ++i)
+            pthread_mutex_destroy (& i_scheduler->workers [i].lock);
+
+        pthread_cond_destroy (& i_scheduler->done);
+        pthread_cond_destroy (& i_scheduler->wake);
+        pthread_mutex_destroy (& i_scheduler->lock);
+
+        m3_Free (i_scheduler->workers);
+        m3_Free (i_scheduler);
+    }
+}
+
+#else
+
+M3Result  m3_NewScheduler  (IM3Scheduler * o_scheduler, uint32_t i_numWorkers, uint64_t i_fuelSlice)
+{
+    return m3Err_schedulerUnsupported;
+}
+
+M3Result  m3_ScheduleCall  (IM3Scheduler i_scheduler, IM3Function i_function, const uint64_t * i_args, M3CallDone i_done, void * i_userdata)
+{
+    return m3Err_schedulerUnsupported;
+}
+
+void  m3_WaitScheduler  (IM3Scheduler i_scheduler)
+{
+}
+
+void  m3_FreeScheduler  (IM3Scheduler i_scheduler)
+{
+}
+
+#endif // d_m3HasScheduler
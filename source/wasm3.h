@@ -36,6 +36,10 @@ struct M3Runtime;       typedef struct M3Runtime *      IM3Runtime;
 struct M3Module;        typedef struct M3Module *       IM3Module;
 struct M3Function;      typedef struct M3Function *     IM3Function;
 struct M3Global;        typedef struct M3Global *       IM3Global;
+struct M3Snapshot;      typedef struct M3Snapshot *     IM3Snapshot;
+struct M3Pool;          typedef struct M3Pool *         IM3Pool;
+struct M3Scheduler;     typedef struct M3Scheduler *    IM3Scheduler;
+struct M3PreparedCall;  typedef struct M3PreparedCall * IM3PreparedCall;
 
 typedef struct M3ErrorInfo
 {
@@ -172,6 +176,7 @@ d_m3ErrorConst  (functionLookupFailed,          "function lookup failed")
 d_m3ErrorConst  (functionImportMissing,         "missing imported function")
 
 d_m3ErrorConst  (malformedFunctionSignature,    "malformed function signature")
+d_m3ErrorConst  (signatureMismatch,             "function signature mismatch")
 
 // compilation errors
 d_m3ErrorConst  (noCompiler,                    "no compiler found for opcode")
@@ -208,6 +213,30 @@ d_m3ErrorConst  (argumentTypeMismatch,          "argument type mismatch")
 d_m3ErrorConst  (globalLookupFailed,            "global lookup failed")
 d_m3ErrorConst  (globalTypeMismatch,            "global type mismatch")
 d_m3ErrorConst  (globalNotMutable,              "global is not mutable")
+d_m3ErrorConst  (memoryReservationUnsupported,  "linear memory reservation not supported by this build")
+d_m3ErrorConst  (jitUnsupported,                "native code generation not supported by this build")
+d_m3ErrorConst  (fuelUnsupported,               "fuel metering not supported by this build")
+d_m3ErrorConst  (epochsUnsupported,             "epoch deadlines not supported by this build")
+d_m3ErrorConst  (suspendUnsupported,            "suspending calls not supported by this build")
+d_m3ErrorConst  (suspended,                     "call suspended")
+d_m3ErrorConst  (yielded,                       "call gave way")
+d_m3ErrorConst  (runtimeSuspended,              "runtime has a suspended call")
+d_m3ErrorConst  (notSuspended,                  "runtime has no suspended call")
+d_m3ErrorConst  (backgroundCompileUnsupported,  "background compilation not supported by this build")
+d_m3ErrorConst  (codeCacheUnsupported,          "code cache not supported by this build")
+d_m3ErrorConst  (codeCacheIO,                   "code cache file couldn't be read or written")
+d_m3ErrorConst  (codeCacheMismatch,             "code cache is for other wasm bytes or another build")
+d_m3ErrorConst  (codeCacheUnrelocatable,        "code refers to something the code cache can't relocate")
+d_m3ErrorConst  (moduleNotShared,               "module's code isn't shared (see m3_ShareModule)")
+d_m3ErrorConst  (moduleAlreadyCompiled,         "module has compiled code already")
+d_m3ErrorConst  (runtimeHasSharedModule,        "runtime already holds a module with shared code")
+d_m3ErrorConst  (poolUnsupported,               "runtime pools not supported by this build")
+d_m3ErrorConst  (poolExhausted,                 "all of the pool's runtimes are in use")
+d_m3ErrorConst  (runtimeNotPooled,              "runtime isn't from a pool")
+d_m3ErrorConst  (schedulerUnsupported,          "schedulers not supported by this build")
+d_m3ErrorConst  (checkpointUnsupported,         "checkpoints not supported by this build")
+d_m3ErrorConst  (checkpointFailed,              "linear memory couldn't be write-protected for a checkpoint")
+d_m3ErrorConst  (noCheckpoint,                  "runtime has no checkpoint")
 
 // traps
 d_m3ErrorConst  (trapOutOfBoundsMemoryAccess,   "[trap] out of bounds memory access")
@@ -226,6 +255,9 @@ d_m3ErrorConst  (trapExit,                      "[trap] program called exit")
 d_m3ErrorConst  (trapAbort,                     "[trap] program called abort")
 d_m3ErrorConst  (trapUnreachable,               "[trap] unreachable executed")
 d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
+d_m3ErrorConst  (trapOutOfFuel,                 "[trap] out of fuel")
+d_m3ErrorConst  (trapInterrupted,               "[trap] interrupted")
+d_m3ErrorConst  (trapCannotSuspend,             "[trap] call can't be suspended")
 
 
 //-------------------------------------------------------------------------------------------------------------------------------
@@ -262,6 +294,96 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
     // This is used internally by Raw Function helpers
     uint32_t            m3_GetMemorySize            (IM3Runtime             i_runtime);
 
+    // Takes a checkpoint of the runtime's linear memory and globals, in place of any earlier one.
+    // m3_RestoreCheckpoint puts them back, copying only the pages written since, and keeps the
+    // checkpoint for the next time. The memory is write-protected meanwhile, and each page's first
+    // write faults into a signal handler that saves it; host code writing the memory by other means
+    // than a wasm store calls m3_TouchMemory first (m3ApiCheckMem does). Growing is fine, but not
+    // past the memory's reservation. Returns m3Err_checkpointUnsupported in builds without it
+    // (see d_m3HasCheckpoints).
+    M3Result            m3_Checkpoint               (IM3Runtime             io_runtime);
+    M3Result            m3_RestoreCheckpoint        (IM3Runtime             io_runtime);
+    void                m3_DropCheckpoint           (IM3Runtime             io_runtime);
+    void                m3_TouchMemory              (IM3Runtime             i_runtime,
+                                                     const void *           i_ptr,
+                                                     uint32_t               i_size);
+
+    // Sets how much address space the runtime sets aside for its linear memory; memory.grow
+    // within it commits pages in place without moving or copying the memory. 0 (the default)
+    // reserves up to the memory's declared maximum. Takes effect when the memory is allocated,
+    // so call it before m3_LoadModule.
+    M3Result            m3_SetMemoryReservation     (IM3Runtime             io_runtime,
+                                                     uint64_t               i_numBytes);
+
+    // Turns native code generation on or off for functions the runtime compiles from now on.
+    // Straight-line runs of integer operations become x86-64 code; the rest stays interpreted.
+    // Returns m3Err_jitUnsupported in builds without it (see d_m3HasJit).
+    M3Result            m3_EnableJit                (IM3Runtime             io_runtime,
+                                                     int                    i_enable);
+
+    // With the JIT on, a function first runs as metacode and is recompiled natively once its
+    // entries and loop iterations add up to i_hotness. 0 compiles everything natively up front.
+    // Defaults to d_m3JitHotness.
+    M3Result            m3_SetJitHotness            (IM3Runtime             io_runtime,
+                                                     uint32_t               i_hotness);
+
+    // Sets the runtime's fuel: a budget of wasm operations for everything it runs from now on.
+    // Each function entry and each loop iteration is charged up front for the operations in it
+    // (a loop's nested loops charging for their own), and a call that runs out traps with
+    // m3Err_trapOutOfFuel, leaving 0. Unlimited until set; a pooled runtime keeps its fuel on release.
+    // Returns m3Err_fuelUnsupported in builds without it (see d_m3HasFuel).
+    M3Result            m3_SetFuel                  (IM3Runtime             io_runtime,
+                                                     uint64_t               i_fuel);
+
+    M3Result            m3_AddFuel                  (IM3Runtime             io_runtime,
+                                                     uint64_t               i_fuel);
+
+    uint64_t            m3_GetFuel                  (IM3Runtime             i_runtime);
+
+    // Gives the runtime's calls a deadline i_numTicks epochs from now. Any thread, a watchdog say,
+    // moves the epoch on with m3_IncrementEpoch; a call running when it reaches the deadline traps
+    // with m3Err_trapInterrupted at its next function entry or loop iteration, as do later calls
+    // until a new deadline is set. No deadline until set (see d_m3HasEpochs).
+    M3Result            m3_SetEpochDeadline         (IM3Runtime             io_runtime,
+                                                     uint64_t               i_numTicks);
+
+    // Safe to call from any thread, also while the runtime runs. Returns the new epoch.
+    uint64_t            m3_IncrementEpoch           (IM3Runtime             io_runtime);
+
+    // Lets host functions suspend the runtime's calls: one returning m3Err_suspended (m3ApiSuspend)
+    // leaves the call, which returns m3Err_suspended, with its frames kept on a native stack the
+    // runtime's outermost calls now run on (d_m3SuspendStackSize). m3_Resume carries on with it,
+    // from any thread, once the host function's results are to hand. Until then the runtime makes
+    // no other calls. Suspending anything else, a start function say, traps with
+    // m3Err_trapCannotSuspend. Disabling aborts a suspended call; not from inside one.
+    // Returns m3Err_suspendUnsupported in builds without it (see d_m3HasSuspend).
+    M3Result            m3_EnableSuspend            (IM3Runtime             io_runtime,
+                                                     int                    i_enable);
+
+    // Returns the suspended host function's results, i_numResults of them as m3ApiRawFunction
+    // would have left them, and runs the call on: to the end, for m3_GetResults, or until it's
+    // suspended again. m3Err_notSuspended if nothing is.
+    M3Result            m3_Resume                   (IM3Runtime             io_runtime,
+                                                     uint32_t               i_numResults,
+                                                     const uint64_t *       i_results);
+
+    // Has the suspended host function return i_trap (m3Err_trapAbort if NULL) instead, unwinding
+    // the call with it. A pooled runtime's released call is aborted likewise.
+    M3Result            m3_AbortSuspended           (IM3Runtime             io_runtime,
+                                                     M3Result               i_trap);
+
+    // With suspension enabled as well, a call that runs out of fuel gives way instead of trapping:
+    // it's suspended, returning m3Err_yielded, for m3_Resume (with no results) to carry on with
+    // once there's more fuel. One that can't be suspended traps as before.
+    M3Result            m3_EnableFuelYield          (IM3Runtime             io_runtime,
+                                                     int                    i_enable);
+
+    // Starts a thread that compiles the functions named by not-yet-bound calls in compiled code,
+    // so they are usually ready before their first call. Off again on 0 or m3_FreeRuntime.
+    // Returns m3Err_backgroundCompileUnsupported in builds without it (see d_m3HasBackgroundCompile).
+    M3Result            m3_EnableBackgroundCompile  (IM3Runtime             io_runtime,
+                                                     int                    i_enable);
+
     void *              m3_GetUserData              (IM3Runtime             i_runtime);
 
 
@@ -286,6 +408,82 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
     // Optional, compiles all functions in the module
     M3Result            m3_CompileModule            (IM3Module io_module);
 
+    // The same, spread over i_numThreads threads (0: one per core). Calls between the module's
+    // functions are bound once all of them are compiled. Compiles serially in builds without
+    // threads (see d_m3HasParallelCompile). The runtime must not be running meanwhile.
+    M3Result            m3_CompileModuleParallel    (IM3Module io_module, uint32_t i_numThreads);
+
+    // Writes the module's compiled code to i_path, and reads it back in a later process, so the
+    // functions needn't be validated and compiled again. The module must be loaded into a runtime,
+    // and for loading, before any of its functions are looked up or run; imports are linked as usual.
+    // A file made by another build or from other wasm bytes gives m3Err_codeCacheMismatch.
+    // Functions that can't be cached (those using ref.func) still compile on their first call.
+    M3Result            m3_SaveCompiledModule       (IM3Module i_module, const char * i_path);
+    M3Result            m3_LoadCompiledModule       (IM3Module io_module, const char * i_path);
+
+    // Compiles all of a loaded module's functions into code that any number of runtimes can run
+    // at once, each with its own instance of the module from m3_InstantiateModule: its own memory,
+    // globals, tables and segments, and none of the parsing or compiling. Share before anything in
+    // the module has run, and link its imports first, as its instances use the same links.
+    // The module's runtime must outlive the others. A runtime holds one module with shared code.
+    M3Result            m3_ShareModule              (IM3Module io_module);
+
+    // Loads an instance of a shared module into io_runtime, which frees it. Its start function is
+    // run by m3_RunStart on o_instance, as for any other module.
+    M3Result            m3_InstantiateModule        (IM3Runtime io_runtime, IM3Module i_module, IM3Module * o_instance);
+
+    // Freezes the instance of a shared module held by i_runtime, after its start function and
+    // whatever else set it up have run, so that m3_ForkSnapshot can make more instances just like
+    // it without running any of that again. Nothing may run in i_runtime meanwhile. Where the build
+    // has d_m3HasMemoryImages, forks map the snapshot's linear memory copy-on-write, and so share
+    // the pages they don't write to; elsewhere they copy it. A fork doesn't need the snapshot once
+    // made, but like any instance needs the shared module's runtime.
+    M3Result            m3_NewSnapshot              (IM3Snapshot * o_snapshot, IM3Runtime i_runtime);
+    M3Result            m3_ForkSnapshot             (IM3Runtime io_runtime, IM3Snapshot i_snapshot, IM3Module * o_instance);
+    void                m3_FreeSnapshot             (IM3Snapshot i_snapshot);
+
+    // i_numRuntimes runtimes, each with an instance forked from i_snapshot, for threads to take
+    // turns with. m3_AcquireRuntime hands one out, or gives m3Err_poolExhausted when all are out.
+    // m3_ReleaseRuntime puts its instance back as it is in the snapshot, compiled code untouched,
+    // and returns it to the pool. A runtime that can't be reset goes back too, with the error
+    // returned, and m3_AcquireRuntime resets it before handing it out, or puts it back and returns
+    // the error again.
+    // Neither takes a lock. The snapshot must outlive the pool, and all runtimes be back for
+    // m3_FreePool. Returns m3Err_poolUnsupported in builds without it (see d_m3HasPool).
+    M3Result            m3_NewPool                  (IM3Pool * o_pool, IM3Snapshot i_snapshot, uint32_t i_stackSizeInBytes, uint32_t i_numRuntimes);
+    M3Result            m3_AcquireRuntime           (IM3Pool i_pool, IM3Runtime * o_runtime);
+    M3Result            m3_ReleaseRuntime           (IM3Runtime io_runtime);
+    void                m3_FreePool                 (IM3Pool i_pool);
+
+    // Worker threads, i_numWorkers of them (one a core when 0), that run the calls scheduled on any
+    // number of runtimes: each runtime's in order and on one worker at a time. Every worker has its
+    // own queue of runtimes with calls to run, and one that's out of them steals from the others.
+    // With i_fuelSlice, a call is given that much fuel at a time and gives way when it's used up
+    // (see m3_EnableFuelYield), to carry on once the runtimes queued behind it have had their turn;
+    // so the scheduler takes charge of its runtimes' fuel, and of their suspension, which a host
+    // function can't use: its call traps with m3Err_trapCannotSuspend. Builds without fuel or
+    // suspension run calls to the end. Returns m3Err_schedulerUnsupported in builds without it
+    // (see d_m3HasScheduler).
+    typedef void (* M3CallDone) (IM3Function i_function, M3Result i_result, const uint64_t * i_results, void * i_userdata);
+
+    M3Result            m3_NewScheduler             (IM3Scheduler * o_scheduler, uint32_t i_numWorkers, uint64_t i_fuelSlice);
+
+    // Queues a call of i_function on its runtime, with i_args a uint64_t for each argument, an i32 or
+    // f32 in its low 32 bits (on a little-endian host, the layout of m3_CallBatch). i_done, if not
+    // NULL, is called on the worker when it's done, with the results likewise, i32s and f32s zero-
+    // extended (good until it returns). Safe from any thread, i_done included; but a runtime with calls scheduled mustn't be
+    // used otherwise, or freed, until they're done.
+    M3Result            m3_ScheduleCall             (IM3Scheduler           i_scheduler,
+                                                     IM3Function            i_function,
+                                                     const uint64_t *       i_args,
+                                                     M3CallDone             i_done,
+                                                     void *                 i_userdata);
+
+    // Waits until all calls scheduled are done, those they schedule included; not from a worker.
+    // m3_FreeScheduler waits likewise before stopping the workers.
+    void                m3_WaitScheduler            (IM3Scheduler i_scheduler);
+    void                m3_FreeScheduler            (IM3Scheduler i_scheduler);
+
     // Calling m3_RunStart is optional
     M3Result            m3_RunStart                 (IM3Module i_module);
 
@@ -334,6 +532,8 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
 //-------------------------------------------------------------------------------------------------------------------------------
 //  functions
 //-------------------------------------------------------------------------------------------------------------------------------
+    // Called at every call. The host's own can return a trap to stop the call, or m3Err_yielded
+    // to have it give way, as m3_EnableFuelYield describes, when it can be suspended.
     M3Result            m3_Yield                    (void);
 
     // o_function is valid during the lifetime of the originating runtime
@@ -354,6 +554,25 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
     M3Result            m3_Call                     (IM3Function i_function, uint32_t i_argc, const void * i_argptrs[]);
     M3Result            m3_CallArgv                 (IM3Function i_function, uint32_t i_argc, const char * i_argv[]);
 
+    // Calls i_function once for each of i_numCalls sets of arguments, back to back, without the
+    // setup m3_Call repeats each time. i_args holds the sets one after another, and o_results gets
+    // the results likewise; every value takes a 64-bit slot, with an i32 or f32 in its first 4 bytes
+    // as on the wasm stack. A trap ends the batch: its result is returned, and o_numCompleted (if
+    // not NULL) is the index of the call that trapped, or i_numCalls when none did.
+    M3Result            m3_CallBatch                (IM3Function i_function, uint32_t i_numCalls, const uint64_t * i_args,
+                                                     uint64_t * o_results, uint32_t * o_numCompleted);
+
+    // Checks i_function against i_signature (as for m3_LinkRawFunction, e.g. "I(if)") once, so
+    // that m3_CallPrepared need not look at the types at all. The arguments are written straight
+    // into the slots from m3_GetPreparedArgs before each call, and the results read from those of
+    // m3_GetPreparedResults after it, in the layout of m3_CallBatch. Both stay put for the life of
+    // the runtime, and the results are good until its next call.
+    M3Result            m3_PrepareCall              (IM3PreparedCall * o_call, IM3Function i_function, const char * i_signature);
+    M3Result            m3_CallPrepared             (IM3PreparedCall i_call);
+    uint64_t *          m3_GetPreparedArgs          (IM3PreparedCall i_call);
+    const uint64_t *    m3_GetPreparedResults       (IM3PreparedCall i_call);
+    void                m3_FreePreparedCall         (IM3PreparedCall i_call);
+
     M3Result            m3_GetResultsV              (IM3Function i_function, ...);
     M3Result            m3_GetResultsVL             (IM3Function i_function, va_list o_rets);
     M3Result            m3_GetResults               (IM3Function i_function, uint32_t i_retc, const void * o_retptrs[]);
@@ -392,12 +611,13 @@ d_m3ErrorConst  (trapStackOverflow,             "[trap] stack overflow")
 # define m3ApiGetArgMem(TYPE, NAME)            TYPE NAME = (TYPE)m3ApiOffsetToPtr(* ((uint32_t *) (_sp++)));
 
 # define m3ApiIsNullPtr(addr)       ((void*)(addr) <= _mem)
-# define m3ApiCheckMem(addr, len)   { if (M3_UNLIKELY(((void*)(addr) < _mem) || ((uint64_t)(uintptr_t)(addr) + (len)) > ((uint64_t)(uintptr_t)(_mem)+m3_GetMemorySize(runtime)))) m3ApiTrap(m3Err_trapOutOfBoundsMemoryAccess); }
+# define m3ApiCheckMem(addr, len)   { if (M3_UNLIKELY(((void*)(addr) < _mem) || ((uint64_t)(uintptr_t)(addr) + (len)) > ((uint64_t)(uintptr_t)(_mem)+m3_GetMemorySize(runtime)))) m3ApiTrap(m3Err_trapOutOfBoundsMemoryAccess); m3_TouchMemory (runtime, (addr), (len)); }
 
 # define m3ApiRawFunction(NAME)     const void * NAME (IM3Runtime runtime, IM3ImportContext _ctx, uint64_t * _sp, void * _mem)
 # define m3ApiReturn(VALUE)                   { *raw_return = (VALUE); return m3Err_none;}
 # define m3ApiMultiValueReturn(NAME, VALUE)   { *NAME = (VALUE); }
 # define m3ApiTrap(VALUE)                     { return VALUE; }
+# define m3ApiSuspend()                       { return m3Err_suspended; }
 # define m3ApiSuccess()                       { return m3Err_none; }
 
 # if defined(M3_BIG_ENDIAN)
@@ -0,0 +1,177 @@
+//
+//  m3_test_cache.c
+//
+//  Saves a module's compiled code to a file, loads it into a fresh runtime, and
+//  checks that the loaded functions and the calls between them run, and that a
+//  file made from other wasm bytes is turned away.
+//
+//  Build:  cc -I ../../source -o m3_test_cache m3_test_cache.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (global $g (mut i32) (i32.const 10))
+//    (table 2 funcref)
+//    (elem (i32.const 0) $f1 $f2)
+//    (func $f0 (export "chain") (param i32) (result i32)
+//      local.get 0  call $f1  global.get $g  i32.add)
+//    (func $f1 (param i32) (result i32)
+//      local.get 0  i32.const 1  call_indirect (param i32) (result i32))
+//    (func $f2 (param i32) (result i32)
+//      local.get 0  i32.const 1000000  i32.add)
+//    (func $count (export "count") (param i32) (result i32)
+//      local.get 0  i32.eqz
+//      if (result i32)
+//        global.get $g
+//      else
+//        local.get 0  i32.const 1  i32.sub  return_call $count
+//      end))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x05, 0x04, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x04, 0x01, 0x70, 0x00, 0x02, 0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x0a,
+    0x0b, 0x07, 0x11, 0x02, 0x05, 0x63, 0x68, 0x61, 0x69, 0x6e, 0x00, 0x00,
+    0x05, 0x63, 0x6f, 0x75, 0x6e, 0x74, 0x00, 0x03, 0x09, 0x08, 0x01, 0x00,
+    0x41, 0x00, 0x0b, 0x02, 0x01, 0x02, 0x0a, 0x32, 0x04, 0x09, 0x00, 0x20,
+    0x00, 0x10, 0x01, 0x23, 0x00, 0x6a, 0x0b, 0x09, 0x00, 0x20, 0x00, 0x41,
+    0x01, 0x11, 0x00, 0x00, 0x0b, 0x09, 0x00, 0x20, 0x00, 0x41, 0xc0, 0x84,
+    0x3d, 0x6a, 0x0b, 0x12, 0x00, 0x20, 0x00, 0x45, 0x04, 0x7f, 0x23, 0x00,
+    0x05, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x12, 0x03, 0x0b, 0x0b,
+};
+
+//  (module
+//    (func (export "chain") (param i32) (result i32)
+//      local.get 0))
+static const unsigned char c_otherModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x09, 0x01, 0x05,
+    0x63, 0x68, 0x61, 0x69, 0x6e, 0x00, 0x00, 0x0a, 0x06, 0x01, 0x04, 0x00,
+    0x20, 0x00, 0x0b,
+};
+
+static const char * c_path = "m3_test_cache.m3c";
+
+static IM3Runtime  LoadModule  (IM3Environment i_env, IM3Module * o_module, const unsigned char * i_wasm, uint32_t i_size, M3Result * o_result)
+{
+    IM3Runtime runtime = m3_NewRuntime (i_env, 64 * 1024, NULL);
+
+    * o_result = m3_ParseModule (i_env, o_module, i_wasm, i_size);
+
+    if (!* o_result)
+        * o_result = m3_LoadModule (runtime, * o_module);
+
+    return runtime;
+}
+
+static int32_t  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg, M3Result * o_result)
+{
+    int32_t value = -1;
+
+    IM3Function function;
+    * o_result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!* o_result)
+        * o_result = m3_CallV (function, i_arg);
+
+    if (!* o_result)
+        m3_GetResultsV (function, & value);
+
+    return value;
+}
+
+static int  CheckRoundTrip  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_module, sizeof (c_module), & result);
+    expect (!result, "save: load module (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        result = m3_SaveCompiledModule (module, c_path);
+        if (result == m3Err_codeCacheUnsupported)
+        {
+            printf ("skip: (%s)\n", result);
+            m3_FreeRuntime (runtime);
+            m3_FreeEnvironment (env);
+            return 0;
+        }
+        expect (!result, "save (%s)", result ? result : "ok");
+
+        // saving compiles copies: the module's own functions are still uncompiled, and run as usual
+        int32_t value = Call (runtime, "chain", 5, & result);
+        expect (!result && value == 1000015, "save: chain (5) = %d", value);
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+
+    // a separate environment and runtime, as in another process
+    env = m3_NewEnvironment ();
+    runtime = LoadModule (env, & module, c_module, sizeof (c_module), & result);
+
+    if (!result)
+    {
+        result = m3_LoadCompiledModule (module, c_path);
+        expect (!result, "load (%s)", result ? result : "ok");
+
+        int32_t value = Call (runtime, "chain", 5, & result);
+        expect (!result && value == 1000015, "load: chain (5) = %d", value);
+
+        value = Call (runtime, "count", 1000, & result);
+        expect (!result && value == 10, "load: count (1000) = %d", value);
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+
+    return 1;
+}
+
+static void  CheckMismatch  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_otherModule, sizeof (c_otherModule), & result);
+
+    if (!result)
+    {
+        result = m3_LoadCompiledModule (module, c_path);
+        expect (result == m3Err_codeCacheMismatch, "other wasm: load refused (%s)", result ? result : "loaded");
+
+        int32_t value = Call (runtime, "chain", 5, & result);
+        expect (!result && value == 5, "other wasm: compiles as usual, chain (5) = %d", value);
+    }
+
+    result = m3_LoadCompiledModule (module, "m3_test_cache.missing");
+    expect (result == m3Err_codeCacheIO, "missing file (%s)", result ? result : "loaded");
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    if (CheckRoundTrip ())
+        CheckMismatch ();
+
+    remove (c_path);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,274 @@
+//
+//  m3_test_call.c
+//
+//  Calls exported functions over many argument sets at once, and through prepared
+//  calls, and checks the results against single calls, that a trap stops a batch
+//  where it happens, and that a prepared call refuses the wrong signature and isn't
+//  clobbered by a module's start function.
+//
+//  Build:  cc -I ../../source -o m3_test_call m3_test_call.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (func (export "mix") (param i32 i64) (result i64)
+//      local.get 0  i64.extend_i32_s  local.get 1  i64.const 3  i64.mul  i64.add)
+//    (func (export "div") (param i32 i32) (result i32)
+//      local.get 0  local.get 1  i32.div_s)
+//    (func (export "scale") (param f64 f32) (result f64)
+//      local.get 0  local.get 1  f64.promote_f32  f64.mul))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x13, 0x03, 0x60,
+    0x02, 0x7f, 0x7e, 0x01, 0x7e, 0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60,
+    0x02, 0x7c, 0x7d, 0x01, 0x7c, 0x03, 0x04, 0x03, 0x00, 0x01, 0x02, 0x07,
+    0x15, 0x03, 0x03, 0x6d, 0x69, 0x78, 0x00, 0x00, 0x03, 0x64, 0x69, 0x76,
+    0x00, 0x01, 0x05, 0x73, 0x63, 0x61, 0x6c, 0x65, 0x00, 0x02, 0x0a, 0x1e,
+    0x03, 0x0b, 0x00, 0x20, 0x00, 0xac, 0x20, 0x01, 0x42, 0x03, 0x7e, 0x7c,
+    0x0b, 0x07, 0x00, 0x20, 0x00, 0x20, 0x01, 0x6d, 0x0b, 0x08, 0x00, 0x20,
+    0x00, 0x20, 0x01, 0xbb, 0xa2, 0x0b,
+};
+
+//  (module
+//    (global $g (mut i32) (i32.const 0))
+//    (func $start (local i32 i32 i32 i32)
+//      i32.const 1  global.set $g)
+//    (func (export "add") (param i32 i32) (result i32)
+//      local.get 0  local.get 1  i32.add)
+//    (start $start))
+static const unsigned char c_startModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0a, 0x02, 0x60,
+    0x00, 0x00, 0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02, 0x00,
+    0x01, 0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07, 0x07, 0x01,
+    0x03, 0x61, 0x64, 0x64, 0x00, 0x01, 0x08, 0x01, 0x00, 0x0a, 0x12, 0x02,
+    0x08, 0x01, 0x04, 0x7f, 0x41, 0x01, 0x24, 0x00, 0x0b, 0x07, 0x00, 0x20,
+    0x00, 0x20, 0x01, 0x6a, 0x0b,
+};
+
+#define c_numCalls  1000
+
+static uint64_t  SlotI32  (int32_t i_value)
+{
+    uint64_t slot = 0;
+    memcpy (& slot, & i_value, sizeof (i_value));
+    return slot;
+}
+
+static int32_t  I32Slot  (uint64_t i_slot)
+{
+    int32_t value;
+    memcpy (& value, & i_slot, sizeof (value));
+    return value;
+}
+
+static void  CheckPrepared  (IM3Runtime i_runtime)
+{
+    IM3Function mix, div, scale;
+    m3_FindFunction (& mix, i_runtime, "mix");
+    m3_FindFunction (& div, i_runtime, "div");
+    m3_FindFunction (& scale, i_runtime, "scale");
+
+    IM3PreparedCall call = NULL;
+    M3Result result = m3_PrepareCall (& call, mix, "I(iF)");
+    expect (result == m3Err_signatureMismatch && !call, "prepare: wrong signature refused (%s)", result ? result : "ok");
+
+    result = m3_PrepareCall (& call, mix, "i(iI)");
+    expect (result == m3Err_signatureMismatch, "prepare: wrong result refused (%s)", result ? result : "ok");
+
+    result = m3_PrepareCall (& call, mix, "I(iI)");
+    expect (!result && call, "prepare: mix (%s)", result ? result : "ok");
+    if (result) return;
+
+    uint64_t * args = m3_GetPreparedArgs (call);
+    const uint64_t * results = m3_GetPreparedResults (call);
+
+    int numWrong = 0;
+    for (int i = 0; i < c_numCalls; ++i)
+    {
+        args [0] = SlotI32 (i - 500);
+        args [1] = (uint64_t) i * 0x100000001ull;
+        result = m3_CallPrepared (call);
+
+        int64_t expected = (int64_t) (i - 500) + (int64_t) ((uint64_t) i * 0x100000001ull) * 3;
+        numWrong += (result || (int64_t) results [0] != expected);
+    }
+    expect (numWrong == 0, "mix: %d of %d prepared calls wrong", numWrong, c_numCalls);
+
+    int64_t last = 0;
+    result = m3_GetResultsV (mix, & last);
+    expect (!result && last == (int64_t) results [0], "mix: last results = %lld", (long long) last);
+
+    m3_FreePreparedCall (call);
+
+    // a trap comes back as from any call, and the next one runs as usual
+    result = m3_PrepareCall (& call, div, "i(ii)");
+    expect (!result, "prepare: div (%s)", result ? result : "ok");
+    if (result) return;
+
+    args = m3_GetPreparedArgs (call);
+    results = m3_GetPreparedResults (call);
+
+    args [0] = SlotI32 (7);
+    args [1] = SlotI32 (0);
+    result = m3_CallPrepared (call);
+    expect (result == m3Err_trapDivisionByZero, "div: trap (%s)", result ? result : "no trap");
+
+    args [0] = SlotI32 (-9);
+    args [1] = SlotI32 (2);
+    result = m3_CallPrepared (call);
+    expect (!result && I32Slot (results [0]) == -4, "div: after the trap, -9 / 2 = %d", I32Slot (results [0]));
+
+    m3_FreePreparedCall (call);
+
+    result = m3_PrepareCall (& call, scale, "F(Ff)");
+    expect (!result, "prepare: scale (%s)", result ? result : "ok");
+    if (result) return;
+
+    double x = 2.5, scaled = 0;
+    float y = -2.0f;
+    args = m3_GetPreparedArgs (call);
+    memcpy (& args [0], & x, sizeof (x));
+    memcpy (& args [1], & y, sizeof (y));
+
+    result = m3_CallPrepared (call);
+    memcpy (& scaled, m3_GetPreparedResults (call), sizeof (scaled));
+    expect (!result && scaled == -5.0, "scale: %g (%s)", scaled, result ? result : "ok");
+
+    m3_FreePreparedCall (call);
+}
+
+// the start function hasn't run when the call's prepared; its locals mustn't land on the arguments
+static void  CheckPreparedStart  (IM3Environment i_environment)
+{
+    IM3Runtime runtime = m3_NewRuntime (i_environment, 64 * 1024, NULL);
+
+    IM3Module module;
+    IM3Function add;
+    IM3PreparedCall call = NULL;
+
+    M3Result result = m3_ParseModule (i_environment, & module, c_startModule, sizeof (c_startModule));
+    if (!result)
+        result = m3_LoadModule (runtime, module);
+    if (!result)
+        result = m3_FindFunction (& add, runtime, "add");
+    if (!result)
+        result = m3_PrepareCall (& call, add, "i(ii)");
+    expect (!result, "prepare with a start function (%s)", result ? result : "ok");
+
+    for (int i = 0; i < 2 && !result; ++i)
+    {
+        uint64_t * args = m3_GetPreparedArgs (call);
+        args [0] = SlotI32 (3);
+        args [1] = SlotI32 (4);
+
+        result = m3_CallPrepared (call);
+        int32_t sum = I32Slot (m3_GetPreparedResults (call) [0]);
+        expect (!result && sum == 7, "add (3, 4), call %d: %d (%s)", i + 1, sum, result ? result : "ok");
+    }
+
+    m3_FreePreparedCall (call);
+    m3_FreeRuntime (runtime);
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    if (!result)
+        result = m3_LoadModule (runtime, module);
+    expect (!result, "load (%s)", result ? result : "ok");
+    if (result) return 1;
+
+    IM3Function mix, div, scale;
+    m3_FindFunction (& mix, runtime, "mix");
+    m3_FindFunction (& div, runtime, "div");
+    m3_FindFunction (& scale, runtime, "scale");
+
+    static uint64_t args [c_numCalls * 2], results [c_numCalls];
+    uint32_t numCompleted = 0;
+
+    // mixed widths, matched against one call at a time
+    for (int i = 0; i < c_numCalls; ++i)
+    {
+        args [i * 2]     = SlotI32 (i - 500);
+        args [i * 2 + 1] = (uint64_t) i * 0x100000001ull;
+    }
+
+    result = m3_CallBatch (mix, c_numCalls, args, results, & numCompleted);
+    expect (!result && numCompleted == c_numCalls, "mix: batch of %u (%s)", numCompleted, result ? result : "ok");
+
+    int numWrong = 0;
+    for (int i = 0; i < c_numCalls; ++i)
+    {
+        int64_t expected;
+        m3_CallV (mix, (int32_t) (i - 500), (int64_t) args [i * 2 + 1]);
+        m3_GetResultsV (mix, & expected);
+
+        numWrong += ((int64_t) results [i] != expected);
+    }
+    expect (numWrong == 0, "mix: %d results differ from single calls", numWrong);
+
+    // the last call's results are there for m3_GetResults, as after m3_Call
+    int64_t last = 0;
+    m3_CallBatch (mix, 2, args, results, NULL);
+    result = m3_GetResultsV (mix, & last);
+    expect (!result && last == (int64_t) results [1], "mix: last results = %lld", (long long) last);
+
+    // a trap partway through: what came before is kept, and the batch stops there
+    for (int i = 0; i < 10; ++i)
+    {
+        args [i * 2]     = SlotI32 (1000);
+        args [i * 2 + 1] = SlotI32 (i == 7 ? 0 : i + 1);
+    }
+
+    memset (results, 0, sizeof (results));
+    result = m3_CallBatch (div, 10, args, results, & numCompleted);
+    expect (result == m3Err_trapDivisionByZero, "div: trap (%s)", result ? result : "no trap");
+    expect (numCompleted == 7, "div: stopped at %u", numCompleted);
+    expect (I32Slot (results [6]) == 1000 / 7 && results [7] == 0, "div: results up to the trap");
+
+    result = m3_GetResultsV (div, & last);
+    expect (result, "div: no last results after a trap (%s)", result ? result : "ok");
+
+    result = m3_CallBatch (div, 7, args, results, & numCompleted);
+    expect (!result && numCompleted == 7, "div: runs again after the trap (%s)", result ? result : "ok");
+
+    result = m3_CallBatch (div, 0, args, results, & numCompleted);
+    expect (!result && numCompleted == 0, "div: empty batch (%s)", result ? result : "ok");
+
+    // floats in slots: f64 fills one, f32 the first half of one
+    double x = 1.5;
+    float y = 4.0f;
+    memset (args, 0, 2 * sizeof (uint64_t));
+    memcpy (& args [0], & x, sizeof (x));
+    memcpy (& args [1], & y, sizeof (y));
+
+    result = m3_CallBatch (scale, 1, args, results, & numCompleted);
+
+    double scaled;
+    memcpy (& scaled, & results [0], sizeof (scaled));
+    expect (!result && scaled == 6.0, "scale: %g (%s)", scaled, result ? result : "ok");
+
+    CheckPrepared (runtime);
+    CheckPreparedStart (env);
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
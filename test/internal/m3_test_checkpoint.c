@@ -0,0 +1,328 @@
+//
+//  m3_test_checkpoint.c
+//
+//  Checkpoints a runtime, writes its memory and globals (from wasm, past a trap,
+//  and from a host function reading a pipe into it) and grows the memory, then
+//  checks that restoring puts everything back, as many times as it's asked to, also
+//  after threads all wrote the same page at once.
+//
+//  Build:  cc -I ../../source -o m3_test_checkpoint m3_test_checkpoint.c libm3.a -lm -lpthread
+//
+
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "wasm3.h"
+#include "m3_config.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (import "env" "read" (func $read (param i32 i32)))
+//    (memory 4 8)
+//    (data (i32.const 0) "abcd")
+//    (global $g (mut i32) (i32.const 10))
+//    (func (export "poke") (param i32 i32)
+//      local.get 0  local.get 1  i32.store)
+//    (func (export "peek") (param i32) (result i32)
+//      local.get 0  i32.load)
+//    (func (export "bump") (param i32) (result i32)
+//      global.get $g  local.get 0  i32.add  global.set $g  global.get $g)
+//    (func (export "grow") (param i32) (result i32)
+//      local.get 0  memory.grow)
+//    (func (export "pokeAndTrap") (param i32 i32)
+//      local.get 0  local.get 1  i32.store  unreachable)
+//    (func (export "read") (param i32 i32)
+//      local.get 0  local.get 1  call $read))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0b, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x02, 0x0c, 0x01,
+    0x03, 0x65, 0x6e, 0x76, 0x04, 0x72, 0x65, 0x61, 0x64, 0x00, 0x01, 0x03,
+    0x07, 0x06, 0x01, 0x00, 0x00, 0x00, 0x01, 0x01, 0x05, 0x04, 0x01, 0x01,
+    0x04, 0x08, 0x06, 0x06, 0x01, 0x7f, 0x01, 0x41, 0x0a, 0x0b, 0x07, 0x32,
+    0x06, 0x04, 0x70, 0x6f, 0x6b, 0x65, 0x00, 0x01, 0x04, 0x70, 0x65, 0x65,
+    0x6b, 0x00, 0x02, 0x04, 0x62, 0x75, 0x6d, 0x70, 0x00, 0x03, 0x04, 0x67,
+    0x72, 0x6f, 0x77, 0x00, 0x04, 0x0b, 0x70, 0x6f, 0x6b, 0x65, 0x41, 0x6e,
+    0x64, 0x54, 0x72, 0x61, 0x70, 0x00, 0x05, 0x04, 0x72, 0x65, 0x61, 0x64,
+    0x00, 0x06, 0x0a, 0x3a, 0x06, 0x09, 0x00, 0x20, 0x00, 0x20, 0x01, 0x36,
+    0x02, 0x00, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b, 0x0b,
+    0x00, 0x23, 0x00, 0x20, 0x00, 0x6a, 0x24, 0x00, 0x23, 0x00, 0x0b, 0x06,
+    0x00, 0x20, 0x00, 0x40, 0x00, 0x0b, 0x0a, 0x00, 0x20, 0x00, 0x20, 0x01,
+    0x36, 0x02, 0x00, 0x00, 0x0b, 0x08, 0x00, 0x20, 0x00, 0x20, 0x01, 0x10,
+    0x00, 0x0b, 0x0b, 0x0a, 0x01, 0x00, 0x41, 0x00, 0x0b, 0x04, 0x61, 0x62,
+    0x63, 0x64,
+};
+
+//  (module
+//    (memory 100 (pagesize 1))
+//    (func (export "peek") (param i32) (result i32)
+//      local.get 0  i32.load)
+//    (func (export "poke") (param i32 i32)
+//      local.get 0  local.get 1  i32.store)
+//    (func (export "grow") (param i32) (result i32)
+//      local.get 0  memory.grow))
+static const unsigned char c_bytePagesModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0b, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x03, 0x04, 0x03,
+    0x00, 0x01, 0x00, 0x05, 0x04, 0x01, 0x08, 0x64, 0x00, 0x07, 0x16, 0x03,
+    0x04, 0x70, 0x65, 0x65, 0x6b, 0x00, 0x00, 0x04, 0x70, 0x6f, 0x6b, 0x65,
+    0x00, 0x01, 0x04, 0x67, 0x72, 0x6f, 0x77, 0x00, 0x02, 0x0a, 0x1a, 0x03,
+    0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b, 0x09, 0x00, 0x20, 0x00,
+    0x20, 0x01, 0x36, 0x02, 0x00, 0x0b, 0x06, 0x00, 0x20, 0x00, 0x40, 0x00,
+    0x0b,
+};
+
+static int s_pipe [2];
+
+// reads into linear memory with read(2), which fails on a write-protected page
+m3ApiRawFunction (Read)
+{
+    m3ApiGetArgMem  (uint8_t *, buffer)
+    m3ApiGetArg     (int32_t,   size)
+
+    m3ApiCheckMem (buffer, size);
+
+    if (read (s_pipe [0], buffer, size) != size)
+        m3ApiTrap ("read failed");
+
+    m3ApiSuccess ();
+}
+
+static int32_t  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg, M3Result * o_result)
+{
+    int32_t value = -1;
+
+    IM3Function function;
+    * o_result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!* o_result)
+        * o_result = m3_CallV (function, i_arg);
+
+    if (!* o_result)
+        m3_GetResultsV (function, & value);
+
+    return value;
+}
+
+static M3Result  Call2  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg0, int32_t i_arg1)
+{
+    IM3Function function;
+    M3Result result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!result)
+        result = m3_CallV (function, i_arg0, i_arg1);
+
+    return result;
+}
+
+static void  CheckRestored  (IM3Runtime i_runtime, const char * i_label)
+{
+    M3Result result;
+
+    int32_t value = Call (i_runtime, "peek", 0, & result);
+    expect (!result && value == 0x64636261, "%s: peek (0) = 0x%x", i_label, value);
+
+    value = Call (i_runtime, "peek", 2 * 65536 + 100, & result);
+    expect (!result && value == 0, "%s: peek (2 * 65536 + 100) = %d", i_label, value);
+
+    value = Call (i_runtime, "peek", 3 * 65536, & result);
+    expect (!result && value == 0, "%s: peek (3 * 65536) = %d", i_label, value);
+
+    value = Call (i_runtime, "bump", 0, & result);
+    expect (!result && value == 10, "%s: bump (0) = %d", i_label, value);
+
+    value = Call (i_runtime, "grow", 0, & result);
+    expect (!result && value == 4, "%s: %d pages", i_label, value);
+}
+
+#define c_numWriters    4
+#define c_numRaces      200
+
+static pthread_barrier_t s_barrier;
+
+// each writer faults on the same untouched page at the same time; only one copy of it
+// may be saved, and before any of their writes
+static void *  Writer  (void * i_byte)
+{
+    volatile uint8_t * byte = (volatile uint8_t *) i_byte;
+
+    for (int i = 0; i < c_numRaces; ++i)
+    {
+        pthread_barrier_wait (& s_barrier);
+        * byte = 0xff;
+        pthread_barrier_wait (& s_barrier);     // the restore
+        pthread_barrier_wait (& s_barrier);
+    }
+
+    return NULL;
+}
+
+static void  CheckRacingWrites  (IM3Runtime i_runtime)
+{
+    uint8_t * memory = m3_GetMemory (i_runtime, NULL, 0);
+    uint8_t * page = memory + 65536;
+
+    pthread_t threads [c_numWriters];
+    pthread_barrier_init (& s_barrier, NULL, c_numWriters + 1);
+
+    for (int i = 0; i < c_numWriters; ++i)
+        pthread_create (& threads [i], NULL, Writer, page + i * 64);
+
+    int numIntact = 0;
+    for (int i = 0; i < c_numRaces; ++i)
+    {
+        pthread_barrier_wait (& s_barrier);
+        pthread_barrier_wait (& s_barrier);
+
+        M3Result result = m3_RestoreCheckpoint (i_runtime);
+
+        int intact = !result;
+        for (int w = 0; w < c_numWriters; ++w)
+            intact = intact && page [w * 64] == 0;
+
+        numIntact += intact;
+        pthread_barrier_wait (& s_barrier);
+    }
+
+    for (int i = 0; i < c_numWriters; ++i)
+        pthread_join (threads [i], NULL);
+
+    pthread_barrier_destroy (& s_barrier);
+
+    expect (numIntact == c_numRaces, "racing writes: restored %d of %d times", numIntact, c_numRaces);
+}
+
+// a memory of 100 one byte pages ends inside an OS page, and what was grown into
+// past its end in that OS page has to be zero again after a restore too
+static void  CheckBytePages  (IM3Environment i_env)
+{
+#if d_m3UseGuardPages
+    // guard pages take pages of whole OS pages
+    printf ("skip: byte pages with d_m3UseGuardPages\n");
+    return;
+#endif
+
+    IM3Runtime runtime = m3_NewRuntime (i_env, 64 * 1024, NULL);
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (i_env, & module, c_bytePagesModule, sizeof (c_bytePagesModule));
+    if (!result)
+        result = m3_LoadModule (runtime, module);
+    if (!result)
+        result = m3_Checkpoint (runtime);
+    expect (!result, "byte pages: checkpoint (%s)", result ? result : "ok");
+
+    int32_t value = -1;
+    if (!result)
+        Call (runtime, "grow", 100, & result);
+    if (!result)
+        result = Call2 (runtime, "poke", 150, 0x5a5a5a5a);
+    if (!result)
+        result = m3_RestoreCheckpoint (runtime);
+    if (!result)
+        value = Call (runtime, "grow", 100, & result);
+    expect (!result && value == 100, "byte pages: grown again from %d pages (%s)", value, result ? result : "ok");
+
+    if (!result)
+        value = Call (runtime, "peek", 150, & result);
+    expect (!result && value == 0, "byte pages: peek (150) = 0x%x", value);
+
+    m3_FreeRuntime (runtime);
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    if (!result)
+        result = m3_LoadModule (runtime, module);
+    if (!result)
+        result = m3_LinkRawFunction (module, "env", "read", "v(ii)", & Read);
+    expect (!result, "load (%s)", result ? result : "ok");
+    if (result) return 1;
+
+    result = m3_RestoreCheckpoint (runtime);
+    expect (result == m3Err_noCheckpoint || result == m3Err_checkpointUnsupported, "restore without a checkpoint refused (%s)", result ? result : "ok");
+
+    result = m3_Checkpoint (runtime);
+    if (result == m3Err_checkpointUnsupported)
+    {
+        printf ("skip: (%s)\n", result);
+        return 0;
+    }
+    expect (!result, "checkpoint (%s)", result ? result : "ok");
+
+    pipe (s_pipe);
+
+    for (int round = 0; round < 3; ++round)
+    {
+        char label [16];
+        snprintf (label, sizeof (label), "round %d", round);
+
+        result = Call2 (runtime, "poke", 0, 1);
+        expect (!result, "%s: poke (%s)", label, result ? result : "ok");
+
+        Call (runtime, "bump", 5, & result);
+
+        // a write, then a trap: the write is undone along with the rest
+        result = Call2 (runtime, "pokeAndTrap", 2 * 65536 + 100, 2);
+        expect (result == m3Err_trapUnreachable, "%s: trap (%s)", label, result ? result : "no trap");
+
+        // the kernel can't fault into the handler, so this only works for the host having touched the page
+        write (s_pipe [1], "wxyz", 4);
+        result = Call2 (runtime, "read", 3 * 65536, 4);
+        expect (!result, "%s: read into memory (%s)", label, result ? result : "ok");
+
+        int32_t value = Call (runtime, "peek", 3 * 65536, & result);
+        expect (!result && value == 0x7a797877, "%s: what was read, peek = 0x%x", label, value);
+
+        value = Call (runtime, "grow", 2, & result);
+        expect (!result && value == 4, "%s: grow (2) = %d", label, value);
+
+        result = Call2 (runtime, "poke", 5 * 65536, 3);
+        expect (!result, "%s: poke the new pages (%s)", label, result ? result : "ok");
+
+        result = m3_RestoreCheckpoint (runtime);
+        expect (!result, "%s: restore (%s)", label, result ? result : "ok");
+
+        CheckRestored (runtime, label);
+
+        // the pages grown into again come back zeroed
+        Call (runtime, "grow", 2, & result);
+        value = Call (runtime, "peek", 5 * 65536, & result);
+        expect (!result && value == 0, "%s: grown again, peek (5 * 65536) = %d", label, value);
+
+        result = m3_RestoreCheckpoint (runtime);
+        expect (!result, "%s: restore again (%s)", label, result ? result : "ok");
+    }
+
+    CheckRacingWrites (runtime);
+
+    m3_DropCheckpoint (runtime);
+
+    result = m3_RestoreCheckpoint (runtime);
+    expect (result == m3Err_noCheckpoint, "restore after dropping refused (%s)", result ? result : "ok");
+
+    result = Call2 (runtime, "poke", 0, 7);
+    int32_t value = Call (runtime, "peek", 0, & result);
+    expect (!result && value == 7, "dropped: memory writable as usual, peek (0) = %d", value);
+
+    m3_FreeRuntime (runtime);
+
+    CheckBytePages (env);
+
+    m3_FreeEnvironment (env);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,285 @@
+//
+//  m3_test_compile.c
+//
+//  Compiles modules up front on several threads, or lazily with a background
+//  thread compiling ahead, and checks that calls between their functions are bound,
+//  and that a function failing to compile is reported without stranding the others.
+//  Also compiles a function whose compile has to compile an imported one first.
+//
+//  Build:  cc -I ../../source -o m3_test_compile m3_test_compile.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (func $f0 (export "chain") (param i32) (result i32)
+//      local.get 0  call $f1  i32.const 1  i32.add)
+//    ... $f1 to $f6 likewise, each calling the next
+//    (func $f7 (param i32) (result i32)
+//      local.get 0)
+//    (func $count (export "count") (param i32) (result i32)
+//      local.get 0  i32.eqz
+//      if (result i32)
+//        i32.const 7
+//      else
+//        local.get 0  i32.const 1  i32.sub  return_call $count
+//      end))
+static const unsigned char c_chainModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x0a, 0x09, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x07, 0x11, 0x02, 0x05, 0x63, 0x68, 0x61, 0x69,
+    0x6e, 0x00, 0x00, 0x05, 0x63, 0x6f, 0x75, 0x6e, 0x74, 0x00, 0x08, 0x0a,
+    0x5f, 0x09, 0x09, 0x00, 0x20, 0x00, 0x10, 0x01, 0x41, 0x01, 0x6a, 0x0b,
+    0x09, 0x00, 0x20, 0x00, 0x10, 0x02, 0x41, 0x01, 0x6a, 0x0b, 0x09, 0x00,
+    0x20, 0x00, 0x10, 0x03, 0x41, 0x01, 0x6a, 0x0b, 0x09, 0x00, 0x20, 0x00,
+    0x10, 0x04, 0x41, 0x01, 0x6a, 0x0b, 0x09, 0x00, 0x20, 0x00, 0x10, 0x05,
+    0x41, 0x01, 0x6a, 0x0b, 0x09, 0x00, 0x20, 0x00, 0x10, 0x06, 0x41, 0x01,
+    0x6a, 0x0b, 0x09, 0x00, 0x20, 0x00, 0x10, 0x07, 0x41, 0x01, 0x6a, 0x0b,
+    0x04, 0x00, 0x20, 0x00, 0x0b, 0x12, 0x00, 0x20, 0x00, 0x45, 0x04, 0x7f,
+    0x41, 0x07, 0x05, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x12, 0x08, 0x0b, 0x0b,
+};
+
+//  (module
+//    (func (export "ok") (param i32) (result i32)
+//      local.get 0  call 1)
+//    (func (param i32) (result i32)
+//      local.get 0  i32.const 1  i32.add)
+//    (func (export "bad") (param i32) (result i32)
+//      i32.add))
+static const unsigned char c_badModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x04, 0x03, 0x00, 0x00, 0x00, 0x07, 0x0c,
+    0x02, 0x02, 0x6f, 0x6b, 0x00, 0x00, 0x03, 0x62, 0x61, 0x64, 0x00, 0x02,
+    0x0a, 0x14, 0x03, 0x06, 0x00, 0x20, 0x00, 0x10, 0x01, 0x0b, 0x07, 0x00,
+    0x20, 0x00, 0x41, 0x01, 0x6a, 0x0b, 0x03, 0x00, 0x6a, 0x0b,
+};
+
+//  (module
+//    (func (export "inc") (param i32) (result i32)
+//      local.get 0  i32.const 1  i32.add))
+static const unsigned char c_libModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x03, 0x02, 0x01, 0x00, 0x07, 0x07, 0x01, 0x03,
+    0x69, 0x6e, 0x63, 0x00, 0x00, 0x0a, 0x09, 0x01, 0x07, 0x00, 0x20, 0x00,
+    0x41, 0x01, 0x6a, 0x0b,
+};
+
+//  (module
+//    (import "lib" "inc" (func $inc (param i32) (result i32)))
+//    (func (export "entry") (param i32) (result i32)
+//      local.get 0  call $outer)
+//    (func $outer (param i32) (result i32) (local i32)
+//      local.get 0  i32.const 10  i32.mul  call $inc  local.set 1
+//      local.get 1  local.get 0  i32.add))
+static const unsigned char c_importModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x06, 0x01, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x02, 0x0b, 0x01, 0x03, 0x6c, 0x69, 0x62, 0x03,
+    0x69, 0x6e, 0x63, 0x00, 0x00, 0x03, 0x03, 0x02, 0x00, 0x00, 0x07, 0x09,
+    0x01, 0x05, 0x65, 0x6e, 0x74, 0x72, 0x79, 0x00, 0x01, 0x0a, 0x1b, 0x02,
+    0x06, 0x00, 0x20, 0x00, 0x10, 0x02, 0x0b, 0x12, 0x01, 0x01, 0x7f, 0x20,
+    0x00, 0x41, 0x0a, 0x6c, 0x10, 0x00, 0x21, 0x01, 0x20, 0x01, 0x20, 0x00,
+    0x6a, 0x0b,
+};
+
+static IM3Runtime  LoadModule  (IM3Environment i_env, IM3Module * o_module, const unsigned char * i_wasm, uint32_t i_size, M3Result * o_result)
+{
+    IM3Runtime runtime = m3_NewRuntime (i_env, 64 * 1024, NULL);
+
+    * o_result = m3_ParseModule (i_env, o_module, i_wasm, i_size);
+
+    if (!* o_result)
+        * o_result = m3_LoadModule (runtime, * o_module);
+
+    return runtime;
+}
+
+static int32_t  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg, M3Result * o_result)
+{
+    int32_t value = -1;
+
+    IM3Function function;
+    * o_result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!* o_result)
+        * o_result = m3_CallV (function, i_arg);
+
+    if (!* o_result)
+        m3_GetResultsV (function, & value);
+
+    return value;
+}
+
+static void  CheckChain  (uint32_t i_numThreads)
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_chainModule, sizeof (c_chainModule), & result);
+    expect (!result, "%u threads: load (%s)", i_numThreads, result ? result : "ok");
+
+    if (!result)
+    {
+        result = m3_CompileModuleParallel (module, i_numThreads);
+        expect (!result, "%u threads: compile (%s)", i_numThreads, result ? result : "ok");
+
+        int32_t value = Call (runtime, "chain", 5, & result);
+        expect (!result && value == 12, "%u threads: chain (5) = %d", i_numThreads, value);
+
+        value = Call (runtime, "count", 100, & result);
+        expect (!result && value == 7, "%u threads: count (100) = %d", i_numThreads, value);
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+
+static void  CheckFailure  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_badModule, sizeof (c_badModule), & result);
+    expect (!result, "failure: load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        result = m3_CompileModuleParallel (module, 3);
+        expect (result, "failure: compile reports (%s)", result ? result : "no error");
+
+        int32_t value = Call (runtime, "ok", 41, & result);
+        expect (!result && value == 42, "failure: the rest still run, ok (41) = %d", value);
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+
+static void  CheckBackground  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_chainModule, sizeof (c_chainModule), & result);
+    expect (!result, "background: load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        result = m3_EnableBackgroundCompile (runtime, 1);
+        if (result == m3Err_backgroundCompileUnsupported)
+        {
+            printf ("skip: background (%s)\n", result);
+            m3_FreeRuntime (runtime);
+            m3_FreeEnvironment (env);
+            return;
+        }
+        expect (!result, "background: enable (%s)", result ? result : "ok");
+
+        // the first calls race the thread for each callee; later ones find them compiled
+        for (int i = 0; i < 100; ++i)
+        {
+            int32_t value = Call (runtime, "chain", i, & result);
+            if (result || value != i + 7)
+            {
+                expect (0, "background: chain (%d) = %d (%s)", i, value, result ? result : "ok");
+                break;
+            }
+
+            value = Call (runtime, "count", i, & result);
+            if (result || value != 7)
+            {
+                expect (0, "background: count (%d) = %d (%s)", i, value, result ? result : "ok");
+                break;
+            }
+        }
+        expect (!result, "background: chain and count, 100 times");
+
+        // off and on again keeps what was compiled; freeing the runtime stops the thread
+        result = m3_EnableBackgroundCompile (runtime, 0);
+        expect (!result, "background: disable (%s)", result ? result : "ok");
+
+        int32_t value = Call (runtime, "chain", 5, & result);
+        expect (!result && value == 12, "background: after disable, chain (5) = %d", value);
+
+        result = m3_EnableBackgroundCompile (runtime, 1);
+        expect (!result, "background: enable again (%s)", result ? result : "ok");
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+
+// Compiling $outer resolves its import, which compiles lib's inc in the middle of it. With
+// the background thread on, it races the runtime's thread for $outer, queued by entry.
+static void  CheckNested  (int i_background)
+{
+    const char * label = i_background ? "nested, background, 50 runtimes" : "nested";
+    int numRounds = i_background ? 50 : 1;
+
+    M3Result result = m3Err_none;
+
+    for (int round = 0; round < numRounds && !result; ++round)
+    {
+        IM3Environment env = m3_NewEnvironment ();
+
+        IM3Module lib, module;
+        IM3Runtime runtime = LoadModule (env, & lib, c_libModule, sizeof (c_libModule), & result);
+        m3_SetModuleName (lib, "lib");
+
+        if (!result)
+            result = m3_ParseModule (env, & module, c_importModule, sizeof (c_importModule));
+        if (!result)
+            result = m3_LoadModule (runtime, module);
+        if (!result && i_background)
+        {
+            result = m3_EnableBackgroundCompile (runtime, 1);
+            if (result == m3Err_backgroundCompileUnsupported)
+            {
+                printf ("skip: %s (%s)\n", label, result);
+                m3_FreeRuntime (runtime);
+                m3_FreeEnvironment (env);
+                return;
+            }
+        }
+
+        int32_t value = result ? -1 : Call (runtime, "entry", 3, & result);
+        if (!result && value != 34)
+            result = "wrong result";
+
+        if (result || round == numRounds - 1)
+            expect (!result && value == 34, "%s: entry (3) = %d (%s)", label, value, result ? result : "ok");
+
+        m3_FreeRuntime (runtime);
+        m3_FreeEnvironment (env);
+    }
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    CheckChain (1);
+    CheckChain (4);
+    CheckChain (0);         // one per core
+    CheckChain (64);        // more threads than functions
+
+    CheckFailure ();
+
+    CheckBackground ();
+
+    CheckNested (0);
+    CheckNested (1);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
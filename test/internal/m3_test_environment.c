@@ -0,0 +1,351 @@
+//
+//  m3_test_environment.c
+//
+//  Has several threads parse modules into one environment at once, each with the same
+//  64 function types listed in its own order, load them into runtimes of their own and
+//  free those again. A module calling into another only links when the types both
+//  list were interned to the same ones, so every call checks that. Then does the same
+//  with 4096 types, and times parsing those into an environment that already has them.
+//
+//  Build:  cc -I ../../source -o m3_test_environment m3_test_environment.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+enum { c_numThreads = 8, c_numRounds = 40, c_maxTypes = 4096 };
+
+// type k takes i64 for each set bit of k, i32 otherwise, so up to 2 ^ numParams distinct types
+typedef struct Shape
+{
+    uint32_t    numTypes;
+    uint32_t    numParams;
+}
+Shape;
+
+static const Shape c_small = { 64, 6 };
+static const Shape c_large = { c_maxTypes, 12 };
+
+typedef struct Wasm
+{
+    uint8_t     bytes [256 * 1024];
+    uint32_t    size;
+}
+Wasm;
+
+static void  Byte  (Wasm * io_wasm, uint8_t i_byte)
+{
+    io_wasm->bytes [io_wasm->size++] = i_byte;
+}
+
+static void  Leb  (Wasm * io_wasm, uint32_t i_value)
+{
+    do
+    {
+        uint8_t byte = i_value & 0x7f;
+        i_value >>= 7;
+        Byte (io_wasm, byte | (i_value ? 0x80 : 0));
+    }
+    while (i_value);
+}
+
+static void  Name  (Wasm * io_wasm, const char * i_name)
+{
+    uint32_t length = (uint32_t) strlen (i_name);
+    Leb (io_wasm, length);
+    for (uint32_t i = 0; i < length; ++i)
+        Byte (io_wasm, i_name [i]);
+}
+
+static void  Section  (Wasm * io_wasm, uint8_t i_id, const Wasm * i_body)
+{
+    Byte (io_wasm, i_id);
+    Leb (io_wasm, i_body->size);
+    memcpy (io_wasm->bytes + io_wasm->size, i_body->bytes, i_body->size);
+    io_wasm->size += i_body->size;
+}
+
+static uint8_t  ParamType  (uint32_t i_type, uint32_t i_param)
+{
+    return (i_type >> i_param) & 1 ? 0x7e : 0x7f;
+}
+
+static void  Types  (Wasm * io_wasm, Shape i_shape, const uint32_t * i_order, int i_withSum)
+{
+    static __thread Wasm body;
+    body.size = 0;
+    Leb (& body, i_shape.numTypes + i_withSum);
+
+    for (uint32_t i = 0; i < i_shape.numTypes; ++i)
+    {
+        Byte (& body, 0x60);
+        Leb (& body, i_shape.numParams);
+        for (uint32_t p = 0; p < i_shape.numParams; ++p)
+            Byte (& body, ParamType (i_order [i], p));
+        Byte (& body, 1);  Byte (& body, 0x7f);
+    }
+
+    if (i_withSum)
+    {
+        Byte (& body, 0x60);  Byte (& body, 0);  Byte (& body, 1);  Byte (& body, 0x7f);
+    }
+
+    Section (io_wasm, 1, & body);
+}
+
+static void  Header  (Wasm * io_wasm)
+{
+    static const uint8_t c_header [] = { 0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00 };
+
+    memcpy (io_wasm->bytes, c_header, sizeof (c_header));
+    io_wasm->size = sizeof (c_header);
+}
+
+// function i has type i_order [i] and returns that number; exported as "f<type>"
+static void  Provider  (Wasm * o_wasm, Shape i_shape, const uint32_t * i_order)
+{
+    Header (o_wasm);
+    Types (o_wasm, i_shape, i_order, 0);
+
+    static __thread Wasm body;
+    body.size = 0;
+    Leb (& body, i_shape.numTypes);
+    for (uint32_t i = 0; i < i_shape.numTypes; ++i)
+        Leb (& body, i);
+    Section (o_wasm, 3, & body);
+
+    body.size = 0;
+    Leb (& body, i_shape.numTypes);
+    for (uint32_t i = 0; i < i_shape.numTypes; ++i)
+    {
+        char name [8];
+        snprintf (name, sizeof (name), "f%u", i_order [i]);
+        Name (& body, name);
+        Byte (& body, 0);  Leb (& body, i);
+    }
+    Section (o_wasm, 7, & body);
+
+    body.size = 0;
+    Leb (& body, i_shape.numTypes);
+    for (uint32_t i = 0; i < i_shape.numTypes; ++i)
+    {
+        // i32.const, its signed LEB immediate two bytes from 64 on
+        uint32_t value = i_order [i];
+        Leb (& body, value < 64 ? 4 : 5);
+        Byte (& body, 0);  Byte (& body, 0x41);
+        if (value < 64)    Byte (& body, value);
+        else             { Byte (& body, 0x80 | (value & 0x7f));  Byte (& body, value >> 7); }
+        Byte (& body, 0x0b);
+    }
+    Section (o_wasm, 10, & body);
+}
+
+// imports "p"."f<type>" in i_order, and exports "sum", which calls each with zeros and adds the results up
+static void  Consumer  (Wasm * o_wasm, Shape i_shape, const uint32_t * i_order)
+{
+    Header (o_wasm);
+    Types (o_wasm, i_shape, i_order, 1);
+
+    static __thread Wasm body, code;
+    body.size = 0;
+    Leb (& body, i_shape.numTypes);
+    for (uint32_t i = 0; i < i_shape.numTypes; ++i)
+    {
+        char name [8];
+        snprintf (name, sizeof (name), "f%u", i_order [i]);
+        Name (& body, "p");  Name (& body, name);
+        Byte (& body, 0);  Leb (& body, i);
+    }
+    Section (o_wasm, 2, & body);
+
+    body.size = 0;
+    Leb (& body, 1);  Leb (& body, i_shape.numTypes);
+    Section (o_wasm, 3, & body);
+
+    body.size = 0;
+    Leb (& body, 1);  Name (& body, "sum");  Byte (& body, 0);  Leb (& body, i_shape.numTypes);
+    Section (o_wasm, 7, & body);
+
+    code.size = 0;
+    Leb (& code, 0);
+    for (uint32_t i = 0; i < i_shape.numTypes; ++i)
+    {
+        for (uint32_t p = 0; p < i_shape.numParams; ++p)
+        {
+            Byte (& code, ParamType (i_order [i], p) == 0x7e ? 0x42 : 0x41);  Byte (& code, 0);
+        }
+        Byte (& code, 0x10);  Leb (& code, i);
+        if (i)
+            Byte (& code, 0x6a);
+    }
+    Byte (& code, 0x0b);
+
+    body.size = 0;
+    Leb (& body, 1);  Leb (& body, code.size);
+    memcpy (body.bytes + body.size, code.bytes, code.size);
+    body.size += code.size;
+    Section (o_wasm, 10, & body);
+}
+
+// a rotation of the types, backwards if i_reversed
+static void  Order  (uint32_t * o_order, Shape i_shape, uint32_t i_rotation, int i_reversed)
+{
+    uint32_t n = i_shape.numTypes;
+
+    for (uint32_t i = 0; i < n; ++i)
+        o_order [i] = (i_reversed ? n - 1 - i + i_rotation : i + i_rotation) % n;
+}
+
+static IM3Environment   s_environment;
+static int              s_numWrong [c_numThreads];
+
+static M3Result  Round  (Shape i_shape, uint32_t i_thread, uint32_t i_round, int32_t * o_sum)
+{
+    M3Result result = m3Err_none;
+
+    uint32_t order [c_maxTypes] = { 0 };
+    static __thread Wasm provider, consumer;
+
+    Order (order, i_shape, i_thread * 7 + i_round, 0);
+    Provider (& provider, i_shape, order);
+    Order (order, i_shape, i_thread * 13 + i_round * 3, 1);
+    Consumer (& consumer, i_shape, order);
+
+    IM3Runtime runtime = m3_NewRuntime (s_environment, 64 * 1024, NULL);
+    if (!runtime)
+        return m3Err_mallocFailed;
+
+    IM3Module providerModule, consumerModule;
+    IM3Function sum;
+
+    result = m3_ParseModule (s_environment, & providerModule, provider.bytes, provider.size);
+    if (!result)
+    {
+        m3_SetModuleName (providerModule, "p");
+        result = m3_LoadModule (runtime, providerModule);
+    }
+    if (!result)
+        result = m3_CompileModule (providerModule);
+    if (!result)
+        result = m3_ParseModule (s_environment, & consumerModule, consumer.bytes, consumer.size);
+    if (!result)
+        result = m3_LoadModule (runtime, consumerModule);
+    if (!result)
+        result = m3_FindFunction (& sum, runtime, "sum");
+    if (!result)
+        result = m3_CallV (sum);
+    if (!result)
+        result = m3_GetResultsV (sum, o_sum);
+
+    // its code pages go back to the environment, for another thread to take
+    m3_FreeRuntime (runtime);
+
+    return result;
+}
+
+static int32_t  Expected  (Shape i_shape)
+{
+    return (int32_t) (i_shape.numTypes * (i_shape.numTypes - 1) / 2);
+}
+
+static void *  Run  (void * i_thread)
+{
+    uint32_t thread = (uint32_t) (intptr_t) i_thread;
+
+    for (uint32_t round = 0; round < c_numRounds; ++round)
+    {
+        int32_t sum = 0;
+        M3Result result = Round (c_small, thread, round, & sum);
+
+        if (result || sum != Expected (c_small))
+        {
+            if (!s_numWrong [thread]++)
+                printf ("      thread %u round %u: %d (%s)\n", thread, round, sum, result ? result : "ok");
+        }
+    }
+
+    return NULL;
+}
+
+static double  Now  ()
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, & now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// parsing a module whose types are all in the environment already
+static void  TimeParse  ()
+{
+    enum { c_numParses = 20 };
+
+    uint32_t order [c_maxTypes] = { 0 };
+    static Wasm consumer;
+
+    Order (order, c_large, 5, 0);
+    Consumer (& consumer, c_large, order);
+
+    M3Result result = m3Err_none;
+    double start = Now ();
+
+    for (int i = 0; i < c_numParses && !result; ++i)
+    {
+        IM3Module module;
+        result = m3_ParseModule (s_environment, & module, consumer.bytes, consumer.size);
+        if (!result)
+            m3_FreeModule (module);
+    }
+
+    double perParse = (Now () - start) / c_numParses;
+    expect (!result, "parse %u types: %.3f ms (%s)", c_large.numTypes, perParse * 1e3, result ? result : "ok");
+}
+
+int  main  (void)
+{
+    s_environment = m3_NewEnvironment ();
+
+    pthread_t threads [c_numThreads];
+    for (int i = 0; i < c_numThreads; ++i)
+        pthread_create (& threads [i], NULL, Run, (void *) (intptr_t) i);
+
+    int numWrong = 0;
+    for (int i = 0; i < c_numThreads; ++i)
+    {
+        pthread_join (threads [i], NULL);
+        numWrong += s_numWrong [i];
+    }
+
+    expect (numWrong == 0, "%d threads x %d rounds: %d wrong", c_numThreads, c_numRounds, numWrong);
+
+    // and again on this thread, now that the environment holds all the types
+    int32_t sum = 0;
+    M3Result result = Round (c_small, c_numThreads, 0, & sum);
+    expect (!result && sum == Expected (c_small), "after: %d (%s)", sum, result ? result : "ok");
+
+    // enough types that the environment has to grow its index a few times
+    for (uint32_t round = 0; round < 2; ++round)
+    {
+        sum = 0;
+        result = Round (c_large, c_numThreads, round, & sum);
+        expect (!result && sum == Expected (c_large), "%u types, round %u: %d (%s)", c_large.numTypes, round, sum, result ? result : "ok");
+    }
+
+    TimeParse ();
+
+    m3_FreeEnvironment (s_environment);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+//
+//  m3_test_epoch.c
+//
+//  Gives calls an epoch deadline, and checks that a call traps once the epoch
+//  reaches it, at a function entry or in a loop, also with a watchdog thread
+//  moving the epoch on, and that a new deadline lets calls run again.
+//
+//  Build:  cc -I ../../source -o m3_test_epoch m3_test_epoch.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (func (export "spin") (param i32) (result i32)
+//      block
+//        loop
+//          local.get 0  i32.eqz  br_if 1
+//          local.get 0  i32.const 1  i32.sub  local.set 0
+//          br 0
+//        end
+//      end
+//      local.get 0)
+//    (func (export "forever")
+//      loop  br 0  end)
+//    (func $recurse (export "recurse")
+//      return_call $recurse))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x09, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x00, 0x03, 0x04, 0x03, 0x00, 0x01,
+    0x01, 0x07, 0x1c, 0x03, 0x04, 0x73, 0x70, 0x69, 0x6e, 0x00, 0x00, 0x07,
+    0x66, 0x6f, 0x72, 0x65, 0x76, 0x65, 0x72, 0x00, 0x01, 0x07, 0x72, 0x65,
+    0x63, 0x75, 0x72, 0x73, 0x65, 0x00, 0x02, 0x0a, 0x27, 0x03, 0x18, 0x00,
+    0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d, 0x01, 0x20, 0x00, 0x41,
+    0x01, 0x6b, 0x21, 0x00, 0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x00, 0x0b, 0x07,
+    0x00, 0x03, 0x40, 0x0c, 0x00, 0x0b, 0x0b, 0x04, 0x00, 0x12, 0x02, 0x0b,
+};
+
+typedef struct Watchdog
+{
+    IM3Runtime      runtime;
+    volatile int    done;
+}
+Watchdog;
+
+static M3Result  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg)
+{
+    IM3Function function;
+    M3Result result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!result)
+        result = m3_CallV (function, i_arg);
+
+    return result;
+}
+
+// ticks every millisecond until the call it watches has come back
+static void *  Tick  (void * i_watchdog)
+{
+    Watchdog * watchdog = (Watchdog *) i_watchdog;
+
+    while (!__atomic_load_n (& watchdog->done, __ATOMIC_RELAXED))
+    {
+        usleep (1000);
+        m3_IncrementEpoch (watchdog->runtime);
+    }
+
+    return NULL;
+}
+
+static void  CheckWatchdog  (IM3Runtime i_runtime, const char * i_name, uint64_t i_numTicks)
+{
+    M3Result result = m3_SetEpochDeadline (i_runtime, i_numTicks);
+
+    Watchdog watchdog = { i_runtime, 0 };
+    pthread_t thread;
+    pthread_create (& thread, NULL, Tick, & watchdog);
+
+    if (!result)
+        result = Call (i_runtime, i_name, 0);
+
+    __atomic_store_n (& watchdog.done, 1, __ATOMIC_RELAXED);
+    pthread_join (thread, NULL);
+
+    expect (result == m3Err_trapInterrupted, "%s: stopped after %llu ticks (%s)", i_name, (unsigned long long) i_numTicks, result ? result : "no trap");
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    if (!result)
+        result = m3_LoadModule (runtime, module);
+    expect (!result, "load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        result = m3_SetEpochDeadline (runtime, 1);
+        if (result == m3Err_epochsUnsupported)
+        {
+            printf ("skip: (%s)\n", result);
+            m3_FreeRuntime (runtime);
+            m3_FreeEnvironment (env);
+            return 0;
+        }
+
+        // the deadline is a tick away: calls run until the tick, then trap until it moves
+        result = Call (runtime, "spin", 1000);
+        expect (!result, "before the deadline: spin (%s)", result ? result : "ok");
+
+        uint64_t epoch = m3_IncrementEpoch (runtime);
+        expect (epoch == 1, "epoch %llu", (unsigned long long) epoch);
+
+        result = Call (runtime, "spin", 1000);
+        expect (result == m3Err_trapInterrupted, "at the deadline: spin (%s)", result ? result : "no trap");
+
+        result = Call (runtime, "spin", 0);
+        expect (result == m3Err_trapInterrupted, "at the deadline: again (%s)", result ? result : "no trap");
+
+        m3_SetEpochDeadline (runtime, 2);
+        m3_IncrementEpoch (runtime);
+        result = Call (runtime, "spin", 1000);
+        expect (!result, "a new deadline: spin (%s)", result ? result : "ok");
+
+        // function entries are checked as well as loops
+        m3_SetEpochDeadline (runtime, 0);
+        result = Call (runtime, "spin", 0);
+        expect (result == m3Err_trapInterrupted, "no ticks: spin (%s)", result ? result : "no trap");
+
+        result = Call (runtime, "recurse", 0);
+        expect (result == m3Err_trapInterrupted, "no ticks: recurse (%s)", result ? result : "no trap");
+
+        // another thread stops what would run for ever
+        CheckWatchdog (runtime, "forever", 5);
+        CheckWatchdog (runtime, "forever", 50);
+
+        m3_SetEpochDeadline (runtime, UINT64_MAX);
+        result = Call (runtime, "spin", 1000);
+        expect (!result, "no deadline: spin (%s)", result ? result : "ok");
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
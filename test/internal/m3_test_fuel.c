@@ -0,0 +1,197 @@
+//
+//  m3_test_fuel.c
+//
+//  Runs functions under a fuel budget, and checks that entries and loop iterations
+//  are charged for their operations, that running out traps, also in an endless
+//  loop, and that the runtime runs again once fuel is added.
+//
+//  Build:  cc -I ../../source -o m3_test_fuel m3_test_fuel.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (func (export "spin") (param i32) (result i32)
+//      block
+//        loop
+//          local.get 0  i32.eqz  br_if 1
+//          local.get 0  i32.const 1  i32.sub  local.set 0
+//          br 0
+//        end
+//      end
+//      local.get 0)
+//    (func $fib (export "fib") (param i32) (result i32)
+//      local.get 0  i32.const 2  i32.lt_s
+//      if (result i32)
+//        local.get 0
+//      else
+//        local.get 0  i32.const 1  i32.sub  call $fib
+//        local.get 0  i32.const 2  i32.sub  call $fib  i32.add
+//      end)
+//    (func (export "forever")
+//      loop  br 0  end))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x09, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x00, 0x03, 0x04, 0x03, 0x00, 0x00,
+    0x01, 0x07, 0x18, 0x03, 0x04, 0x73, 0x70, 0x69, 0x6e, 0x00, 0x00, 0x03,
+    0x66, 0x69, 0x62, 0x00, 0x01, 0x07, 0x66, 0x6f, 0x72, 0x65, 0x76, 0x65,
+    0x72, 0x00, 0x02, 0x0a, 0x3f, 0x03, 0x18, 0x00, 0x02, 0x40, 0x03, 0x40,
+    0x20, 0x00, 0x45, 0x0d, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x21, 0x00,
+    0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x00, 0x0b, 0x1c, 0x00, 0x20, 0x00, 0x41,
+    0x02, 0x48, 0x04, 0x7f, 0x20, 0x00, 0x05, 0x20, 0x00, 0x41, 0x01, 0x6b,
+    0x10, 0x01, 0x20, 0x00, 0x41, 0x02, 0x6b, 0x10, 0x01, 0x6a, 0x0b, 0x0b,
+    0x07, 0x00, 0x03, 0x40, 0x0c, 0x00, 0x0b, 0x0b,
+};
+
+static uint64_t  FibCalls  (int32_t i_n)
+{
+    return i_n < 2 ? 1 : 1 + FibCalls (i_n - 1) + FibCalls (i_n - 2);
+}
+
+static M3Result  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg)
+{
+    IM3Function function;
+    M3Result result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!result)
+        result = m3_CallV (function, i_arg);
+
+    return result;
+}
+
+static IM3Runtime  LoadModule  (IM3Environment i_env, M3Result * o_result)
+{
+    IM3Runtime runtime = m3_NewRuntime (i_env, 64 * 1024, NULL);
+
+    IM3Module module;
+    * o_result = m3_ParseModule (i_env, & module, c_module, sizeof (c_module));
+
+    if (!* o_result)
+        * o_result = m3_LoadModule (runtime, module);
+
+    return runtime;
+}
+
+static uint64_t  Used  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg, M3Result * o_result)
+{
+    uint64_t before = m3_GetFuel (i_runtime);
+    * o_result = Call (i_runtime, i_name, i_arg);
+
+    return before - m3_GetFuel (i_runtime);
+}
+
+static void  CheckCharges  (IM3Runtime i_runtime, const char * i_label)
+{
+    M3Result result = m3_SetFuel (i_runtime, 1000000);
+    expect (!result && m3_GetFuel (i_runtime) == 1000000, "%s: set (%s)", i_label, result ? result : "ok");
+
+    // spin's entry, plus one iteration per count and one more to leave
+    uint64_t spin0 = Used (i_runtime, "spin", 0, & result);
+    uint64_t iteration = Used (i_runtime, "spin", 1, & result) - spin0;
+    expect (!result && spin0 > iteration && iteration > 0, "%s: spin entry %llu, iteration %llu", i_label,
+            (unsigned long long) (spin0 - iteration), (unsigned long long) iteration);
+
+    uint32_t counts [] = { 100, 1000 };
+    for (int i = 0; i < 2; ++i)
+    {
+        uint64_t used = Used (i_runtime, "spin", counts [i], & result);
+        expect (!result && used == spin0 + counts [i] * iteration, "%s: spin (%u) used %llu", i_label, counts [i], (unsigned long long) used);
+    }
+
+    // every call to fib is charged the same
+    uint64_t fib0 = Used (i_runtime, "fib", 0, & result);
+    uint64_t used = Used (i_runtime, "fib", 15, & result);
+    expect (!result && used == FibCalls (15) * fib0, "%s: fib (15) used %llu", i_label, (unsigned long long) used);
+
+    // exactly enough runs to the end with nothing left; one short traps
+    uint64_t spin100 = spin0 + 100 * iteration;
+    result = m3_SetFuel (i_runtime, spin100);
+    if (!result)
+        result = Call (i_runtime, "spin", 100);
+    expect (!result && m3_GetFuel (i_runtime) == 0, "%s: spin (100) on exactly enough (%s)", i_label, result ? result : "ok");
+
+    m3_SetFuel (i_runtime, spin100 - 1);
+    result = Call (i_runtime, "spin", 100);
+    expect (result == m3Err_trapOutOfFuel, "%s: spin (100) on one short (%s)", i_label, result ? result : "no trap");
+
+    // an endless loop stops, and so does everything after it until more is added
+    m3_SetFuel (i_runtime, 100000);
+    result = Call (i_runtime, "forever", 0);
+    expect (result == m3Err_trapOutOfFuel && m3_GetFuel (i_runtime) == 0, "%s: forever (%s)", i_label, result ? result : "no trap");
+
+    result = Call (i_runtime, "spin", 0);
+    expect (result == m3Err_trapOutOfFuel, "%s: empty after the trap (%s)", i_label, result ? result : "no trap");
+
+    m3_AddFuel (i_runtime, spin0);
+    result = Call (i_runtime, "spin", 0);
+    expect (!result && m3_GetFuel (i_runtime) == 0, "%s: runs again once added (%s)", i_label, result ? result : "ok");
+
+    m3_AddFuel (i_runtime, UINT64_MAX);
+    m3_AddFuel (i_runtime, UINT64_MAX);
+    expect (m3_GetFuel (i_runtime) == INT64_MAX, "%s: adding saturates", i_label);
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Runtime runtime = LoadModule (env, & result);
+    expect (!result, "load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        result = m3_SetFuel (runtime, 1);
+        if (result == m3Err_fuelUnsupported)
+        {
+            printf ("skip: (%s)\n", result);
+            m3_FreeRuntime (runtime);
+            m3_FreeEnvironment (env);
+            return 0;
+        }
+
+        // unlimited until set
+        IM3Runtime fresh = LoadModule (env, & result);
+        expect (m3_GetFuel (fresh) == INT64_MAX, "unlimited to begin with");
+
+        if (!result)
+            result = Call (fresh, "spin", 100000);
+        expect (!result, "unlimited: spin (100000) (%s)", result ? result : "ok");
+        expect (m3_GetFuel (fresh) == INT64_MAX, "unlimited: not charged for it");
+
+        m3_FreeRuntime (fresh);
+
+        CheckCharges (runtime, "interpreted");
+    }
+
+    m3_FreeRuntime (runtime);
+
+    // native code is charged the same, as the loops and entries stay in metacode
+    runtime = LoadModule (env, & result);
+    if (!result)
+        result = m3_EnableJit (runtime, 1);
+
+    if (!result)
+    {
+        m3_SetJitHotness (runtime, 0);
+        CheckCharges (runtime, "jit");
+    }
+    else printf ("skip: jit (%s)\n", result);
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,284 @@
+//
+//  m3_test_guard.c
+//
+//  With d_m3UseGuardPages, loads and stores aren't bounds checked and one past the
+//  end of memory faults instead. Checks that such a fault comes back as the usual
+//  trap, at the old and new end of a grown memory, from a runtime called back into
+//  by a host function of another and partway through a batch of calls, and that a
+//  fault elsewhere still reaches the handler that was installed before wasm3's.
+//
+//  The library and the test both need the flag:
+//  Build:  cc -Dd_m3UseGuardPages=1 -I ../../source -o m3_test_guard m3_test_guard.c libm3.a -lm -lpthread
+//
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "wasm3.h"
+#include "m3_config.h"
+
+#if d_m3UseGuardPages
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (import "env" "reenter" (func $reenter (param i32) (result i32)))
+//    (import "env" "touch" (func $touch))
+//    (memory 1)
+//    (func (export "load") (param i32) (result i32)
+//      local.get 0  i32.load)
+//    (func (export "store") (param i32 i32)
+//      local.get 0  local.get 1  i32.store)
+//    (func (export "load_far") (param i32) (result i32)
+//      local.get 0  i32.load offset=0xfffffff0)
+//    (func (export "grow") (param i32) (result i32)
+//      local.get 0  memory.grow)
+//    (func (export "nest") (param i32) (result i32)
+//      local.get 0  call $reenter  local.get 0  i32.load  i32.add)
+//    (func (export "touch")
+//      call $touch))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0e, 0x03, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x60, 0x00, 0x00,
+    0x02, 0x1b, 0x02, 0x03, 0x65, 0x6e, 0x76, 0x07, 0x72, 0x65, 0x65, 0x6e,
+    0x74, 0x65, 0x72, 0x00, 0x00, 0x03, 0x65, 0x6e, 0x76, 0x05, 0x74, 0x6f,
+    0x75, 0x63, 0x68, 0x00, 0x02, 0x03, 0x07, 0x06, 0x00, 0x01, 0x00, 0x00,
+    0x00, 0x02, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x31, 0x06, 0x04, 0x6c,
+    0x6f, 0x61, 0x64, 0x00, 0x02, 0x05, 0x73, 0x74, 0x6f, 0x72, 0x65, 0x00,
+    0x03, 0x08, 0x6c, 0x6f, 0x61, 0x64, 0x5f, 0x66, 0x61, 0x72, 0x00, 0x04,
+    0x04, 0x67, 0x72, 0x6f, 0x77, 0x00, 0x05, 0x04, 0x6e, 0x65, 0x73, 0x74,
+    0x00, 0x06, 0x05, 0x74, 0x6f, 0x75, 0x63, 0x68, 0x00, 0x07, 0x0a, 0x38,
+    0x06, 0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b, 0x09, 0x00, 0x20,
+    0x00, 0x20, 0x01, 0x36, 0x02, 0x00, 0x0b, 0x0b, 0x00, 0x20, 0x00, 0x28,
+    0x02, 0xf0, 0xff, 0xff, 0xff, 0x0f, 0x0b, 0x06, 0x00, 0x20, 0x00, 0x40,
+    0x00, 0x0b, 0x0c, 0x00, 0x20, 0x00, 0x10, 0x00, 0x20, 0x00, 0x28, 0x02,
+    0x00, 0x6a, 0x0b, 0x04, 0x00, 0x10, 0x01, 0x0b,
+};
+
+#define c_pageSize      65536
+
+static IM3Runtime           s_inner;        // what reenter calls into
+static M3Result             s_innerResult;
+
+static volatile uint8_t *   s_poisoned;     // an inaccessible page outside any memory
+static size_t               s_osPageSize;
+static volatile int         s_numChained;
+
+
+static int32_t  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg, M3Result * o_result)
+{
+    int32_t value = -1;
+
+    IM3Function function;
+    * o_result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!* o_result)
+        * o_result = m3_CallV (function, i_arg);
+
+    if (!* o_result)
+        m3_GetResultsV (function, & value);
+
+    return value;
+}
+
+// loads from the inner runtime while the outer one's call is still running
+m3ApiRawFunction (Reenter)
+{
+    m3ApiReturnType (int32_t)
+    m3ApiGetArg     (int32_t, address)
+
+    int32_t value = Call (s_inner, "load", address, & s_innerResult);
+
+    m3ApiReturn (s_innerResult ? 0 : value);
+}
+
+m3ApiRawFunction (Touch)
+{
+    s_poisoned [0] = 1;
+
+    m3ApiSuccess ();
+}
+
+// stands in for an embedder's own handler: it makes the page accessible, and the
+// faulting write goes through when it reruns
+static void  PreviousHandler  (int i_signal, siginfo_t * i_info, void * i_context)
+{
+    const volatile uint8_t * address = (const volatile uint8_t *) i_info->si_addr;
+
+    if (address < s_poisoned || address >= s_poisoned + s_osPageSize)
+        _exit (2);
+
+    ++s_numChained;
+    mprotect ((void *) s_poisoned, s_osPageSize, PROT_READ | PROT_WRITE);
+}
+
+static IM3Runtime  NewRuntime  (IM3Environment i_env, const char * i_label)
+{
+    IM3Runtime runtime = m3_NewRuntime (i_env, 64 * 1024, NULL);
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (i_env, & module, c_module, sizeof (c_module));
+    if (!result)
+        result = m3_LoadModule (runtime, module);
+    if (!result)
+        result = m3_LinkRawFunction (module, "env", "reenter", "i(i)", & Reenter);
+    if (!result)
+        result = m3_LinkRawFunction (module, "env", "touch", "v()", & Touch);
+    expect (!result, "%s: load (%s)", i_label, result ? result : "ok");
+
+    return result ? NULL : runtime;
+}
+
+static void  CheckBounds  (IM3Runtime i_runtime)
+{
+    M3Result result;
+
+    IM3Function store;
+    m3_FindFunction (& store, i_runtime, "store");
+
+    result = m3_CallV (store, c_pageSize - 4, 0x12345678);
+    expect (!result, "store at the last word (%s)", result ? result : "ok");
+
+    int32_t value = Call (i_runtime, "load", c_pageSize - 4, & result);
+    expect (!result && value == 0x12345678, "load of the last word = 0x%x", value);
+
+    Call (i_runtime, "load", c_pageSize - 3, & result);
+    expect (result == m3Err_trapOutOfBoundsMemoryAccess, "load straddling the end traps (%s)", result ? result : "no trap");
+
+    result = m3_CallV (store, c_pageSize, 1);
+    expect (result == m3Err_trapOutOfBoundsMemoryAccess, "store past the end traps (%s)", result ? result : "no trap");
+
+    Call (i_runtime, "load", -1, & result);
+    expect (result == m3Err_trapOutOfBoundsMemoryAccess, "load at 0xffffffff traps (%s)", result ? result : "no trap");
+
+    // the farthest a u32 address and offset can reach still lands in the guard region
+    Call (i_runtime, "load_far", -1, & result);
+    expect (result == m3Err_trapOutOfBoundsMemoryAccess, "load at 0xffffffff + 0xfffffff0 traps (%s)", result ? result : "no trap");
+
+    value = Call (i_runtime, "load", c_pageSize - 4, & result);
+    expect (!result && value == 0x12345678, "runtime still works after the traps, load = 0x%x", value);
+}
+
+static void  CheckGrow  (IM3Runtime i_runtime)
+{
+    M3Result result;
+
+    int32_t previous = Call (i_runtime, "grow", 1, & result);
+    expect (!result && previous == 1, "grow (1) = %d", previous);
+
+    int32_t value = Call (i_runtime, "load", c_pageSize, & result);
+    expect (!result && value == 0, "load at the old end = %d", value);
+
+    value = Call (i_runtime, "load", 2 * c_pageSize - 4, & result);
+    expect (!result && value == 0, "load of the new last word = %d", value);
+
+    Call (i_runtime, "load", 2 * c_pageSize, & result);
+    expect (result == m3Err_trapOutOfBoundsMemoryAccess, "load at the new end traps (%s)", result ? result : "no trap");
+}
+
+static void  CheckNested  (IM3Runtime i_outer, IM3Runtime i_inner)
+{
+    M3Result result;
+    s_inner = i_inner;
+
+    // the inner runtime's fault unwinds its own call only
+    s_innerResult = m3Err_none;
+    int32_t value = Call (i_outer, "nest", 2 * c_pageSize - 4, & result);
+    expect (s_innerResult == m3Err_trapOutOfBoundsMemoryAccess, "nested: inner load traps (%s)", s_innerResult ? s_innerResult : "no trap");
+    expect (!result && value == 0, "nested: outer call goes on after it, nest = %d (%s)", value, result ? result : "ok");
+
+    // and the outer one's frame is back in place for a fault of its own
+    s_innerResult = m3Err_none;
+    Call (i_outer, "nest", 4 * c_pageSize, & result);
+    expect (s_innerResult == m3Err_trapOutOfBoundsMemoryAccess, "nested: inner load traps again (%s)", s_innerResult ? s_innerResult : "no trap");
+    expect (result == m3Err_trapOutOfBoundsMemoryAccess, "nested: outer load traps after it (%s)", result ? result : "no trap");
+
+    value = Call (i_inner, "load", c_pageSize - 4, & result);
+    expect (!result && value == 0x12345678, "nested: inner runtime still works, load = 0x%x", value);
+}
+
+static void  CheckBatch  (IM3Runtime i_runtime)
+{
+    IM3Function load;
+    m3_FindFunction (& load, i_runtime, "load");
+
+    // the third call faults; the two before it are done and counted
+    const uint64_t args [4] = { c_pageSize - 4, c_pageSize - 4, c_pageSize, 0 };
+    uint64_t results [4] = { 0 };
+    uint32_t numCompleted = 0;
+
+    M3Result result = m3_CallBatch (load, 4, args, results, & numCompleted);
+    expect (result == m3Err_trapOutOfBoundsMemoryAccess, "batch: the fault traps (%s)", result ? result : "no trap");
+    expect (numCompleted == 2, "batch: stopped at %u", numCompleted);
+    expect ((uint32_t) results [1] == 0x12345678, "batch: result before the fault = 0x%x", (uint32_t) results [1]);
+
+    result = m3_CallBatch (load, 2, args, results, & numCompleted);
+    expect (!result && numCompleted == 2, "batch: runs again after the fault (%s)", result ? result : "ok");
+}
+
+static void  CheckChained  (IM3Runtime i_runtime)
+{
+    M3Result result;
+
+    s_numChained = 0;
+    s_poisoned [0] = 1;
+    expect (s_numChained == 1, "chained: a fault outside any call reaches the previous handler");
+
+    mprotect ((void *) s_poisoned, s_osPageSize, PROT_NONE);
+
+    // inside a call, but not in its memory: not a trap
+    Call (i_runtime, "touch", 0, & result);
+    expect (!result && s_numChained == 2, "chained: a fault from a host function reaches it too (%s)", result ? result : "ok");
+}
+
+int  main  (void)
+{
+    s_osPageSize = (size_t) sysconf (_SC_PAGESIZE);
+    s_poisoned = (volatile uint8_t *) mmap (NULL, s_osPageSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    // before the first runtime, which puts wasm3's handler in front of it
+    struct sigaction action;
+    memset (& action, 0, sizeof (action));
+    action.sa_sigaction = PreviousHandler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset (& action.sa_mask);
+    sigaction (SIGSEGV, & action, NULL);
+    sigaction (SIGBUS, & action, NULL);
+
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime outer = NewRuntime (env, "outer");
+    IM3Runtime inner = NewRuntime (env, "inner");
+    if (!outer || !inner) return 1;
+
+    CheckBounds (inner);
+    CheckGrow (outer);
+    CheckNested (outer, inner);
+    CheckBatch (inner);
+    CheckChained (outer);
+
+    m3_FreeRuntime (inner);
+    m3_FreeRuntime (outer);
+    m3_FreeEnvironment (env);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
+
+#else
+
+int  main  (void)
+{
+    printf ("skip: built without d_m3UseGuardPages\n");
+    return 0;
+}
+
+#endif // d_m3UseGuardPages
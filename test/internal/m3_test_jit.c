@@ -0,0 +1,143 @@
+//
+//  m3_test_jit.c
+//
+//  Runs the same functions with and without native code generation, both
+//  up front and by promotion once hot, and checks that results and traps agree.
+//  Promotion patches the metacode where it stands, without taking more code pages.
+//
+//  Build:  cc -I ../../source -o m3_test_jit m3_test_jit.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+
+#include "wasm3.h"
+#include "m3_env.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (memory 1)
+//    (func (export "sum") (param i32) (result i64) (local i32 i64)
+//      loop
+//        local.get 1  i32.const 2  i32.shl
+//        local.get 1  local.get 1  i32.mul
+//        i32.store
+//        local.get 2
+//        local.get 1  i32.const 2  i32.shl
+//        i64.load32_u
+//        i64.add  local.set 2
+//        local.get 1  i32.const 1  i32.add  local.tee 1
+//        local.get 0  i32.lt_u
+//        br_if 0
+//      end
+//      local.get 2)
+//    (func (export "peek") (param i32) (result i32)
+//      local.get 0
+//      i32.load))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0b, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7e, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x03, 0x03, 0x02,
+    0x00, 0x01, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x0e, 0x02, 0x03, 0x73,
+    0x75, 0x6d, 0x00, 0x00, 0x04, 0x70, 0x65, 0x65, 0x6b, 0x00, 0x01, 0x0a,
+    0x3b, 0x02, 0x31, 0x02, 0x01, 0x7f, 0x01, 0x7e, 0x03, 0x40, 0x20, 0x01,
+    0x41, 0x02, 0x74, 0x20, 0x01, 0x20, 0x01, 0x6c, 0x36, 0x02, 0x00, 0x20,
+    0x02, 0x20, 0x01, 0x41, 0x02, 0x74, 0x35, 0x02, 0x00, 0x7c, 0x21, 0x02,
+    0x20, 0x01, 0x41, 0x01, 0x6a, 0x22, 0x01, 0x20, 0x00, 0x49, 0x0d, 0x00,
+    0x0b, 0x20, 0x02, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b,
+};
+
+static int  RunAndCheck  (int i_jit, uint32_t i_hotness, const char * i_label)
+{
+    int startFailures = failures;
+
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    if (i_jit)
+    {
+        M3Result result = m3_EnableJit (runtime, 1);
+        if (result == m3Err_jitUnsupported)
+        {
+            printf ("skip: %s (%s)\n", i_label, result);
+            m3_FreeRuntime (runtime);
+            m3_FreeEnvironment (env);
+            return 0;
+        }
+        expect (!result, "%s: enable (%s)", i_label, result ? result : "ok");
+
+        result = m3_SetJitHotness (runtime, i_hotness);
+        expect (!result, "%s: set hotness %u (%s)", i_label, i_hotness, result ? result : "ok");
+    }
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    expect (!result, "%s: parse module (%s)", i_label, result ? result : "ok");
+    if (result) return 1;
+
+    result = m3_LoadModule (runtime, module);
+    expect (!result, "%s: load module (%s)", i_label, result ? result : "ok");
+    if (result) return 1;
+
+    IM3Function sum, peek;
+    m3_FindFunction (& sum, runtime, "sum");
+    m3_FindFunction (& peek, runtime, "peek");
+
+    result = m3_CompileModule (module);
+    expect (!result, "%s: compile (%s)", i_label, result ? result : "ok");
+
+    pc_t compiled = sum->compiled;
+    u32 numCodePages = runtime->numCodePages;
+
+    // sum of i * i, written to and read back from memory
+    for (uint32_t n = 1; n <= 4096; n *= 4)
+    {
+        uint64_t expected = 0;
+        for (uint64_t i = 0; i < n; ++i)
+            expected += i * i;
+
+        uint64_t value = 0;
+        result = m3_CallV (sum, n);
+        m3_GetResultsV (sum, & value);
+        expect (!result && value == expected, "%s: sum (%u) = %llu", i_label, n, (unsigned long long) value);
+    }
+
+    if (i_jit && i_hotness)
+    {
+        expect (sum->hotness == 0, "%s: promoted", i_label);
+        expect (sum->compiled == compiled && runtime->numCodePages == numCodePages, "%s: in place, on the same %u code pages", i_label, numCodePages);
+    }
+
+    int32_t word = 0;
+    result = m3_CallV (peek, 4 * 3);
+    m3_GetResultsV (peek, & word);
+    expect (!result && word == 9, "%s: peek in bounds", i_label);
+
+    result = m3_CallV (peek, 65536 - 2);
+    expect (result == m3Err_trapOutOfBoundsMemoryAccess, "%s: peek across the end traps (%s)", i_label, result ? result : "no trap");
+
+    result = m3_CallV (peek, 4 * 5);
+    m3_GetResultsV (peek, & word);
+    expect (!result && word == 25, "%s: runs again after the trap", i_label);
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+
+    return failures - startFailures;
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    RunAndCheck (0, 0,  "interpreter");
+    RunAndCheck (1, 0,  "native");
+    RunAndCheck (1, 3,  "promoted");         // partway through the first sum's loop
+    RunAndCheck (1, 50, "promoted later");
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+//
+//  m3_test_memory.c
+//
+//  Grows linear memory one page at a time and checks that contents survive,
+//  both inside the address space reservation (in place) and past it (moved).
+//
+//  Build:  cc -I ../../source -o m3_test_memory m3_test_memory.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (memory 1)
+//    (func (export "grow") (param i32) (result i32)
+//      local.get 0
+//      memory.grow)
+//    (func (export "poke") (param i32 i32)
+//      local.get 0
+//      local.get 1
+//      i32.store)
+//    (func (export "peek") (param i32) (result i32)
+//      local.get 0
+//      i32.load))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0b, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x03, 0x04, 0x03,
+    0x00, 0x01, 0x00, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x16, 0x03, 0x04,
+    0x67, 0x72, 0x6f, 0x77, 0x00, 0x00, 0x04, 0x70, 0x6f, 0x6b, 0x65, 0x00,
+    0x01, 0x04, 0x70, 0x65, 0x65, 0x6b, 0x00, 0x02, 0x0a, 0x1a, 0x03, 0x06,
+    0x00, 0x20, 0x00, 0x40, 0x00, 0x0b, 0x09, 0x00, 0x20, 0x00, 0x20, 0x01,
+    0x36, 0x02, 0x00, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b,
+};
+
+#define c_pageSize      65536
+#define c_numGrowths    64
+
+static int  GrowAndCheck  (uint64_t i_reservation, const char * i_label)
+{
+    int startFailures = failures;
+
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    M3Result result = m3_SetMemoryReservation (runtime, i_reservation);
+    if (result == m3Err_memoryReservationUnsupported)
+    {
+        printf ("skip: %s (%s)\n", i_label, result);
+        m3_FreeRuntime (runtime);
+        m3_FreeEnvironment (env);
+        return 0;
+    }
+    expect (!result, "%s: set reservation (%s)", i_label, result ? result : "ok");
+
+    IM3Module module;
+    result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    expect (!result, "%s: parse module (%s)", i_label, result ? result : "ok");
+    if (result) return 1;
+
+    result = m3_LoadModule (runtime, module);
+    expect (!result, "%s: load module (%s)", i_label, result ? result : "ok");
+    if (result) return 1;
+
+    IM3Function grow, poke, peek;
+    m3_FindFunction (& grow, runtime, "grow");
+    m3_FindFunction (& poke, runtime, "poke");
+    m3_FindFunction (& peek, runtime, "peek");
+
+    // stamp each page as it appears, then read every stamp back at the end
+    int allGrew = 1;
+    for (uint32_t i = 0; i < c_numGrowths; ++i)
+    {
+        uint32_t address = i * c_pageSize + 12;
+        result = m3_CallV (poke, address, i + 1000);
+        if (result) break;
+
+        int32_t previous = -1;
+        result = m3_CallV (grow, 1);
+        if (result) break;
+        m3_GetResultsV (grow, & previous);
+
+        allGrew = allGrew && (previous == (int32_t) i + 1);
+    }
+    expect (!result && allGrew, "%s: grew %d times (%s)", i_label, c_numGrowths, result ? result : "ok");
+
+    uint32_t memorySize = 0;
+    m3_GetMemory (runtime, & memorySize, 0);
+    expect (memorySize == (c_numGrowths + 1) * c_pageSize, "%s: memory size %u", i_label, memorySize);
+
+    int allKept = 1;
+    for (uint32_t i = 0; i < c_numGrowths; ++i)
+    {
+        int32_t value = 0;
+        result = m3_CallV (peek, i * c_pageSize + 12);
+        if (result) break;
+        m3_GetResultsV (peek, & value);
+
+        allKept = allKept && (value == (int32_t) i + 1000);
+    }
+    expect (!result && allKept, "%s: contents kept across growth", i_label);
+
+    int32_t fresh = -1;
+    result = m3_CallV (peek, c_numGrowths * c_pageSize + 12);
+    m3_GetResultsV (peek, & fresh);
+    expect (!result && fresh == 0, "%s: new page is zeroed", i_label);
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+
+    return failures - startFailures;
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    GrowAndCheck (0,                            "default reservation");
+    GrowAndCheck (8 * c_pageSize,               "outgrown reservation");
+    GrowAndCheck ((uint64_t) 1024 * c_pageSize, "explicit reservation");
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,537 @@
+//
+//  m3_test_ops.c
+//
+//  Checks which operations the compiler picks for some common sequences, and that
+//  they give the results the regular operations would, at the edges too.
+//
+//  The compiler is built into the test, so that its operations can be told apart
+//  by address; libm3.a supplies the rest.
+//
+//  Build:  cc -I ../../source -o m3_test_ops m3_test_ops.c libm3.a -lm -lpthread
+//
+//  The second-register checks need the flag, and a libm3.a built with it too:
+//          cc -I ../../source -Dd_m3HasSecondRegister=1 -o m3_test_ops m3_test_ops.c libm3.a -lm -lpthread
+//
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "wasm3.h"
+#include "m3_compile.c"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (func (export "count_up") (param i32) (result i32) (local i32)
+//      loop
+//        local.get 1  i32.const 1  i32.add  local.set 1
+//        local.get 0  i32.const 1  i32.sub  local.tee 0
+//        i32.const 0  i32.gt_s  br_if 0
+//      end
+//      local.get 1)
+//    (func (export "below_ten") (param i32) (result i32)
+//      block
+//        i32.const 10  local.get 0  i32.gt_u  br_if 0
+//        i32.const 0  return
+//      end
+//      i32.const 1)
+//    (func (export "is_zero") (param i64) (result i32)
+//      block
+//        local.get 0  i64.eqz  br_if 0
+//        i32.const 0  return
+//      end
+//      i32.const 1))
+static const unsigned char c_compareBranchModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0b, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x01, 0x7e, 0x01, 0x7f, 0x03, 0x04, 0x03,
+    0x00, 0x00, 0x01, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x22, 0x03, 0x08,
+    0x63, 0x6f, 0x75, 0x6e, 0x74, 0x5f, 0x75, 0x70, 0x00, 0x00, 0x09, 0x62,
+    0x65, 0x6c, 0x6f, 0x77, 0x5f, 0x74, 0x65, 0x6e, 0x00, 0x01, 0x07, 0x69,
+    0x73, 0x5f, 0x7a, 0x65, 0x72, 0x6f, 0x00, 0x02, 0x0a, 0x40, 0x03, 0x1c,
+    0x01, 0x01, 0x7f, 0x03, 0x40, 0x20, 0x01, 0x41, 0x01, 0x6a, 0x21, 0x01,
+    0x20, 0x00, 0x41, 0x01, 0x6b, 0x22, 0x00, 0x41, 0x00, 0x4a, 0x0d, 0x00,
+    0x0b, 0x20, 0x01, 0x0b, 0x11, 0x00, 0x02, 0x40, 0x41, 0x0a, 0x20, 0x00,
+    0x4b, 0x0d, 0x00, 0x41, 0x00, 0x0f, 0x0b, 0x41, 0x01, 0x0b, 0x0f, 0x00,
+    0x02, 0x40, 0x20, 0x00, 0x50, 0x0d, 0x00, 0x41, 0x00, 0x0f, 0x0b, 0x41,
+    0x01, 0x0b,
+};
+
+//  (module
+//    (func (export "inc") (param i32) (result i32)
+//      local.get 0  i32.const 1  i32.add  local.set 0  local.get 0)
+//    (func (export "sub_sum") (param i32 i32) (result i32)
+//      local.get 0  local.get 0  local.get 1  i32.add  local.set 0  local.get 0  i32.sub)
+//    (func (export "shl") (param i64 i64) (result i64)
+//      local.get 0  local.get 1  i64.shl  local.set 0  local.get 0)
+//    (func (export "div") (param f64 f64) (result f64)
+//      local.get 0  local.get 1  f64.div  local.set 0  local.get 0))
+static const unsigned char c_threeAddressModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x18, 0x04, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x02,
+    0x7e, 0x7e, 0x01, 0x7e, 0x60, 0x02, 0x7c, 0x7c, 0x01, 0x7c, 0x03, 0x05,
+    0x04, 0x00, 0x01, 0x02, 0x03, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x1d,
+    0x04, 0x03, 0x69, 0x6e, 0x63, 0x00, 0x00, 0x07, 0x73, 0x75, 0x62, 0x5f,
+    0x73, 0x75, 0x6d, 0x00, 0x01, 0x03, 0x73, 0x68, 0x6c, 0x00, 0x02, 0x03,
+    0x64, 0x69, 0x76, 0x00, 0x03, 0x0a, 0x34, 0x04, 0x0b, 0x00, 0x20, 0x00,
+    0x41, 0x01, 0x6a, 0x21, 0x00, 0x20, 0x00, 0x0b, 0x0e, 0x00, 0x20, 0x00,
+    0x20, 0x00, 0x20, 0x01, 0x6a, 0x21, 0x00, 0x20, 0x00, 0x6b, 0x0b, 0x0b,
+    0x00, 0x20, 0x00, 0x20, 0x01, 0x86, 0x21, 0x00, 0x20, 0x00, 0x0b, 0x0b,
+    0x00, 0x20, 0x00, 0x20, 0x01, 0xa3, 0x21, 0x00, 0x20, 0x00, 0x0b,
+};
+
+//  (module
+//    (func (export "div_u8") (param i32) (result i32)
+//      local.get 0  i32.const 8  i32.div_u)
+//    (func (export "rem_u16") (param i32) (result i32)
+//      local.get 0  i32.const 16  i32.rem_u)
+//    (func (export "mul8") (param i64) (result i64)
+//      local.get 0  i64.const 8  i64.mul)
+//    (func (export "div_s7") (param i32) (result i32)
+//      local.get 0  i32.const 7  i32.div_s)
+//    (func (export "div_s_m1") (param i32) (result i32)
+//      local.get 0  i32.const -1  i32.div_s)
+//    (func (export "above_five") (param i32) (result i32)
+//      i32.const 5  local.get 0  i32.lt_s))
+static const unsigned char c_immediateModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0b, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x01, 0x7e, 0x01, 0x7e, 0x03, 0x07, 0x06,
+    0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07,
+    0x3c, 0x06, 0x06, 0x64, 0x69, 0x76, 0x5f, 0x75, 0x38, 0x00, 0x00, 0x07,
+    0x72, 0x65, 0x6d, 0x5f, 0x75, 0x31, 0x36, 0x00, 0x01, 0x04, 0x6d, 0x75,
+    0x6c, 0x38, 0x00, 0x02, 0x06, 0x64, 0x69, 0x76, 0x5f, 0x73, 0x37, 0x00,
+    0x03, 0x08, 0x64, 0x69, 0x76, 0x5f, 0x73, 0x5f, 0x6d, 0x31, 0x00, 0x04,
+    0x0a, 0x61, 0x62, 0x6f, 0x76, 0x65, 0x5f, 0x66, 0x69, 0x76, 0x65, 0x00,
+    0x05, 0x0a, 0x31, 0x06, 0x07, 0x00, 0x20, 0x00, 0x41, 0x08, 0x6e, 0x0b,
+    0x07, 0x00, 0x20, 0x00, 0x41, 0x10, 0x70, 0x0b, 0x07, 0x00, 0x20, 0x00,
+    0x42, 0x08, 0x7e, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x41, 0x07, 0x6d, 0x0b,
+    0x07, 0x00, 0x20, 0x00, 0x41, 0x7f, 0x6d, 0x0b, 0x07, 0x00, 0x41, 0x05,
+    0x20, 0x00, 0x48, 0x0b,
+};
+
+//  (module
+//    (memory 1)
+//    (func (export "load_at") (param i32) (result i32)
+//      local.get 0  i32.load)
+//    (func (export "store_at") (param i32 i32)
+//      local.get 0  local.get 1  i32.store)
+//    (func (export "load_top") (result i32)
+//      i32.const 65530  i32.load16_u offset=4)
+//    (func (export "store_const") (param i64)
+//      i32.const 100  local.get 0  i64.store offset=8)
+//    (func (export "load_past") (result i32)
+//      i32.const 65533  i32.load)
+//    (func (export "load_wrap") (result i32)
+//      i32.const -16  i32.load offset=32))
+static const unsigned char c_addressModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x13, 0x04, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x60, 0x00, 0x01,
+    0x7f, 0x60, 0x01, 0x7e, 0x00, 0x03, 0x07, 0x06, 0x00, 0x01, 0x02, 0x03,
+    0x02, 0x02, 0x05, 0x03, 0x01, 0x00, 0x01, 0x07, 0x47, 0x06, 0x07, 0x6c,
+    0x6f, 0x61, 0x64, 0x5f, 0x61, 0x74, 0x00, 0x00, 0x08, 0x73, 0x74, 0x6f,
+    0x72, 0x65, 0x5f, 0x61, 0x74, 0x00, 0x01, 0x08, 0x6c, 0x6f, 0x61, 0x64,
+    0x5f, 0x74, 0x6f, 0x70, 0x00, 0x02, 0x0b, 0x73, 0x74, 0x6f, 0x72, 0x65,
+    0x5f, 0x63, 0x6f, 0x6e, 0x73, 0x74, 0x00, 0x03, 0x09, 0x6c, 0x6f, 0x61,
+    0x64, 0x5f, 0x70, 0x61, 0x73, 0x74, 0x00, 0x04, 0x09, 0x6c, 0x6f, 0x61,
+    0x64, 0x5f, 0x77, 0x72, 0x61, 0x70, 0x00, 0x05, 0x0a, 0x3a, 0x06, 0x07,
+    0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b, 0x09, 0x00, 0x20, 0x00, 0x20,
+    0x01, 0x36, 0x02, 0x00, 0x0b, 0x09, 0x00, 0x41, 0xfa, 0xff, 0x03, 0x2f,
+    0x01, 0x04, 0x0b, 0x0a, 0x00, 0x41, 0xe4, 0x00, 0x20, 0x00, 0x37, 0x03,
+    0x08, 0x0b, 0x09, 0x00, 0x41, 0xfd, 0xff, 0x03, 0x28, 0x02, 0x00, 0x0b,
+    0x07, 0x00, 0x41, 0x70, 0x28, 0x02, 0x20, 0x0b,
+};
+
+static IM3Runtime  LoadModule  (IM3Environment i_env, IM3Module * o_module, const unsigned char * i_wasm, uint32_t i_size, M3Result * o_result)
+{
+    IM3Runtime runtime = m3_NewRuntime (i_env, 64 * 1024, NULL);
+
+    * o_result = m3_ParseModule (i_env, o_module, i_wasm, i_size);
+
+    if (!* o_result)
+        * o_result = m3_LoadModule (runtime, * o_module);
+
+    return runtime;
+}
+
+static int32_t  CallI32  (IM3Function i_function, M3Result * o_result, ...)
+{
+    int32_t value = -1;
+
+    va_list args;
+    va_start (args, o_result);
+    * o_result = i_function ? m3_CallVL (i_function, args) : m3Err_functionLookupFailed;
+    va_end (args);
+
+    if (!* o_result)
+        * o_result = m3_GetResultsV (i_function, & value);
+
+    return value;
+}
+
+// the function, compiled; NULL if it isn't there
+static IM3Function  Compiled  (IM3Runtime i_runtime, const char * i_name)
+{
+    IM3Function function = NULL;
+    M3Result result = m3_FindFunction (& function, i_runtime, i_name);
+
+    return (result or not function->compiled) ? NULL : function;
+}
+
+// how many times i_operation appears in a function's code, up to its first return. Immediates
+// are counted too, should one happen to equal the operation's address
+static u32  CountOps  (IM3Function i_function, IM3Operation i_operation)
+{
+    u32 count = 0;
+    pc_t pc = i_function->compiled;
+
+    for (u32 i = 0; i < 1000 and pc [i] != (code_t) op_Return; ++i)
+        count += (pc [i] == (code_t) i_operation);
+
+    return count;
+}
+
+#if d_m3FuseCompareBranch
+static void  CheckCompareBranch  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_compareBranchModule, sizeof (c_compareBranchModule), & result);
+    expect (!result, "compare-branch: load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        // a loop's back edge, the constant as the immediate
+        IM3Function function = Compiled (runtime, "count_up");
+        expect (function && CountOps (function, op_i32_GreaterThan_ContinueLoopIf_is) == 1 && CountOps (function, op_i32_GreaterThan_is) == 0,
+                "compare-branch: count_up continues the loop from the compare");
+
+        const int32_t counts [][2] = { { 5, 5 }, { 1, 1 }, { 0, 1 }, { -1, 1 } };     // signed: -2 isn't above 0
+        for (int i = 0; i < 4; ++i)
+        {
+            int32_t value = CallI32 (function, & result, counts [i] [0]);
+            expect (!result && value == counts [i] [1], "compare-branch: count_up (%d) = %d", counts [i] [0], value);
+        }
+
+        // the constant below the other operand: the compare is mirrored, 10 > x to x < 10
+        function = Compiled (runtime, "below_ten");
+        expect (function && CountOps (function, op_u32_LessThan_BranchIf_is) == 1,
+                "compare-branch: below_ten mirrors the compare around its constant");
+
+        const int32_t belows [][2] = { { 9, 1 }, { 10, 0 }, { 0, 1 }, { -1, 0 } };
+        for (int i = 0; i < 4; ++i)
+        {
+            int32_t value = CallI32 (function, & result, belows [i] [0]);
+            expect (!result && value == belows [i] [1], "compare-branch: below_ten (%d) = %d", belows [i] [0], value);
+        }
+
+        // eqz tests the whole of a 64-bit value
+        function = Compiled (runtime, "is_zero");
+        expect (function && CountOps (function, op_i64_EqualToZero_BranchIf_s) == 1,
+                "compare-branch: is_zero branches on the slot");
+
+        const int64_t zeros [] = { 0, 1, 1ll << 40, INT64_MIN };
+        for (int i = 0; i < 4; ++i)
+        {
+            int32_t value = CallI32 (function, & result, zeros [i]);
+            expect (!result && value == (zeros [i] == 0), "compare-branch: is_zero (%lld) = %d", (long long) zeros [i], value);
+        }
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+#endif
+
+static void  CheckThreeAddress  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_threeAddressModule, sizeof (c_threeAddressModule), & result);
+    expect (!result, "three-address: load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        // the local is also an operand, which is read before it's written: nothing to preserve.
+        // the one copy is the local's to the return slot
+        IM3Function function = Compiled (runtime, "inc");
+        int32_t value = CallI32 (function, & result, 41);
+        expect (!result && value == 42, "three-address: inc (41) = %d", value);
+        expect (function && CountOps (function, op_i32_Add_sss) == 1 && CountOps (function, op_CopySlot_32) == 1,
+                "three-address: inc adds straight into the local, without preserving it");
+
+        // the local's old value, further down the stack, is
+        function = Compiled (runtime, "sub_sum");
+        result = function ? m3_CallV (function, 5, 3) : m3Err_functionLookupFailed;
+        if (!result)
+            result = m3_GetResultsV (function, & value);
+        expect (!result && value == -3, "three-address: sub_sum (5, 3) = %d", value);
+        expect (function && CountOps (function, op_i32_Add_sss) == 1 && CountOps (function, op_CopySlot_32) == 1,
+                "three-address: sub_sum preserves the local's old value once");
+
+        // the shift count is taken modulo 64, as by the regular operation
+        function = Compiled (runtime, "shl");
+        expect (function && CountOps (function, op_u64_ShiftLeft_sss) == 1, "three-address: shl shifts into the local");
+
+        const uint64_t shifts [][3] = { { 1, 63, 1ull << 63 }, { 3, 64, 3 }, { 3, 65, 6 }, { ~0ull, 1, ~1ull } };
+        for (int i = 0; i < 4; ++i)
+        {
+            uint64_t shifted = 0;
+            result = function ? m3_CallV (function, shifts [i] [0], shifts [i] [1]) : m3Err_functionLookupFailed;
+            if (!result)
+                result = m3_GetResultsV (function, & shifted);
+            expect (!result && shifted == shifts [i] [2], "three-address: shl (%llx, %llu) = %llx",
+                    (unsigned long long) shifts [i] [0], (unsigned long long) shifts [i] [1], (unsigned long long) shifted);
+        }
+
+# if d_m3HasFloat
+        function = Compiled (runtime, "div");
+        expect (function && CountOps (function, op_f64_Divide_sss) == 1, "three-address: div divides into the local");
+
+        const double divs [][3] = { { 7, 2, 3.5 }, { 1, 0, INFINITY }, { -1, 0, -INFINITY }, { -0.0, 5, -0.0 } };
+        for (int i = 0; i < 4; ++i)
+        {
+            double quotient = 0;
+            result = function ? m3_CallV (function, divs [i] [0], divs [i] [1]) : m3Err_functionLookupFailed;
+            if (!result)
+                result = m3_GetResultsV (function, & quotient);
+            expect (!result && quotient == divs [i] [2] && signbit (quotient) == signbit (divs [i] [2]),
+                    "three-address: div (%g, %g) = %g", divs [i] [0], divs [i] [1], quotient);
+        }
+# endif
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+
+static void  CheckImmediate  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_immediateModule, sizeof (c_immediateModule), & result);
+    expect (!result, "immediate: load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        // unsigned division and remainder by a power of two become a shift and a mask; a
+        // constant below the other operand becomes the immediate of the mirrored compare
+        static const struct { const char * name; IM3Operation operation; int32_t cases [4] [2]; } c_cases [] =
+        {
+            { "div_u8",     op_u32_ShiftRight_is,   { { 64, 8 }, { 7, 0 }, { -1, 0x1fffffff }, { INT32_MIN, 0x10000000 } } },
+            { "rem_u16",    op_u32_And_is,          { { 35, 3 }, { 16, 0 }, { -1, 15 }, { INT32_MIN, 0 } } },
+            { "div_s7",     op_i32_Divide_is,       { { 14, 2 }, { -6, 0 }, { -7, -1 }, { INT32_MIN, -306783378 } } },
+            { "above_five", op_i32_GreaterThan_is,  { { 5, 0 }, { 6, 1 }, { -6, 0 }, { INT32_MAX, 1 } } },
+        };
+
+        for (int i = 0; i < M3_COUNT_OF (c_cases); ++i)
+        {
+            IM3Function function = Compiled (runtime, c_cases [i].name);
+            expect (function && CountOps (function, c_cases [i].operation) == 1, "immediate: %s carries its constant inline", c_cases [i].name);
+
+            for (int j = 0; j < 4; ++j)
+            {
+                int32_t arg = c_cases [i].cases [j] [0], expected = c_cases [i].cases [j] [1];
+                int32_t value = CallI32 (function, & result, arg);
+                expect (!result && value == expected, "immediate: %s (%d) = %d", c_cases [i].name, arg, value);
+            }
+        }
+
+        // multiplication by a power of two, a shift, wraps as the multiplication does
+        IM3Function function = Compiled (runtime, "mul8");
+        expect (function && CountOps (function, op_u64_ShiftLeft_is) == 1, "immediate: mul8 shifts");
+
+        const int64_t muls [][2] = { { 5, 40 }, { -1, -8 }, { 1ll << 61, 0 }, { (1ll << 60) + 1, INT64_MIN + 8 } };
+        for (int i = 0; i < 4; ++i)
+        {
+            int64_t product = 0;
+            result = function ? m3_CallV (function, muls [i] [0]) : m3Err_functionLookupFailed;
+            if (!result)
+                result = m3_GetResultsV (function, & product);
+            expect (!result && product == muls [i] [1], "immediate: mul8 (%lld) = %lld", (long long) muls [i] [0], (long long) product);
+        }
+
+        // dividing by -1 keeps the regular operation, for its overflow trap
+        function = Compiled (runtime, "div_s_m1");
+        expect (function && CountOps (function, op_i32_Divide_is) == 0, "immediate: div_s_m1 isn't given the immediate form");
+
+        int32_t value = CallI32 (function, & result, 7);
+        expect (!result && value == -7, "immediate: div_s_m1 (7) = %d", value);
+
+        CallI32 (function, & result, INT32_MIN);
+        expect (result == m3Err_trapIntegerOverflow, "immediate: div_s_m1 (%d) traps (%s)", INT32_MIN, result ? result : "ok");
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+
+static void  CheckAddressModes  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_addressModule, sizeof (c_addressModule), & result);
+    expect (!result, "address: load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        // a base in a slot and no offset
+        IM3Function load = Compiled (runtime, "load_at");
+        IM3Function store = Compiled (runtime, "store_at");
+        expect (load && CountOps (load, op_i32_Load_i32_sz) == 1, "address: load_at reads the base's slot, no offset");
+        expect (store && CountOps (store, op_i32_Store_i32_ssz) == 1, "address: store_at reads the base's slot, no offset");
+
+        result = store ? m3_CallV (store, 65532, 0xbeef1234) : m3Err_functionLookupFailed;
+        expect (!result, "address: store_at (65532) (%s)", result ? result : "ok");
+
+        int32_t value = CallI32 (load, & result, 65532);
+        expect (!result && value == (int32_t) 0xbeef1234, "address: load_at (65532) = %x", value);
+
+        result = store ? m3_CallV (store, 65533, 0) : m3Err_functionLookupFailed;
+        expect (result == m3Err_trapOutOfBoundsMemoryAccess, "address: store_at (65533) traps (%s)", result ? result : "ok");
+
+        CallI32 (load, & result, 65533);
+        expect (result == m3Err_trapOutOfBoundsMemoryAccess, "address: load_at (65533) traps (%s)", result ? result : "ok");
+
+        // a constant base, the offset folded into it
+        IM3Function function = Compiled (runtime, "load_top");
+        expect (function && CountOps (function, op_i32_Load_u16_i) == 1, "address: load_top folds its address");
+
+        value = CallI32 (function, & result);
+        expect (!result && value == 0xbeef, "address: load_top = %x", value);
+
+        function = Compiled (runtime, "store_const");
+        expect (function && CountOps (function, op_i64_Store_i64_si) == 1, "address: store_const folds its address");
+
+        result = function ? m3_CallV (function, 0x1122334455667788ull) : m3Err_functionLookupFailed;
+        expect (!result, "address: store_const (%s)", result ? result : "ok");
+
+        int32_t low = CallI32 (load, & result, 108), high = CallI32 (load, & result, 112);
+        expect (!result && low == 0x55667788 && high == 0x11223344, "address: store_const wrote %x %x at 108", high, low);
+
+        // folded or not, an access past the end traps
+        function = Compiled (runtime, "load_past");
+        expect (function && CountOps (function, op_i32_Load_i32_i) == 1, "address: load_past folds its address");
+
+        CallI32 (function, & result);
+        expect (result == m3Err_trapOutOfBoundsMemoryAccess, "address: load_past traps (%s)", result ? result : "ok");
+
+        function = Compiled (runtime, "load_wrap");
+        expect (function && CountOps (function, op_i32_Load_i32_i) == 0, "address: load_wrap, past 4 GiB, isn't folded");
+
+        CallI32 (function, & result);
+        expect (result == m3Err_trapOutOfBoundsMemoryAccess, "address: load_wrap traps (%s)", result ? result : "ok");
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+
+#if d_m3HasSecondRegister
+//  (module
+//    (func (export "dot") (param i32 i32 i32 i32) (result i32)
+//      local.get 0  local.get 1  i32.mul  local.get 2  local.get 3  i32.mul  i32.add)
+//    (func (export "cross") (param i32 i32 i32 i32) (result i32)
+//      local.get 0  local.get 1  i32.mul  local.get 2  local.get 3  i32.mul  i32.sub)
+//    (func (export "ratio") (param i64 i64 i64 i64) (result i64)
+//      local.get 0  local.get 1  i64.mul  local.get 2  local.get 3  i64.mul  i64.div_s))
+static const unsigned char c_secondRegisterModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x11, 0x02, 0x60,
+    0x04, 0x7f, 0x7f, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x04, 0x7e, 0x7e, 0x7e,
+    0x7e, 0x01, 0x7e, 0x03, 0x04, 0x03, 0x00, 0x00, 0x01, 0x05, 0x03, 0x01,
+    0x00, 0x01, 0x07, 0x17, 0x03, 0x03, 0x64, 0x6f, 0x74, 0x00, 0x00, 0x05,
+    0x63, 0x72, 0x6f, 0x73, 0x73, 0x00, 0x01, 0x05, 0x72, 0x61, 0x74, 0x69,
+    0x6f, 0x00, 0x02, 0x0a, 0x2b, 0x03, 0x0d, 0x00, 0x20, 0x00, 0x20, 0x01,
+    0x6c, 0x20, 0x02, 0x20, 0x03, 0x6c, 0x6a, 0x0b, 0x0d, 0x00, 0x20, 0x00,
+    0x20, 0x01, 0x6c, 0x20, 0x02, 0x20, 0x03, 0x6c, 0x6b, 0x0b, 0x0d, 0x00,
+    0x20, 0x00, 0x20, 0x01, 0x7e, 0x20, 0x02, 0x20, 0x03, 0x7e, 0x7f, 0x0b,
+};
+
+static void  CheckSecondRegister  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Module module;
+    IM3Runtime runtime = LoadModule (env, & module, c_secondRegisterModule, sizeof (c_secondRegisterModule), & result);
+    expect (!result, "second register: load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        // the first product waits in _r1 while the second is worked out in _r0, and the
+        // operator takes both from the registers, in order
+        static const struct { const char * name; IM3Operation operation; int32_t cases [3] [5]; } c_cases [] =
+        {
+            { "dot",    op_i32_Add_xr,      { { 2, 3, 4, 5, 26 }, { 0x10000, 0x10000, 1, 1, 1 }, { -7, 3, 7, 3, 0 } } },
+            { "cross",  op_i32_Subtract_xr, { { 2, 3, 4, 5, -14 }, { 4, 5, 2, 3, 14 }, { INT32_MIN, 1, 1, 1, INT32_MAX } } },
+        };
+
+        for (int i = 0; i < M3_COUNT_OF (c_cases); ++i)
+        {
+            IM3Function function = Compiled (runtime, c_cases [i].name);
+            expect (function && CountOps (function, op_MoveToExtraRegister) == 1 && CountOps (function, c_cases [i].operation) == 1,
+                    "second register: %s parks a product and takes both operands from the registers", c_cases [i].name);
+
+            for (int j = 0; j < 3; ++j)
+            {
+                const int32_t * c = c_cases [i].cases [j];
+                int32_t value = CallI32 (function, & result, c [0], c [1], c [2], c [3]);
+                expect (!result && value == c [4], "second register: %s (%d, %d, %d, %d) = %d", c_cases [i].name, c [0], c [1], c [2], c [3], value);
+            }
+        }
+
+        // division has no _xr form: the parked value goes to its slot first
+        IM3Function function = Compiled (runtime, "ratio");
+        expect (function && CountOps (function, op_MoveToExtraRegister) == 1 && CountOps (function, op_SetSlotFromExtra_i64) == 1,
+                "second register: ratio flushes the parked product");
+
+        const int64_t ratios [][5] = { { 100, 3, -2, 5, -30 }, { 1ll << 40, 1 << 20, 1 << 30, 1 << 29, 2 }, { 7, 1, 0, 1, 0 } };
+        for (int i = 0; i < 3; ++i)
+        {
+            const int64_t * r = ratios [i];
+            int64_t value = 0;
+            result = function ? m3_CallV (function, r [0], r [1], r [2], r [3]) : m3Err_functionLookupFailed;
+            if (!result)
+                result = m3_GetResultsV (function, & value);
+
+            if (r [2] == 0)
+                expect (result == m3Err_trapDivisionByZero, "second register: ratio by zero traps (%s)", result ? result : "ok");
+            else
+                expect (!result && value == r [4], "second register: ratio = %lld", (long long) value);
+        }
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+#endif
+
+int  main  (void)
+{
+# if d_m3FuseCompareBranch
+    CheckCompareBranch ();
+# endif
+    CheckThreeAddress ();
+    CheckImmediate ();
+    CheckAddressModes ();
+
+# if d_m3HasSecondRegister
+    CheckSecondRegister ();
+# endif
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,354 @@
+//
+//  m3_test_pool.c
+//
+//  Hands out runtimes from a pool forked from a snapshot, changes them, and checks
+//  that each comes back from m3_ReleaseRuntime as it was in the snapshot, also with
+//  threads taking turns at a pool smaller than their number, and that one whose
+//  reset failed is back in the pool and reset when it's handed out again.
+//
+//  Build:  cc -I ../../source -o m3_test_pool m3_test_pool.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "wasm3.h"
+#include "m3_env.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (memory 16)
+//    (global $g (mut i32) (i32.const 0))
+//    (table 2 funcref)
+//    (elem (i32.const 0) $f6 $f7)
+//    (start $init)
+//    (func $init
+//      i32.const 0  i32.const 42  i32.store
+//      i32.const 0x80000  i32.const 99  i32.store
+//      i32.const 7  global.set $g)
+//    (func (export "bump") (param i32) (result i32)
+//      global.get $g  local.get 0  i32.add  global.set $g  global.get $g)
+//    (func (export "peek") (param i32) (result i32)
+//      local.get 0  i32.load)
+//    (func (export "poke") (param i32 i32)
+//      local.get 0  local.get 1  i32.store)
+//    (func (export "dispatch") (param i32) (result i32)
+//      local.get 0  local.get 0  call_indirect (param i32) (result i32))
+//    (func (export "grow") (param i32) (result i32)
+//      local.get 0  memory.grow)
+//    (func $f6 (param i32) (result i32)
+//      local.get 0  i32.const 100  i32.add)
+//    (func $f7 (param i32) (result i32)
+//      local.get 0  i32.const 200  i32.add))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0e, 0x03, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x60, 0x00, 0x00,
+    0x03, 0x09, 0x08, 0x02, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x04, 0x01, 0x70, 0x00, 0x02, 0x05, 0x03, 0x01, 0x00, 0x10, 0x06, 0x06,
+    0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07, 0x28, 0x05, 0x04, 0x62, 0x75,
+    0x6d, 0x70, 0x00, 0x01, 0x04, 0x70, 0x65, 0x65, 0x6b, 0x00, 0x02, 0x04,
+    0x70, 0x6f, 0x6b, 0x65, 0x00, 0x03, 0x08, 0x64, 0x69, 0x73, 0x70, 0x61,
+    0x74, 0x63, 0x68, 0x00, 0x04, 0x04, 0x67, 0x72, 0x6f, 0x77, 0x00, 0x05,
+    0x08, 0x01, 0x00, 0x09, 0x08, 0x01, 0x00, 0x41, 0x00, 0x0b, 0x02, 0x06,
+    0x07, 0x0a, 0x5a, 0x08, 0x17, 0x00, 0x41, 0x00, 0x41, 0x2a, 0x36, 0x02,
+    0x00, 0x41, 0x80, 0x80, 0x20, 0x41, 0xe3, 0x00, 0x36, 0x02, 0x00, 0x41,
+    0x07, 0x24, 0x00, 0x0b, 0x0b, 0x00, 0x23, 0x00, 0x20, 0x00, 0x6a, 0x24,
+    0x00, 0x23, 0x00, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b,
+    0x09, 0x00, 0x20, 0x00, 0x20, 0x01, 0x36, 0x02, 0x00, 0x0b, 0x09, 0x00,
+    0x20, 0x00, 0x20, 0x00, 0x11, 0x00, 0x00, 0x0b, 0x06, 0x00, 0x20, 0x00,
+    0x40, 0x00, 0x0b, 0x08, 0x00, 0x20, 0x00, 0x41, 0xe4, 0x00, 0x6a, 0x0b,
+    0x08, 0x00, 0x20, 0x00, 0x41, 0xc8, 0x01, 0x6a, 0x0b,
+};
+
+//  (module
+//    (memory 100 (pagesize 1))
+//    (func (export "peek") (param i32) (result i32)
+//      local.get 0  i32.load)
+//    (func (export "poke") (param i32 i32)
+//      local.get 0  local.get 1  i32.store)
+//    (func (export "grow") (param i32) (result i32)
+//      local.get 0  memory.grow))
+static const unsigned char c_bytePagesModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0b, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x03, 0x04, 0x03,
+    0x00, 0x01, 0x00, 0x05, 0x04, 0x01, 0x08, 0x64, 0x00, 0x07, 0x16, 0x03,
+    0x04, 0x70, 0x65, 0x65, 0x6b, 0x00, 0x00, 0x04, 0x70, 0x6f, 0x6b, 0x65,
+    0x00, 0x01, 0x04, 0x67, 0x72, 0x6f, 0x77, 0x00, 0x02, 0x0a, 0x1a, 0x03,
+    0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b, 0x09, 0x00, 0x20, 0x00,
+    0x20, 0x01, 0x36, 0x02, 0x00, 0x0b, 0x06, 0x00, 0x20, 0x00, 0x40, 0x00,
+    0x0b,
+};
+
+#define c_numRuntimes   3
+#define c_numThreads    8
+#define c_numRequests   200
+
+static int32_t  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg, M3Result * o_result)
+{
+    int32_t value = -1;
+
+    IM3Function function;
+    * o_result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!* o_result)
+        * o_result = m3_CallV (function, i_arg);
+
+    if (!* o_result)
+        m3_GetResultsV (function, & value);
+
+    return value;
+}
+
+static M3Result  Poke  (IM3Runtime i_runtime, int32_t i_address, int32_t i_value)
+{
+    IM3Function poke;
+    M3Result result = m3_FindFunction (& poke, i_runtime, "poke");
+
+    if (!result)
+        result = m3_CallV (poke, i_address, i_value);
+
+    return result;
+}
+
+// a request: finds the runtime as snapshotted, and leaves it changed
+static int  Serve  (IM3Runtime i_runtime, int32_t i_tag)
+{
+    M3Result result;
+
+    if (Call (i_runtime, "peek", 0, & result) != 42 || result)          return 0;
+    if (Call (i_runtime, "bump", 1, & result) != 8 || result)           return 0;
+    if (Call (i_runtime, "grow", 0, & result) != 16 || result)          return 0;
+
+    if (Poke (i_runtime, 0, i_tag))                                     return 0;
+    if (Call (i_runtime, "grow", 1, & result) != 16 || result)          return 0;
+    if (Poke (i_runtime, 16 * 65536, i_tag))                            return 0;
+
+    return Call (i_runtime, "peek", 0, & result) == i_tag && !result;
+}
+
+static void *  Worker  (void * i_pool)
+{
+    IM3Pool pool = (IM3Pool) i_pool;
+    intptr_t numServed = 0;
+
+    for (int i = 0; i < c_numRequests; ++i)
+    {
+        IM3Runtime runtime;
+        M3Result result;
+
+        while ((result = m3_AcquireRuntime (pool, & runtime)) == m3Err_poolExhausted)
+            sched_yield ();
+
+        if (result)
+            break;
+
+        numServed += Serve (runtime, 1000 + i);
+
+        if (m3_ReleaseRuntime (runtime))
+            break;
+    }
+
+    return (void *) numServed;
+}
+
+// a memory limit below the snapshot's memory makes the reset on release fail
+static void  CheckFailedReset  (IM3Pool i_pool)
+{
+    IM3Runtime runtime, again;
+    M3Result result = m3_AcquireRuntime (i_pool, & runtime);
+    expect (!result, "failed reset: acquire (%s)", result ? result : "ok");
+    if (result) return;
+
+    Poke (runtime, 0, 1234);
+    runtime->memoryLimit = 65536;
+
+    result = m3_ReleaseRuntime (runtime);
+    expect (result, "failed reset: release reports it (%s)", result ? result : "no error");
+
+    result = m3_AcquireRuntime (i_pool, & again);
+    expect (result, "failed reset: acquire tries it again and reports it (%s)", result ? result : "no error");
+
+    runtime->memoryLimit = 0;
+
+    result = m3_AcquireRuntime (i_pool, & again);
+    expect (!result && again == runtime, "failed reset: acquire resets it now (%s)", result ? result : "ok");
+
+    int32_t value = Call (again, "peek", 0, & result);
+    expect (!result && value == 42, "failed reset: peek (0) = %d", value);
+
+    result = m3_ReleaseRuntime (again);
+    expect (!result, "failed reset: release (%s)", result ? result : "ok");
+}
+
+// a memory of 100 one byte pages ends inside an OS page, and what was grown into
+// past its end in that OS page has to be zero again after a reset too
+static void  CheckBytePages  (IM3Environment i_env)
+{
+#if d_m3UseGuardPages
+    // guard pages take pages of whole OS pages
+    printf ("skip: byte pages with d_m3UseGuardPages\n");
+    return;
+#endif
+
+    IM3Runtime home = m3_NewRuntime (i_env, 64 * 1024, NULL);
+    IM3Runtime original = m3_NewRuntime (i_env, 64 * 1024, NULL);
+
+    IM3Module module, instance;
+    M3Result result = m3_ParseModule (i_env, & module, c_bytePagesModule, sizeof (c_bytePagesModule));
+    if (!result)
+        result = m3_LoadModule (home, module);
+    if (!result)
+        result = m3_ShareModule (module);
+    if (!result)
+        result = m3_InstantiateModule (original, module, & instance);
+
+    IM3Snapshot snapshot = NULL;
+    if (!result)
+        result = m3_NewSnapshot (& snapshot, original);
+
+    IM3Pool pool = NULL;
+    if (!result)
+        result = m3_NewPool (& pool, snapshot, 64 * 1024, 1);
+    expect (!result, "byte pages: pool (%s)", result ? result : "ok");
+
+    IM3Runtime runtime;
+    if (!result)
+        result = m3_AcquireRuntime (pool, & runtime);
+
+    int32_t value = -1;
+    if (!result)
+    {
+        value = Call (runtime, "grow", 100, & result);
+        if (!result)
+            result = Poke (runtime, 150, 0x5a5a5a5a);
+        if (!result)
+            result = m3_ReleaseRuntime (runtime);
+    }
+    if (!result)
+        result = m3_AcquireRuntime (pool, & runtime);
+    if (!result)
+        value = Call (runtime, "grow", 100, & result);
+    expect (!result && value == 100, "byte pages: grown again from %d pages (%s)", value, result ? result : "ok");
+
+    if (!result)
+        value = Call (runtime, "peek", 150, & result);
+    expect (!result && value == 0, "byte pages: peek (150) = 0x%x", value);
+
+    if (pool)
+        m3_FreePool (pool);
+    if (snapshot)
+        m3_FreeSnapshot (snapshot);
+    m3_FreeRuntime (original);
+    m3_FreeRuntime (home);
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime home = m3_NewRuntime (env, 64 * 1024, NULL);
+    IM3Runtime original = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    IM3Module module, instance;
+    M3Result result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    if (!result)
+        result = m3_LoadModule (home, module);
+    if (!result)
+        result = m3_ShareModule (module);
+    if (!result)
+        result = m3_InstantiateModule (original, module, & instance);
+    if (!result)
+        result = m3_RunStart (instance);
+
+    IM3Snapshot snapshot = NULL;
+    if (!result)
+        result = m3_NewSnapshot (& snapshot, original);
+    expect (!result, "snapshot (%s)", result ? result : "ok");
+    if (result) return 1;
+
+    IM3Pool pool = NULL;
+    result = m3_NewPool (& pool, snapshot, 64 * 1024, c_numRuntimes);
+    if (result == m3Err_poolUnsupported)
+    {
+        printf ("skip: (%s)\n", result);
+        return 0;
+    }
+    expect (!result, "new pool (%s)", result ? result : "ok");
+    if (result) return 1;
+
+    IM3Runtime runtimes [c_numRuntimes];
+    for (int i = 0; i < c_numRuntimes; ++i)
+    {
+        result = m3_AcquireRuntime (pool, & runtimes [i]);
+        expect (!result, "acquire %d (%s)", i, result ? result : "ok");
+    }
+
+    IM3Runtime extra;
+    result = m3_AcquireRuntime (pool, & extra);
+    expect (result == m3Err_poolExhausted, "all out (%s)", result ? result : "ok");
+
+    result = m3_ReleaseRuntime (original);
+    expect (result == m3Err_runtimeNotPooled, "release of another runtime refused (%s)", result ? result : "ok");
+
+    for (int i = 0; i < c_numRuntimes; ++i)
+    {
+        expect (Serve (runtimes [i], 500 + i), "runtime %d: serve", i);
+
+        result = m3_ReleaseRuntime (runtimes [i]);
+        expect (!result, "runtime %d: release (%s)", i, result ? result : "ok");
+    }
+
+    // the last one back is the first out again, reset
+    IM3Runtime runtime;
+    result = m3_AcquireRuntime (pool, & runtime);
+    expect (!result && runtime == runtimes [c_numRuntimes - 1], "acquire again (%s)", result ? result : "ok");
+
+    int32_t value = Call (runtime, "grow", 0, & result);
+    expect (!result && value == 16, "reset: memory size %d pages", value);
+
+    value = Call (runtime, "peek", 0x80000, & result);
+    expect (!result && value == 99, "reset: peek (0x80000) = %d", value);
+
+    value = Call (runtime, "peek", 16 * 65536, & result);
+    expect (result == m3Err_trapOutOfBoundsMemoryAccess, "reset: past the end traps (%s)", result ? result : "no trap");
+
+    value = Call (runtime, "grow", 1, & result);
+    value = Call (runtime, "peek", 16 * 65536, & result);
+    expect (!result && value == 0, "reset: grown again, peek (16 * 65536) = %d", value);
+
+    result = m3_ReleaseRuntime (runtime);
+    expect (!result, "release again (%s)", result ? result : "ok");
+
+    CheckFailedReset (pool);
+
+    // more threads than runtimes
+    pthread_t threads [c_numThreads];
+    for (int i = 0; i < c_numThreads; ++i)
+        pthread_create (& threads [i], NULL, Worker, pool);
+
+    for (int i = 0; i < c_numThreads; ++i)
+    {
+        void * numServed;
+        pthread_join (threads [i], & numServed);
+        expect ((intptr_t) numServed == c_numRequests, "thread %d: served %d", i, (int) (intptr_t) numServed);
+    }
+
+    m3_FreePool (pool);
+    m3_FreeSnapshot (snapshot);
+
+    CheckBytePages (env);
+
+    m3_FreeRuntime (original);
+    m3_FreeRuntime (home);
+    m3_FreeEnvironment (env);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
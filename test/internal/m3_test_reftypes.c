@@ -4,7 +4,7 @@
 //  Exercises the reference-type embedding API: the 'r'/'R' link signature
 //  characters, and funcref/externref values crossing m3_Call/m3_GetResults.
 //
-//  Build:  cc -I ../../source -o m3_test_reftypes m3_test_reftypes.c libm3.a -lm
+//  Build:  cc -I ../../source -o m3_test_reftypes m3_test_reftypes.c libm3.a -lm -lpthread
 //
 
 #include <stdio.h>
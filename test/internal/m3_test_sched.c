@@ -0,0 +1,296 @@
+//
+//  m3_test_sched.c
+//
+//  Schedules calls on many runtimes and checks their results, that a runtime's calls
+//  run in order, that traps are reported, and that with a fuel slice a long call gives
+//  way to short ones queued behind it, the runtime's own fuel put back after. Then times
+//  thousands of short calls over 1, 2, 4, ... workers, up to one a core, to show the
+//  throughput scaling.
+//
+//  Build:  cc -I ../../source -o m3_test_sched m3_test_sched.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (global $g (mut i32) (i32.const 0))
+//    (func (export "add") (param i32 i32) (result i32)
+//      local.get 0  local.get 1  i32.add)
+//    (func (export "spin") (param i32) (result i32) (local i32)
+//      block
+//        loop
+//          local.get 0  i32.eqz  br_if 1
+//          local.get 1  i32.const 3  i32.add  local.set 1
+//          local.get 0  i32.const 1  i32.sub  local.set 0
+//          br 0
+//        end
+//      end
+//      local.get 1)
+//    (func (export "bump") (result i32)
+//      global.get $g  i32.const 1  i32.add  global.set $g  global.get $g)
+//    (func (export "div") (param i32 i32) (result i32)
+//      local.get 0  local.get 1  i32.div_s))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x10, 0x03, 0x60,
+    0x02, 0x7f, 0x7f, 0x01, 0x7f, 0x60, 0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00,
+    0x01, 0x7f, 0x03, 0x05, 0x04, 0x00, 0x01, 0x02, 0x00, 0x06, 0x06, 0x01,
+    0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07, 0x1b, 0x04, 0x03, 0x61, 0x64, 0x64,
+    0x00, 0x00, 0x04, 0x73, 0x70, 0x69, 0x6e, 0x00, 0x01, 0x04, 0x62, 0x75,
+    0x6d, 0x70, 0x00, 0x02, 0x03, 0x64, 0x69, 0x76, 0x00, 0x03, 0x0a, 0x3f,
+    0x04, 0x07, 0x00, 0x20, 0x00, 0x20, 0x01, 0x6a, 0x0b, 0x21, 0x01, 0x01,
+    0x7f, 0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d, 0x01, 0x20, 0x01,
+    0x41, 0x03, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b, 0x21, 0x00,
+    0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x01, 0x0b, 0x0b, 0x00, 0x23, 0x00, 0x41,
+    0x01, 0x6a, 0x24, 0x00, 0x23, 0x00, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x20,
+    0x01, 0x6d, 0x0b,
+};
+
+enum { c_numRuntimes = 64 };
+
+static IM3Runtime       s_runtimes [c_numRuntimes];
+
+// what the calls have reported back
+static int              s_numDone, s_numWrong, s_numOutOfOrder, s_numTraps;
+static int              s_lastBump [c_numRuntimes];
+static int              s_doneOrder [2], s_numOrdered;
+
+static uint64_t  SlotI32  (int32_t i_value)     { return (uint32_t) i_value; }
+static int32_t   I32Slot  (uint64_t i_slot)     { return (int32_t) (uint32_t) i_slot; }
+
+static IM3Function  Find  (int i_runtime, const char * i_name)
+{
+    IM3Function function = NULL;
+    m3_FindFunction (& function, s_runtimes [i_runtime], i_name);
+    return function;
+}
+
+// userdata: the expected sum, which comes back zero-extended like the arguments go in
+static void  AddDone  (IM3Function i_function, M3Result i_result, const uint64_t * i_results, void * i_userdata)
+{
+    if (i_result || i_results [0] != SlotI32 ((int32_t) (intptr_t) i_userdata))
+        __atomic_add_fetch (& s_numWrong, 1, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch (& s_numDone, 1, __ATOMIC_RELAXED);
+}
+
+// userdata: the runtime; each runtime's calls run one at a time, in order
+static void  BumpDone  (IM3Function i_function, M3Result i_result, const uint64_t * i_results, void * i_userdata)
+{
+    int runtime = (int) (intptr_t) i_userdata;
+
+    if (i_result || I32Slot (i_results [0]) != s_lastBump [runtime] + 1)
+        __atomic_add_fetch (& s_numOutOfOrder, 1, __ATOMIC_RELAXED);
+
+    s_lastBump [runtime] = I32Slot (i_results [0]);
+}
+
+static void  DivDone  (IM3Function i_function, M3Result i_result, const uint64_t * i_results, void * i_userdata)
+{
+    if (i_result == m3Err_trapDivisionByZero)
+        __atomic_add_fetch (& s_numTraps, 1, __ATOMIC_RELAXED);
+}
+
+// userdata: which call this is
+static void  OrderDone  (IM3Function i_function, M3Result i_result, const uint64_t * i_results, void * i_userdata)
+{
+    int n = __atomic_fetch_add (& s_numOrdered, 1, __ATOMIC_RELAXED);
+    if (n < 2)
+        s_doneOrder [n] = i_result ? -1 : (int) (intptr_t) i_userdata;
+}
+
+static void  CheckCalls  (IM3Scheduler i_scheduler)
+{
+    s_numDone = s_numWrong = 0;
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        int r = i % c_numRuntimes;
+        uint64_t args [2] = { SlotI32 (i), SlotI32 (-3 * i) };
+
+        m3_ScheduleCall (i_scheduler, Find (r, "add"), args, AddDone, (void *) (intptr_t) (-2 * i));
+        m3_ScheduleCall (i_scheduler, Find (r, "bump"), NULL, BumpDone, (void *) (intptr_t) r);
+    }
+
+    uint64_t args [2] = { SlotI32 (1), SlotI32 (0) };
+    m3_ScheduleCall (i_scheduler, Find (3, "div"), args, DivDone, NULL);
+
+    m3_WaitScheduler (i_scheduler);
+
+    expect (s_numDone == 10000 && s_numWrong == 0, "add: %d done, %d wrong", s_numDone, s_numWrong);
+    expect (s_numOutOfOrder == 0, "bump: %d out of order", s_numOutOfOrder);
+    expect (s_numTraps == 1, "div: trap reported");
+
+    // the runtimes are free to use otherwise once their calls are done
+    IM3Function bump = Find (5, "bump");
+    int32_t value = 0;
+    M3Result result = m3_CallV (bump);
+    if (!result)
+        result = m3_GetResultsV (bump, & value);
+    expect (!result && value == s_lastBump [5] + 1, "bump directly after: %d (%s)", value, result ? result : "ok");
+    s_lastBump [5] = value;
+}
+
+// one worker: a long call ahead of a short one on another runtime
+static void  CheckSlicing  (IM3Scheduler i_scheduler, int i_sliced)
+{
+    s_numOrdered = 0;
+
+    uint64_t spinArgs [1] = { SlotI32 (20000000) };
+    uint64_t addArgs [2] = { SlotI32 (1), SlotI32 (2) };
+
+    m3_ScheduleCall (i_scheduler, Find (0, "spin"), spinArgs, OrderDone, (void *) 1);
+    m3_ScheduleCall (i_scheduler, Find (1, "add"), addArgs, OrderDone, (void *) 2);
+
+    m3_WaitScheduler (i_scheduler);
+
+    if (i_sliced)
+        expect (s_doneOrder [0] == 2 && s_doneOrder [1] == 1, "sliced: the long call gave way (%d, %d)", s_doneOrder [0], s_doneOrder [1]);
+    else
+        expect (s_doneOrder [0] == 1 && s_doneOrder [1] == 2, "not sliced: the long call ran first (%d, %d)", s_doneOrder [0], s_doneOrder [1]);
+}
+
+// the runtime's own fuel comes back after sliced calls, and a call made directly runs out
+// of it rather than giving way
+static void  CheckRestored  (IM3Scheduler i_scheduler)
+{
+    IM3Runtime runtime = s_runtimes [7];
+    m3_SetFuel (runtime, 50000);
+
+    s_numDone = s_numWrong = 0;
+    uint64_t args [1] = { SlotI32 (20000) };
+
+    m3_ScheduleCall (i_scheduler, Find (7, "spin"), args, AddDone, (void *) (intptr_t) 60000);
+    m3_ScheduleCall (i_scheduler, Find (7, "spin"), args, AddDone, (void *) (intptr_t) 60000);
+    m3_WaitScheduler (i_scheduler);
+
+    expect (s_numDone == 2 && s_numWrong == 0, "restored: %d sliced calls done, %d wrong", s_numDone, s_numWrong);
+    expect (m3_GetFuel (runtime) == 50000, "restored: fuel %llu", (unsigned long long) m3_GetFuel (runtime));
+
+    M3Result result = m3_CallV (Find (7, "spin"), 20000);
+    expect (result == m3Err_trapOutOfFuel, "restored: a direct call runs out of fuel (%s)", result ? result : "ok");
+
+    m3_SetFuel (runtime, UINT64_MAX);
+}
+
+static double  Now  ()
+{
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, & now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void  Benchmark  ()
+{
+    enum { c_numCalls = 200000 };
+
+    long numCores = sysconf (_SC_NPROCESSORS_ONLN);
+    double first = 0;
+
+    IM3Function spin [c_numRuntimes];
+    for (int i = 0; i < c_numRuntimes; ++i)
+        spin [i] = Find (i, "spin");
+
+    for (long numWorkers = 1; numWorkers <= numCores; numWorkers *= 2)
+    {
+        IM3Scheduler scheduler;
+        if (m3_NewScheduler (& scheduler, (uint32_t) numWorkers, 100000))
+            break;
+
+        s_numDone = s_numWrong = 0;
+        uint64_t args [1] = { SlotI32 (200) };
+
+        double start = Now ();
+        for (int i = 0; i < c_numCalls; ++i)
+            m3_ScheduleCall (scheduler, spin [i % c_numRuntimes], args, AddDone, (void *) (intptr_t) 600);
+
+        m3_FreeScheduler (scheduler);
+        double rate = c_numCalls / (Now () - start);
+
+        if (numWorkers == 1)
+            first = rate;
+
+        printf ("      %2ld workers: %9.0f calls/s, x%.2f\n", numWorkers, rate, rate / first);
+
+        if (s_numWrong)
+            break;
+    }
+
+    expect (s_numWrong == 0, "benchmark: %d wrong", s_numWrong);
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    M3Result result = m3Err_none;
+
+    for (int i = 0; i < c_numRuntimes && !result; ++i)
+    {
+        IM3Module module;
+        s_runtimes [i] = m3_NewRuntime (env, 64 * 1024, NULL);
+
+        result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+        if (!result)
+            result = m3_LoadModule (s_runtimes [i], module);
+        if (!result)
+            result = m3_CompileModule (module);
+    }
+    expect (!result, "load (%s)", result ? result : "ok");
+
+    IM3Scheduler scheduler = NULL;
+    if (!result)
+    {
+        result = m3_NewScheduler (& scheduler, 4, 1000);
+        if (result == m3Err_schedulerUnsupported)
+        {
+            printf ("skip: (%s)\n", result);
+            for (int i = 0; i < c_numRuntimes; ++i)
+                m3_FreeRuntime (s_runtimes [i]);
+            m3_FreeEnvironment (env);
+            return 0;
+        }
+        expect (!result, "new scheduler (%s)", result ? result : "ok");
+    }
+
+    if (!result)
+    {
+        CheckCalls (scheduler);
+        m3_FreeScheduler (scheduler);
+
+        // slicing is there when fuel can give way
+        int sliced = m3_EnableFuelYield (s_runtimes [0], 0) == m3Err_none;
+
+        m3_NewScheduler (& scheduler, 1, 1000);
+        CheckSlicing (scheduler, sliced);
+
+        if (sliced)
+            CheckRestored (scheduler);
+
+        m3_FreeScheduler (scheduler);
+
+        m3_NewScheduler (& scheduler, 1, 0);
+        CheckSlicing (scheduler, 0);
+        m3_FreeScheduler (scheduler);
+
+        Benchmark ();
+    }
+
+    for (int i = 0; i < c_numRuntimes; ++i)
+        m3_FreeRuntime (s_runtimes [i]);
+    m3_FreeEnvironment (env);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,226 @@
+//
+//  m3_test_share.c
+//
+//  Shares one module's compiled code, instantiates it into several runtimes, and
+//  checks that each instance keeps its own memory, globals, table and functions,
+//  also when the instances run at once on their own threads.
+//
+//  Build:  cc -I ../../source -o m3_test_share m3_test_share.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (memory 1)
+//    (data (i32.const 0) "\2a\00\00\00")
+//    (global $g (mut i32) (i32.const 10))
+//    (table 2 funcref)
+//    (elem (i32.const 0) $f4 $f5)
+//    (func (export "bump") (param i32) (result i32)
+//      global.get $g  local.get 0  i32.add  global.set $g  global.get $g)
+//    (func (export "peek") (param i32) (result i32)
+//      local.get 0  i32.load)
+//    (func (export "poke") (param i32 i32)
+//      local.get 0  local.get 1  i32.store)
+//    (func (export "dispatch") (param i32) (result i32)
+//      local.get 0  local.get 0  call_indirect (param i32) (result i32))
+//    (func $f4 (param i32) (result i32)
+//      local.get 0  i32.const 100  i32.add)
+//    (func $f5 (param i32) (result i32)
+//      local.get 0  i32.const 200  i32.add)
+//    (func (export "aim") (param i32)
+//      local.get 0  ref.func $f5  table.set 0))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0f, 0x03, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x60, 0x01, 0x7f,
+    0x00, 0x03, 0x08, 0x07, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x04,
+    0x04, 0x01, 0x70, 0x00, 0x02, 0x05, 0x03, 0x01, 0x00, 0x01, 0x06, 0x06,
+    0x01, 0x7f, 0x01, 0x41, 0x0a, 0x0b, 0x07, 0x27, 0x05, 0x04, 0x62, 0x75,
+    0x6d, 0x70, 0x00, 0x00, 0x04, 0x70, 0x65, 0x65, 0x6b, 0x00, 0x01, 0x04,
+    0x70, 0x6f, 0x6b, 0x65, 0x00, 0x02, 0x08, 0x64, 0x69, 0x73, 0x70, 0x61,
+    0x74, 0x63, 0x68, 0x00, 0x03, 0x03, 0x61, 0x69, 0x6d, 0x00, 0x06, 0x09,
+    0x08, 0x01, 0x00, 0x41, 0x00, 0x0b, 0x02, 0x04, 0x05, 0x0a, 0x44, 0x07,
+    0x0b, 0x00, 0x23, 0x00, 0x20, 0x00, 0x6a, 0x24, 0x00, 0x23, 0x00, 0x0b,
+    0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b, 0x09, 0x00, 0x20, 0x00,
+    0x20, 0x01, 0x36, 0x02, 0x00, 0x0b, 0x09, 0x00, 0x20, 0x00, 0x20, 0x00,
+    0x11, 0x00, 0x00, 0x0b, 0x08, 0x00, 0x20, 0x00, 0x41, 0xe4, 0x00, 0x6a,
+    0x0b, 0x08, 0x00, 0x20, 0x00, 0x41, 0xc8, 0x01, 0x6a, 0x0b, 0x08, 0x00,
+    0x20, 0x00, 0xd2, 0x05, 0x26, 0x00, 0x0b, 0x0b, 0x0a, 0x01, 0x00, 0x41,
+    0x00, 0x0b, 0x04, 0x2a, 0x00, 0x00, 0x00,
+};
+
+#define c_numInstances  4
+
+static int32_t  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg, M3Result * o_result)
+{
+    int32_t value = -1;
+
+    IM3Function function;
+    * o_result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!* o_result)
+        * o_result = m3_CallV (function, i_arg);
+
+    if (!* o_result)
+        m3_GetResultsV (function, & value);
+
+    return value;
+}
+
+static void *  Bump  (void * i_runtime)
+{
+    M3Result result = m3Err_none;
+    int32_t value = 0;
+
+    for (int i = 0; i < 10000 && !result; ++i)
+        value = Call ((IM3Runtime) i_runtime, "bump", 1, & result);
+
+    return (void *) (intptr_t) (result ? -1 : value);
+}
+
+static void  CheckInstances  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime home = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    if (!result)
+        result = m3_LoadModule (home, module);
+    expect (!result, "load (%s)", result ? result : "ok");
+    if (result) return;
+
+    result = m3_InstantiateModule (home, module, NULL);
+    expect (result == m3Err_moduleNotShared, "instantiate before sharing refused (%s)", result ? result : "ok");
+
+    result = m3_ShareModule (module);
+    expect (!result, "share (%s)", result ? result : "ok");
+
+    IM3Runtime runtimes [c_numInstances];
+    IM3Module instances [c_numInstances];
+    for (int i = 0; i < c_numInstances; ++i)
+    {
+        runtimes [i] = m3_NewRuntime (env, 64 * 1024, NULL);
+
+        result = m3_InstantiateModule (runtimes [i], module, & instances [i]);
+        expect (!result, "instance %d: instantiate (%s)", i, result ? result : "ok");
+
+        if (i == 0)
+        {
+            IM3Module instance;
+            result = m3_InstantiateModule (runtimes [i], module, & instance);
+            expect (result == m3Err_runtimeHasSharedModule, "instance %d: a second one refused (%s)", i, result ? result : "ok");
+        }
+    }
+
+    // each instance starts from the module's data and global, and changes only its own
+    for (int i = 0; i < c_numInstances; ++i)
+    {
+        int32_t value = Call (runtimes [i], "peek", 0, & result);
+        expect (!result && value == 42, "instance %d: peek (0) = %d", i, value);
+
+        value = Call (runtimes [i], "bump", i, & result);
+        expect (!result && value == 10 + i, "instance %d: bump (%d) = %d", i, i, value);
+
+        IM3Function poke;
+        result = m3_FindFunction (& poke, runtimes [i], "poke");
+        if (!result)
+            result = m3_CallV (poke, 0, 1000 + i);
+        expect (!result, "instance %d: poke (%s)", i, result ? result : "ok");
+
+        value = Call (runtimes [i], "dispatch", i % 2, & result);
+        expect (!result && value == (i % 2) * 101 + 100, "instance %d: dispatch (%d) = %d", i, i % 2, value);
+    }
+
+    // ref.func names the instance's own function, the one its elements put in the table
+    for (int i = 0; i < c_numInstances; ++i)
+    {
+        IM3Function aim, aimed = NULL, element = NULL, home_element = NULL;
+        result = m3_FindFunction (& aim, runtimes [i], "aim");
+        if (!result)
+            result = m3_CallV (aim, 0);
+        if (!result)
+            result = m3_GetTableFunction (& aimed, instances [i], 0);
+        if (!result)
+            result = m3_GetTableFunction (& element, instances [i], 1);
+        if (!result)
+            result = m3_GetTableFunction (& home_element, module, 1);
+        expect (!result && aimed == element && aimed != home_element, "instance %d: ref.func is its own (%s)", i, result ? result : "ok");
+
+        int32_t value = Call (runtimes [i], "dispatch", 0, & result);
+        expect (!result && value == 200, "instance %d: dispatch (0) after aim = %d", i, value);
+    }
+
+    for (int i = 0; i < c_numInstances; ++i)
+    {
+        int32_t value = Call (runtimes [i], "peek", 0, & result);
+        expect (!result && value == 1000 + i, "instance %d: own memory, peek (0) = %d", i, value);
+
+        value = Call (runtimes [i], "bump", 0, & result);
+        expect (!result && value == 10 + i, "instance %d: own global, bump (0) = %d", i, value);
+    }
+
+    int32_t value = Call (home, "bump", 0, & result);
+    expect (!result && value == 10, "home: untouched, bump (0) = %d", value);
+
+    // the shared code runs in all of them at once
+    pthread_t threads [c_numInstances];
+    for (int i = 0; i < c_numInstances; ++i)
+        pthread_create (& threads [i], NULL, Bump, runtimes [i]);
+
+    for (int i = 0; i < c_numInstances; ++i)
+    {
+        void * bumped;
+        pthread_join (threads [i], & bumped);
+        expect ((intptr_t) bumped == 10010 + i, "instance %d: threaded bump = %d", i, (int) (intptr_t) bumped);
+    }
+
+    for (int i = 0; i < c_numInstances; ++i)
+        m3_FreeRuntime (runtimes [i]);
+
+    m3_FreeRuntime (home);
+    m3_FreeEnvironment (env);
+}
+
+static void  CheckCompiledFirst  ()
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    if (!result)
+        result = m3_LoadModule (runtime, module);
+
+    if (!result)
+    {
+        Call (runtime, "bump", 1, & result);
+        expect (!result, "compiled first: bump (%s)", result ? result : "ok");
+
+        result = m3_ShareModule (module);
+        expect (result == m3Err_moduleAlreadyCompiled, "compiled first: share refused (%s)", result ? result : "ok");
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    CheckInstances ();
+    CheckCompiledFirst ();
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
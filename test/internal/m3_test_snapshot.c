@@ -0,0 +1,202 @@
+//
+//  m3_test_snapshot.c
+//
+//  Sets up an instance of a shared module, snapshots it, and forks more instances
+//  from the snapshot: they start where the original left off, without running its
+//  start function, and go on separately from it and from each other.
+//
+//  Build:  cc -I ../../source -o m3_test_snapshot m3_test_snapshot.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (memory 16)
+//    (global $g (mut i32) (i32.const 0))
+//    (table 2 funcref)
+//    (elem (i32.const 0) $f6 $f7)
+//    (start $init)
+//    (func $init
+//      i32.const 0  i32.const 42  i32.store
+//      i32.const 0x80000  i32.const 99  i32.store
+//      i32.const 7  global.set $g)
+//    (func (export "bump") (param i32) (result i32)
+//      global.get $g  local.get 0  i32.add  global.set $g  global.get $g)
+//    (func (export "peek") (param i32) (result i32)
+//      local.get 0  i32.load)
+//    (func (export "poke") (param i32 i32)
+//      local.get 0  local.get 1  i32.store)
+//    (func (export "dispatch") (param i32) (result i32)
+//      local.get 0  local.get 0  call_indirect (param i32) (result i32))
+//    (func (export "grow") (param i32) (result i32)
+//      local.get 0  memory.grow)
+//    (func $f6 (param i32) (result i32)
+//      local.get 0  i32.const 100  i32.add)
+//    (func $f7 (param i32) (result i32)
+//      local.get 0  i32.const 200  i32.add))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0e, 0x03, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x02, 0x7f, 0x7f, 0x00, 0x60, 0x00, 0x00,
+    0x03, 0x09, 0x08, 0x02, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x04, 0x01, 0x70, 0x00, 0x02, 0x05, 0x03, 0x01, 0x00, 0x10, 0x06, 0x06,
+    0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b, 0x07, 0x28, 0x05, 0x04, 0x62, 0x75,
+    0x6d, 0x70, 0x00, 0x01, 0x04, 0x70, 0x65, 0x65, 0x6b, 0x00, 0x02, 0x04,
+    0x70, 0x6f, 0x6b, 0x65, 0x00, 0x03, 0x08, 0x64, 0x69, 0x73, 0x70, 0x61,
+    0x74, 0x63, 0x68, 0x00, 0x04, 0x04, 0x67, 0x72, 0x6f, 0x77, 0x00, 0x05,
+    0x08, 0x01, 0x00, 0x09, 0x08, 0x01, 0x00, 0x41, 0x00, 0x0b, 0x02, 0x06,
+    0x07, 0x0a, 0x5a, 0x08, 0x17, 0x00, 0x41, 0x00, 0x41, 0x2a, 0x36, 0x02,
+    0x00, 0x41, 0x80, 0x80, 0x20, 0x41, 0xe3, 0x00, 0x36, 0x02, 0x00, 0x41,
+    0x07, 0x24, 0x00, 0x0b, 0x0b, 0x00, 0x23, 0x00, 0x20, 0x00, 0x6a, 0x24,
+    0x00, 0x23, 0x00, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x28, 0x02, 0x00, 0x0b,
+    0x09, 0x00, 0x20, 0x00, 0x20, 0x01, 0x36, 0x02, 0x00, 0x0b, 0x09, 0x00,
+    0x20, 0x00, 0x20, 0x00, 0x11, 0x00, 0x00, 0x0b, 0x06, 0x00, 0x20, 0x00,
+    0x40, 0x00, 0x0b, 0x08, 0x00, 0x20, 0x00, 0x41, 0xe4, 0x00, 0x6a, 0x0b,
+    0x08, 0x00, 0x20, 0x00, 0x41, 0xc8, 0x01, 0x6a, 0x0b,
+};
+
+#define c_numForks  4
+
+static int32_t  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg, M3Result * o_result)
+{
+    int32_t value = -1;
+
+    IM3Function function;
+    * o_result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!* o_result)
+        * o_result = m3_CallV (function, i_arg);
+
+    if (!* o_result)
+        m3_GetResultsV (function, & value);
+
+    return value;
+}
+
+static M3Result  Poke  (IM3Runtime i_runtime, int32_t i_address, int32_t i_value)
+{
+    IM3Function poke;
+    M3Result result = m3_FindFunction (& poke, i_runtime, "poke");
+
+    if (!result)
+        result = m3_CallV (poke, i_address, i_value);
+
+    return result;
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime home = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    if (!result)
+        result = m3_LoadModule (home, module);
+    if (!result)
+        result = m3_ShareModule (module);
+    expect (!result, "load and share (%s)", result ? result : "ok");
+    if (result) return 1;
+
+    IM3Snapshot snapshot = NULL;
+    IM3Runtime plain = m3_NewRuntime (env, 64 * 1024, NULL);
+    result = m3_NewSnapshot (& snapshot, plain);
+    expect (result == m3Err_moduleNotShared, "runtime without a shared module refused (%s)", result ? result : "ok");
+    m3_FreeRuntime (plain);
+
+    // the original: started, then changed some more
+    IM3Runtime original = m3_NewRuntime (env, 64 * 1024, NULL);
+
+    IM3Module instance;
+    result = m3_InstantiateModule (original, module, & instance);
+    if (!result)
+        result = m3_RunStart (instance);
+    expect (!result, "original: instantiate and start (%s)", result ? result : "ok");
+
+    int32_t value = Call (original, "bump", 3, & result);
+    expect (!result && value == 10, "original: bump (3) = %d", value);
+
+    result = Poke (original, 4, 5);
+    expect (!result, "original: poke (%s)", result ? result : "ok");
+
+    result = m3_NewSnapshot (& snapshot, original);
+    expect (!result, "snapshot (%s)", result ? result : "ok");
+    if (result) return 1;
+
+    // forks needn't outlive the original, nor the snapshot them
+    m3_FreeRuntime (original);
+
+    IM3Runtime forks [c_numForks];
+    for (int i = 0; i < c_numForks; ++i)
+    {
+        forks [i] = m3_NewRuntime (env, 64 * 1024, NULL);
+
+        result = m3_ForkSnapshot (forks [i], snapshot, & instance);
+        expect (!result, "fork %d (%s)", i, result ? result : "ok");
+
+        // the start function ran before the snapshot, and doesn't again
+        if (!result)
+            result = m3_RunStart (instance);
+        expect (!result, "fork %d: start (%s)", i, result ? result : "ok");
+    }
+
+    m3_FreeSnapshot (snapshot);
+
+    for (int i = 0; i < c_numForks; ++i)
+    {
+        value = Call (forks [i], "peek", 0, & result);
+        expect (!result && value == 42, "fork %d: peek (0) = %d", i, value);
+
+        value = Call (forks [i], "peek", 4, & result);
+        expect (!result && value == 5, "fork %d: peek (4) = %d", i, value);
+
+        value = Call (forks [i], "peek", 0x80000, & result);
+        expect (!result && value == 99, "fork %d: peek (0x80000) = %d", i, value);
+
+        value = Call (forks [i], "bump", i, & result);
+        expect (!result && value == 10 + i, "fork %d: bump (%d) = %d", i, i, value);
+
+        value = Call (forks [i], "dispatch", i % 2, & result);
+        expect (!result && value == (i % 2) * 101 + 100, "fork %d: dispatch (%d) = %d", i, i % 2, value);
+
+        result = Poke (forks [i], 0, 1000 + i);
+        expect (!result, "fork %d: poke (%s)", i, result ? result : "ok");
+    }
+
+    for (int i = 0; i < c_numForks; ++i)
+    {
+        value = Call (forks [i], "peek", 0, & result);
+        expect (!result && value == 1000 + i, "fork %d: own memory, peek (0) = %d", i, value);
+
+        value = Call (forks [i], "bump", 0, & result);
+        expect (!result && value == 10 + i, "fork %d: own global, bump (0) = %d", i, value);
+    }
+
+    // growing keeps what was mapped, and adds zeroed pages
+    value = Call (forks [0], "grow", 4, & result);
+    expect (!result && value == 16, "fork 0: grow (4) = %d", value);
+
+    value = Call (forks [0], "peek", 0x80000, & result);
+    expect (!result && value == 99, "fork 0: after growing, peek (0x80000) = %d", value);
+
+    value = Call (forks [0], "peek", 16 * 65536, & result);
+    expect (!result && value == 0, "fork 0: a new page, peek (16 * 65536) = %d", value);
+
+    for (int i = 0; i < c_numForks; ++i)
+        m3_FreeRuntime (forks [i]);
+
+    m3_FreeRuntime (home);
+    m3_FreeEnvironment (env);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
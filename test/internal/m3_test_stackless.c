@@ -0,0 +1,159 @@
+//
+//  m3_test_stackless.c
+//
+//  Recurses far deeper than a small native stack could hold, directly and through
+//  call_indirect, and runs a long loop, on a thread with 128KB of stack; checks the
+//  results, that running out of m3 stack traps instead, and that a call made with
+//  nothing on the operand stack compiles.
+//
+//  Build:  cc -I ../../source -Dd_m3Stackless=1 -o m3_test_stackless m3_test_stackless.c libm3.a -lm -lpthread
+//          (with libm3.a built with -Dd_m3Stackless=1 as well; a compiler without musttail
+//          also needs -Dd_m3CanTailCall=1 and an optimised build)
+//
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "wasm3.h"
+#include "m3_config.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (type $t (func (param i32) (result i32)))
+//    (table 1 funcref)
+//    (elem (i32.const 0) $down_indirect)
+//    (func $down (export "down") (type $t)
+//      local.get 0  i32.eqz
+//      if (result i32)  i32.const 0
+//      else  local.get 0  local.get 0  i32.const 1  i32.sub  call $down  i32.add  end)
+//    (func $down_indirect (export "down_indirect") (type $t)
+//      local.get 0  i32.eqz
+//      if (result i32)  i32.const 0
+//      else  local.get 0  local.get 0  i32.const 1  i32.sub  i32.const 0  call_indirect (type $t)  i32.add  end)
+//    (func (export "count") (param i32) (result i32) (local i32)
+//      block
+//        loop
+//          local.get 0  i32.eqz  br_if 1
+//          local.get 1  i32.const 3  i32.add  local.set 1
+//          local.get 0  i32.const 1  i32.sub  local.set 0
+//          br 0
+//        end
+//      end
+//      local.get 1)
+//    (func $nothing)
+//    (func (export "empty_call") (result i32)
+//      call $nothing  i32.const 5))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x0d, 0x03, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x00, 0x60, 0x00, 0x01, 0x7f, 0x03,
+    0x06, 0x05, 0x00, 0x00, 0x00, 0x01, 0x02, 0x04, 0x04, 0x01, 0x70, 0x00,
+    0x01, 0x07, 0x2d, 0x04, 0x04, 0x64, 0x6f, 0x77, 0x6e, 0x00, 0x00, 0x0d,
+    0x64, 0x6f, 0x77, 0x6e, 0x5f, 0x69, 0x6e, 0x64, 0x69, 0x72, 0x65, 0x63,
+    0x74, 0x00, 0x01, 0x05, 0x63, 0x6f, 0x75, 0x6e, 0x74, 0x00, 0x02, 0x0a,
+    0x65, 0x6d, 0x70, 0x74, 0x79, 0x5f, 0x63, 0x61, 0x6c, 0x6c, 0x00, 0x04,
+    0x09, 0x07, 0x01, 0x00, 0x41, 0x00, 0x0b, 0x01, 0x01, 0x0a, 0x5c, 0x05,
+    0x15, 0x00, 0x20, 0x00, 0x45, 0x04, 0x7f, 0x41, 0x00, 0x05, 0x20, 0x00,
+    0x20, 0x00, 0x41, 0x01, 0x6b, 0x10, 0x00, 0x6a, 0x0b, 0x0b, 0x18, 0x00,
+    0x20, 0x00, 0x45, 0x04, 0x7f, 0x41, 0x00, 0x05, 0x20, 0x00, 0x20, 0x00,
+    0x41, 0x01, 0x6b, 0x41, 0x00, 0x11, 0x00, 0x00, 0x6a, 0x0b, 0x0b, 0x21,
+    0x01, 0x01, 0x7f, 0x02, 0x40, 0x03, 0x40, 0x20, 0x00, 0x45, 0x0d, 0x01,
+    0x20, 0x01, 0x41, 0x03, 0x6a, 0x21, 0x01, 0x20, 0x00, 0x41, 0x01, 0x6b,
+    0x21, 0x00, 0x0c, 0x00, 0x0b, 0x0b, 0x20, 0x01, 0x0b, 0x02, 0x00, 0x0b,
+    0x06, 0x00, 0x10, 0x03, 0x41, 0x05, 0x0b,
+};
+
+enum { c_depth = 100000 };
+
+static M3Result  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg, int32_t * o_value)
+{
+    IM3Function function;
+    M3Result result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!result)
+        result = m3_CallV (function, i_arg);
+    if (!result)
+        result = m3_GetResultsV (function, o_value);
+
+    return result;
+}
+
+// n + (n - 1) + ... + 1, wrapping as i32.add does
+static int32_t  Sum  (uint32_t i_n)
+{
+    return (int32_t) (uint32_t) ((uint64_t) i_n * (i_n + 1) / 2);
+}
+
+static void *  Run  (void * i_runtime)
+{
+    IM3Runtime runtime = (IM3Runtime) i_runtime;
+    int32_t value = 0;
+
+    M3Result result = Call (runtime, "down", c_depth, & value);
+    expect (!result && value == Sum (c_depth), "down %d: %d (%s)", c_depth, value, result ? result : "ok");
+
+    value = 0;
+    result = Call (runtime, "down_indirect", c_depth, & value);
+    expect (!result && value == Sum (c_depth), "down_indirect %d: %d (%s)", c_depth, value, result ? result : "ok");
+
+    value = 0;
+    result = Call (runtime, "empty_call", 0, & value);
+    expect (!result && value == 5, "empty_call: %d (%s)", value, result ? result : "ok");
+
+    value = 0;
+    result = Call (runtime, "count", 10000000, & value);
+    expect (!result && value == 30000000, "count: %d (%s)", value, result ? result : "ok");
+
+    // the m3 stack runs out well before this
+    result = Call (runtime, "down", 100000000, & value);
+    expect (result == m3Err_trapStackOverflow, "too deep (%s)", result ? result : "no trap");
+
+    // and the frames it left are gone
+    value = 0;
+    result = Call (runtime, "down", 1000, & value);
+    expect (!result && value == Sum (1000), "down after the overflow: %d (%s)", value, result ? result : "ok");
+
+    return NULL;
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+#if d_m3Stackless
+    IM3Environment env = m3_NewEnvironment ();
+    IM3Runtime runtime = m3_NewRuntime (env, 32 * 1024 * 1024, NULL);
+
+    IM3Module module;
+    M3Result result = m3_ParseModule (env, & module, c_module, sizeof (c_module));
+    if (!result)
+        result = m3_LoadModule (runtime, module);
+    expect (!result, "load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        // a Wasm call doesn't recurse natively, so this is plenty
+        pthread_attr_t attributes;
+        pthread_attr_init (& attributes);
+        pthread_attr_setstacksize (& attributes, 128 * 1024);
+
+        pthread_t thread;
+        pthread_create (& thread, & attributes, Run, runtime);
+        pthread_join (thread, NULL);
+
+        pthread_attr_destroy (& attributes);
+    }
+
+    m3_FreeRuntime (runtime);
+    m3_FreeEnvironment (env);
+#else
+    printf ("skip: (not built with d_m3Stackless)\n");
+#endif
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,286 @@
+//
+//  m3_test_suspend.c
+//
+//  Suspends calls from a host function and resumes them with its results, also
+//  from another thread, inside a nested call and across many runtimes taking turns
+//  on one thread, and checks that a suspended runtime refuses other calls, that
+//  aborting unwinds, and that only calls able to be suspended are.
+//
+//  Build:  cc -I ../../source -o m3_test_suspend m3_test_suspend.c libm3.a -lm -lpthread
+//
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "wasm3.h"
+
+static int failures = 0;
+
+#define expect(TEST, ...) do {                                          \
+        if (TEST) { printf ("ok:   " __VA_ARGS__); }                    \
+        else      { printf ("FAIL: " __VA_ARGS__); failures++; }        \
+        printf ("\n");                                                  \
+    } while (0)
+
+//  (module
+//    (import "env" "wait" (func $wait (param i32) (result i32)))
+//    (import "env" "reenter" (func $reenter (param i32) (result i32)))
+//    (func (export "run") (param i32) (result i32)
+//      local.get 0  call $wait  call $wait  i32.const 1  i32.add)
+//    (func (export "outer") (param i32) (result i32)
+//      local.get 0  call $reenter)
+//    (func (export "plain") (param i32) (result i32)
+//      local.get 0  i32.const 2  i32.mul))
+static const unsigned char c_module [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x09, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x00, 0x02, 0x1a, 0x02, 0x03, 0x65,
+    0x6e, 0x76, 0x04, 0x77, 0x61, 0x69, 0x74, 0x00, 0x00, 0x03, 0x65, 0x6e,
+    0x76, 0x07, 0x72, 0x65, 0x65, 0x6e, 0x74, 0x65, 0x72, 0x00, 0x00, 0x03,
+    0x04, 0x03, 0x00, 0x00, 0x00, 0x07, 0x17, 0x03, 0x03, 0x72, 0x75, 0x6e,
+    0x00, 0x02, 0x05, 0x6f, 0x75, 0x74, 0x65, 0x72, 0x00, 0x03, 0x05, 0x70,
+    0x6c, 0x61, 0x69, 0x6e, 0x00, 0x04, 0x0a, 0x1c, 0x03, 0x0b, 0x00, 0x20,
+    0x00, 0x10, 0x00, 0x10, 0x00, 0x41, 0x01, 0x6a, 0x0b, 0x06, 0x00, 0x20,
+    0x00, 0x10, 0x01, 0x0b, 0x07, 0x00, 0x20, 0x00, 0x41, 0x02, 0x6c, 0x0b,
+};
+
+//  (module
+//    (import "env" "wait" (func $wait (param i32) (result i32)))
+//    (func $start  i32.const 5  call $wait  drop)
+//    (start $start))
+static const unsigned char c_startModule [] = {
+    0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00, 0x01, 0x09, 0x02, 0x60,
+    0x01, 0x7f, 0x01, 0x7f, 0x60, 0x00, 0x00, 0x02, 0x0c, 0x01, 0x03, 0x65,
+    0x6e, 0x76, 0x04, 0x77, 0x61, 0x69, 0x74, 0x00, 0x00, 0x03, 0x02, 0x01,
+    0x01, 0x08, 0x01, 0x01, 0x0a, 0x09, 0x01, 0x07, 0x00, 0x41, 0x05, 0x10,
+    0x00, 0x1a, 0x0b,
+};
+
+// its result is whatever m3_Resume is given
+m3ApiRawFunction (Wait)
+{
+    m3ApiSuspend ();
+}
+
+m3ApiRawFunction (Reenter)
+{
+    m3ApiReturnType (int32_t)
+    m3ApiGetArg     (int32_t, value)
+
+    IM3Function run;
+    M3Result result = m3_FindFunction (& run, runtime, "run");
+
+    if (!result)
+        result = m3_CallV (run, value);
+    if (!result)
+        result = m3_GetResultsV (run, & value);
+    if (result)
+        m3ApiTrap (result);
+
+    m3ApiReturn (value + 100);
+}
+
+static IM3Module  Load  (IM3Environment i_env, IM3Runtime io_runtime, const unsigned char * i_wasm, uint32_t i_numBytes, M3Result * o_result)
+{
+    IM3Module module = NULL;
+    * o_result = m3_ParseModule (i_env, & module, i_wasm, i_numBytes);
+
+    if (!* o_result)
+        * o_result = m3_LoadModule (io_runtime, module);
+    if (!* o_result)
+        * o_result = m3_LinkRawFunction (module, "env", "wait", "i(i)", & Wait);
+    if (!* o_result && i_wasm == c_module)
+        * o_result = m3_LinkRawFunction (module, "env", "reenter", "i(i)", & Reenter);
+
+    return module;
+}
+
+static M3Result  Call  (IM3Runtime i_runtime, const char * i_name, int32_t i_arg)
+{
+    IM3Function function;
+    M3Result result = m3_FindFunction (& function, i_runtime, i_name);
+
+    if (!result)
+        result = m3_CallV (function, i_arg);
+
+    return result;
+}
+
+static int32_t  Result  (IM3Runtime i_runtime, const char * i_name)
+{
+    IM3Function function;
+    int32_t value = -1;
+
+    if (!m3_FindFunction (& function, i_runtime, i_name))
+        m3_GetResultsV (function, & value);
+
+    return value;
+}
+
+static M3Result  Resume  (IM3Runtime i_runtime, int32_t i_value)
+{
+    uint64_t result = (uint32_t) i_value;
+    return m3_Resume (i_runtime, 1, & result);
+}
+
+static void *  ResumeTwice  (void * i_runtime)
+{
+    IM3Runtime runtime = (IM3Runtime) i_runtime;
+
+    M3Result result = Resume (runtime, 20);
+    if (result == m3Err_suspended)
+        result = Resume (runtime, 30);
+
+    return (void *) result;
+}
+
+static void  CheckSuspend  (IM3Runtime i_runtime)
+{
+    M3Result result = Call (i_runtime, "run", 5);
+    expect (result == m3Err_suspended, "run suspends (%s)", result ? result : "ran on");
+
+    // nothing else runs in the meantime
+    result = Call (i_runtime, "plain", 1);
+    expect (result == m3Err_runtimeSuspended, "plain is refused (%s)", result ? result : "ran");
+
+    result = m3_Resume (i_runtime, 0, NULL);
+    expect (result == m3Err_argumentCountMismatch, "resume with no results (%s)", result ? result : "ok");
+
+    result = Resume (i_runtime, 7);
+    expect (result == m3Err_suspended, "resume once: suspends again (%s)", result ? result : "ran on");
+
+    result = Resume (i_runtime, 10);
+    expect (!result && Result (i_runtime, "run") == 11, "resume twice: run = %d (%s)", Result (i_runtime, "run"), result ? result : "ok");
+
+    result = Resume (i_runtime, 10);
+    expect (result == m3Err_notSuspended, "resume when done (%s)", result ? result : "ok");
+
+    result = Call (i_runtime, "plain", 21);
+    expect (!result && Result (i_runtime, "plain") == 42, "plain after (%s)", result ? result : "ok");
+
+    // the host function's frames, and the nested call's, are kept across the suspension
+    result = Call (i_runtime, "outer", 1);
+    if (result == m3Err_suspended)
+        result = Resume (i_runtime, 3);
+    if (result == m3Err_suspended)
+        result = Resume (i_runtime, 4);
+    expect (!result && Result (i_runtime, "outer") == 105, "nested: outer = %d (%s)", Result (i_runtime, "outer"), result ? result : "ok");
+
+    // aborting has the host function trap instead
+    result = Call (i_runtime, "run", 1);
+    if (result == m3Err_suspended)
+        result = m3_AbortSuspended (i_runtime, m3Err_trapExit);
+    expect (result == m3Err_trapExit, "abort (%s)", result ? result : "no trap");
+
+    result = Call (i_runtime, "plain", 2);
+    expect (!result && Result (i_runtime, "plain") == 4, "plain after the abort (%s)", result ? result : "ok");
+
+    // resumed from another thread
+    pthread_t thread;
+    result = Call (i_runtime, "run", 1);
+    if (result == m3Err_suspended)
+    {
+        pthread_create (& thread, NULL, ResumeTwice, i_runtime);
+        pthread_join (thread, (void **) & result);
+    }
+    expect (!result && Result (i_runtime, "run") == 31, "another thread: run = %d (%s)", Result (i_runtime, "run"), result ? result : "ok");
+}
+
+static void  CheckTakingTurns  (IM3Environment i_env)
+{
+    enum { c_numRuntimes = 16 };
+
+    IM3Runtime runtimes [c_numRuntimes];
+    int suspended = 0, done = 0;
+
+    for (int i = 0; i < c_numRuntimes; ++i)
+    {
+        M3Result result;
+        runtimes [i] = m3_NewRuntime (i_env, 64 * 1024, NULL);
+        Load (i_env, runtimes [i], c_module, sizeof (c_module), & result);
+
+        if (!result)
+            result = m3_EnableSuspend (runtimes [i], 1);
+        if (!result)
+            result = Call (runtimes [i], "run", i);
+
+        suspended += (result == m3Err_suspended);
+    }
+
+    // each waits twice; the others run in between
+    for (int turn = 0; turn < 2; ++turn)
+    {
+        for (int i = 0; i < c_numRuntimes; ++i)
+        {
+            M3Result result = Resume (runtimes [i], i * 10 + turn);
+
+            if (turn == 1)
+                done += (!result && Result (runtimes [i], "run") == i * 10 + 2);
+        }
+    }
+
+    expect (suspended == c_numRuntimes && done == c_numRuntimes, "taking turns: %d suspended, %d done", suspended, done);
+
+    // freeing one mid-call unwinds it
+    Call (runtimes [0], "run", 0);
+    for (int i = 0; i < c_numRuntimes; ++i)
+        m3_FreeRuntime (runtimes [i]);
+}
+
+int  main  (int i_argc, const char * i_argv [])
+{
+    IM3Environment env = m3_NewEnvironment ();
+
+    M3Result result;
+    IM3Runtime runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+    Load (env, runtime, c_module, sizeof (c_module), & result);
+    expect (!result, "load (%s)", result ? result : "ok");
+
+    if (!result)
+    {
+        // not until enabled
+        result = Call (runtime, "run", 5);
+        expect (result == m3Err_trapCannotSuspend, "not enabled (%s)", result ? result : "no trap");
+
+        result = m3_EnableSuspend (runtime, 1);
+        if (result == m3Err_suspendUnsupported)
+        {
+            printf ("skip: (%s)\n", result);
+            m3_FreeRuntime (runtime);
+            m3_FreeEnvironment (env);
+            return 0;
+        }
+        expect (!result, "enable (%s)", result ? result : "ok");
+
+        CheckSuspend (runtime);
+
+        // disabling aborts what's suspended
+        result = Call (runtime, "run", 5);
+        expect (result == m3Err_suspended && !m3_EnableSuspend (runtime, 0), "disable while suspended");
+
+        result = Call (runtime, "plain", 3);
+        expect (!result && Result (runtime, "plain") == 6, "plain once disabled (%s)", result ? result : "ok");
+
+        result = Call (runtime, "run", 5);
+        expect (result == m3Err_trapCannotSuspend, "disabled (%s)", result ? result : "no trap");
+    }
+
+    m3_FreeRuntime (runtime);
+
+    // a start function isn't run by a call that can be suspended
+    runtime = m3_NewRuntime (env, 64 * 1024, NULL);
+    IM3Module module = Load (env, runtime, c_startModule, sizeof (c_startModule), & result);
+    if (!result)
+        result = m3_EnableSuspend (runtime, 1);
+    if (!result)
+        result = m3_RunStart (module);
+    expect (result == m3Err_trapCannotSuspend, "start function (%s)", result ? result : "no trap");
+
+    m3_FreeRuntime (runtime);
+
+    CheckTakingTurns (env);
+
+    m3_FreeEnvironment (env);
+
+    printf ("\n%s\n", failures ? "FAILED" : "all passed");
+    return failures ? 1 : 0;
+}